@@ -506,6 +506,7 @@ static bool common_download_model(
         struct gguf_init_params gguf_params = {
             /*.no_alloc = */ true,
             /*.ctx      = */ NULL,
+            /*.no_mmap  = */ false,
         };
         auto * ctx_gguf = gguf_init_from_file(model.path.c_str(), gguf_params);
         if (!ctx_gguf) {
@@ -2165,6 +2166,17 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.logits_file = value;
         }
     ).set_examples({LLAMA_EXAMPLE_PERPLEXITY}));
+    add_opt(common_arg(
+        {"--kl-divergence-top-k"}, "N",
+        string_format("with --kl-divergence-base, save only the N most likely log-probs and the remaining probability mass per token\n"
+                      "(0 = save the log-probs of the full vocabulary, default: %d)", params.kl_divergence_top_k),
+        [](common_params & params, int value) {
+            if (value < 0) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.kl_divergence_top_k = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_PERPLEXITY}));
     add_opt(common_arg(
         {"--ppl-stride"}, "N",
         string_format("stride for perplexity calculation (default: %d)", params.ppl_stride),
@@ -2243,6 +2255,20 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.mmproj_use_gpu = false;
         }
     ).set_examples(mmproj_examples).set_env("LLAMA_ARG_NO_MMPROJ_OFFLOAD"));
+    add_opt(common_arg(
+        {"--mmproj-cache-size"}, "N",
+        string_format("size in MiB of the in-memory cache of encoded images and audio, 0 = disabled (default: %d)", params.mmproj_cache_mb),
+        [](common_params & params, int value) {
+            params.mmproj_cache_mb = value;
+        }
+    ).set_examples(mmproj_examples).set_env("LLAMA_ARG_MMPROJ_CACHE_SIZE"));
+    add_opt(common_arg(
+        {"--mmproj-cache-dir"}, "PATH",
+        "directory used to persist the cache of encoded images and audio across runs (default: none)",
+        [](common_params & params, const std::string & value) {
+            params.mmproj_cache_dir = value;
+        }
+    ).set_examples(mmproj_examples).set_env("LLAMA_ARG_MMPROJ_CACHE_DIR"));
     add_opt(common_arg(
         {"--image", "--audio"}, "FILE",
         "path to an image or audio file. use with multimodal models, can be repeated if you have multiple files\n",
@@ -2267,6 +2293,21 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.use_mlock = true;
         }
     ).set_env("LLAMA_ARG_MLOCK"));
+    add_opt(common_arg(
+        {"--moe-prefetch"},
+        "prefetch the MoE experts selected by the router from the memory-mapped model before they are used\n"
+        "(useful for MoE models that do not fit in RAM)",
+        [](common_params & params) {
+            params.moe_prefetch = true;
+        }
+    ).set_env("LLAMA_ARG_MOE_PREFETCH"));
+    add_opt(common_arg(
+        {"--moe-mlock"}, "N",
+        string_format("with --moe-prefetch, lock up to N MiB of the most frequently routed MoE experts in RAM (default: %d)", params.moe_mlock_mb),
+        [](common_params & params, int value) {
+            params.moe_mlock_mb = value;
+        }
+    ).set_env("LLAMA_ARG_MOE_MLOCK"));
     add_opt(common_arg(
         {"--no-mmap"},
         "do not memory-map model (slower load but may reduce pageouts if not using mlock)",
@@ -2591,6 +2632,29 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.chunk_separator = value;
         }
     ).set_examples({LLAMA_EXAMPLE_RETRIEVAL}));
+    add_opt(common_arg(
+        {"--vector-index"}, "FNAME",
+        "path to an approximate nearest neighbor index of the embeddings, created if it does not exist\n"
+        "(retrieval: cache of the chunk embeddings, server: enables the /vector/add and /vector/search endpoints)",
+        [](common_params & params, const std::string & value) {
+            params.vindex_path = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_RETRIEVAL, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_VECTOR_INDEX"));
+    add_opt(common_arg(
+        {"--vector-index-type"}, "TYPE",
+        string_format("storage type of a new vector index: f32, f16 or i8 (default: %s)", ggml_type_name(params.vindex_type)),
+        [](common_params & params, const std::string & value) {
+            if (value == "f32") {
+                params.vindex_type = GGML_TYPE_F32;
+            } else if (value == "f16") {
+                params.vindex_type = GGML_TYPE_F16;
+            } else if (value == "i8") {
+                params.vindex_type = GGML_TYPE_I8;
+            } else {
+                throw std::invalid_argument("invalid value");
+            }
+        }
+    ).set_examples({LLAMA_EXAMPLE_RETRIEVAL, LLAMA_EXAMPLE_SERVER}));
     add_opt(common_arg(
         {"--junk"}, "N",
         string_format("number of times to repeat the junk text (default: %d)", params.n_junk),
@@ -2647,6 +2711,20 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.i_chunk = value;
         }
     ).set_examples({LLAMA_EXAMPLE_IMATRIX}));
+    add_opt(common_arg(
+        {"--n-shards"}, "N",
+        string_format("split the chunks between N processes, the results are written in a raw format that can be merged with --in-file (default: %d)", params.n_shards),
+        [](common_params & params, int value) {
+            params.n_shards = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_IMATRIX}));
+    add_opt(common_arg(
+        {"--shard-index"}, "N",
+        string_format("index of this process when the chunks are split with --n-shards (default: %d)", params.i_shard),
+        [](common_params & params, int value) {
+            params.i_shard = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_IMATRIX}));
     add_opt(common_arg(
         {"--parse-special"},
         string_format("prase special tokens (chat, tool, etc) (default: %s)", params.parse_special ? "true" : "false"),
@@ -2685,6 +2763,41 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.n_pl.insert(params.n_pl.end(), p.begin(), p.end());
         }
     ).set_examples({LLAMA_EXAMPLE_BENCH}));
+    add_opt(common_arg(
+        {"--workload-trace"}, "FNAME",
+        "replay the requests in FNAME, one \"t_arrival n_prompt n_gen\" per line, with continuous batching over -np slots",
+        [](common_params & params, const std::string & value) {
+            params.workload_trace = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_BENCH}));
+    add_opt(common_arg(
+        {"--workload-rate"}, "N",
+        "generate Poisson arrivals at N requests/s with lengths drawn from -npp/-ntg, with continuous batching over -np slots (default: disabled)",
+        [](common_params & params, const std::string & value) {
+            params.workload_rate = std::stof(value);
+        }
+    ).set_examples({LLAMA_EXAMPLE_BENCH}));
+    add_opt(common_arg(
+        {"--workload-n-req"}, "N",
+        string_format("number of requests generated with --workload-rate (default: %d)", params.workload_n_req),
+        [](common_params & params, int value) {
+            params.workload_n_req = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_BENCH}));
+    add_opt(common_arg(
+        {"--slo-ttft"}, "MS",
+        "workload mode: time to first token objective in ms for the goodput (default: none)",
+        [](common_params & params, const std::string & value) {
+            params.workload_slo_ttft = std::stof(value);
+        }
+    ).set_examples({LLAMA_EXAMPLE_BENCH}));
+    add_opt(common_arg(
+        {"--slo-itl"}, "MS",
+        "workload mode: mean inter-token latency objective in ms for the goodput (default: none)",
+        [](common_params & params, const std::string & value) {
+            params.workload_slo_itl = std::stof(value);
+        }
+    ).set_examples({LLAMA_EXAMPLE_BENCH}));
     add_opt(common_arg(
         {"--embd-normalize"}, "N",
         string_format("normalisation for embeddings (default: %d) (-1=none, 0=max absolute int16, 1=taxicab, 2=euclidean, >2=p-norm)", params.embd_normalize),
@@ -2756,6 +2869,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.pooling_type = LLAMA_POOLING_TYPE_RANK;
         }
     ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_RERANKING"));
+    add_opt(common_arg(
+        {"--embd-batch-seqs"}, "N",
+        "number of additional sequences used to batch embedding and rerank requests together, -1 = auto, 0 = disabled (default: -1)",
+        [](common_params & params, int value) {
+            params.n_seq_embd = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_EMBD_BATCH_SEQS"));
     add_opt(common_arg(
         {"--api-key"}, "KEY",
         "API key to use for authentication (default: none)",
@@ -3193,6 +3313,30 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.speculative.p_min = std::stof(value);
         }
     ).set_examples({LLAMA_EXAMPLE_SPECULATIVE, LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_DRAFT_P_MIN"));
+    add_opt(common_arg(
+        {"--lookahead"}, "W",
+        string_format("lookahead decoding window size, uses the spare batch capacity to guess and verify n-grams for the generating slots (default: %d, 0 = disabled)", params.speculative.lookahead_w),
+        [](common_params & params, int value) {
+            params.speculative.lookahead_w = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOOKAHEAD"));
+    add_opt(common_arg(
+        {"--lookahead-ngram"}, "N",
+        string_format("lookahead decoding n-gram size, >= 3 (default: %d)", params.speculative.lookahead_n),
+        [](common_params & params, int value) {
+            if (value < 3) {
+                throw std::invalid_argument("invalid value");
+            }
+            params.speculative.lookahead_n = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOOKAHEAD_NGRAM"));
+    add_opt(common_arg(
+        {"--lookahead-verify"}, "G",
+        "max number of n-grams verified per lookahead step (default: same as the window size)",
+        [](common_params & params, int value) {
+            params.speculative.lookahead_g = value;
+        }
+    ).set_examples({LLAMA_EXAMPLE_SERVER}).set_env("LLAMA_ARG_LOOKAHEAD_VERIFY"));
     add_opt(common_arg(
         {"-cd", "--ctx-size-draft"}, "N",
         string_format("size of the prompt context for the draft model (default: %d, 0 = loaded from model)", params.speculative.n_ctx),
@@ -3275,6 +3419,13 @@ common_params_context common_params_parser_init(common_params & params, llama_ex
             params.vocoder.speaker_file = value;
         }
     ).set_examples({LLAMA_EXAMPLE_TTS}));
+    add_opt(common_arg(
+        {"--tts-stream"},
+        "convert the generated codes to audio in overlapping chunks while they are generated",
+        [](common_params & params) {
+            params.vocoder.stream = true;
+        }
+    ).set_examples({LLAMA_EXAMPLE_TTS}));
 
     // model-specific
     add_opt(common_arg(
@@ -911,6 +911,12 @@ struct common_init_result common_init_from_params(common_params & params) {
 
     const llama_vocab * vocab = llama_model_get_vocab(model);
 
+    // the speculative branches are removed token by token, which the recurrent states do not support
+    if (params.n_seq_spec > 0 && (llama_model_is_recurrent(model) || llama_model_is_hybrid(model))) {
+        LOG_WRN("%s: speculative sequences are not supported with recurrent models, disabling them\n", __func__);
+        params.n_seq_spec = 0;
+    }
+
     auto cparams = common_context_params_to_llama(params);
 
     llama_context * lctx = llama_init_from_model(model, cparams);
@@ -1132,7 +1138,8 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     auto cparams = llama_context_default_params();
 
     cparams.n_ctx             = params.n_ctx;
-    cparams.n_seq_max         = params.n_parallel;
+    cparams.n_seq_max         = params.n_parallel + std::max(0, params.n_seq_embd) + params.n_seq_spec;
+    cparams.n_seq_aux         = std::max(0, params.n_seq_embd) + params.n_seq_spec;
     cparams.n_batch           = params.n_batch;
     cparams.n_ubatch          = params.n_ubatch;
     cparams.n_threads         = params.cpuparams.n_threads;
@@ -1157,6 +1164,8 @@ struct llama_context_params common_context_params_to_llama(const common_params &
     cparams.no_perf           = params.no_perf;
     cparams.op_offload        = !params.no_op_offload;
     cparams.swa_full          = params.swa_full;
+    cparams.moe_prefetch      = params.moe_prefetch;
+    cparams.moe_mlock_size    = (size_t) params.moe_mlock_mb * 1024 * 1024;
 
     cparams.type_k = params.cache_type_k;
     cparams.type_v = params.cache_type_v;
@@ -1420,6 +1429,7 @@ static common_control_vector_data common_control_vector_load_one(const common_co
     struct gguf_init_params meta_gguf_params = {
         /* .no_alloc = */ false,
         /* .ctx      = */ &ctx,
+        /* .no_mmap  = */ false,
     };
     struct gguf_context * ctx_gguf = gguf_init_from_file(load_info.fname.c_str(), meta_gguf_params);
     if (!ctx_gguf) {
@@ -200,6 +200,10 @@ struct common_params_speculative {
     float   p_split      =  0.1f; // speculative decoding split probability
     float   p_min        = 0.75f; // minimum speculative decoding probability (greedy)
 
+    int32_t lookahead_w  =     0; // lookahead decoding window size in the server (0 = disabled)
+    int32_t lookahead_n  =     4; // lookahead decoding n-gram size
+    int32_t lookahead_g  =     0; // max lookahead n-grams verified per step (0 = same as the window size)
+
     ggml_type cache_type_k = GGML_TYPE_F16; // KV cache data type for the K
     ggml_type cache_type_v = GGML_TYPE_F16; // KV cache data type for the V
 
@@ -215,6 +219,7 @@ struct common_params_vocoder {
     std::string speaker_file = ""; // speaker file path                                      // NOLINT
 
     bool use_guide_tokens = false; // enable guide tokens to improve TTS accuracy            // NOLINT
+    bool stream           = false; // convert the codes to audio while they are generated    // NOLINT
 };
 
 enum common_reasoning_format {
@@ -250,6 +255,7 @@ struct common_params {
     int32_t n_gpu_layers      = -1;  // number of layers to store in VRAM (-1 - use default)
     int32_t main_gpu          = 0;   // the GPU that is used for scratch and small tensors
     float   tensor_split[128] = {0}; // how split tensors should be distributed across GPUs
+    int32_t moe_mlock_mb      = 0;   // MiB of the most frequently routed MoE experts to lock in RAM (with moe_prefetch)
 
     enum llama_split_mode split_mode = LLAMA_SPLIT_MODE_LAYER; // how to split the model across GPUs
 
@@ -311,7 +317,8 @@ struct common_params {
     bool   multiple_choice  = false;  // compute TruthfulQA score over random tasks from datafile supplied in prompt
     size_t multiple_choice_tasks = 0; // number of tasks to use when computing the TruthfulQA score. If 0, all tasks will be computed
 
-    bool   kl_divergence    = false; // compute KL divergence
+    bool    kl_divergence       = false; // compute KL divergence
+    int32_t kl_divergence_top_k = 0;     // number of base log-probs to save per token, 0 = all (full vocabulary)
 
     bool usage             = false; // print usage
     bool completion        = false; // print source-able completion script
@@ -334,6 +341,7 @@ struct common_params {
     bool input_prefix_bos  = false; // prefix BOS to user inputs, preceding input_prefix
     bool use_mmap          = true;  // use mmap for faster loads
     bool use_mlock         = false; // use mlock to keep model in memory
+    bool moe_prefetch      = false; // prefetch the routed MoE experts from the mmap'ed model
     bool verbose_prompt    = false; // print prompt tokens before generation
     bool display_prompt    = true;  // print prompt before generation
     bool no_kv_offload     = false; // disable KV offloading
@@ -351,6 +359,8 @@ struct common_params {
     // multimodal models (see tools/mtmd)
     struct common_params_model mmproj;
     bool mmproj_use_gpu = true;     // use GPU for multimodal model
+    int32_t mmproj_cache_mb = 256;  // size of the in-memory cache of encoded images/audio in MiB (0 = disabled)
+    std::string mmproj_cache_dir;   // directory to persist the cache of encoded images/audio
     bool no_mmproj = false;         // explicitly disable multimodal model
     std::vector<std::string> image; // path to image file(s)
 
@@ -360,6 +370,8 @@ struct common_params {
     std::string embd_out   = "";    // empty = default, "array" = [[],[]...], "json" = openai style, "json+" = same "json" + cosine similarity matrix
     std::string embd_sep   = "\n";  // separator of embeddings
     std::string cls_sep    = "\t";  // separator of classification sequences
+    int32_t n_seq_embd     = -1;    // extra sequences used by the server to batch embedding requests (-1 = auto, 0 = disabled)
+    int32_t n_seq_spec     =  0;    // extra sequences used by the server for the lookahead decoding branches
 
     // server params
     int32_t port           = 8080;         // server listens on this network port
@@ -403,6 +415,13 @@ struct common_params {
     std::vector<int32_t> n_tg;
     std::vector<int32_t> n_pl;
 
+    // batched-bench workload mode - requests arrive over time and are batched continuously like in the server
+    std::string workload_trace;            // trace file with one "t_arrival n_prompt n_gen" request per line
+    float       workload_rate     = 0.0f;  // synthetic Poisson arrivals in requests/s (> 0 enables the workload mode)
+    int32_t     workload_n_req    = 64;    // number of synthetic requests
+    float       workload_slo_ttft = 0.0f;  // SLO for the time to first token in ms (0 = none)
+    float       workload_slo_itl  = 0.0f;  // SLO for the mean inter-token latency of a request in ms (0 = none)
+
     // retrieval params
     std::vector<std::string> context_files; // context files to embed
 
@@ -410,6 +429,10 @@ struct common_params {
 
     std::string chunk_separator = "\n"; // chunk separator for context embedding
 
+    // vector index params
+    std::string vindex_path;                // path to the vector index file (retrieval, server)
+    ggml_type   vindex_type = GGML_TYPE_I8; // storage type of newly created vector indices
+
     // passkey params
     int32_t n_junk = 250; // number of times to repeat the junk text
     int32_t i_pos  = -1;  // position of the passkey in the junk text
@@ -418,6 +441,8 @@ struct common_params {
     int32_t n_out_freq  = 10; // output the imatrix every n_out_freq iterations
     int32_t n_save_freq =  0; // save the imatrix every n_save_freq iterations
     int32_t i_chunk     =  0; // start processing from this chunk
+    int32_t n_shards    =  1; // number of processes that share the chunks
+    int32_t i_shard     =  0; // index of this process, it processes the chunks i with i % n_shards == i_shard
 
     bool process_output = false; // collect data for the output tensor
     bool compute_ppl    = true;  // whether to compute perplexity
@@ -4,7 +4,9 @@
 #include <nlohmann/json.hpp>
 
 #include <algorithm>
+#include <list>
 #include <map>
+#include <mutex>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -959,11 +961,46 @@ std::string json_schema_to_grammar(const json & schema, bool force_gbnf) {
 #else
     (void)force_gbnf;
 #endif // LLAMA_USE_LLGUIDANCE
-    return build_grammar([&](const common_grammar_builder & callbacks) {
+
+    // the same schemas are converted over and over (e.g. for every request of a server client)
+    // keep the most recently used ones, the least recently used is evicted when the cache is full
+    // note: the compact dump is used as the key - the order of the keys is significant (e.g. for "properties")
+    static constexpr size_t max_cached = 256;
+
+    static std::mutex             cache_mutex;
+    static std::list<std::string> cache_lru; // most recently used first
+    static std::unordered_map<std::string, std::pair<std::string, std::list<std::string>::iterator>> cache;
+
+    const std::string key = schema.dump();
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+
+        auto it = cache.find(key);
+        if (it != cache.end()) {
+            cache_lru.splice(cache_lru.begin(), cache_lru, it->second.second);
+            return it->second.first;
+        }
+    }
+
+    auto grammar = build_grammar([&](const common_grammar_builder & callbacks) {
         auto copy = schema;
         callbacks.resolve_refs(copy);
         callbacks.add_schema("", copy);
     });
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    if (cache.find(key) == cache.end()) {
+        if (cache.size() >= max_cached) {
+            cache.erase(cache_lru.back());
+            cache_lru.pop_back();
+        }
+        cache_lru.push_front(key);
+        cache.emplace(key, std::make_pair(grammar, cache_lru.begin()));
+    }
+
+    return grammar;
 }
 
 std::string build_grammar(const std::function<void(const common_grammar_builder &)> & cb, const common_grammar_options & options) {
@@ -0,0 +1,1073 @@
+#include "vector-index.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <random>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#   define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__) && defined(__FMA__) && defined(__F16C__)
+#   include <immintrin.h>
+#   define VINDEX_AVX2
+#   define VINDEX_AVX2_TARGET
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+// the common library is not built with -march=native, select the AVX2 kernels at runtime instead
+#   include <immintrin.h>
+#   define VINDEX_AVX2
+#   define VINDEX_AVX2_DISPATCH
+#   define VINDEX_AVX2_TARGET __attribute__((target("avx2,fma,f16c")))
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#   include <arm_neon.h>
+#   define VINDEX_NEON
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define VINDEX_PREFETCH(p) __builtin_prefetch(p)
+#else
+#   define VINDEX_PREFETCH(p)
+#endif
+
+#define VINDEX_FILE_MAGIC   0x49564747u // "GGVI"
+#define VINDEX_FILE_VERSION 2
+#define VINDEX_FILE_ALIGN   64
+#define VINDEX_MAX_LEVEL    16
+
+//
+// distance kernels - dot products of two rows of the same storage type
+//
+
+typedef float (*vindex_dot_t)(const void * a, const void * b, int n);
+
+static float vindex_dot_f32_ref(const void * va, const void * vb, int n) {
+    const float * a = (const float *) va;
+    const float * b = (const float *) vb;
+
+    float sum[8] = { 0.0f };
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int j = 0; j < 8; ++j) {
+            sum[j] += a[i + j]*b[i + j];
+        }
+    }
+    for (; i < n; ++i) {
+        sum[0] += a[i]*b[i];
+    }
+
+    return (sum[0] + sum[1] + sum[2] + sum[3]) + (sum[4] + sum[5] + sum[6] + sum[7]);
+}
+
+static float vindex_dot_f16_ref(const void * va, const void * vb, int n) {
+    const ggml_fp16_t * a = (const ggml_fp16_t *) va;
+    const ggml_fp16_t * b = (const ggml_fp16_t *) vb;
+
+    float sum = 0.0f;
+    for (int i = 0; i < n; ++i) {
+        sum += ggml_fp16_to_fp32(a[i])*ggml_fp16_to_fp32(b[i]);
+    }
+
+    return sum;
+}
+
+static float vindex_dot_i8_ref(const void * va, const void * vb, int n) {
+    const int8_t * a = (const int8_t *) va;
+    const int8_t * b = (const int8_t *) vb;
+
+    int32_t sum = 0;
+    for (int i = 0; i < n; ++i) {
+        sum += (int32_t) a[i]*b[i];
+    }
+
+    return (float) sum;
+}
+
+#if defined(VINDEX_AVX2)
+VINDEX_AVX2_TARGET static inline float vindex_hsum_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+VINDEX_AVX2_TARGET static float vindex_dot_f32_avx2(const void * va, const void * vb, int n) {
+    const float * a = (const float *) va;
+    const float * b = (const float *) vb;
+
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),     _mm256_loadu_ps(b + i),     acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+
+    float sum = vindex_hsum_avx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i]*b[i];
+    }
+
+    return sum;
+}
+
+VINDEX_AVX2_TARGET static float vindex_dot_f16_avx2(const void * va, const void * vb, int n) {
+    const ggml_fp16_t * a = (const ggml_fp16_t *) va;
+    const ggml_fp16_t * b = (const ggml_fp16_t *) vb;
+
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256 a0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (a + i)));
+        const __m256 b0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (b + i)));
+        const __m256 a1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (a + i + 8)));
+        const __m256 b1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (b + i + 8)));
+        acc0 = _mm256_fmadd_ps(a0, b0, acc0);
+        acc1 = _mm256_fmadd_ps(a1, b1, acc1);
+    }
+
+    float sum = vindex_hsum_avx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += ggml_fp16_to_fp32(a[i])*ggml_fp16_to_fp32(b[i]);
+    }
+
+    return sum;
+}
+
+VINDEX_AVX2_TARGET static float vindex_dot_i8_avx2(const void * va, const void * vb, int n) {
+    const int8_t * a = (const int8_t *) va;
+    const int8_t * b = (const int8_t *) vb;
+
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    __m256i acc = _mm256_setzero_si256();
+
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i *) (a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i *) (b + i));
+        // the quantized values are in [-127, 127], so the pairwise sums of maddubs cannot saturate
+        const __m256i p = _mm256_maddubs_epi16(_mm256_sign_epi8(x, x), _mm256_sign_epi8(y, x));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    int32_t sum = _mm_cvtsi128_si32(s);
+    for (; i < n; ++i) {
+        sum += (int32_t) a[i]*b[i];
+    }
+
+    return (float) sum;
+}
+#endif
+
+#if defined(VINDEX_NEON)
+static float vindex_dot_f32_neon(const void * va, const void * vb, int n) {
+    const float * a = (const float *) va;
+    const float * b = (const float *) vb;
+
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i),     vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += a[i]*b[i];
+    }
+
+    return sum;
+}
+
+static float vindex_dot_f16_neon(const void * va, const void * vb, int n) {
+    const ggml_fp16_t * a = (const ggml_fp16_t *) va;
+    const ggml_fp16_t * b = (const ggml_fp16_t *) vb;
+
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const float16x8_t x = vreinterpretq_f16_u16(vld1q_u16(a + i));
+        const float16x8_t y = vreinterpretq_f16_u16(vld1q_u16(b + i));
+        acc0 = vfmaq_f32(acc0, vcvt_f32_f16(vget_low_f16(x)),  vcvt_f32_f16(vget_low_f16(y)));
+        acc1 = vfmaq_f32(acc1, vcvt_f32_f16(vget_high_f16(x)), vcvt_f32_f16(vget_high_f16(y)));
+    }
+
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        sum += ggml_fp16_to_fp32(a[i])*ggml_fp16_to_fp32(b[i]);
+    }
+
+    return sum;
+}
+
+static float vindex_dot_i8_neon(const void * va, const void * vb, int n) {
+    const int8_t * a = (const int8_t *) va;
+    const int8_t * b = (const int8_t *) vb;
+
+    int32x4_t acc = vdupq_n_s32(0);
+
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const int8x16_t x = vld1q_s8(a + i);
+        const int8x16_t y = vld1q_s8(b + i);
+#if defined(__ARM_FEATURE_DOTPROD)
+        acc = vdotq_s32(acc, x, y);
+#else
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(x),  vget_low_s8(y)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(x), vget_high_s8(y)));
+#endif
+    }
+
+    int32_t sum = vaddvq_s32(acc);
+    for (; i < n; ++i) {
+        sum += (int32_t) a[i]*b[i];
+    }
+
+    return (float) sum;
+}
+#endif
+
+static vindex_dot_t vindex_get_dot(ggml_type type) {
+    struct kernels {
+        vindex_dot_t f32 = vindex_dot_f32_ref;
+        vindex_dot_t f16 = vindex_dot_f16_ref;
+        vindex_dot_t i8  = vindex_dot_i8_ref;
+    };
+
+    static const kernels k = [] {
+        kernels k;
+#if defined(VINDEX_AVX2)
+#if defined(VINDEX_AVX2_DISPATCH)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+#endif
+        {
+            k.f32 = vindex_dot_f32_avx2;
+            k.f16 = vindex_dot_f16_avx2;
+            k.i8  = vindex_dot_i8_avx2;
+        }
+#elif defined(VINDEX_NEON)
+        k.f32 = vindex_dot_f32_neon;
+        k.f16 = vindex_dot_f16_neon;
+        k.i8  = vindex_dot_i8_neon;
+#endif
+        return k;
+    }();
+
+    switch (type) {
+        case GGML_TYPE_F32: return k.f32;
+        case GGML_TYPE_F16: return k.f16;
+        case GGML_TYPE_I8:  return k.i8;
+        default:            GGML_ABORT("unsupported vector index type %s", ggml_type_name(type));
+    }
+}
+
+//
+// file mapping
+//
+
+struct vindex_mapping {
+    void * addr = nullptr;
+    size_t size = 0;
+
+#if defined(_WIN32)
+    HANDLE hfile = INVALID_HANDLE_VALUE;
+    HANDLE hmap  = NULL;
+
+    bool open(const std::string & fname) {
+        hfile = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hfile == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fsize;
+        if (!GetFileSizeEx(hfile, &fsize)) {
+            return false;
+        }
+        size = (size_t) fsize.QuadPart;
+        hmap = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hmap == NULL) {
+            return false;
+        }
+        addr = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+        return addr != nullptr;
+    }
+
+    ~vindex_mapping() {
+        if (addr) {
+            UnmapViewOfFile(addr);
+        }
+        if (hmap != NULL) {
+            CloseHandle(hmap);
+        }
+        if (hfile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hfile);
+        }
+    }
+#else
+    bool open(const std::string & fname) {
+        const int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size = (size_t) st.st_size;
+        void * ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED) {
+            return false;
+        }
+        addr = ptr;
+        return true;
+    }
+
+    ~vindex_mapping() {
+        if (addr) {
+            munmap(addr, size);
+        }
+    }
+#endif
+};
+
+//
+// index
+//
+
+struct vindex_file_header {
+    uint32_t magic;
+    uint32_t version;
+    int32_t  n_embd;
+    int32_t  type;
+    int32_t  M;
+    int32_t  ef_construction;
+    int32_t  ef_search;
+    int32_t  max_level;
+    int64_t  n;
+    int64_t  entry;
+    uint64_t n_links_up;
+    uint32_t seed;
+    uint32_t reserved;
+    uint64_t source;
+};
+
+// (distance, node)
+typedef std::pair<float, int32_t> vindex_cand;
+
+// visited markers for the graph traversal, reset in O(1) by bumping the tag
+struct vindex_visited {
+    std::vector<uint16_t> tags;
+    uint16_t              cur = 0;
+
+    void reset(int64_t n) {
+        if ((int64_t) tags.size() < n) {
+            tags.assign(n + n/4, 0);
+            cur = 0;
+        }
+        if (++cur == 0) {
+            std::fill(tags.begin(), tags.end(), 0);
+            cur = 1;
+        }
+    }
+
+    bool test_and_set(int32_t i) {
+        if (tags[i] == cur) {
+            return true;
+        }
+        tags[i] = cur;
+        return false;
+    }
+};
+
+struct common_vindex {
+    common_vindex_params params;
+
+    vindex_dot_t dot;
+    size_t       row_size;
+    int32_t      M0;
+    double       level_mult;
+
+    std::mt19937 rng;
+
+    int64_t n         = 0;
+    int32_t max_level = -1;
+    int64_t entry     = -1;
+
+    // storage - per node: the quantized vector, its scale, its level, the bottom layer links [count, M0 ids] and the
+    // offset of the upper layer links [count, M ids] x level in links_up
+    std::vector<uint8_t>  codes_buf;
+    std::vector<float>    scales_buf;
+    std::vector<int8_t>   levels_buf;
+    std::vector<int32_t>  links0_buf;
+    std::vector<uint64_t> offs_buf;
+    std::vector<int32_t>  links_up_buf;
+
+    // views of the storage, either the buffers above or the mapped file
+    const uint8_t  * codes    = nullptr;
+    const float    * scales   = nullptr;
+    const int8_t   * levels   = nullptr;
+    const int32_t  * links0   = nullptr;
+    const uint64_t * offs     = nullptr;
+    const int32_t  * links_up = nullptr;
+    uint64_t         n_links_up = 0;
+
+    std::unique_ptr<vindex_mapping> mapping;
+
+    explicit common_vindex(const common_vindex_params & params) : params(params) {
+        GGML_ASSERT(params.n_embd > 0);
+        GGML_ASSERT(params.M >= 2);
+
+        dot        = vindex_get_dot(params.type);
+        row_size   = (size_t) params.n_embd*ggml_type_size(params.type);
+        M0         = 2*params.M;
+        level_mult = 1.0/std::log((double) params.M);
+        rng.seed(params.seed);
+    }
+
+    void update_views() {
+        codes    = codes_buf.data();
+        scales   = scales_buf.data();
+        levels   = levels_buf.data();
+        links0   = links0_buf.data();
+        offs     = offs_buf.data();
+        links_up = links_up_buf.data();
+        n_links_up = links_up_buf.size();
+    }
+
+    // copy the mapped storage to memory before modifying it
+    void to_memory() {
+        if (!mapping) {
+            return;
+        }
+
+        codes_buf   .assign(codes,    codes    + n*row_size);
+        scales_buf  .assign(scales,   scales   + n);
+        levels_buf  .assign(levels,   levels   + n);
+        links0_buf  .assign(links0,   links0   + n*(1 + M0));
+        offs_buf    .assign(offs,     offs     + n);
+        links_up_buf.assign(links_up, links_up + n_links_up);
+
+        update_views();
+        mapping.reset();
+    }
+
+    const uint8_t * row(int64_t i) const {
+        return codes + i*row_size;
+    }
+
+    const int32_t * links(int64_t i, int32_t level) const {
+        return level == 0 ? links0 + i*(1 + M0) : links_up + offs[i] + (size_t) (level - 1)*(1 + params.M);
+    }
+
+    int32_t * links_mut(int64_t i, int32_t level) {
+        return level == 0 ? links0_buf.data() + i*(1 + M0) : links_up_buf.data() + offs_buf[i] + (size_t) (level - 1)*(1 + params.M);
+    }
+
+    // check that the graph of a loaded index only references existing nodes and links
+    bool validate() const {
+        if (n == 0) {
+            return entry == -1 && max_level == -1;
+        }
+        if (entry < 0 || entry >= n || max_level < 0 || max_level > VINDEX_MAX_LEVEL || levels[entry] != max_level) {
+            return false;
+        }
+
+        auto valid_links = [&](const int32_t * nb, int32_t m_max, int32_t level) {
+            if (nb[0] < 0 || nb[0] > m_max) {
+                return false;
+            }
+            for (int32_t j = 1; j <= nb[0]; ++j) {
+                if (nb[j] < 0 || nb[j] >= n || levels[nb[j]] < level) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        for (int64_t i = 0; i < n; ++i) {
+            if (levels[i] < 0 || levels[i] > max_level) {
+                return false;
+            }
+            if (offs[i] > n_links_up || (uint64_t) levels[i]*(1 + params.M) > n_links_up - offs[i]) {
+                return false;
+            }
+            for (int32_t l = 0; l <= levels[i]; ++l) {
+                if (!valid_links(links(i, l), l == 0 ? M0 : params.M, l)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // normalize and quantize a vector to the storage type
+    void encode(const float * embd, uint8_t * dst, float & scale) const {
+        const int n_embd = params.n_embd;
+
+        double sum = 0.0;
+        for (int i = 0; i < n_embd; ++i) {
+            sum += (double) embd[i]*embd[i];
+        }
+        const float norm = sum > 0.0 ? (float) (1.0/std::sqrt(sum)) : 0.0f;
+
+        switch (params.type) {
+            case GGML_TYPE_F32:
+                {
+                    float * y = (float *) dst;
+                    for (int i = 0; i < n_embd; ++i) {
+                        y[i] = embd[i]*norm;
+                    }
+                    scale = 1.0f;
+                } break;
+            case GGML_TYPE_F16:
+                {
+                    ggml_fp16_t * y = (ggml_fp16_t *) dst;
+                    for (int i = 0; i < n_embd; ++i) {
+                        y[i] = ggml_fp32_to_fp16(embd[i]*norm);
+                    }
+                    scale = 1.0f;
+                } break;
+            case GGML_TYPE_I8:
+                {
+                    float amax = 0.0f;
+                    for (int i = 0; i < n_embd; ++i) {
+                        amax = std::max(amax, std::fabs(embd[i]*norm));
+                    }
+                    scale = amax/127.0f;
+                    const float id = amax > 0.0f ? 127.0f/amax : 0.0f;
+
+                    int8_t * y = (int8_t *) dst;
+                    for (int i = 0; i < n_embd; ++i) {
+                        y[i] = (int8_t) std::lround(embd[i]*norm*id);
+                    }
+                } break;
+            default:
+                GGML_ABORT("fatal error");
+        }
+    }
+
+    float dist(const uint8_t * q, float q_scale, int64_t i) const {
+        return 1.0f - dot(q, row(i), params.n_embd)*q_scale*scales[i];
+    }
+
+    // greedy descent to the closest node on a single layer
+    void search_greedy(const uint8_t * q, float q_scale, int32_t level, int32_t & ep, float & d_ep) const {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+
+            const int32_t * nb = links(ep, level);
+            for (int32_t j = 1; j <= nb[0]; ++j) {
+                const float d = dist(q, q_scale, nb[j]);
+                if (d < d_ep) {
+                    d_ep    = d;
+                    ep      = nb[j];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // best-first search of a single layer, returns up to ef candidates sorted by distance
+    std::vector<vindex_cand> search_layer(const uint8_t * q, float q_scale, int32_t ep, float d_ep, int32_t ef, int32_t level) const {
+        thread_local vindex_visited visited;
+        visited.reset(n);
+
+        std::priority_queue<vindex_cand, std::vector<vindex_cand>, std::greater<vindex_cand>> cand;
+        std::priority_queue<vindex_cand> top;
+
+        visited.test_and_set(ep);
+        cand.emplace(d_ep, ep);
+        top .emplace(d_ep, ep);
+
+        while (!cand.empty()) {
+            const vindex_cand c = cand.top();
+            if (c.first > top.top().first && (int32_t) top.size() >= ef) {
+                break;
+            }
+            cand.pop();
+
+            const int32_t * nb = links(c.second, level);
+            const int32_t   nn = nb[0];
+
+            if (nn > 0) {
+                VINDEX_PREFETCH(row(nb[1]));
+            }
+
+            for (int32_t j = 1; j <= nn; ++j) {
+                const int32_t e = nb[j];
+                if (j < nn) {
+                    VINDEX_PREFETCH(row(nb[j + 1]));
+                }
+                if (visited.test_and_set(e)) {
+                    continue;
+                }
+
+                const float d = dist(q, q_scale, e);
+                if ((int32_t) top.size() < ef || d < top.top().first) {
+                    cand.emplace(d, e);
+                    top .emplace(d, e);
+                    if ((int32_t) top.size() > ef) {
+                        top.pop();
+                    }
+                }
+            }
+        }
+
+        std::vector<vindex_cand> res(top.size());
+        for (size_t i = res.size(); i-- > 0; top.pop()) {
+            res[i] = top.top();
+        }
+
+        return res;
+    }
+
+    // neighbor selection heuristic of the HNSW paper - skip candidates that are closer to an already selected
+    // neighbor than to the base node, which keeps the graph navigable across clusters
+    void select_neighbors(const std::vector<vindex_cand> & cands, int32_t m, std::vector<int32_t> & res) const {
+        res.clear();
+        for (const auto & c : cands) {
+            if ((int32_t) res.size() >= m) {
+                break;
+            }
+
+            bool good = true;
+            for (int32_t r : res) {
+                if (1.0f - dot(row(c.second), row(r), params.n_embd)*scales[c.second]*scales[r] < c.first) {
+                    good = false;
+                    break;
+                }
+            }
+            if (good) {
+                res.push_back(c.second);
+            }
+        }
+    }
+
+    void connect(int32_t i, int32_t id, int32_t level) {
+        const int32_t m_max = level == 0 ? M0 : params.M;
+
+        int32_t * nb = links_mut(i, level);
+        if (nb[0] < m_max) {
+            nb[++nb[0]] = id;
+            return;
+        }
+
+        // the list is full - rebuild it from the old neighbors and the new node
+        std::vector<vindex_cand> cands;
+        cands.reserve(m_max + 1);
+        cands.emplace_back(dist(row(i), scales[i], id), id);
+        for (int32_t j = 1; j <= nb[0]; ++j) {
+            cands.emplace_back(dist(row(i), scales[i], nb[j]), nb[j]);
+        }
+        std::sort(cands.begin(), cands.end());
+
+        std::vector<int32_t> sel;
+        select_neighbors(cands, m_max, sel);
+
+        nb[0] = (int32_t) sel.size();
+        std::copy(sel.begin(), sel.end(), nb + 1);
+    }
+
+    int64_t add(const float * embd) {
+        GGML_ASSERT(n < INT32_MAX);
+
+        to_memory();
+
+        const int32_t id = (int32_t) n;
+
+        std::uniform_real_distribution<double> dist_u(0.0, 1.0);
+        const int32_t level = std::min((int32_t) (-std::log(1.0 - dist_u(rng))*level_mult), VINDEX_MAX_LEVEL);
+
+        codes_buf.resize(codes_buf.size() + row_size);
+        scales_buf.push_back(0.0f);
+        encode(embd, codes_buf.data() + id*row_size, scales_buf.back());
+
+        levels_buf.push_back((int8_t) level);
+        links0_buf.resize(links0_buf.size() + 1 + M0, 0);
+        offs_buf.push_back(links_up_buf.size());
+        links_up_buf.resize(links_up_buf.size() + (size_t) level*(1 + params.M), 0);
+
+        update_views();
+        n++;
+
+        if (entry < 0) {
+            entry     = id;
+            max_level = level;
+            return id;
+        }
+
+        const uint8_t * q       = row(id);
+        const float     q_scale = scales[id];
+
+        int32_t ep   = (int32_t) entry;
+        float   d_ep = dist(q, q_scale, ep);
+
+        for (int32_t l = max_level; l > level; --l) {
+            search_greedy(q, q_scale, l, ep, d_ep);
+        }
+
+        std::vector<int32_t> sel;
+        for (int32_t l = std::min(level, max_level); l >= 0; --l) {
+            const auto cands = search_layer(q, q_scale, ep, d_ep, params.ef_construction, l);
+
+            select_neighbors(cands, params.M, sel);
+
+            int32_t * nb = links_mut(id, l);
+            nb[0] = (int32_t) sel.size();
+            std::copy(sel.begin(), sel.end(), nb + 1);
+
+            for (int32_t e : sel) {
+                connect(e, id, l);
+            }
+
+            ep   = cands[0].second;
+            d_ep = cands[0].first;
+        }
+
+        if (level > max_level) {
+            entry     = id;
+            max_level = level;
+        }
+
+        return id;
+    }
+
+    std::vector<common_vindex_result> search(const float * query, int32_t k, int32_t ef) const {
+        std::vector<common_vindex_result> res;
+        if (n == 0 || k <= 0) {
+            return res;
+        }
+
+        std::vector<uint8_t> q(row_size);
+        float q_scale;
+        encode(query, q.data(), q_scale);
+
+        int32_t ep   = (int32_t) entry;
+        float   d_ep = dist(q.data(), q_scale, ep);
+
+        for (int32_t l = max_level; l > 0; --l) {
+            search_greedy(q.data(), q_scale, l, ep, d_ep);
+        }
+
+        const auto cands = search_layer(q.data(), q_scale, ep, d_ep, std::max(ef > 0 ? ef : params.ef_search, k), 0);
+
+        for (size_t i = 0; i < cands.size() && (int32_t) i < k; ++i) {
+            res.push_back({ cands[i].second, 1.0f - cands[i].first });
+        }
+
+        return res;
+    }
+
+    std::vector<common_vindex_result> search_exact(const float * query, int32_t k) const {
+        std::vector<uint8_t> q(row_size);
+        float q_scale;
+        encode(query, q.data(), q_scale);
+
+        std::vector<common_vindex_result> res(n);
+        for (int64_t i = 0; i < n; ++i) {
+            res[i] = { i, 1.0f - dist(q.data(), q_scale, i) };
+        }
+
+        k = (int32_t) std::min<int64_t>(std::max(k, 0), n);
+        std::partial_sort(res.begin(), res.begin() + k, res.end(), [](const common_vindex_result & a, const common_vindex_result & b) {
+            return a.score > b.score;
+        });
+        res.resize(k);
+
+        return res;
+    }
+
+    // file layout: header, then each array padded to VINDEX_FILE_ALIGN bytes
+    struct layout {
+        size_t off_codes, off_scales, off_levels, off_links0, off_offs, off_links_up, size;
+    };
+
+    static layout get_layout(int64_t n, size_t row_size, int32_t M0, uint64_t n_links_up) {
+        auto pad = [](size_t x) { return GGML_PAD(x, VINDEX_FILE_ALIGN); };
+
+        layout l;
+        l.off_codes    = pad(sizeof(vindex_file_header));
+        l.off_scales   = pad(l.off_codes    + n*row_size);
+        l.off_levels   = pad(l.off_scales   + n*sizeof(float));
+        l.off_links0   = pad(l.off_levels   + n*sizeof(int8_t));
+        l.off_offs     = pad(l.off_links0   + n*(1 + M0)*sizeof(int32_t));
+        l.off_links_up = pad(l.off_offs     + n*sizeof(uint64_t));
+        l.size         =     l.off_links_up + n_links_up*sizeof(int32_t);
+        return l;
+    }
+};
+
+void common_vindex_deleter::operator()(common_vindex * vindex) {
+    delete vindex;
+}
+
+common_vindex_ptr common_vindex_init(const common_vindex_params & params) {
+    if (params.type != GGML_TYPE_F32 && params.type != GGML_TYPE_F16 && params.type != GGML_TYPE_I8) {
+        LOG_ERR("%s: unsupported vector index type %s\n", __func__, ggml_type_name(params.type));
+        return nullptr;
+    }
+
+    return common_vindex_ptr(new common_vindex(params));
+}
+
+common_vindex_ptr common_vindex_load(const std::string & fname, bool use_mmap) {
+    FILE * f = fopen(fname.c_str(), "rb");
+    if (!f) {
+        LOG_ERR("%s: failed to open %s\n", __func__, fname.c_str());
+        return nullptr;
+    }
+
+    vindex_file_header hdr;
+    const bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1;
+    if (!ok || hdr.magic != VINDEX_FILE_MAGIC) {
+        LOG_ERR("%s: %s is not a vector index file\n", __func__, fname.c_str());
+        fclose(f);
+        return nullptr;
+    }
+    if (hdr.version != VINDEX_FILE_VERSION) {
+        LOG_ERR("%s: %s has version %u, expected %u\n", __func__, fname.c_str(), hdr.version, VINDEX_FILE_VERSION);
+        fclose(f);
+        return nullptr;
+    }
+
+    // the file size bounds the counts in the header, so that the layout below cannot overflow
+    uint64_t file_size = 0;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        const long end = ftell(f);
+        file_size = end > 0 ? (uint64_t) end : 0;
+    }
+    if (fseek(f, sizeof(hdr), SEEK_SET) != 0) {
+        file_size = 0;
+    }
+
+    if (hdr.n_embd <= 0 || (uint64_t) hdr.n_embd > file_size ||
+        hdr.M < 2 || hdr.M > 1024 || hdr.ef_construction <= 0 || hdr.ef_search <= 0 ||
+        hdr.n < 0 || hdr.n >= INT32_MAX || (uint64_t) hdr.n > file_size / ((uint64_t) hdr.n_embd + 2*hdr.M) ||
+        hdr.n_links_up > file_size/sizeof(int32_t)) {
+        LOG_ERR("%s: %s has an invalid header\n", __func__, fname.c_str());
+        fclose(f);
+        return nullptr;
+    }
+
+    common_vindex_params params;
+    params.source          = hdr.source;
+    params.n_embd          = hdr.n_embd;
+    params.type            = (ggml_type) hdr.type;
+    params.M               = hdr.M;
+    params.ef_construction = hdr.ef_construction;
+    params.ef_search       = hdr.ef_search;
+    params.seed            = hdr.seed + (uint32_t) hdr.n;
+
+    common_vindex_ptr vindex = common_vindex_init(params);
+    if (!vindex) {
+        fclose(f);
+        return nullptr;
+    }
+
+    vindex->n         = hdr.n;
+    vindex->max_level = hdr.max_level;
+    vindex->entry     = hdr.entry;
+
+    const auto l = common_vindex::get_layout(hdr.n, vindex->row_size, vindex->M0, hdr.n_links_up);
+    if (l.size > file_size) {
+        LOG_ERR("%s: %s is truncated\n", __func__, fname.c_str());
+        fclose(f);
+        return nullptr;
+    }
+
+    if (use_mmap) {
+        fclose(f);
+
+        auto mapping = std::make_unique<vindex_mapping>();
+        if (!mapping->open(fname) || mapping->size < l.size) {
+            LOG_ERR("%s: failed to map %s\n", __func__, fname.c_str());
+            return nullptr;
+        }
+
+        const uint8_t * base = (const uint8_t *) mapping->addr;
+
+        vindex->codes      = base + l.off_codes;
+        vindex->scales     = (const float    *) (base + l.off_scales);
+        vindex->levels     = (const int8_t   *) (base + l.off_levels);
+        vindex->links0     = (const int32_t  *) (base + l.off_links0);
+        vindex->offs       = (const uint64_t *) (base + l.off_offs);
+        vindex->links_up   = (const int32_t  *) (base + l.off_links_up);
+        vindex->n_links_up = hdr.n_links_up;
+        vindex->mapping    = std::move(mapping);
+
+        if (!vindex->validate()) {
+            LOG_ERR("%s: %s has an invalid graph\n", __func__, fname.c_str());
+            return nullptr;
+        }
+
+        return vindex;
+    }
+
+    size_t pos = sizeof(hdr);
+    auto read = [&](size_t off, void * dst, size_t size) {
+        uint8_t pad[VINDEX_FILE_ALIGN];
+        GGML_ASSERT(off >= pos && off - pos <= VINDEX_FILE_ALIGN);
+        bool ok = off == pos || fread(pad, off - pos, 1, f) == 1;
+        ok = ok && (size == 0 || fread(dst, size, 1, f) == 1);
+        pos = off + size;
+        return ok;
+    };
+
+    const int64_t n = hdr.n;
+
+    vindex->codes_buf   .resize(n*vindex->row_size);
+    vindex->scales_buf  .resize(n);
+    vindex->levels_buf  .resize(n);
+    vindex->links0_buf  .resize(n*(1 + vindex->M0));
+    vindex->offs_buf    .resize(n);
+    vindex->links_up_buf.resize(hdr.n_links_up);
+
+    const bool ok_data =
+        read(l.off_codes,    vindex->codes_buf.data(),    vindex->codes_buf.size()) &&
+        read(l.off_scales,   vindex->scales_buf.data(),   vindex->scales_buf.size()*sizeof(float)) &&
+        read(l.off_levels,   vindex->levels_buf.data(),   vindex->levels_buf.size()) &&
+        read(l.off_links0,   vindex->links0_buf.data(),   vindex->links0_buf.size()*sizeof(int32_t)) &&
+        read(l.off_offs,     vindex->offs_buf.data(),     vindex->offs_buf.size()*sizeof(uint64_t)) &&
+        read(l.off_links_up, vindex->links_up_buf.data(), vindex->links_up_buf.size()*sizeof(int32_t));
+
+    fclose(f);
+
+    if (!ok_data) {
+        LOG_ERR("%s: failed to read %s\n", __func__, fname.c_str());
+        return nullptr;
+    }
+
+    vindex->update_views();
+
+    if (!vindex->validate()) {
+        LOG_ERR("%s: %s has an invalid graph\n", __func__, fname.c_str());
+        return nullptr;
+    }
+
+    return vindex;
+}
+
+bool common_vindex_save(const common_vindex * vindex, const std::string & fname) {
+    // write to a temporary file first - the index may be mapped from fname
+    const std::string fname_tmp = fname + ".tmp";
+
+    FILE * f = fopen(fname_tmp.c_str(), "wb");
+    if (!f) {
+        LOG_ERR("%s: failed to open %s\n", __func__, fname_tmp.c_str());
+        return false;
+    }
+
+    const int64_t n = vindex->n;
+
+    vindex_file_header hdr = {};
+    hdr.magic           = VINDEX_FILE_MAGIC;
+    hdr.version         = VINDEX_FILE_VERSION;
+    hdr.n_embd          = vindex->params.n_embd;
+    hdr.type            = vindex->params.type;
+    hdr.M               = vindex->params.M;
+    hdr.ef_construction = vindex->params.ef_construction;
+    hdr.ef_search       = vindex->params.ef_search;
+    hdr.max_level       = vindex->max_level;
+    hdr.n               = n;
+    hdr.entry           = vindex->entry;
+    hdr.n_links_up      = vindex->n_links_up;
+    hdr.seed            = vindex->params.seed;
+    hdr.source          = vindex->params.source;
+
+    const auto l = common_vindex::get_layout(n, vindex->row_size, vindex->M0, vindex->n_links_up);
+
+    size_t pos = 0;
+    auto write = [&](size_t off, const void * src, size_t size) {
+        static const uint8_t zeros[VINDEX_FILE_ALIGN] = { 0 };
+        GGML_ASSERT(off >= pos && off - pos <= VINDEX_FILE_ALIGN);
+        bool ok = off == pos || fwrite(zeros, off - pos, 1, f) == 1;
+        ok = ok && (size == 0 || fwrite(src, size, 1, f) == 1);
+        pos = off + size;
+        return ok;
+    };
+
+    const bool ok =
+        write(0,              &hdr,             sizeof(hdr)) &&
+        write(l.off_codes,    vindex->codes,    n*vindex->row_size) &&
+        write(l.off_scales,   vindex->scales,   n*sizeof(float)) &&
+        write(l.off_levels,   vindex->levels,   n*sizeof(int8_t)) &&
+        write(l.off_links0,   vindex->links0,   n*(1 + vindex->M0)*sizeof(int32_t)) &&
+        write(l.off_offs,     vindex->offs,     n*sizeof(uint64_t)) &&
+        write(l.off_links_up, vindex->links_up, vindex->n_links_up*sizeof(int32_t));
+
+    if (fclose(f) != 0 || !ok) {
+        LOG_ERR("%s: failed to write %s\n", __func__, fname_tmp.c_str());
+        std::remove(fname_tmp.c_str());
+        return false;
+    }
+
+#if defined(_WIN32)
+    std::remove(fname.c_str());
+#endif
+    if (std::rename(fname_tmp.c_str(), fname.c_str()) != 0) {
+        LOG_ERR("%s: failed to rename %s to %s\n", __func__, fname_tmp.c_str(), fname.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int64_t common_vindex_size(const common_vindex * vindex) {
+    return vindex->n;
+}
+
+int32_t common_vindex_n_embd(const common_vindex * vindex) {
+    return vindex->params.n_embd;
+}
+
+ggml_type common_vindex_type(const common_vindex * vindex) {
+    return vindex->params.type;
+}
+
+uint64_t common_vindex_source(const common_vindex * vindex) {
+    return vindex->params.source;
+}
+
+int64_t common_vindex_add(common_vindex * vindex, const float * embd) {
+    return vindex->add(embd);
+}
+
+std::vector<common_vindex_result> common_vindex_search(const common_vindex * vindex, const float * query, int32_t k, int32_t ef) {
+    return vindex->search(query, k, ef);
+}
+
+std::vector<common_vindex_result> common_vindex_search_exact(const common_vindex * vindex, const float * query, int32_t k) {
+    return vindex->search_exact(query, k);
+}
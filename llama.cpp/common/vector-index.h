@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ggml.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+//
+// embedded approximate nearest neighbor index for embeddings
+//
+// HNSW graph over L2-normalized vectors, scored by cosine similarity (same as common_embd_similarity_cos)
+// the vectors are stored as F32, F16 or I8 (symmetric per-vector scale) and the index file can be mmap'ed,
+// so that large indices are searchable right after loading without reading the whole file
+//
+// searches are thread-safe; adding vectors requires exclusive access to the index
+//
+
+struct common_vindex;
+
+struct common_vindex_params {
+    int32_t   n_embd          = 0;
+    ggml_type type            = GGML_TYPE_I8; // storage type: GGML_TYPE_F32, GGML_TYPE_F16 or GGML_TYPE_I8
+    int32_t   M               = 16;           // max neighbors per node on the upper layers (2*M on the bottom layer)
+    int32_t   ef_construction = 200;          // candidate list size when inserting
+    int32_t   ef_search       = 64;           // default candidate list size when searching
+    uint32_t  seed            = 42;           // RNG seed for the node levels
+    uint64_t  source          = 0;            // user-defined id of the data the vectors were computed from, saved with the index
+};
+
+struct common_vindex_result {
+    int64_t id;    // insertion order of the vector
+    float   score; // cosine similarity
+};
+
+struct common_vindex_deleter {
+    void operator()(common_vindex * vindex);
+};
+
+typedef std::unique_ptr<common_vindex, common_vindex_deleter> common_vindex_ptr;
+
+common_vindex_ptr common_vindex_init(const common_vindex_params & params);
+
+// returns nullptr on failure
+// with use_mmap the vectors and the graph are mapped from the file - the first add() copies them to memory
+common_vindex_ptr common_vindex_load(const std::string & fname, bool use_mmap);
+
+bool common_vindex_save(const common_vindex * vindex, const std::string & fname);
+
+int64_t   common_vindex_size  (const common_vindex * vindex);
+int32_t   common_vindex_n_embd(const common_vindex * vindex);
+ggml_type common_vindex_type  (const common_vindex * vindex);
+uint64_t  common_vindex_source(const common_vindex * vindex);
+
+// add a vector of n_embd floats (normalized internally) and return its id
+int64_t common_vindex_add(common_vindex * vindex, const float * embd);
+
+// approximate top-k search, ef <= 0 uses params.ef_search
+std::vector<common_vindex_result> common_vindex_search(const common_vindex * vindex, const float * query, int32_t k, int32_t ef = 0);
+
+// exhaustive top-k search over the stored vectors, for measuring the recall of the approximate search
+std::vector<common_vindex_result> common_vindex_search_exact(const common_vindex * vindex, const float * query, int32_t k);
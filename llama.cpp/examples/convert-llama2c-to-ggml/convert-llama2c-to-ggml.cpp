@@ -535,6 +535,7 @@ static void load_vocab(const char * filename, const Config * config, struct my_l
         struct gguf_init_params params = {
             /*.no_alloc = */ false,
             /*.ctx      = */ &ctx_data,
+            /*.no_mmap  = */ false,
         };
 
         struct gguf_context * ctx = gguf_init_from_file(filename, params);
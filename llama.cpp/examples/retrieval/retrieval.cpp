@@ -2,6 +2,7 @@
 #include "common.h"
 #include "log.h"
 #include "llama.h"
+#include "vector-index.h"
 
 #include <algorithm>
 #include <fstream>
@@ -22,8 +23,6 @@ struct chunk {
     std::string textdata;
     // tokenized text data
     std::vector<llama_token> tokens;
-    // embedding
-    std::vector<float> embedding;
 };
 
 // chunk file data to chunks of size >= chunk_size
@@ -111,6 +110,38 @@ static void batch_process(llama_context * ctx, llama_batch & batch, float * outp
     }
 }
 
+// FNV-1a hash of the chunk texts and of the model that embeds them - identifies the data a saved index was built from
+static uint64_t chunks_source_hash(const std::vector<chunk> & chunks, const llama_model * model, const std::string & model_path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto update = [&](const void * data, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= ((const uint8_t *) data)[i];
+            hash *= 0x100000001b3ULL;
+        }
+    };
+    auto update_str = [&](const std::string & str) {
+        const uint64_t size = str.size();
+        update(&size, sizeof(size));
+        update(str.data(), str.size());
+    };
+
+    char desc[256];
+    llama_model_desc(model, desc, sizeof(desc));
+    update_str(desc);
+    update_str(model_path);
+
+    const uint64_t n_params = llama_model_n_params(model);
+    const uint64_t size     = llama_model_size(model);
+    update(&n_params, sizeof(n_params));
+    update(&size,     sizeof(size));
+
+    for (const auto & chunk : chunks) {
+        update_str(chunk.textdata);
+    }
+
+    return hash;
+}
+
 int main(int argc, char ** argv) {
     common_params params;
 
@@ -185,8 +216,45 @@ int main(int argc, char ** argv) {
     const uint64_t n_batch = params.n_batch;
     GGML_ASSERT(params.n_batch >= params.n_ctx);
 
+    const int n_chunks = chunks.size();
+    const int n_embd = llama_model_n_embd(model);
+
+    const uint64_t source = chunks_source_hash(chunks, model, params.model.path);
+
+    // the index of the chunk embeddings - reuse a saved index if it was built from the same chunks and model
+    common_vindex_ptr vindex;
+    if (!params.vindex_path.empty() && std::ifstream(params.vindex_path).good()) {
+        vindex = common_vindex_load(params.vindex_path, params.use_mmap);
+        if (vindex && (common_vindex_source(vindex.get()) != source ||
+                       common_vindex_size  (vindex.get()) != n_chunks ||
+                       common_vindex_n_embd(vindex.get()) != n_embd)) {
+            LOG_WRN("%s: vector index %s does not match the context files, rebuilding it\n", __func__, params.vindex_path.c_str());
+            vindex.reset();
+        }
+    }
+
+    if (vindex) {
+        LOG_INF("%s: loaded %d chunk embeddings from %s\n", __func__, n_chunks, params.vindex_path.c_str());
+    } else {
+        common_vindex_params vparams;
+        vparams.n_embd = n_embd;
+        vparams.type   = params.vindex_type;
+        vparams.source = source;
+
+        vindex = common_vindex_init(vparams);
+        if (!vindex) {
+            return 1;
+        }
+    }
+
+    const bool embed_chunks = common_vindex_size(vindex.get()) == 0;
+
     // tokenize the prompts and trim
     for (auto & chunk : chunks) {
+        if (!embed_chunks) {
+            break;
+        }
+
         auto inp = common_tokenize(ctx, chunk.textdata, true, false);
         if (inp.size() > n_batch) {
             LOG_ERR("%s: chunk size (%lld) exceeds batch size (%lld), increase batch size and re-run\n",
@@ -213,18 +281,16 @@ int main(int argc, char ** argv) {
     }
 
     // initialize batch
-    const int n_chunks = chunks.size();
     struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
 
     // allocate output
-    const int n_embd = llama_model_n_embd(model);
-    std::vector<float> embeddings(n_chunks * n_embd, 0);
+    std::vector<float> embeddings(embed_chunks ? n_chunks * n_embd : 0, 0);
     float * emb = embeddings.data();
 
     // break into batches
     int p = 0; // number of prompts processed already
     int s = 0; // number of prompts in current batch
-    for (int k = 0; k < n_chunks; k++) {
+    for (int k = 0; k < n_chunks && embed_chunks; k++) {
         // clamp to n_batch tokens
         auto & inp = chunks[k].tokens;
 
@@ -244,15 +310,21 @@ int main(int argc, char ** argv) {
         s += 1;
     }
 
-    // final batch
-    float * out = emb + p * n_embd;
-    batch_process(ctx, batch, out, s, n_embd);
+    if (embed_chunks) {
+        // final batch
+        float * out = emb + p * n_embd;
+        batch_process(ctx, batch, out, s, n_embd);
+
+        // add the embeddings to the index - the ids are the chunk indices
+        for (int i = 0; i < n_chunks; i++) {
+            common_vindex_add(vindex.get(), emb + i * n_embd);
+            // clear tokens as they are no longer needed
+            chunks[i].tokens.clear();
+        }
 
-    // save embeddings to chunks
-    for (int i = 0; i < n_chunks; i++) {
-        chunks[i].embedding = std::vector<float>(emb + i * n_embd, emb + (i + 1) * n_embd);
-        // clear tokens as they are no longer needed
-        chunks[i].tokens.clear();
+        if (!params.vindex_path.empty() && common_vindex_save(vindex.get(), params.vindex_path)) {
+            LOG_INF("%s: saved %d chunk embeddings to %s\n", __func__, n_chunks, params.vindex_path.c_str());
+        }
     }
 
     struct llama_batch query_batch = llama_batch_init(n_batch, 0, 1);
@@ -271,25 +343,16 @@ int main(int argc, char ** argv) {
 
         common_batch_clear(query_batch);
 
-        // compute cosine similarities
+        // find the most similar chunks by cosine similarity
         {
-            std::vector<std::pair<int, float>> similarities;
-            for (int i = 0; i < n_chunks; i++) {
-                float sim = common_embd_similarity_cos(chunks[i].embedding.data(), query_emb.data(), n_embd);
-                similarities.push_back(std::make_pair(i, sim));
-            }
-
-            // sort similarities
-            std::sort(similarities.begin(), similarities.end(), [](const std::pair<int, float> & a, const std::pair<int, float> & b) {
-                return a.second > b.second;
-            });
+            const auto similarities = common_vindex_search(vindex.get(), query_emb.data(), params.sampling.top_k);
 
             LOG("Top %d similar chunks:\n", params.sampling.top_k);
-            for (int i = 0; i < std::min(params.sampling.top_k, (int) chunks.size()); i++) {
-                LOG("filename: %s\n", chunks[similarities[i].first].filename.c_str());
-                LOG("filepos: %lld\n", (long long int) chunks[similarities[i].first].filepos);
-                LOG("similarity: %f\n", similarities[i].second);
-                LOG("textdata:\n%s\n", chunks[similarities[i].first].textdata.c_str());
+            for (const auto & sim : similarities) {
+                LOG("filename: %s\n", chunks[sim.id].filename.c_str());
+                LOG("filepos: %lld\n", (long long int) chunks[sim.id].filepos);
+                LOG("similarity: %f\n", sim.score);
+                LOG("textdata:\n%s\n", chunks[sim.id].textdata.c_str());
                 LOG("--------------------\n");
             }
         }
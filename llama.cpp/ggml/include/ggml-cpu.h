@@ -19,6 +19,13 @@ extern "C" {
         // abort ggml_graph_compute when true
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
+
+        // optional MoE expert residency manager, see ggml_backend_cpu_set_expert_residency()
+        struct ggml_cpu_expert_cache * expert_cache;
+
+        // tail of the work buffer that keeps the converted src1 of a MUL_MAT for the following MUL_MATs with the same src1
+        // (e.g. the Q, K and V projections), calculated by `ggml_graph_plan()`
+        size_t work_shared_size;
     };
 
     // numa strategies
@@ -132,6 +139,20 @@ extern "C" {
     GGML_BACKEND_API void ggml_backend_cpu_set_threadpool    (ggml_backend_t backend_cpu, ggml_threadpool_t threadpool);
     GGML_BACKEND_API void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_callback abort_callback, void * abort_callback_data);
 
+    // MoE expert residency
+    // prefetch the experts selected by the router of GGML_OP_MUL_MAT_ID from (mmap'ed) weights as soon as the ids are computed
+    // and lock the most frequently selected experts in RAM, up to mlock_size bytes (0 = no locking)
+    struct ggml_cpu_expert_stats {
+        uint64_t n_lookups;   // number of expert slices selected by the router
+        uint64_t n_hits;      // number of selected expert slices that were already resident in RAM
+        uint64_t n_prefetch;  // number of readaheads issued
+        uint64_t n_pinned;    // number of expert slices currently locked in RAM
+        size_t   pinned_size; // size of the expert slices currently locked in RAM
+    };
+
+    GGML_BACKEND_API void ggml_backend_cpu_set_expert_residency(ggml_backend_t backend_cpu, bool enabled, size_t mlock_size);
+    GGML_BACKEND_API void ggml_backend_cpu_get_expert_stats    (ggml_backend_t backend_cpu, struct ggml_cpu_expert_stats * stats);
+
     GGML_BACKEND_API ggml_backend_reg_t ggml_backend_cpu_reg(void);
 
     GGML_BACKEND_API void ggml_cpu_fp32_to_fp32(const float *,       float *, int64_t);
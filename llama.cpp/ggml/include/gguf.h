@@ -74,6 +74,9 @@ extern "C" {
 
         // if not NULL, create a ggml_context and allocate the tensor data in it
         struct ggml_context ** ctx;
+
+        // read the metadata with buffered reads instead of mapping the file
+        bool no_mmap;
     };
 
     GGML_API struct gguf_context * gguf_init_empty(void);
@@ -118,6 +121,10 @@ extern "C" {
     // get ith C string from array with given key_id
     GGML_API const char * gguf_get_arr_str (const struct gguf_context * ctx, int64_t key_id, size_t i);
 
+    // get ith string from array with given key_id without copying it, the string is NOT null-terminated and its length is stored in len
+    // for a context read from a file, this avoids decoding the whole array as gguf_get_arr_str does on first use
+    GGML_API const char * gguf_get_arr_str_view(const struct gguf_context * ctx, int64_t key_id, size_t i, size_t * len);
+
     GGML_API int64_t        gguf_get_n_tensors    (const struct gguf_context * ctx);
     GGML_API int64_t        gguf_find_tensor      (const struct gguf_context * ctx, const char * name); // returns -1 if the tensor is not found
     GGML_API size_t         gguf_get_tensor_offset(const struct gguf_context * ctx, int64_t tensor_id);
@@ -0,0 +1,335 @@
+#include "expert-cache.h"
+#include "ggml-impl.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#    include <sys/mman.h>
+#    include <unistd.h>
+#    define GGML_CPU_EXPERT_CACHE_MMAN
+#endif
+
+// number of graph evaluations between two updates of the set of pinned experts
+#define GGML_CPU_EXPERT_CACHE_REPIN_INTERVAL 16
+
+namespace {
+
+struct expert_slice {
+    uint8_t * addr;  // page-aligned start of the expert weights
+    size_t    size;  // page-aligned size of the expert weights
+    float     score; // exponentially decayed selection count
+    bool      pinned;
+};
+
+// the weights of all MUL_MAT_ID nodes that share the same expert ids
+struct expert_group {
+    const ggml_tensor *              ids;
+    std::vector<const ggml_tensor *> weights;
+};
+
+size_t expert_cache_page_size() {
+#ifdef GGML_CPU_EXPERT_CACHE_MMAN
+    static const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return page_size;
+#else
+    return 4096;
+#endif
+}
+
+} // namespace
+
+struct ggml_cpu_expert_cache {
+    std::mutex mutex;
+
+    size_t mlock_size;
+    bool   mlock_failed = false;
+
+    // per-graph state
+    std::vector<expert_group> groups;
+    std::vector<int32_t>      node_group; // [n_nodes] group to prefetch after the node has been computed, or -1
+
+    // router statistics, keyed by the address of the expert weights
+    std::unordered_map<const uint8_t *, expert_slice> slices;
+
+    std::vector<uint8_t>  used;     // scratch: experts selected by the router
+    std::vector<uint8_t>  resident; // scratch: selected experts that are resident in RAM
+    std::vector<uint8_t>  vec;      // scratch: mincore output
+
+    uint64_t n_graphs = 0;
+
+    ggml_cpu_expert_stats stats = {};
+
+    ~ggml_cpu_expert_cache() {
+#ifdef GGML_CPU_EXPERT_CACHE_MMAN
+        for (auto & it : slices) {
+            if (it.second.pinned) {
+                munlock(it.second.addr, it.second.size);
+            }
+        }
+#endif
+    }
+
+    expert_slice & get_slice(const ggml_tensor * w, int32_t expert) {
+        const uint8_t * base = (const uint8_t *) w->data + expert*w->nb[2];
+
+        auto it = slices.find(base);
+        if (it != slices.end()) {
+            return it->second;
+        }
+
+        const size_t page_size = expert_cache_page_size();
+
+        const uintptr_t beg = (uintptr_t) base & ~(page_size - 1);
+        const uintptr_t end = GGML_PAD((uintptr_t) base + w->ne[1]*w->nb[1], page_size);
+
+        expert_slice slice = {
+            /*.addr   =*/ (uint8_t *) beg,
+            /*.size   =*/ (size_t) (end - beg),
+            /*.score  =*/ 0.0f,
+            /*.pinned =*/ false,
+        };
+
+        return slices.emplace(base, slice).first->second;
+    }
+
+    // set resident[e] for the experts of w selected in used
+    // the experts of a tensor are contiguous, so the residency of all of them is checked with a single mincore call
+    void check_resident(const ggml_tensor * w, int64_t n_expert) {
+        resident.assign(n_expert, 0);
+
+#ifdef GGML_CPU_EXPERT_CACHE_MMAN
+        const size_t page_size = expert_cache_page_size();
+
+        uint8_t * beg = nullptr;
+        uint8_t * end = nullptr;
+
+        for (int32_t e = 0; e < (int32_t) n_expert; ++e) {
+            if (!used[e]) {
+                continue;
+            }
+            const expert_slice & slice = get_slice(w, e);
+            if (slice.pinned) {
+                resident[e] = 1;
+                continue;
+            }
+            if (beg == nullptr) {
+                beg = slice.addr;
+            }
+            end = slice.addr + slice.size;
+        }
+
+        if (beg == nullptr) {
+            return;
+        }
+
+        vec.resize((end - beg) / page_size);
+
+#if defined(__APPLE__)
+        if (mincore(beg, end - beg, (char *) vec.data()) != 0) {
+#else
+        if (mincore(beg, end - beg, (unsigned char *) vec.data()) != 0) {
+#endif
+            return;
+        }
+
+        for (int32_t e = 0; e < (int32_t) n_expert; ++e) {
+            if (!used[e] || resident[e]) {
+                continue;
+            }
+            const expert_slice & slice = get_slice(w, e);
+
+            const uint8_t * v0 = vec.data() + (slice.addr - beg) / page_size;
+            const uint8_t * v1 = v0 + slice.size / page_size;
+
+            resident[e] = std::all_of(v0, v1, [](uint8_t v) { return (v & 1) != 0; });
+        }
+#else
+        GGML_UNUSED(w);
+        for (int32_t e = 0; e < (int32_t) n_expert; ++e) {
+            resident[e] = used[e];
+        }
+#endif
+    }
+
+    void prefetch(const expert_group & group) {
+        const ggml_tensor * ids = group.ids;
+
+        const int64_t n_expert = group.weights[0]->ne[2];
+
+        used.assign(n_expert, 0);
+
+        for (int64_t iid1 = 0; iid1 < ids->ne[1]; ++iid1) {
+            for (int64_t id = 0; id < ids->ne[0]; ++id) {
+                const int32_t i02 = *(const int32_t *) ((const char *) ids->data + iid1*ids->nb[1] + id*ids->nb[0]);
+                if (i02 >= 0 && i02 < n_expert) {
+                    used[i02] = 1;
+                }
+            }
+        }
+
+        for (const ggml_tensor * w : group.weights) {
+            check_resident(w, n_expert);
+
+            for (int32_t e = 0; e < (int32_t) n_expert; ++e) {
+                if (!used[e]) {
+                    continue;
+                }
+
+                expert_slice & slice = get_slice(w, e);
+                slice.score += 1.0f;
+
+                stats.n_lookups++;
+
+                if (resident[e]) {
+                    stats.n_hits++;
+                    continue;
+                }
+
+#ifdef GGML_CPU_EXPERT_CACHE_MMAN
+                // asynchronous readahead - the pages are read while the preceding matrix multiplications run
+                if (madvise(slice.addr, slice.size, MADV_WILLNEED) == 0) {
+                    stats.n_prefetch++;
+                }
+#endif
+            }
+        }
+    }
+
+    // lock the experts with the highest scores in RAM, up to mlock_size bytes
+    void repin() {
+#ifdef GGML_CPU_EXPERT_CACHE_MMAN
+        std::vector<expert_slice *> order;
+        order.reserve(slices.size());
+        for (auto & it : slices) {
+            order.push_back(&it.second);
+        }
+
+        std::sort(order.begin(), order.end(), [](const expert_slice * a, const expert_slice * b) {
+            return a->score > b->score;
+        });
+
+        size_t budget = mlock_failed ? 0 : mlock_size;
+
+        // release first, so that the newly pinned experts fit in RLIMIT_MEMLOCK
+        std::vector<expert_slice *> to_pin;
+        for (expert_slice * slice : order) {
+            const bool keep = slice->score > 0.0f && slice->size <= budget;
+            if (keep) {
+                budget -= slice->size;
+                if (!slice->pinned) {
+                    to_pin.push_back(slice);
+                }
+            } else if (slice->pinned) {
+                munlock(slice->addr, slice->size);
+                slice->pinned = false;
+                stats.n_pinned--;
+                stats.pinned_size -= slice->size;
+            }
+        }
+
+        for (expert_slice * slice : to_pin) {
+            if (mlock(slice->addr, slice->size) != 0) {
+                GGML_LOG_WARN("%s: failed to mlock %zu bytes of expert weights, disabling expert pinning\n", __func__, slice->size);
+                mlock_failed = true;
+                break;
+            }
+            slice->pinned = true;
+            stats.n_pinned++;
+            stats.pinned_size += slice->size;
+        }
+#endif
+
+        // decay the scores so that the pinned set follows changes in the routing distribution
+        for (auto & it : slices) {
+            it.second.score *= 0.5f;
+        }
+    }
+};
+
+ggml_cpu_expert_cache * ggml_cpu_expert_cache_init(size_t mlock_size) {
+    ggml_cpu_expert_cache * cache = new ggml_cpu_expert_cache;
+    cache->mlock_size = mlock_size;
+    return cache;
+}
+
+void ggml_cpu_expert_cache_free(ggml_cpu_expert_cache * cache) {
+    delete cache;
+}
+
+void ggml_cpu_expert_cache_set_mlock_size(ggml_cpu_expert_cache * cache, size_t mlock_size) {
+    std::lock_guard<std::mutex> lock(cache->mutex);
+
+    cache->mlock_size   = mlock_size;
+    cache->mlock_failed = false;
+    cache->repin();
+}
+
+void ggml_cpu_expert_cache_get_stats(ggml_cpu_expert_cache * cache, ggml_cpu_expert_stats * stats) {
+    std::lock_guard<std::mutex> lock(cache->mutex);
+
+    *stats = cache->stats;
+}
+
+void ggml_cpu_expert_cache_begin_graph(ggml_cpu_expert_cache * cache, const ggml_cgraph * cgraph) {
+    std::lock_guard<std::mutex> lock(cache->mutex);
+
+    const int n_nodes = cgraph->n_nodes;
+
+    cache->groups.clear();
+    cache->node_group.assign(n_nodes, -1);
+
+    std::unordered_map<const ggml_tensor *, int> node_index;
+
+    for (int i = 0; i < n_nodes; ++i) {
+        const ggml_tensor * node = cgraph->nodes[i];
+        node_index[node] = i;
+
+        if (node->op != GGML_OP_MUL_MAT_ID) {
+            continue;
+        }
+
+        const ggml_tensor * w   = node->src[0];
+        const ggml_tensor * ids = node->src[2];
+
+        if (w->data == nullptr || ids->type != GGML_TYPE_I32) {
+            continue;
+        }
+
+        // prefetch as soon as the ids are available - if they are an input of the graph, right before this node
+        auto it = node_index.find(ids);
+        const int trigger = it != node_index.end() ? it->second : i - 1;
+        if (trigger < 0) {
+            continue;
+        }
+
+        int32_t & g = cache->node_group[trigger];
+        if (g < 0) {
+            g = (int32_t) cache->groups.size();
+            cache->groups.push_back({ ids, {} });
+        }
+
+        auto & weights = cache->groups[g].weights;
+        if (std::find(weights.begin(), weights.end(), w) == weights.end() &&
+            (weights.empty() || weights[0]->ne[2] == w->ne[2])) {
+            weights.push_back(w);
+        }
+    }
+
+    if (!cache->groups.empty() && ++cache->n_graphs % GGML_CPU_EXPERT_CACHE_REPIN_INTERVAL == 0) {
+        cache->repin();
+    }
+}
+
+void ggml_cpu_expert_cache_node_done(ggml_cpu_expert_cache * cache, int node_n) {
+    if (node_n >= (int) cache->node_group.size() || cache->node_group[node_n] < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cache->mutex);
+
+    cache->prefetch(cache->groups[cache->node_group[node_n]]);
+}
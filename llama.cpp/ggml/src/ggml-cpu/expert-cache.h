@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+// GGML CPU internal header
+
+//
+// MoE expert residency manager
+//
+// tracks which experts the router selects for each GGML_OP_MUL_MAT_ID node, issues readahead for the selected expert
+// slices of (typically mmap'ed) weights as soon as the router ids are computed and keeps the most frequently used
+// experts locked in RAM
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ggml_cpu_expert_cache;
+
+struct ggml_cpu_expert_cache * ggml_cpu_expert_cache_init(size_t mlock_size);
+void                           ggml_cpu_expert_cache_free(struct ggml_cpu_expert_cache * cache);
+
+void ggml_cpu_expert_cache_set_mlock_size(struct ggml_cpu_expert_cache * cache, size_t mlock_size);
+void ggml_cpu_expert_cache_get_stats     (struct ggml_cpu_expert_cache * cache, struct ggml_cpu_expert_stats * stats);
+
+// must be called before computing a graph - finds the MUL_MAT_ID nodes and the nodes that produce their expert ids
+void ggml_cpu_expert_cache_begin_graph(struct ggml_cpu_expert_cache * cache, const struct ggml_cgraph * cgraph);
+
+// called by the main compute thread after node_n has been computed by all threads
+void ggml_cpu_expert_cache_node_done(struct ggml_cpu_expert_cache * cache, int node_n);
+
+#ifdef __cplusplus
+}
+#endif
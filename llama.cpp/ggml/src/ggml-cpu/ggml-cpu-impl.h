@@ -15,6 +15,15 @@
 extern "C" {
 #endif
 
+// src1 of a MUL_MAT converted to vec_dot_type, reused by the following MUL_MATs of the graph with the same src1
+struct ggml_compute_shared_src1 {
+    void * data; // tail of the work buffer, NULL if the graph has no MUL_MATs that share src1
+    size_t size;
+
+    const struct ggml_tensor * src1; // tensor currently converted in data, or NULL
+    enum ggml_type             type;
+};
+
 struct ggml_compute_params {
     // ith = thread index, nth = number of threads
     int ith, nth;
@@ -24,6 +33,9 @@ struct ggml_compute_params {
     void * wdata;
 
     struct ggml_threadpool * threadpool;
+
+    // per-thread, only set while computing a MUL_MAT node of the graph
+    struct ggml_compute_shared_src1 * shared_src1;
 };
 
 
@@ -4,6 +4,7 @@
 #include "ggml-backend-impl.h"
 #include "ggml-backend.h"
 #include "traits.h"
+#include "expert-cache.h"
 #include "ggml-cpu-impl.h"
 #include "ggml-cpu.h"
 #include "ggml-impl.h"
@@ -1104,14 +1105,14 @@ void ggml_set_f32_nd(const struct ggml_tensor * tensor, int i0, int i1, int i2,
 // ggml_compute_forward_mul_mat
 
 static void ggml_compute_forward_mul_mat_one_chunk(
-    const struct ggml_compute_params * params,
     struct ggml_tensor * dst,
     const enum ggml_type type,
     const int64_t num_rows_per_vec_dot,
     const int64_t ir0_start,
     const int64_t ir0_end,
     const int64_t ir1_start,
-    const int64_t ir1_end) {
+    const int64_t ir1_end,
+    const void * wdata_src1) {
 
     const struct ggml_tensor * src0 = dst->src[0];
     const struct ggml_tensor * src1 = dst->src[1];
@@ -1134,7 +1135,7 @@ static void ggml_compute_forward_mul_mat_one_chunk(
         return;
     }
 
-    const void * wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
+    const void * wdata = (src1->type == vec_dot_type) ? src1->data : wdata_src1;
     const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
     assert(ne12 % ne02 == 0);
@@ -1255,9 +1256,26 @@ void ggml_compute_forward_mul_mat(
 UseGgmlGemm1:;
 #endif
 
-    if (src1->type != vec_dot_type) {
-        char * wdata = params->wdata;
+    char * wdata = params->wdata;
 
+    // src1 has already been converted by an earlier MUL_MAT
+    bool shared_src1 = false;
+
+    if (src1->type != vec_dot_type && params->shared_src1) {
+        struct ggml_compute_shared_src1 * shared = params->shared_src1;
+
+        if (shared->src1 == src1 && shared->type == vec_dot_type) {
+            wdata       = shared->data;
+            shared_src1 = true;
+        } else if (ggml_row_size(vec_dot_type, ggml_nelements(src1)) <= shared->size) {
+            // convert into the shared buffer for the following MUL_MATs
+            wdata        = shared->data;
+            shared->src1 = src1;
+            shared->type = vec_dot_type;
+        }
+    }
+
+    if (src1->type != vec_dot_type && !shared_src1) {
         const size_t nbw0 = ggml_type_size(vec_dot_type);
         const size_t nbw1 = ggml_row_size(vec_dot_type, ne10);
         const size_t nbw2 = nbw1*ne11;
@@ -1292,16 +1310,18 @@ UseGgmlGemm1:;
     #endif
     }
 
-    if (ith == 0) {
-        // Every thread starts at ith, so the first unprocessed chunk is nth.  This save a bit of coordination right at the start.
-        atomic_store_explicit(&params->threadpool->current_chunk, nth, memory_order_relaxed);
-    }
+    // a shared src1 is complete since the barrier at the end of the previous node
+    if (!shared_src1) {
+        if (ith == 0) {
+            // Every thread starts at ith, so the first unprocessed chunk is nth.  This save a bit of coordination right at the start.
+            atomic_store_explicit(&params->threadpool->current_chunk, nth, memory_order_relaxed);
+        }
 
-    ggml_barrier(params->threadpool);
+        ggml_barrier(params->threadpool);
+    }
 
 #if GGML_USE_LLAMAFILE
     if (src1->type != vec_dot_type) {
-        const void* wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
         for (int64_t i13 = 0; i13 < ne13; i13++)
@@ -1323,6 +1343,14 @@ UseGgmlGemm1:;
 UseGgmlGemm2:;
 #endif
 
+    if (shared_src1) {
+        if (ith == 0) {
+            atomic_store_explicit(&params->threadpool->current_chunk, nth, memory_order_relaxed);
+        }
+
+        ggml_barrier(params->threadpool);
+    }
+
     // This is the size of the first dimension of the result, so we can iterate that way. (see the ASSERT above, these are the same numbers)
     const int64_t nr0 = ne0;
 
@@ -1377,7 +1405,7 @@ UseGgmlGemm2:;
         if ((nr0 % 2 != 0) || (ne11 % 2 != 0) || ((ir0_end - ir0_start) % 2 != 0) || ((ir1_end - ir1_start) % 2 != 0)) {
             num_rows_per_vec_dot = 1;
         }
-        ggml_compute_forward_mul_mat_one_chunk(params, dst, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end);
+        ggml_compute_forward_mul_mat_one_chunk(dst, src0->type, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end, wdata);
 
         if (nth >= nchunk0 * nchunk1) {
             break;
@@ -2642,6 +2670,10 @@ struct ggml_cplan ggml_graph_plan(
     }
 
     size_t work_size = 0;
+    size_t work_shared_size = 0;
+
+    // src1 of the MUL_MATs that convert it to vec_dot_type
+    struct ggml_hash_set mul_mat_src1 = { 0, NULL, NULL };
 
     struct ggml_cplan cplan;
     memset(&cplan, 0, sizeof(struct ggml_cplan));
@@ -2693,6 +2725,14 @@ struct ggml_cplan ggml_graph_plan(
 
                         if (node->src[1]->type != vec_dot_type) {
                             cur = ggml_row_size(vec_dot_type, ggml_nelements(node->src[1]));
+
+                            // src1 is shared with an earlier MUL_MAT - keep the converted src1 in the tail of the work buffer
+                            if (mul_mat_src1.size == 0) {
+                                mul_mat_src1 = ggml_hash_set_new(cgraph->n_nodes);
+                            }
+                            if (ggml_hash_insert(&mul_mat_src1, node->src[1]) == GGML_HASHSET_ALREADY_EXISTS) {
+                                work_shared_size = MAX(work_shared_size, cur);
+                            }
                         }
                     } break;
                 case GGML_OP_MUL_MAT_ID:
@@ -2813,14 +2853,42 @@ struct ggml_cplan ggml_graph_plan(
         work_size += CACHE_LINE_SIZE*(n_threads);
     }
 
-    cplan.threadpool = threadpool;
-    cplan.n_threads  = MIN(max_tasks, n_threads);
-    cplan.work_size  = work_size;
-    cplan.work_data  = NULL;
+    if (mul_mat_src1.size > 0) {
+        ggml_hash_set_free(&mul_mat_src1);
+    }
+
+    if (work_shared_size > 0) {
+        work_size = GGML_PAD(work_size, CACHE_LINE_SIZE) + work_shared_size;
+    }
+
+    cplan.threadpool       = threadpool;
+    cplan.n_threads        = MIN(max_tasks, n_threads);
+    cplan.work_size        = work_size;
+    cplan.work_data        = NULL;
+    cplan.work_shared_size = work_shared_size;
 
     return cplan;
 }
 
+// true if computing node may modify the data of t
+static bool ggml_node_writes_to(const struct ggml_tensor * node, const struct ggml_tensor * t) {
+    switch (node->op) {
+        case GGML_OP_NONE:
+        case GGML_OP_RESHAPE:
+        case GGML_OP_VIEW:
+        case GGML_OP_PERMUTE:
+        case GGML_OP_TRANSPOSE:
+            return false;
+        default:
+            break;
+    }
+
+    const char * a = (const char *) node->data;
+    const char * b = (const char *) t->data;
+
+    return a < b + ggml_nbytes(t) && b < a + ggml_nbytes(node);
+}
+
 static thread_ret_t ggml_graph_compute_thread(void * data) {
     struct ggml_compute_state * state = (struct ggml_compute_state *) data;
     struct ggml_threadpool    * tp    = state->threadpool;
@@ -2830,19 +2898,35 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
 
     set_numa_thread_affinity(state->ith);
 
+    // all threads compute the same nodes, so each thread can track the shared src1 on its own
+    struct ggml_compute_shared_src1 shared_src1 = {
+        /*.data =*/ cplan->work_shared_size > 0 ? cplan->work_data + cplan->work_size - cplan->work_shared_size : NULL,
+        /*.size =*/ cplan->work_shared_size,
+        /*.src1 =*/ NULL,
+        /*.type =*/ GGML_TYPE_COUNT,
+    };
+
     struct ggml_compute_params params = {
-        /*.ith       =*/ state->ith,
-        /*.nth       =*/ atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed),
-        /*.wsize     =*/ cplan->work_size,
-        /*.wdata     =*/ cplan->work_data,
-        /*.threadpool=*/ tp,
+        /*.ith        =*/ state->ith,
+        /*.nth        =*/ atomic_load_explicit(&tp->n_threads_cur, memory_order_relaxed),
+        /*.wsize      =*/ cplan->work_size - cplan->work_shared_size, // the ops must not overwrite the shared src1 at the end
+        /*.wdata      =*/ cplan->work_data,
+        /*.threadpool =*/ tp,
+        /*.shared_src1=*/ NULL,
     };
 
     for (int node_n = 0; node_n < cgraph->n_nodes && atomic_load_explicit(&tp->abort, memory_order_relaxed) != node_n; node_n++) {
         struct ggml_tensor * node = cgraph->nodes[node_n];
 
+        params.shared_src1 = node->op == GGML_OP_MUL_MAT && shared_src1.data ? &shared_src1 : NULL;
+
         ggml_compute_forward(&params, node);
 
+        // the converted src1 is stale if the node has written into src1 (e.g. an in-place op)
+        if (shared_src1.src1 && ggml_node_writes_to(node, shared_src1.src1)) {
+            shared_src1.src1 = NULL;
+        }
+
         if (state->ith == 0 && cplan->abort_callback &&
                 cplan->abort_callback(cplan->abort_callback_data)) {
             atomic_store_explicit(&tp->abort, node_n + 1, memory_order_relaxed);
@@ -2852,6 +2936,11 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
         if (node_n + 1 < cgraph->n_nodes) {
             ggml_barrier(state->threadpool);
         }
+
+        // the expert ids of a MUL_MAT_ID are now available - start reading the selected experts from disk
+        if (state->ith == 0 && cplan->expert_cache) {
+            ggml_cpu_expert_cache_node_done(cplan->expert_cache, node_n);
+        }
     }
 
     ggml_barrier(state->threadpool);
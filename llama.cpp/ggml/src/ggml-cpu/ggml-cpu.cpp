@@ -3,6 +3,7 @@
 #include "ggml-cpu.h"
 #include "repack.h"
 #include "traits.h"
+#include "expert-cache.h"
 #include "ggml-impl.h"
 #include "amx/amx.h"
 
@@ -91,6 +92,8 @@ struct ggml_backend_cpu_context {
 
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
+
+    struct ggml_cpu_expert_cache * expert_cache;
 };
 
 static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
@@ -101,6 +104,9 @@ static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
 
 static void ggml_backend_cpu_free(ggml_backend_t backend) {
     struct ggml_backend_cpu_context * cpu_ctx = (struct ggml_backend_cpu_context *)backend->context;
+    if (cpu_ctx->expert_cache) {
+        ggml_cpu_expert_cache_free(cpu_ctx->expert_cache);
+    }
     delete[] cpu_ctx->work_data;
     delete cpu_ctx;
     delete backend;
@@ -129,6 +135,7 @@ static ggml_backend_graph_plan_t ggml_backend_cpu_graph_plan_create(ggml_backend
 
     cpu_plan->cplan.abort_callback      = cpu_ctx->abort_callback;
     cpu_plan->cplan.abort_callback_data = cpu_ctx->abort_callback_data;
+    cpu_plan->cplan.expert_cache        = cpu_ctx->expert_cache;
 
     return cpu_plan;
 }
@@ -145,6 +152,10 @@ static void ggml_backend_cpu_graph_plan_free(ggml_backend_t backend, ggml_backen
 static enum ggml_status ggml_backend_cpu_graph_plan_compute(ggml_backend_t backend, ggml_backend_graph_plan_t plan) {
     struct ggml_backend_plan_cpu * cpu_plan = (struct ggml_backend_plan_cpu *)plan;
 
+    if (cpu_plan->cplan.expert_cache) {
+        ggml_cpu_expert_cache_begin_graph(cpu_plan->cplan.expert_cache, &cpu_plan->cgraph);
+    }
+
     return ggml_graph_compute(&cpu_plan->cgraph, &cpu_plan->cplan);
 
     GGML_UNUSED(backend);
@@ -168,6 +179,11 @@ static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, s
 
     cplan.abort_callback      = cpu_ctx->abort_callback;
     cplan.abort_callback_data = cpu_ctx->abort_callback_data;
+    cplan.expert_cache        = cpu_ctx->expert_cache;
+
+    if (cplan.expert_cache) {
+        ggml_cpu_expert_cache_begin_graph(cplan.expert_cache, cgraph);
+    }
 
     return ggml_graph_compute(cgraph, &cplan);
 }
@@ -208,6 +224,7 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->work_size           = 0;
     ctx->abort_callback      = NULL;
     ctx->abort_callback_data = NULL;
+    ctx->expert_cache        = NULL;
 
     ggml_backend_t cpu_backend = new ggml_backend {
         /* .guid      = */ ggml_backend_cpu_guid(),
@@ -255,6 +272,38 @@ void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_
     ctx->abort_callback_data = abort_callback_data;
 }
 
+void ggml_backend_cpu_set_expert_residency(ggml_backend_t backend_cpu, bool enabled, size_t mlock_size) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+
+    if (!enabled) {
+        if (ctx->expert_cache) {
+            ggml_cpu_expert_cache_free(ctx->expert_cache);
+            ctx->expert_cache = NULL;
+        }
+        return;
+    }
+
+    if (ctx->expert_cache) {
+        ggml_cpu_expert_cache_set_mlock_size(ctx->expert_cache, mlock_size);
+    } else {
+        ctx->expert_cache = ggml_cpu_expert_cache_init(mlock_size);
+    }
+}
+
+void ggml_backend_cpu_get_expert_stats(ggml_backend_t backend_cpu, struct ggml_cpu_expert_stats * stats) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+
+    if (ctx->expert_cache) {
+        ggml_cpu_expert_cache_get_stats(ctx->expert_cache, stats);
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
 // CPU backend - device
 
 struct ggml_backend_cpu_device_context {
@@ -629,6 +678,12 @@ static void * ggml_backend_cpu_get_proc_address(ggml_backend_reg_t reg, const ch
     if (strcmp(name, "ggml_backend_set_abort_callback") == 0) {
         return (void *)ggml_backend_cpu_set_abort_callback;
     }
+    if (strcmp(name, "ggml_backend_cpu_set_expert_residency") == 0) {
+        return (void *)ggml_backend_cpu_set_expert_residency;
+    }
+    if (strcmp(name, "ggml_backend_cpu_get_expert_stats") == 0) {
+        return (void *)ggml_backend_cpu_get_expert_stats;
+    }
     if (strcmp(name, "ggml_backend_cpu_numa_init") == 0) {
         return (void *)ggml_numa_init;
     }
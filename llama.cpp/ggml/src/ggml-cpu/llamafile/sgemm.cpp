@@ -1075,6 +1075,374 @@ class tinyBLAS_Q0_AVX {
 };
 #endif // __AVX__
 
+#if defined(__AVX2__) || defined(__ARM_FEATURE_DOTPROD)
+// a K-quant super-block with its quants expanded to bytes and its scales expanded to int16, so
+// that it only has to be unpacked once for all the columns of a tile
+//
+//   dot(x, y) = y.d * (d * sum(sc[i] * x.q[i] * y.q[i]) - dmin * sum(mn[j] * y.bsums[j]))
+//
+// where the scales and offsets are per 16 quants
+struct block_k_unpacked {
+    float   d;
+    float   dmin;
+    int16_t sc[QK_K/32][16]; // scales of quants [32*i, 32*i + 16) in sc[i][0..7], of [32*i + 16, 32*i + 32) in sc[i][8..15]
+    int16_t mn[QK_K/16];     // offsets of the groups of 16 quants, multiplied by the sum of the activations in y.bsums
+    uint8_t qs[QK_K];        // unsigned quants
+};
+
+template <typename TA>
+class tinyBLAS_K {
+  public:
+    tinyBLAS_K(int64_t k,
+               const TA *A, int64_t lda,
+               const block_q8_K *B, int64_t ldb,
+               float *C, int64_t ldc,
+               int ith, int nth)
+        : A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc), ith(ith), nth(nth) {
+    }
+
+    void matmul(int64_t m, int64_t n) {
+        mnpack(0, m, 0, n);
+    }
+
+  private:
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    using V = __m512;
+#elif defined(__AVX2__)
+    using V = __m256;
+#else
+    using V = float32x4_t;
+#endif
+
+    NOINLINE void mnpack(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t mc, nc, mp, np;
+        switch ((MIN(m - m0, 4) << 4) | MIN(n - n0, 4)) {
+#if VECTOR_REGISTERS == 32
+        case 0x44:
+            mc = 4;
+            nc = 4;
+            gemm<4, 4>(m0, m, n0, n);
+            break;
+        case 0x43:
+            mc = 4;
+            nc = 3;
+            gemm<4, 3>(m0, m, n0, n);
+            break;
+        case 0x34:
+            mc = 3;
+            nc = 4;
+            gemm<3, 4>(m0, m, n0, n);
+            break;
+        case 0x33:
+            mc = 3;
+            nc = 3;
+            gemm<3, 3>(m0, m, n0, n);
+            break;
+        case 0x42:
+            mc = 4;
+            nc = 2;
+            gemm<4, 2>(m0, m, n0, n);
+            break;
+        case 0x24:
+            mc = 2;
+            nc = 4;
+            gemm<2, 4>(m0, m, n0, n);
+            break;
+#else
+        case 0x44:
+        case 0x43:
+        case 0x42:
+            mc = 4;
+            nc = 2;
+            gemm<4, 2>(m0, m, n0, n);
+            break;
+        case 0x34:
+        case 0x24:
+            mc = 2;
+            nc = 4;
+            gemm<2, 4>(m0, m, n0, n);
+            break;
+        case 0x33:
+#endif
+        case 0x32:
+            mc = 3;
+            nc = 2;
+            gemm<3, 2>(m0, m, n0, n);
+            break;
+        case 0x23:
+            mc = 2;
+            nc = 3;
+            gemm<2, 3>(m0, m, n0, n);
+            break;
+        case 0x41:
+            mc = 4;
+            nc = 1;
+            gemm<4, 1>(m0, m, n0, n);
+            break;
+        case 0x22:
+            mc = 2;
+            nc = 2;
+            gemm<2, 2>(m0, m, n0, n);
+            break;
+        case 0x14:
+            mc = 1;
+            nc = 4;
+            gemm<1, 4>(m0, m, n0, n);
+            break;
+        case 0x31:
+            mc = 3;
+            nc = 1;
+            gemm<3, 1>(m0, m, n0, n);
+            break;
+        case 0x13:
+            mc = 1;
+            nc = 3;
+            gemm<1, 3>(m0, m, n0, n);
+            break;
+        case 0x21:
+            mc = 2;
+            nc = 1;
+            gemm<2, 1>(m0, m, n0, n);
+            break;
+        case 0x12:
+            mc = 1;
+            nc = 2;
+            gemm<1, 2>(m0, m, n0, n);
+            break;
+        case 0x11:
+            mc = 1;
+            nc = 1;
+            gemm<1, 1>(m0, m, n0, n);
+            break;
+        default:
+            return;
+        }
+        mp = m0 + (m - m0) / mc * mc;
+        np = n0 + (n - n0) / nc * nc;
+        mnpack(mp, m, n0, np);
+        mnpack(m0, m, np, n);
+    }
+
+    template <int RM, int RN>
+    NOINLINE void gemm(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t ytiles = (m - m0) / RM;
+        int64_t xtiles = (n - n0) / RN;
+        int64_t tiles = xtiles * ytiles;
+        int64_t duty = (tiles + nth - 1) / nth;
+        int64_t start = duty * ith;
+        int64_t end = start + duty;
+        if (end > tiles)
+            end = tiles;
+        for (int64_t job = start; job < end; ++job) {
+            int64_t ii = m0 + job / xtiles * RM;
+            int64_t jj = n0 + job % xtiles * RN;
+            V Cv[RN][RM] = {};
+            block_k_unpacked Au[RM];
+            for (int64_t l = 0; l < k; ++l) {
+                for (int64_t i = 0; i < RM; ++i)
+                    unpack(A + lda * (ii + i) + l, Au[i]);
+                for (int64_t j = 0; j < RN; ++j)
+                    for (int64_t i = 0; i < RM; ++i)
+                        Cv[j][i] = dot(Au[i], B + ldb * (jj + j) + l, Cv[j][i]);
+            }
+            for (int64_t j = 0; j < RN; ++j)
+                for (int64_t i = 0; i < RM; ++i)
+                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+        }
+    }
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+    inline __m512 dot(const block_k_unpacked & x, const block_q8_K * y, __m512 c) {
+        __m512i sumi = _mm512_setzero_si512();
+        for (int i = 0; i < QK_K/64; ++i) {
+            const __m512i p = _mm512_maddubs_epi16(_mm512_loadu_si512((const __m512i *)(x.qs + 64*i)),
+                                                   _mm512_loadu_si512((const __m512i *)(y->qs + 64*i)));
+            sumi = _mm512_add_epi32(sumi, _mm512_madd_epi16(p, _mm512_loadu_si512((const __m512i *) x.sc[2*i])));
+        }
+        const __m256i summ = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) y->bsums),
+                                               _mm256_loadu_si256((const __m256i *) x.mn));
+        c = madd(_mm512_set1_ps(x.d * y->d), _mm512_cvtepi32_ps(sumi), c);
+        c = madd(_mm512_set1_ps(-x.dmin * y->d), _mm512_cvtepi32_ps(_mm512_inserti64x4(_mm512_setzero_si512(), summ, 0)), c);
+        return c;
+    }
+#elif defined(__AVX2__)
+    inline __m256 dot(const block_k_unpacked & x, const block_q8_K * y, __m256 c) {
+        __m256i sumi = _mm256_setzero_si256();
+        for (int i = 0; i < QK_K/32; ++i) {
+            const __m256i p = _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(x.qs + 32*i)),
+                                                   _mm256_loadu_si256((const __m256i *)(y->qs + 32*i)));
+            sumi = _mm256_add_epi32(sumi, _mm256_madd_epi16(p, _mm256_loadu_si256((const __m256i *) x.sc[i])));
+        }
+        const __m256i summ = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) y->bsums),
+                                               _mm256_loadu_si256((const __m256i *) x.mn));
+        c = madd(_mm256_set1_ps(x.d * y->d), _mm256_cvtepi32_ps(sumi), c);
+        c = madd(_mm256_set1_ps(-x.dmin * y->d), _mm256_cvtepi32_ps(summ), c);
+        return c;
+    }
+#else
+    inline float32x4_t dot(const block_k_unpacked & x, const block_q8_K * y, float32x4_t c) {
+        int32x4_t sumi = vdupq_n_s32(0);
+        for (int i = 0; i < QK_K/16; ++i) {
+            const int32x4_t p = vdotq_s32(vdupq_n_s32(0), vreinterpretq_s8_u8(vld1q_u8(x.qs + 16*i)), vld1q_s8(y->qs + 16*i));
+            sumi = vmlaq_n_s32(sumi, p, x.sc[i/2][8*(i%2)]);
+        }
+        const int16x8_t b0 = vld1q_s16(y->bsums);
+        const int16x8_t b1 = vld1q_s16(y->bsums + 8);
+        const int16x8_t m0 = vld1q_s16(x.mn);
+        const int16x8_t m1 = vld1q_s16(x.mn + 8);
+        int32x4_t summ = vmull_s16(vget_low_s16(b0), vget_low_s16(m0));
+        summ = vmlal_s16(summ, vget_high_s16(b0), vget_high_s16(m0));
+        summ = vmlal_s16(summ, vget_low_s16(b1), vget_low_s16(m1));
+        summ = vmlal_s16(summ, vget_high_s16(b1), vget_high_s16(m1));
+        c = vmlaq_n_f32(c, vcvtq_f32_s32(sumi), x.d * y->d);
+        c = vmlsq_n_f32(c, vcvtq_f32_s32(summ), x.dmin * y->d);
+        return c;
+    }
+#endif
+
+    // 6-bit scales and mins of Q4_K and Q5_K
+    static inline void get_scale_min(int j, const uint8_t * q, int16_t & sc, int16_t & mn) {
+        if (j < 4) {
+            sc = q[j] & 63;
+            mn = q[j + 4] & 63;
+        } else {
+            sc = (q[j + 4] & 0xF) | ((q[j - 4] >> 6) << 4);
+            mn = (q[j + 4] >>  4) | ((q[j - 0] >> 6) << 4);
+        }
+    }
+
+    static inline void unpack_scales_k4(const uint8_t * scales, block_k_unpacked & u) {
+        for (int j = 0; j < QK_K/32; ++j) {
+            int16_t sc, mn;
+            get_scale_min(j, scales, sc, mn);
+#if defined(__AVX2__)
+            _mm256_storeu_si256((__m256i *) u.sc[j], _mm256_set1_epi16(sc));
+#else
+            vst1q_s16(u.sc[j] + 0, vdupq_n_s16(sc));
+            vst1q_s16(u.sc[j] + 8, vdupq_n_s16(sc));
+#endif
+            u.mn[2*j + 0] = mn;
+            u.mn[2*j + 1] = mn;
+        }
+    }
+
+#if defined(__AVX2__)
+    static inline void unpack(const block_q4_K * x, block_k_unpacked & u) {
+        u.d    = unhalf(x->d);
+        u.dmin = unhalf(x->dmin);
+        unpack_scales_k4(x->scales, u);
+        const __m256i m4 = _mm256_set1_epi8(0xF);
+        for (int j = 0; j < QK_K/64; ++j) {
+            const __m256i q = _mm256_loadu_si256((const __m256i *)(x->qs + 32*j));
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j +  0), _mm256_and_si256(q, m4));
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j + 32), _mm256_and_si256(_mm256_srli_epi16(q, 4), m4));
+        }
+    }
+
+    static inline void unpack(const block_q5_K * x, block_k_unpacked & u) {
+        u.d    = unhalf(x->d);
+        u.dmin = unhalf(x->dmin);
+        unpack_scales_k4(x->scales, u);
+        const __m256i m4 = _mm256_set1_epi8(0xF);
+        const __m256i m1 = _mm256_set1_epi8(1);
+        const __m256i qh = _mm256_loadu_si256((const __m256i *) x->qh);
+        for (int j = 0; j < QK_K/64; ++j) {
+            const __m256i q  = _mm256_loadu_si256((const __m256i *)(x->qs + 32*j));
+            const __m256i h0 = _mm256_and_si256(_mm256_srli_epi16(qh, 2*j + 0), m1);
+            const __m256i h1 = _mm256_and_si256(_mm256_srli_epi16(qh, 2*j + 1), m1);
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j +  0),
+                                _mm256_or_si256(_mm256_and_si256(q, m4), _mm256_slli_epi16(h0, 4)));
+            _mm256_storeu_si256((__m256i *)(u.qs + 64*j + 32),
+                                _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(q, 4), m4), _mm256_slli_epi16(h1, 4)));
+        }
+    }
+
+    // the quants are offset by 32 - the offset is applied through the sums of the activations
+    static inline void unpack(const block_q6_K * x, block_k_unpacked & u) {
+        u.d    = unhalf(x->d);
+        u.dmin = u.d;
+        for (int j = 0; j < QK_K/32; ++j) {
+            _mm256_storeu_si256((__m256i *) u.sc[j], _mm256_set_m128i(_mm_set1_epi16(x->scales[2*j + 1]),
+                                                                      _mm_set1_epi16(x->scales[2*j + 0])));
+        }
+        _mm256_storeu_si256((__m256i *) u.mn,
+                            _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) x->scales)), 5));
+        const __m256i m4 = _mm256_set1_epi8(0xF);
+        const __m256i m3 = _mm256_set1_epi8(3);
+        for (int j = 0; j < QK_K/128; ++j) {
+            const __m256i l0 = _mm256_loadu_si256((const __m256i *)(x->ql + 64*j +  0));
+            const __m256i l1 = _mm256_loadu_si256((const __m256i *)(x->ql + 64*j + 32));
+            const __m256i qh = _mm256_loadu_si256((const __m256i *)(x->qh + 32*j));
+            const __m256i h0 = _mm256_slli_epi16(_mm256_and_si256(qh, m3), 4);
+            const __m256i h1 = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 2), m3), 4);
+            const __m256i h2 = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 4), m3), 4);
+            const __m256i h3 = _mm256_slli_epi16(_mm256_and_si256(_mm256_srli_epi16(qh, 6), m3), 4);
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j +  0), _mm256_or_si256(_mm256_and_si256(l0, m4), h0));
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j + 32), _mm256_or_si256(_mm256_and_si256(l1, m4), h1));
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j + 64), _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(l0, 4), m4), h2));
+            _mm256_storeu_si256((__m256i *)(u.qs + 128*j + 96), _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(l1, 4), m4), h3));
+        }
+    }
+#else
+    static inline void unpack(const block_q4_K * x, block_k_unpacked & u) {
+        u.d    = unhalf(x->d);
+        u.dmin = unhalf(x->dmin);
+        unpack_scales_k4(x->scales, u);
+        for (int j = 0; j < QK_K/64; ++j) {
+            for (int l = 0; l < 32; ++l) {
+                u.qs[64*j + l +  0] = x->qs[32*j + l] & 0xF;
+                u.qs[64*j + l + 32] = x->qs[32*j + l] >> 4;
+            }
+        }
+    }
+
+    static inline void unpack(const block_q5_K * x, block_k_unpacked & u) {
+        u.d    = unhalf(x->d);
+        u.dmin = unhalf(x->dmin);
+        unpack_scales_k4(x->scales, u);
+        for (int j = 0; j < QK_K/64; ++j) {
+            for (int l = 0; l < 32; ++l) {
+                u.qs[64*j + l +  0] = (x->qs[32*j + l] & 0xF) | (((x->qh[l] >> (2*j + 0)) & 1) << 4);
+                u.qs[64*j + l + 32] = (x->qs[32*j + l] >>  4) | (((x->qh[l] >> (2*j + 1)) & 1) << 4);
+            }
+        }
+    }
+
+    // the quants are offset by 32 - the offset is applied through the sums of the activations
+    static inline void unpack(const block_q6_K * x, block_k_unpacked & u) {
+        u.d    = unhalf(x->d);
+        u.dmin = u.d;
+        for (int j = 0; j < QK_K/16; ++j) {
+            for (int l = 0; l < 8; ++l) {
+                u.sc[j/2][8*(j%2) + l] = x->scales[j];
+            }
+            u.mn[j] = 32*x->scales[j];
+        }
+        for (int j = 0; j < QK_K/128; ++j) {
+            const uint8_t * ql = x->ql + 64*j;
+            const uint8_t * qh = x->qh + 32*j;
+            for (int l = 0; l < 32; ++l) {
+                u.qs[128*j + l +  0] = (ql[l +  0] & 0xF) | (((qh[l] >> 0) & 3) << 4);
+                u.qs[128*j + l + 32] = (ql[l + 32] & 0xF) | (((qh[l] >> 2) & 3) << 4);
+                u.qs[128*j + l + 64] = (ql[l +  0] >>  4) | (((qh[l] >> 4) & 3) << 4);
+                u.qs[128*j + l + 96] = (ql[l + 32] >>  4) | (((qh[l] >> 6) & 3) << 4);
+            }
+        }
+    }
+#endif
+
+    const TA *const A;
+    const block_q8_K *const B;
+    float *const C;
+    const int64_t k;
+    const int64_t lda;
+    const int64_t ldb;
+    const int64_t ldc;
+    const int ith;
+    const int nth;
+};
+#endif // __AVX2__ || __ARM_FEATURE_DOTPROD
+
 //PPC Implementation
 #if defined(__MMA__)
 
@@ -3558,6 +3926,54 @@ bool llamafile_sgemm(const struct ggml_compute_params * params, int64_t m, int64
 #endif
     }
 
+    case GGML_TYPE_Q4_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__) || defined(__ARM_FEATURE_DOTPROD)
+        tinyBLAS_K<block_q4_K> tb{
+            k, (const block_q4_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__) || defined(__ARM_FEATURE_DOTPROD)
+        tinyBLAS_K<block_q5_K> tb{
+            k, (const block_q5_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q6_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+#if defined(__AVX2__) || defined(__ARM_FEATURE_DOTPROD)
+        tinyBLAS_K<block_q6_K> tb{
+            k, (const block_q6_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            params->ith, params->nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     case GGML_TYPE_IQ4_NL: {
         if (Btype != GGML_TYPE_Q8_0)
             return false;
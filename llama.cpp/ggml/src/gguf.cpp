@@ -1,3 +1,15 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#ifndef NOMINMAX
+#   define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define GGUF_USE_MMAP
+#endif
+
 #include "ggml.h"
 #include "ggml-backend.h"
 #include "ggml-impl.h"
@@ -10,9 +22,12 @@
 #include <cstdlib>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <new>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 template <typename T>
@@ -123,8 +138,15 @@ struct gguf_kv {
     bool is_array;
     enum gguf_type type;
 
-    std::vector<int8_t>      data;
-    std::vector<std::string> data_string;
+    std::vector<int8_t> data;
+
+    // for string arrays read from a file, this is only filled by the first call of gguf_get_arr_str()
+    mutable std::vector<std::string> data_string;
+
+    // string arrays read from a file are indexed instead of decoded: str_offs are the offsets of the strings
+    // (their uint64_t length followed by the characters) in the metadata of the file, which starts at str_base
+    const char *          str_base = nullptr;
+    std::vector<uint64_t> str_offs;
 
     template <typename T>
     gguf_kv(const std::string & key, const T value)
@@ -167,7 +189,7 @@ struct gguf_kv {
 
     size_t get_ne() const {
         if (type == GGUF_TYPE_STRING) {
-            const size_t ne = data_string.size();
+            const size_t ne = is_indexed() ? str_offs.size() : data_string.size();
             GGML_ASSERT(is_array || ne == 1);
             return ne;
         }
@@ -191,6 +213,23 @@ struct gguf_kv {
         return reinterpret_cast<const T *>(data.data())[i];
     }
 
+    bool is_indexed() const {
+        return str_base != nullptr;
+    }
+
+    // get the ith string without copying it
+    std::string_view get_str(const size_t i) const {
+        GGML_ASSERT(type == GGUF_TYPE_STRING);
+        if (!is_indexed()) {
+            GGML_ASSERT(data_string.size() >= i+1);
+            return data_string[i];
+        }
+        GGML_ASSERT(str_offs.size() >= i+1);
+        uint64_t n;
+        memcpy(&n, str_base + str_offs[i], sizeof(n));
+        return std::string_view(str_base + str_offs[i] + sizeof(n), n);
+    }
+
     void cast(const enum gguf_type new_type) {
         const size_t new_type_size = gguf_type_size(new_type);
         GGML_ASSERT(data.size() % new_type_size == 0);
@@ -214,20 +253,149 @@ struct gguf_context {
     size_t size      = 0; // size of `data` in bytes
 
     void * data = nullptr;
+
+    // a copy of the metadata of the file, kept if there are indexed string arrays
+    std::vector<char> meta;
+
+    // guards the decoding of the indexed string arrays in gguf_get_arr_str()
+    mutable std::mutex mutex;
+};
+
+static int64_t gguf_ftell(FILE * file) {
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+static int gguf_fseek(FILE * file, int64_t offset, int whence) {
+#ifdef _WIN32
+    return _fseeki64(file, offset, whence);
+#else
+    return fseeko(file, offset, whence);
+#endif
+}
+
+// read-only mapping of a whole file while parsing it, only the pages of the metadata are actually read
+struct gguf_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+
+#ifdef _WIN32
+    HANDLE hmap = nullptr;
+#endif
+
+    gguf_mmap(FILE * file, size_t size) : size(size) {
+        if (size == 0) {
+            return;
+        }
+#if defined(_WIN32)
+        HANDLE hfile = (HANDLE) _get_osfhandle(_fileno(file));
+        hmap = CreateFileMappingA(hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (hmap != nullptr) {
+            addr = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+        }
+#elif defined(GGUF_USE_MMAP)
+        addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (addr == MAP_FAILED) {
+            addr = nullptr;
+        }
+#else
+        GGML_UNUSED(file);
+#endif
+    }
+
+    ~gguf_mmap() {
+#if defined(_WIN32)
+        if (addr != nullptr) {
+            UnmapViewOfFile(addr);
+        }
+        if (hmap != nullptr) {
+            CloseHandle(hmap);
+        }
+#elif defined(GGUF_USE_MMAP)
+        if (addr != nullptr) {
+            munmap(addr, size);
+        }
+#endif
+    }
 };
 
+// reads the metadata from the mapped file, or with few large reads into a buffer if the file could not be mapped,
+// instead of one fread per value
 struct gguf_reader {
     FILE * file;
 
-    gguf_reader(FILE * file) : file(file) {}
+    const char *        data; // the mapped file starting from its initial position, if any
+    std::vector<char> & buf;  // otherwise the bytes of the file starting from its initial position
+
+    size_t pos    = 0; // read position in the file, from its initial position
+    size_t n_file = 0; // size of the file, from its initial position
+
+    // the first read of the metadata, the later reads double the size of the buffer
+    static constexpr size_t CHUNK_SIZE = 256*1024;
+
+    gguf_reader(FILE * file, const char * data, std::vector<char> & buf, size_t n_file) : file(file), data(data), buf(buf), n_file(n_file) {}
+
+    const char * cur() const {
+        return (data ? data : buf.data()) + pos;
+    }
+
+    size_t n_left() const {
+        return n_file - pos;
+    }
+
+    // make sure that the next n bytes can be read
+    bool ensure(const size_t n) {
+        if (n > n_left()) {
+            return false;
+        }
+        if (data != nullptr || n <= buf.size() - pos) {
+            return true;
+        }
+
+        const size_t n_buf  = buf.size();
+        const size_t n_read = std::min(n_file - n_buf, std::max(pos + n - n_buf, std::max(n_buf, CHUNK_SIZE)));
+
+        try {
+            buf.resize(n_buf + n_read);
+        } catch (std::bad_alloc &) {
+            buf.resize(n_buf);
+            return false;
+        }
+
+        buf.resize(n_buf + fread(buf.data() + n_buf, 1, n_read, file));
+
+        return n <= buf.size() - pos;
+    }
 
     template <typename T>
-    bool read(T & dst) const {
-        return fread(&dst, 1, sizeof(dst), file) == sizeof(dst);
+    bool read(T & dst) {
+        if (!ensure(sizeof(dst))) {
+            return false;
+        }
+        memcpy(&dst, cur(), sizeof(dst));
+        pos += sizeof(dst);
+        return true;
     }
 
     template <typename T>
-    bool read(std::vector<T> & dst, const size_t n) const {
+    bool read(std::vector<T> & dst, const size_t n) {
+        if constexpr (std::is_arithmetic<T>::value && !std::is_same<T, bool>::value) {
+            if (n > SIZE_MAX/sizeof(T) || !ensure(n*sizeof(T))) {
+                return false;
+            }
+            dst.resize(n);
+            memcpy(dst.data(), cur(), n*sizeof(T));
+            pos += n*sizeof(T);
+            return true;
+        }
+
+        // every element takes at least 1 byte, avoid allocating memory for arrays that cannot be in the file
+        if (n > n_left()) {
+            return false;
+        }
         dst.resize(n);
         for (size_t i = 0; i < dst.size(); ++i) {
             if constexpr (std::is_same<T, bool>::value) {
@@ -245,7 +413,7 @@ struct gguf_reader {
         return true;
     }
 
-    bool read(bool & dst) const {
+    bool read(bool & dst) {
         int8_t tmp = -1;
         if (!read(tmp)) {
             return false;
@@ -254,7 +422,7 @@ struct gguf_reader {
         return true;
     }
 
-    bool read(enum ggml_type & dst) const {
+    bool read(enum ggml_type & dst) {
         int32_t tmp = -1;
         if (!read(tmp)) {
             return false;
@@ -263,7 +431,7 @@ struct gguf_reader {
         return true;
     }
 
-    bool read(enum gguf_type & dst) const {
+    bool read(enum gguf_type & dst) {
         int32_t tmp = -1;
         if (!read(tmp)) {
             return false;
@@ -272,17 +440,32 @@ struct gguf_reader {
         return true;
     }
 
-    bool read(std::string & dst) const {
+    bool read(std::string & dst) {
         uint64_t size = -1;
         if (!read(size)) {
             return false;
         }
-        dst.resize(size);
-        return fread(dst.data(), 1, dst.length(), file) == dst.length();
+        if (size > SIZE_MAX || !ensure(size)) {
+            return false;
+        }
+        dst.assign(cur(), size);
+        pos += size;
+        return true;
     }
 
-    bool read(void * dst, const size_t size) const {
-        return fread(dst, 1, size, file) == size;
+    // skip a string, off is set to the offset of its length
+    bool skip_str(uint64_t & off) {
+        off = pos;
+
+        uint64_t size = -1;
+        if (!read(size)) {
+            return false;
+        }
+        if (size > SIZE_MAX || !ensure(size)) {
+            return false;
+        }
+        pos += size;
+        return true;
     }
 };
 
@@ -291,7 +474,7 @@ struct gguf_context * gguf_init_empty(void) {
 }
 
 template<typename T>
-bool gguf_read_emplace_helper(const struct gguf_reader & gr, std::vector<struct gguf_kv> & kv, const std::string & key, const bool is_array, const size_t n) {
+bool gguf_read_emplace_helper(struct gguf_reader & gr, std::vector<struct gguf_kv> & kv, const std::string & key, const bool is_array, const size_t n) {
     if (is_array) {
         std::vector<T> value;
         try {
@@ -316,8 +499,48 @@ bool gguf_read_emplace_helper(const struct gguf_reader & gr, std::vector<struct
     return true;
 }
 
+// string arrays are only indexed, the strings are decoded on demand
+static bool gguf_read_emplace_str_index(struct gguf_reader & gr, std::vector<struct gguf_kv> & kv, const std::string & key, const uint64_t n) {
+    // every string takes at least the 8 bytes of its length
+    if (n > gr.n_left()/sizeof(uint64_t)) {
+        GGML_LOG_ERROR("%s: array of %" PRIu64 " strings for key '%s' exceeds the file size\n", __func__, n, key.c_str());
+        return false;
+    }
+
+    std::vector<uint64_t> offs(n);
+    for (uint64_t i = 0; i < n; ++i) {
+        if (!gr.skip_str(offs[i])) {
+            return false;
+        }
+    }
+    // str_base is set once the metadata of the file is complete
+    kv.emplace_back(key, std::vector<std::string>());
+    kv.back().str_offs = std::move(offs);
+    return true;
+}
+
 struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_params params) {
-    const struct gguf_reader gr(file);
+    // size of the file from the current position
+    const int64_t file_start = gguf_ftell(file);
+
+    int64_t file_end = file_start;
+    if (file_start >= 0 && gguf_fseek(file, 0, SEEK_END) == 0) {
+        file_end = gguf_ftell(file);
+    }
+    if (file_start < 0 || file_end < file_start || gguf_fseek(file, file_start, SEEK_SET) != 0) {
+        GGML_LOG_ERROR("%s: failed to determine the file size\n", __func__);
+        return nullptr;
+    }
+
+    // the mapping is only used while parsing the metadata, it is released before returning
+    std::unique_ptr<gguf_mmap> mapping;
+    if (!params.no_mmap) {
+        mapping = std::make_unique<gguf_mmap>(file, size_t(file_end));
+    }
+    const char * mapped = mapping && mapping->addr ? (const char *) mapping->addr + file_start : nullptr;
+
+    std::vector<char> buf;
+    struct gguf_reader gr(file, mapped, buf, size_t(file_end - file_start));
     struct gguf_context * ctx = new gguf_context;
 
     bool ok = true;
@@ -455,7 +678,14 @@ struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_par
                 case GGUF_TYPE_INT32:   ok = ok && gguf_read_emplace_helper<int32_t>    (gr, ctx->kv, key, is_array, n); break;
                 case GGUF_TYPE_FLOAT32: ok = ok && gguf_read_emplace_helper<float>      (gr, ctx->kv, key, is_array, n); break;
                 case GGUF_TYPE_BOOL:    ok = ok && gguf_read_emplace_helper<bool>       (gr, ctx->kv, key, is_array, n); break;
-                case GGUF_TYPE_STRING:  ok = ok && gguf_read_emplace_helper<std::string>(gr, ctx->kv, key, is_array, n); break;
+                case GGUF_TYPE_STRING:
+                    {
+                        if (is_array) {
+                            ok = ok && gguf_read_emplace_str_index(gr, ctx->kv, key, n);
+                        } else {
+                            ok = ok && gguf_read_emplace_helper<std::string>(gr, ctx->kv, key, is_array, n);
+                        }
+                    } break;
                 case GGUF_TYPE_UINT64:  ok = ok && gguf_read_emplace_helper<uint64_t>   (gr, ctx->kv, key, is_array, n); break;
                 case GGUF_TYPE_INT64:   ok = ok && gguf_read_emplace_helper<int64_t>    (gr, ctx->kv, key, is_array, n); break;
                 case GGUF_TYPE_FLOAT64: ok = ok && gguf_read_emplace_helper<double>     (gr, ctx->kv, key, is_array, n); break;
@@ -609,16 +839,46 @@ struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_par
     }
     GGML_ASSERT(int64_t(ctx->info.size()) == n_tensors);
 
+    // keep a copy of the metadata for the indexed string arrays, so that the mapping does not outlive the parsing
+    {
+        bool indexed = false;
+        for (const gguf_kv & kv : ctx->kv) {
+            indexed = indexed || !kv.str_offs.empty();
+        }
+
+        if (indexed) {
+            if (mapped != nullptr) {
+                ctx->meta.assign(mapped, mapped + gr.pos);
+            } else {
+                buf.resize(gr.pos);
+                buf.shrink_to_fit();
+
+                ctx->meta = std::move(buf);
+            }
+            const char * base = ctx->meta.data();
+
+            for (gguf_kv & kv : ctx->kv) {
+                if (!kv.str_offs.empty()) {
+                    kv.str_base = base;
+                }
+            }
+        }
+
+        // the tensor data is read with fread
+        mapping.reset();
+    }
+
     // we require the data section to be aligned, so take into account any padding
-    if (fseek(file, GGML_PAD(ftell(file), ctx->alignment), SEEK_SET) != 0) {
+    // the padding is relative to the start of the GGUF data, which is not necessarily the start of the file
+    // store the file offset - this is where the data section starts
+    ctx->offset = file_start + GGML_PAD(gr.pos, ctx->alignment);
+
+    if (gguf_fseek(file, ctx->offset, SEEK_SET) != 0) {
         GGML_LOG_ERROR("%s: failed to seek to beginning of data section\n", __func__);
         gguf_free(ctx);
         return nullptr;
     }
 
-    // store the current file offset - this is where the data section starts
-    ctx->offset = ftell(file);
-
     // compute the total size of the data section, taking into account the alignment
     {
         ctx->size = 0;
@@ -674,7 +934,7 @@ struct gguf_context * gguf_init_from_file_impl(FILE * file, struct gguf_init_par
             }
 
             // read the binary blob with the tensor data
-            ok = ok && gr.read(data->data, ctx->size);
+            ok = ok && fread(data->data, 1, ctx->size, file) == ctx->size;
 
             if (!ok) {
                 GGML_LOG_ERROR("%s: failed to read tensor data binary blob\n", __func__);
@@ -805,14 +1065,38 @@ const void * gguf_get_arr_data(const struct gguf_context * ctx, int64_t key_id)
 const char * gguf_get_arr_str(const struct gguf_context * ctx, int64_t key_id, size_t i) {
     GGML_ASSERT(key_id >= 0 && key_id < gguf_get_n_kv(ctx));
     GGML_ASSERT(ctx->kv[key_id].get_type() == GGUF_TYPE_STRING);
-    return ctx->kv[key_id].data_string[i].c_str();
+
+    const struct gguf_kv & kv = ctx->kv[key_id];
+
+    if (kv.is_indexed()) {
+        // decode all the strings of the array the first time that a C string is needed
+        std::lock_guard<std::mutex> lock(ctx->mutex);
+        if (kv.data_string.empty()) {
+            const size_t ne = kv.get_ne();
+            kv.data_string.reserve(ne);
+            for (size_t j = 0; j < ne; ++j) {
+                kv.data_string.emplace_back(kv.get_str(j));
+            }
+        }
+    }
+
+    return kv.data_string[i].c_str();
+}
+
+const char * gguf_get_arr_str_view(const struct gguf_context * ctx, int64_t key_id, size_t i, size_t * len) {
+    GGML_ASSERT(key_id >= 0 && key_id < gguf_get_n_kv(ctx));
+    GGML_ASSERT(ctx->kv[key_id].get_type() == GGUF_TYPE_STRING);
+
+    const std::string_view str = ctx->kv[key_id].get_str(i);
+    *len = str.size();
+    return str.data();
 }
 
 size_t gguf_get_arr_n(const struct gguf_context * ctx, int64_t key_id) {
     GGML_ASSERT(key_id >= 0 && key_id < gguf_get_n_kv(ctx));
 
     if (ctx->kv[key_id].type == GGUF_TYPE_STRING) {
-        return ctx->kv[key_id].data_string.size();
+        return ctx->kv[key_id].get_ne();
     }
 
     const size_t type_size = gguf_type_size(ctx->kv[key_id].type);
@@ -1098,11 +1382,13 @@ void gguf_set_kv(struct gguf_context * ctx, const struct gguf_context * src) {
                 gguf_set_arr_data(ctx, kv.get_key().c_str(), kv.get_type(), kv.data.data(), ne);
             } break;
             case GGUF_TYPE_STRING: {
-                std::vector<const char *> tmp(ne);
+                std::vector<std::string> tmp(ne);
                 for (size_t j = 0; j < ne; ++j) {
-                    tmp[j] = kv.data_string[j].c_str();
+                    tmp[j] = kv.get_str(j);
                 }
-                gguf_set_arr_str(ctx, kv.get_key().c_str(), tmp.data(), ne);
+                gguf_check_reserved_keys(kv.get_key(), tmp);
+                gguf_remove_key(ctx, kv.get_key().c_str());
+                ctx->kv.emplace_back(kv.get_key(), tmp);
             } break;
             case GGUF_TYPE_ARRAY:
             default: GGML_ABORT("invalid type");
@@ -1180,14 +1466,16 @@ struct gguf_writer {
         write(val8);
     }
 
-    void write(const std::string & val) const {
+    void write(const std::string_view & val) const {
         {
             const uint64_t n = val.length();
             write(n);
         }
-        for (size_t i = 0; i < val.length(); ++i) {
-            buf.push_back(reinterpret_cast<const int8_t *>(val.data())[i]);
-        }
+        buf.insert(buf.end(), reinterpret_cast<const int8_t *>(val.data()), reinterpret_cast<const int8_t *>(val.data()) + val.length());
+    }
+
+    void write(const std::string & val) const {
+        write(std::string_view(val));
     }
 
     void write(const char * val) const {
@@ -1235,7 +1523,7 @@ struct gguf_writer {
             } break;
             case GGUF_TYPE_STRING: {
                 for (size_t i = 0; i < ne; ++i) {
-                    write(kv.get_val<std::string>(i));
+                    write(kv.get_str(i));
                 }
             } break;
             case GGUF_TYPE_ARRAY:
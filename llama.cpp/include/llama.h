@@ -336,6 +336,8 @@ extern "C" {
         uint32_t n_batch;           // logical maximum batch size that can be submitted to llama_decode
         uint32_t n_ubatch;          // physical maximum batch size
         uint32_t n_seq_max;         // max number of sequences (i.e. distinct states for recurrent models)
+        uint32_t n_seq_aux;         // number of the n_seq_max sequences that only hold a few short-lived tokens (e.g. batched embeddings)
+                                    // they are not counted when splitting the context between the sequences (default: 0)
         int32_t  n_threads;         // number of threads to use for generation
         int32_t  n_threads_batch;   // number of threads to use for batch processing
 
@@ -365,6 +367,8 @@ extern "C" {
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
 
+        size_t moe_mlock_size; // max. size of the most frequently routed MoE experts to lock in RAM (requires moe_prefetch)
+
         // Keep the booleans together and at the end of the struct to avoid misalignment during copy-by-value.
         bool embeddings;  // if true, extract embeddings (together with logits)
         bool offload_kqv; // offload the KQV ops (including the KV cache) to GPU
@@ -374,6 +378,7 @@ extern "C" {
         bool swa_full;    // use full-size SWA cache (https://github.com/ggml-org/llama.cpp/pull/13194#issuecomment-2868343055)
                           // NOTE: setting to false when n_seq_max > 1 can cause bad performance in some cases
                           //       ref: https://github.com/ggml-org/llama.cpp/pull/13845#issuecomment-2924800573
+        bool moe_prefetch; // prefetch the routed MoE experts of mmap'ed CPU weights as soon as the router has selected them
     };
 
     // model quantization parameters
@@ -573,6 +578,9 @@ extern "C" {
     // Returns true if the model is recurrent (like Mamba, RWKV, etc.)
     LLAMA_API bool llama_model_is_recurrent(const struct llama_model * model);
 
+    // Returns true if the model is hybrid, with both attention and recurrent layers (like Jamba, Granite, etc.)
+    LLAMA_API bool llama_model_is_hybrid(const struct llama_model * model);
+
     // Returns 0 on success
     LLAMA_API uint32_t llama_model_quantize(
             const char * fname_inp,
@@ -624,6 +632,19 @@ extern "C" {
                          int32_t   il_start,
                          int32_t   il_end);
 
+    // Same as llama_apply_adapter_cvec, but only for the tokens of seq_id, replacing the context-wide
+    // control vector for them. If data is NULL, the sequence uses the context-wide vector again.
+    // Sequences with different control vectors can be decoded in the same batch.
+    // Tokens that belong to several sequences use the control vector of their first seq_id.
+    LLAMA_API int32_t llama_apply_adapter_cvec_seq(
+            struct llama_context * ctx,
+                      llama_seq_id   seq_id,
+                     const float * data,
+                          size_t   len,
+                         int32_t   n_embd,
+                         int32_t   il_start,
+                         int32_t   il_end);
+
     //
     // Memory
     //
@@ -1429,6 +1450,10 @@ extern "C" {
 
         int32_t n_p_eval;
         int32_t n_eval;
+
+        // MoE expert residency (moe_prefetch)
+        int64_t n_expert_lookups; // number of routed expert weights
+        int64_t n_expert_hits;    // number of routed expert weights that were already resident in RAM
     };
 
     struct llama_perf_sampler_data {
@@ -18,7 +18,20 @@ ggml_tensor * llama_adapter_cvec::tensor_for(int il) const {
     return tensors[il];
 }
 
-ggml_tensor * llama_adapter_cvec::apply_to(ggml_context * ctx, ggml_tensor * cur, int  il) const {
+ggml_tensor * llama_adapter_cvec::apply_to(ggml_context * ctx, ggml_tensor * cur, ggml_tensor * rows, int il) const {
+    if (has_seq()) {
+        if (!is_active(il)) {
+            return cur;
+        }
+
+        GGML_ASSERT(rows != nullptr);
+
+        // gather the vector of each token by its sequence
+        ggml_tensor * layer_dir = ggml_get_rows(ctx, tensors_seq[il], rows);
+
+        return ggml_add(ctx, cur, layer_dir);
+    }
+
     ggml_tensor * layer_dir = tensor_for(il);
     if (layer_dir != nullptr) {
         cur = ggml_add(ctx, cur, layer_dir);
@@ -27,13 +40,27 @@ ggml_tensor * llama_adapter_cvec::apply_to(ggml_context * ctx, ggml_tensor * cur
     return cur;
 }
 
-bool llama_adapter_cvec::init(const llama_model & model) {
+// allocate one F32 [n_embd, n_rows] tensor per layer, except for layer 0
+static bool llama_adapter_cvec_alloc(
+        const llama_model & model,
+        int64_t n_rows,
+        std::vector<ggml_tensor *> & tensors,
+        std::vector<ggml_context_ptr> & ctxs,
+        std::vector<ggml_backend_buffer_ptr> & bufs) {
     const auto & hparams = model.hparams;
 
     GGML_ASSERT(tensors.empty());
     GGML_ASSERT(ctxs.empty());
     GGML_ASSERT(bufs.empty());
 
+    // free a partial allocation, so that the next call starts over instead of using the incomplete tensors
+    auto fail = [&]() {
+        tensors.clear();
+        bufs.clear();
+        ctxs.clear();
+        return false;
+    };
+
     // create a context for each buffer type
     std::map<ggml_backend_buffer_type_t, ggml_context *> ctx_map;
     auto ctx_for_buft = [&](ggml_backend_buffer_type_t buft) -> ggml_context * {
@@ -67,9 +94,11 @@ bool llama_adapter_cvec::init(const llama_model & model) {
         ggml_context * ctx = ctx_for_buft(buft);
         if (!ctx) {
             LLAMA_LOG_ERROR("%s: failed to allocate context for control vector\n", __func__);
-            return false;
+            return fail();
         }
-        ggml_tensor * tensor = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, hparams.n_embd);
+        ggml_tensor * tensor = n_rows == 1
+            ? ggml_new_tensor_1d(ctx, GGML_TYPE_F32, hparams.n_embd)
+            : ggml_new_tensor_2d(ctx, GGML_TYPE_F32, hparams.n_embd, n_rows);
         tensors.push_back(tensor);
     }
 
@@ -81,7 +110,7 @@ bool llama_adapter_cvec::init(const llama_model & model) {
         ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
         if (!buf) {
             LLAMA_LOG_ERROR("%s: failed to allocate buffer for control vector\n", __func__);
-            return false;
+            return fail();
         }
         ggml_backend_buffer_clear(buf, 0);
         bufs.emplace_back(buf);
@@ -90,6 +119,82 @@ bool llama_adapter_cvec::init(const llama_model & model) {
     return true;
 }
 
+bool llama_adapter_cvec::init(const llama_model & model) {
+    return llama_adapter_cvec_alloc(model, 1, tensors, ctxs, bufs);
+}
+
+bool llama_adapter_cvec::init_seq(const llama_model & model, uint32_t n_seq_max) {
+    if (!llama_adapter_cvec_alloc(model, 1 + n_seq_max, tensors_seq, ctxs_seq, bufs_seq)) {
+        return false;
+    }
+
+    seq_layers.assign(n_seq_max, { -1, -1 });
+
+    // row 0 starts as a copy of the context-wide vector
+    if (layer_start >= 0) {
+        std::vector<float> data;
+        for (size_t il = 1; il < tensors.size(); il++) {
+            const size_t n_embd = ggml_nelements(tensors[il]);
+            data.resize(il*n_embd);
+            ggml_backend_tensor_get(tensors[il], data.data() + (il - 1)*n_embd, 0, ggml_nbytes(tensors[il]));
+        }
+        set_row(0, data.data(), data.size(), layer_start, layer_end);
+    }
+
+    return true;
+}
+
+void llama_adapter_cvec::set_row(int32_t row, const float * data, size_t len, int32_t il_start, int32_t il_end) {
+    for (size_t il = 1; il < tensors_seq.size(); il++) {
+        ggml_tensor * t = tensors_seq[il];
+
+        const size_t n_embd = t->ne[0];
+        const size_t off    = n_embd * (il - 1); // buffer doesn't have data for layer 0, since it's never present
+
+        if (data != nullptr && (int32_t) il >= il_start && (int32_t) il <= il_end && off + n_embd <= len) {
+            ggml_backend_tensor_set(t, data + off, row*t->nb[1], t->nb[1]);
+        } else {
+            ggml_backend_tensor_memset(t, 0, row*t->nb[1], t->nb[1]);
+        }
+    }
+}
+
+bool llama_adapter_cvec::is_active(int il) const {
+    if (il < 1 || (size_t) il >= tensors_seq.size()) {
+        return false;
+    }
+
+    if (layer_start >= 0 && il >= layer_start && il <= layer_end) {
+        return true;
+    }
+
+    for (const auto & [il_start, il_end] : seq_layers) {
+        if (il >= il_start && il <= il_end) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool llama_adapter_cvec::has_seq() const {
+    for (const auto & [il_start, il_end] : seq_layers) {
+        if (il_start >= 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int32_t llama_adapter_cvec::row_for(llama_seq_id seq_id) const {
+    if (seq_id < 0 || (size_t) seq_id >= seq_layers.size() || seq_layers[seq_id].first < 0) {
+        return 0;
+    }
+
+    return 1 + seq_id;
+}
+
 bool llama_adapter_cvec::apply(
         const llama_model & model,
         const float * data,
@@ -103,6 +208,9 @@ bool llama_adapter_cvec::apply(
         // disable the current control vector (but leave allocated for later)
         layer_start = -1;
         layer_end   = -1;
+        if (!tensors_seq.empty()) {
+            set_row(0, nullptr, 0, -1, -1);
+        }
         return true;
     }
 
@@ -129,6 +237,52 @@ bool llama_adapter_cvec::apply(
         }
     }
 
+    if (!tensors_seq.empty()) {
+        set_row(0, data, len, il_start, il_end);
+    }
+
+    return true;
+}
+
+bool llama_adapter_cvec::apply_seq(
+        const llama_model & model,
+        uint32_t n_seq_max,
+        llama_seq_id seq_id,
+        const float * data,
+        size_t len,
+        int32_t n_embd,
+        int32_t il_start,
+        int32_t il_end) {
+    const auto & hparams = model.hparams;
+
+    if (seq_id < 0 || (uint32_t) seq_id >= n_seq_max) {
+        LLAMA_LOG_ERROR("%s: invalid seq_id %d, n_seq_max = %u\n", __func__, seq_id, n_seq_max);
+        return false;
+    }
+
+    if (data == nullptr) {
+        // the sequence falls back to the context-wide control vector
+        if ((size_t) seq_id < seq_layers.size()) {
+            seq_layers[seq_id] = { -1, -1 };
+        }
+        return true;
+    }
+
+    if (n_embd != (int) hparams.n_embd) {
+        LLAMA_LOG_ERROR("%s: control vector n_embd does not match model\n", __func__);
+        return false;
+    }
+
+    if (tensors_seq.empty()) {
+        if (!init_seq(model, n_seq_max)) {
+            return false;
+        }
+    }
+
+    set_row(1 + seq_id, data, len, il_start, il_end);
+
+    seq_layers[seq_id] = { il_start, il_end };
+
     return true;
 }
 
@@ -152,6 +306,7 @@ static void llama_adapter_lora_init_impl(llama_model & model, const char * path_
     gguf_init_params meta_gguf_params = {
         /* .no_alloc = */ true,
         /* .ctx      = */ &ctx_init,
+        /* .no_mmap  = */ false,
     };
 
     gguf_context_ptr ctx_gguf { gguf_init_from_file(path_lora, meta_gguf_params) };
@@ -17,7 +17,8 @@
 struct llama_adapter_cvec {
     ggml_tensor * tensor_for(int il) const;
 
-    ggml_tensor * apply_to(ggml_context * ctx, ggml_tensor * cur, int  il) const;
+    // rows: I32 [n_tokens] with row_for() of each token, required when has_seq()
+    ggml_tensor * apply_to(ggml_context * ctx, ggml_tensor * cur, ggml_tensor * rows, int il) const;
 
     bool apply(
             const llama_model & model,
@@ -27,8 +28,32 @@ struct llama_adapter_cvec {
             int32_t il_start,
             int32_t il_end);
 
+    // control vector of a single sequence, replaces the context-wide one for the tokens of seq_id
+    bool apply_seq(
+            const llama_model & model,
+            uint32_t n_seq_max,
+            llama_seq_id seq_id,
+            const float * data,
+            size_t len,
+            int32_t n_embd,
+            int32_t il_start,
+            int32_t il_end);
+
+    // true if any sequence has its own control vector
+    bool has_seq() const;
+
+    // row of the per-sequence tensors used by the tokens of seq_id (0 is the context-wide vector)
+    int32_t row_for(llama_seq_id seq_id) const;
+
+    // true if any of the per-sequence vectors applies to layer il
+    bool is_active(int il) const;
+
 private:
     bool init(const llama_model & model);
+    bool init_seq(const llama_model & model, uint32_t n_seq_max);
+
+    // write row of the per-sequence tensors, zero outside of [il_start, il_end]
+    void set_row(int32_t row, const float * data, size_t len, int32_t il_start, int32_t il_end);
 
     int32_t layer_start = -1;
     int32_t layer_end   = -1;
@@ -37,6 +62,15 @@ private:
     std::vector<ggml_backend_buffer_ptr> bufs;
 
     std::vector<ggml_tensor *> tensors; // per layer
+
+    // per-sequence control vectors, allocated on the first apply_seq()
+    // one F32 [n_embd, 1 + n_seq_max] tensor per layer - row 0 is the context-wide vector, row 1 + s is sequence s
+    std::vector<ggml_context_ptr> ctxs_seq;
+    std::vector<ggml_backend_buffer_ptr> bufs_seq;
+
+    std::vector<ggml_tensor *> tensors_seq; // per layer
+
+    std::vector<std::pair<int32_t, int32_t>> seq_layers; // [il_start, il_end] per sequence, {-1, -1} if not set
 };
 
 //
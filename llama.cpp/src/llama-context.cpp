@@ -33,6 +33,11 @@ llama_context::llama_context(
         throw std::runtime_error("n_seq_max must be <= " + std::to_string(LLAMA_MAX_SEQ));
     }
 
+    cparams.n_seq_aux = params.n_seq_aux;
+    if (cparams.n_seq_aux >= cparams.n_seq_max) {
+        throw std::runtime_error("n_seq_aux must be < n_seq_max");
+    }
+
     cparams.n_threads        = params.n_threads;
     cparams.n_threads_batch  = params.n_threads_batch;
     cparams.yarn_ext_factor  = params.yarn_ext_factor;
@@ -103,9 +108,12 @@ llama_context::llama_context(
 
     cparams.op_offload = params.op_offload;
 
-    const uint32_t n_ctx_per_seq = cparams.n_ctx / cparams.n_seq_max;
+    const uint32_t n_ctx_per_seq = cparams.n_ctx / (cparams.n_seq_max - cparams.n_seq_aux);
 
     LLAMA_LOG_INFO("%s: n_seq_max     = %u\n",   __func__, cparams.n_seq_max);
+    if (cparams.n_seq_aux > 0) {
+        LLAMA_LOG_INFO("%s: n_seq_aux     = %u\n",   __func__, cparams.n_seq_aux);
+    }
     LLAMA_LOG_INFO("%s: n_ctx         = %u\n",   __func__, cparams.n_ctx);
     LLAMA_LOG_INFO("%s: n_ctx_per_seq = %u\n",   __func__, n_ctx_per_seq);
     LLAMA_LOG_INFO("%s: n_batch       = %u\n",   __func__, cparams.n_batch);
@@ -159,6 +167,17 @@ llama_context::llama_context(
         }
         backends.emplace_back(backend_cpu);
 
+        if (params.moe_prefetch && model.hparams.n_expert > 0) {
+            auto * reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(backend_cpu));
+            auto * set_expert_residency_fn = (decltype(ggml_backend_cpu_set_expert_residency) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_set_expert_residency");
+            if (set_expert_residency_fn) {
+                LLAMA_LOG_INFO("%s: MoE expert prefetch enabled, mlock size = %.2f MiB\n", __func__, params.moe_mlock_size / 1024.0 / 1024.0);
+                set_expert_residency_fn(backend_cpu, true, params.moe_mlock_size);
+            } else {
+                LLAMA_LOG_WARN("%s: MoE expert prefetch is not supported by the CPU backend\n", __func__);
+            }
+        }
+
         // create a list of the set_n_threads functions in the backends
         for (auto & backend : backends) {
             ggml_backend_dev_t dev = ggml_backend_get_device(backend.get());
@@ -397,7 +416,7 @@ uint32_t llama_context::n_ctx() const {
 }
 
 uint32_t llama_context::n_ctx_per_seq() const {
-    return cparams.n_ctx / cparams.n_seq_max;
+    return cparams.n_ctx / (cparams.n_seq_max - cparams.n_seq_aux);
 }
 
 uint32_t llama_context::n_batch() const {
@@ -678,6 +697,18 @@ bool llama_context::apply_adapter_cvec(
     return cvec.apply(model, data, len, n_embd, il_start, il_end);
 }
 
+bool llama_context::apply_adapter_cvec_seq(
+           llama_seq_id   seq_id,
+            const float * data,
+                 size_t   len,
+                int32_t   n_embd,
+                int32_t   il_start,
+                int32_t   il_end) {
+    LLAMA_LOG_DEBUG("%s: seq_id = %d, il_start = %d, il_end = %d\n", __func__, seq_id, il_start, il_end);
+
+    return cvec.apply_seq(model, cparams.n_seq_max, seq_id, data, len, n_embd, il_start, il_end);
+}
+
 llm_graph_result_ptr llama_context::process_ubatch(const llama_ubatch & ubatch, llm_graph_type gtype, llama_memory_context_i * mctx, ggml_status & ret) {
     if (mctx && !mctx->apply()) {
         LLAMA_LOG_ERROR("%s: failed to apply memory context\n", __func__);
@@ -1295,8 +1326,14 @@ ggml_cgraph * llama_context::graph_reserve(uint32_t n_tokens, uint32_t n_seqs, u
     LLAMA_LOG_DEBUG("%s: reserving a graph for ubatch with n_tokens = %4u, n_seqs = %2u, n_outputs = %4u\n", __func__, n_tokens, n_seqs, n_outputs);
 
     if (n_tokens % n_seqs != 0) {
+        // keep all tokens as outputs when all were requested - the pooling inputs are sized for all the tokens of the ubatch
+        const bool output_all = n_outputs == n_tokens;
+
         n_tokens = ((n_tokens + (n_seqs - 1)) / n_seqs) * n_seqs; // round to next multiple of n_seqs
-        n_outputs = std::min(n_outputs, n_tokens);
+        if (n_tokens > cparams.n_ctx) {
+            n_tokens -= n_seqs; // the ubatch cannot be larger than the KV cache
+        }
+        n_outputs = output_all ? n_tokens : std::min(n_outputs, n_tokens);
 
         LLAMA_LOG_DEBUG("%s: making n_tokens a multiple of n_seqs - n_tokens = %u, n_seqs = %u, n_outputs = %u\n", __func__, n_tokens, n_seqs, n_outputs);
     }
@@ -1931,6 +1968,18 @@ llama_perf_context_data llama_context::perf_get_data() const {
     data.n_p_eval    = std::max(1, n_p_eval);
     data.n_eval      = std::max(1, n_eval);
 
+    if (backend_cpu != nullptr) {
+        auto * reg = ggml_backend_dev_backend_reg(ggml_backend_get_device(backend_cpu));
+        auto * get_expert_stats_fn = (decltype(ggml_backend_cpu_get_expert_stats) *) ggml_backend_reg_get_proc_address(reg, "ggml_backend_cpu_get_expert_stats");
+        if (get_expert_stats_fn) {
+            ggml_cpu_expert_stats stats;
+            get_expert_stats_fn(backend_cpu, &stats);
+
+            data.n_expert_lookups = stats.n_lookups;
+            data.n_expert_hits    = stats.n_hits;
+        }
+    }
+
     return data;
 }
 
@@ -2162,6 +2211,7 @@ llama_context_params llama_context_default_params() {
         /*.n_batch                     =*/ 2048,
         /*.n_ubatch                    =*/ 512,
         /*.n_seq_max                   =*/ 1,
+        /*.n_seq_aux                   =*/ 0,
         /*.n_threads                   =*/ GGML_DEFAULT_N_THREADS, // TODO: better default
         /*.n_threads_batch             =*/ GGML_DEFAULT_N_THREADS,
         /*.rope_scaling_type           =*/ LLAMA_ROPE_SCALING_TYPE_UNSPECIFIED,
@@ -2181,12 +2231,14 @@ llama_context_params llama_context_default_params() {
         /*.type_v                      =*/ GGML_TYPE_F16,
         /*.abort_callback              =*/ nullptr,
         /*.abort_callback_data         =*/ nullptr,
+        /*.moe_mlock_size              =*/ 0,
         /*.embeddings                  =*/ false,
         /*.offload_kqv                 =*/ true,
         /*.flash_attn                  =*/ false,
         /*.no_perf                     =*/ true,
         /*.op_offload                  =*/ true,
         /*.swa_full                    =*/ true,
+        /*.moe_prefetch                =*/ false,
     };
 
     return result;
@@ -2383,6 +2435,19 @@ int32_t llama_apply_adapter_cvec(
     return res ? 0 : -1;
 }
 
+int32_t llama_apply_adapter_cvec_seq(
+        llama_context * ctx,
+          llama_seq_id   seq_id,
+                 const float * data,
+                      size_t   len,
+                     int32_t   n_embd,
+                     int32_t   il_start,
+                     int32_t   il_end) {
+    bool res = ctx->apply_adapter_cvec_seq(seq_id, data, len, n_embd, il_start, il_end);
+
+    return res ? 0 : -1;
+}
+
 //
 // memory
 //
@@ -2807,6 +2872,10 @@ void llama_perf_context_print(const llama_context * ctx) {
     LLAMA_LOG_INFO("%s:        eval time = %10.2f ms / %5d runs   (%8.2f ms per token, %8.2f tokens per second)\n",
             __func__, data.t_eval_ms, data.n_eval, data.t_eval_ms / data.n_eval, 1e3 / data.t_eval_ms * data.n_eval);
     LLAMA_LOG_INFO("%s:       total time = %10.2f ms / %5d tokens\n", __func__, (t_end_ms - data.t_start_ms), (data.n_p_eval + data.n_eval));
+    if (data.n_expert_lookups > 0) {
+        LLAMA_LOG_INFO("%s:  expert hit rate = %10.2f %% (%" PRId64 " / %" PRId64 " routed experts resident in RAM)\n",
+                __func__, 100.0 * data.n_expert_hits / data.n_expert_lookups, data.n_expert_hits, data.n_expert_lookups);
+    }
 }
 
 void llama_perf_context_reset(llama_context * ctx) {
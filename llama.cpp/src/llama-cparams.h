@@ -11,6 +11,7 @@ struct llama_cparams {
     uint32_t n_batch;
     uint32_t n_ubatch;
     uint32_t n_seq_max;
+    uint32_t n_seq_aux;       // auxiliary sequences, not counted in the context size per sequence
     int      n_threads;       // number of threads to use for generation
     int      n_threads_batch; // number of threads to use for batch processing
 
@@ -6,7 +6,10 @@
 
 #include <cmath>
 #include <algorithm>
+#include <list>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_map>
 
 //
 // helpers
@@ -816,7 +819,7 @@ static bool llama_grammar_detect_left_recursion(
 }
 
 const llama_grammar_rules & llama_grammar_get_rules(const struct llama_grammar * grammar) {
-    return grammar->rules;
+    return *grammar->rules;
 }
 
 llama_grammar_stacks & llama_grammar_get_stacks(struct llama_grammar * grammar) {
@@ -841,7 +844,7 @@ void llama_grammar_accept(struct llama_grammar * grammar, uint32_t chr) {
             if (!llama_grammar_is_end_of_sequence(pos)) {
                 new_stack.push_back(pos);
             }
-            llama_grammar_advance_stack(grammar->rules, new_stack, stacks_new);
+            llama_grammar_advance_stack(*grammar->rules, new_stack, stacks_new);
         }
     }
 
@@ -905,20 +908,118 @@ llama_grammar_candidates llama_grammar_reject_candidates_for_stack(
 
 ////////////////////
 
-struct llama_grammar * llama_grammar_init_impl(
-        const struct llama_vocab * vocab,
+namespace {
+
+// the rules of a grammar and the initial stacks, which point into the rules
+struct llama_grammar_compiled {
+    std::shared_ptr<const llama_grammar_rules> rules;
+    llama_grammar_stacks                       stacks;
+};
+
+// map with a fixed capacity, evicts the least recently used entry when it is full
+template <typename T>
+struct llama_lru_map {
+    const size_t capacity;
+
+    std::list<std::string> lru; // most recently used first
+    std::unordered_map<std::string, std::pair<T, std::list<std::string>::iterator>> entries;
+
+    explicit llama_lru_map(size_t capacity) : capacity(capacity) {}
+
+    const T * get(const std::string & key) {
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            return nullptr;
+        }
+
+        lru.splice(lru.begin(), lru, it->second.second);
+
+        return &it->second.first;
+    }
+
+    void put(const std::string & key, const T & value) {
+        if (get(key) != nullptr) {
+            return;
+        }
+
+        if (entries.size() >= capacity) {
+            entries.erase(lru.back());
+            lru.pop_back();
+        }
+
+        lru.push_front(key);
+        entries.emplace(key, std::make_pair(value, lru.begin()));
+    }
+};
+
+// grammars are typically re-created from the same source for every request (e.g. JSON schemas, tool calls)
+// cache the compiled grammars keyed by their source and the compiled trigger patterns
+struct llama_grammar_cache {
+    std::mutex mutex;
+
+    llama_lru_map<llama_grammar_compiled> grammars { 64 };
+    llama_lru_map<std::regex>             regexes  { 256 };
+
+    bool get(const std::string & key, llama_grammar_compiled & result) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const llama_grammar_compiled * compiled = grammars.get(key);
+        if (compiled == nullptr) {
+            return false;
+        }
+
+        result = *compiled;
+
+        return true;
+    }
+
+    void put(const std::string & key, const llama_grammar_compiled & compiled) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        grammars.put(key, compiled);
+    }
+
+    std::regex get_regex(const std::string & pattern) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            const std::regex * regex = regexes.get(pattern);
+            if (regex != nullptr) {
+                return *regex;
+            }
+        }
+
+        std::regex regex(pattern);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        regexes.put(pattern, regex);
+
+        return regex;
+    }
+};
+
+llama_grammar_cache & llama_grammar_get_cache() {
+    static llama_grammar_cache cache;
+    return cache;
+}
+
+} // namespace
+
+static bool llama_grammar_compile(
         const llama_grammar_element ** rules,
         size_t n_rules,
-        size_t start_rule_index) {
+        size_t start_rule_index,
+        llama_grammar_compiled & result) {
     const llama_grammar_element * pos;
 
     // copy rule definitions into vectors
-    llama_grammar_rules vec_rules(n_rules);
+    auto vec_rules = std::make_shared<llama_grammar_rules>(n_rules);
     for (size_t i = 0; i < n_rules; i++) {
         for (pos = rules[i]; pos->type != LLAMA_GRETYPE_END; pos++) {
-            vec_rules[i].push_back(*pos);
+            (*vec_rules)[i].push_back(*pos);
         }
-        vec_rules[i].push_back({LLAMA_GRETYPE_END, 0});
+        (*vec_rules)[i].push_back({LLAMA_GRETYPE_END, 0});
     }
 
     // Check for left recursion
@@ -929,22 +1030,23 @@ struct llama_grammar * llama_grammar_init_impl(
         if (rules_visited[i]) {
             continue;
         }
-        if (llama_grammar_detect_left_recursion(vec_rules, i, &rules_visited, &rules_in_progress, &rules_may_be_empty)) {
+        if (llama_grammar_detect_left_recursion(*vec_rules, i, &rules_visited, &rules_in_progress, &rules_may_be_empty)) {
             LLAMA_LOG_ERROR("unsupported grammar, left recursion detected for nonterminal at index %zu", i);
-            return nullptr;
+            return false;
         }
     }
 
     // loop over alternates of start rule to build initial stacks
+    // note: the stacks contain pointers to the elements of the rules, which are never modified after this point
     llama_grammar_stacks stacks;
-    pos = vec_rules[start_rule_index].data();
+    pos = (*vec_rules)[start_rule_index].data();
     do {
         llama_grammar_stack stack;
         if (!llama_grammar_is_end_of_sequence(pos)) {
             // if alternate is nonempty, add to stack
             stack.push_back(pos);
         }
-        llama_grammar_advance_stack(vec_rules, stack, stacks);
+        llama_grammar_advance_stack(*vec_rules, stack, stacks);
         while (!llama_grammar_is_end_of_sequence(pos)) {
             // scan to end of alternate def
             pos++;
@@ -957,13 +1059,26 @@ struct llama_grammar * llama_grammar_init_impl(
         }
     } while (true);
 
-    // Important: vec_rules has to be moved here, not copied, because stacks contains
-    // pointers to elements of vec_rules. If vec_rules were copied into llama_grammar
-    // then the pointers would be invalidated when the local vec_rules goes out of scope.
+    result.rules  = std::move(vec_rules);
+    result.stacks = std::move(stacks);
+
+    return true;
+}
+
+struct llama_grammar * llama_grammar_init_impl(
+        const struct llama_vocab * vocab,
+        const llama_grammar_element ** rules,
+        size_t n_rules,
+        size_t start_rule_index) {
+    llama_grammar_compiled compiled;
+    if (!llama_grammar_compile(rules, n_rules, start_rule_index, compiled)) {
+        return nullptr;
+    }
+
     return new llama_grammar {
         vocab,
-        std::move(vec_rules),
-        std::move(stacks),
+        std::move(compiled.rules),
+        std::move(compiled.stacks),
         /* .partial_utf8 = */     {},
         /* .lazy =*/              false,
         /* .awaiting_trigger = */ false,
@@ -982,72 +1097,35 @@ struct llama_grammar * llama_grammar_init_impl(
                             size_t num_trigger_patterns,
                const llama_token * trigger_tokens,
                             size_t num_trigger_tokens) {
-    llama_grammar_parser parser;
-
-    // if there is a grammar, parse it
-    // rules will be empty (default) if there are parse errors
-    if (!parser.parse(grammar_str) || parser.rules.empty()) {
-        fprintf(stderr, "%s: failed to parse grammar\n", __func__);
-        return nullptr;
-    }
-
-    // Ensure that there is a "root" node.
-    if (parser.symbol_ids.find("root") == parser.symbol_ids.end()) {
-        fprintf(stderr, "%s: grammar does not contain a 'root' symbol\n", __func__);
-        return nullptr;
-    }
+    auto & cache = llama_grammar_get_cache();
 
-    std::vector<const llama_grammar_element *> grammar_rules(parser.c_rules());
+    const std::string key = std::string(grammar_root) + '\0' + grammar_str;
 
-    const size_t n_rules = grammar_rules.size();
-    const size_t start_rule_index = parser.symbol_ids.at(grammar_root);
-
-    const llama_grammar_element * pos;
+    llama_grammar_compiled compiled;
+    if (!cache.get(key, compiled)) {
+        llama_grammar_parser parser;
 
-    // copy rule definitions into vectors
-    llama_grammar_rules vec_rules(n_rules);
-    for (size_t i = 0; i < n_rules; i++) {
-        for (pos = grammar_rules[i]; pos->type != LLAMA_GRETYPE_END; pos++) {
-            vec_rules[i].push_back(*pos);
+        // if there is a grammar, parse it
+        // rules will be empty (default) if there are parse errors
+        if (!parser.parse(grammar_str) || parser.rules.empty()) {
+            fprintf(stderr, "%s: failed to parse grammar\n", __func__);
+            return nullptr;
         }
-        vec_rules[i].push_back({LLAMA_GRETYPE_END, 0});
-    }
 
-    // Check for left recursion
-    std::vector<bool> rules_visited(n_rules);
-    std::vector<bool> rules_in_progress(n_rules);
-    std::vector<bool> rules_may_be_empty(n_rules);
-    for (size_t i = 0; i < n_rules; i++) {
-        if (rules_visited[i]) {
-            continue;
-        }
-        if (llama_grammar_detect_left_recursion(vec_rules, i, &rules_visited, &rules_in_progress, &rules_may_be_empty)) {
-            LLAMA_LOG_ERROR("unsupported grammar, left recursion detected for nonterminal at index %zu", i);
+        // Ensure that there is a "root" node.
+        if (parser.symbol_ids.find("root") == parser.symbol_ids.end()) {
+            fprintf(stderr, "%s: grammar does not contain a 'root' symbol\n", __func__);
             return nullptr;
         }
-    }
 
-    // loop over alternates of start rule to build initial stacks
-    llama_grammar_stacks stacks;
-    pos = vec_rules[start_rule_index].data();
-    do {
-        llama_grammar_stack stack;
-        if (!llama_grammar_is_end_of_sequence(pos)) {
-            // if alternate is nonempty, add to stack
-            stack.push_back(pos);
-        }
-        llama_grammar_advance_stack(vec_rules, stack, stacks);
-        while (!llama_grammar_is_end_of_sequence(pos)) {
-            // scan to end of alternate def
-            pos++;
-        }
-        if (pos->type == LLAMA_GRETYPE_ALT) {
-            // there's another alternate def of this rule to process
-            pos++;
-        } else {
-            break;
+        std::vector<const llama_grammar_element *> grammar_rules(parser.c_rules());
+
+        if (!llama_grammar_compile(grammar_rules.data(), grammar_rules.size(), parser.symbol_ids.at(grammar_root), compiled)) {
+            return nullptr;
         }
-    } while (true);
+
+        cache.put(key, compiled);
+    }
 
     std::vector<llama_token>    vec_trigger_tokens;
     std::vector<llama_grammar_trigger_pattern> vec_trigger_patterns;
@@ -1059,16 +1137,13 @@ struct llama_grammar * llama_grammar_init_impl(
         GGML_ASSERT(trigger_patterns != nullptr);
         auto & trigger = vec_trigger_patterns.emplace_back();
         trigger.pattern = trigger_patterns[i];
-        trigger.regex = std::regex(trigger.pattern);
+        trigger.regex = cache.get_regex(trigger.pattern);
     }
 
-    // Important: vec_rules has to be moved here, not copied, because stacks contains
-    // pointers to elements of vec_rules. If vec_rules were copied into llama_grammar
-    // then the pointers would be invalidated when the local vec_rules goes out of scope.
     return new llama_grammar {
         vocab,
-        std::move(vec_rules),
-        std::move(stacks),
+        std::move(compiled.rules),
+        std::move(compiled.stacks),
         /* .partial_utf8 = */     {},
         /* .lazy = */             lazy,
         /* .awaiting_trigger = */ lazy,
@@ -1087,7 +1162,8 @@ void llama_grammar_free_impl(struct llama_grammar * grammar) {
 }
 
 struct llama_grammar * llama_grammar_clone_impl(const struct llama_grammar & grammar) {
-    auto * result = new llama_grammar {
+    // the rules are shared, so the elements in the stacks remain valid
+    return new llama_grammar {
         grammar.vocab,
         grammar.rules,
         grammar.stacks,
@@ -1098,21 +1174,6 @@ struct llama_grammar * llama_grammar_clone_impl(const struct llama_grammar & gra
         grammar.trigger_tokens,
         grammar.trigger_patterns,
     };
-
-    // redirect elements in stacks to point to new rules
-    for (size_t is = 0; is < result->stacks.size(); is++) {
-        for (size_t ie = 0; ie < result->stacks[is].size(); ie++) {
-            for (size_t ir0 = 0; ir0 < grammar.rules.size(); ir0++) {
-                for (size_t ir1 = 0; ir1 < grammar.rules[ir0].size(); ir1++) {
-                    if (grammar.stacks[is][ie] == &grammar.rules[ir0][ir1]) {
-                        result->stacks[is][ie] =  &result->rules[ir0][ir1];
-                    }
-                }
-            }
-        }
-    }
-
-    return result;
 }
 
 void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_data_array * cur_p) {
@@ -1152,7 +1213,7 @@ void llama_grammar_apply_impl(const struct llama_grammar & grammar, llama_token_
         }
     }
 
-    const auto rejects = llama_grammar_reject_candidates(grammar.rules, grammar.stacks, candidates_grammar);
+    const auto rejects = llama_grammar_reject_candidates(*grammar.rules, grammar.stacks, candidates_grammar);
     for (const auto & reject : rejects) {
         cur_p->data[reject.index].logit = -INFINITY;
     }
@@ -218,6 +218,36 @@ void llm_graph_input_cls::set_input(const llama_ubatch * ubatch) {
     }
 }
 
+void llm_graph_input_cvec::set_input(const llama_ubatch * ubatch) {
+    const int64_t n_tokens = ubatch->n_tokens;
+
+    std::vector<int32_t> data;
+
+    // tokens shared by several sequences use the control vector of the first one
+    if (rows) {
+        for (int64_t i = 0; i < n_tokens; ++i) {
+            data.push_back(cvec->row_for(ubatch->seq_id[i][0]));
+        }
+
+        ggml_backend_tensor_set(rows, data.data(), 0, data.size()*ggml_element_size(rows));
+    }
+
+    if (rows_out) {
+        const bool all_outputs = rows_out->ne[0] == n_tokens;
+
+        data.clear();
+        for (int64_t i = 0; i < n_tokens; ++i) {
+            if (all_outputs || ubatch->output[i]) {
+                data.push_back(cvec->row_for(ubatch->seq_id[i][0]));
+            }
+        }
+
+        GGML_ASSERT((int64_t) data.size() == rows_out->ne[0]);
+
+        ggml_backend_tensor_set(rows_out, data.data(), 0, data.size()*ggml_element_size(rows_out));
+    }
+}
+
 void llm_graph_input_rs::set_input(const llama_ubatch * ubatch) {
     GGML_UNUSED(ubatch);
 
@@ -410,7 +440,12 @@ void llm_graph_context::cb(ggml_tensor * cur, const char * name, int il) const {
 ggml_tensor * llm_graph_context::build_cvec(
          ggml_tensor * cur,
                  int   il) const {
-    return cvec->apply_to(ctx0, cur, il);
+    ggml_tensor * rows = nullptr;
+    if (cvec->has_seq() && cvec->is_active(il)) {
+        rows = build_inp_cvec(cur->ne[1]);
+    }
+
+    return cvec->apply_to(ctx0, cur, rows, il);
 }
 
 ggml_tensor * llm_graph_context::build_lora_mm(
@@ -918,6 +953,25 @@ ggml_tensor * llm_graph_context::build_inp_cls() const {
     return cur;
 }
 
+ggml_tensor * llm_graph_context::build_inp_cvec(int64_t n_rows) const {
+    if (!inp_cvec) {
+        auto inp = std::make_unique<llm_graph_input_cvec>(cvec);
+        inp_cvec = inp.get();
+        res->add_input(std::move(inp));
+    }
+
+    // the last layer can be applied only to the output tokens
+    auto & cur = n_rows == n_tokens ? inp_cvec->rows : inp_cvec->rows_out;
+    GGML_ASSERT(n_rows == n_tokens || n_rows == n_outputs);
+
+    if (!cur) {
+        cur = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_rows);
+        ggml_set_input(cur);
+    }
+
+    return cur;
+}
+
 ggml_tensor * llm_graph_context::build_inp_cross_embd() const {
     auto inp = std::make_unique<llm_graph_input_cross_embd>(cross);
 
@@ -191,6 +191,19 @@ public:
     const llama_cparams & cparams;
 };
 
+class llm_graph_input_cvec : public llm_graph_input_i {
+public:
+    llm_graph_input_cvec(const llama_adapter_cvec * cvec) : cvec(cvec) {}
+    virtual ~llm_graph_input_cvec() = default;
+
+    void set_input(const llama_ubatch * ubatch) override;
+
+    ggml_tensor * rows     = nullptr; // I32 [n_batch]
+    ggml_tensor * rows_out = nullptr; // I32 [n_outputs] - for the layers after the output rows have been selected
+
+    const llama_adapter_cvec * cvec;
+};
+
 class llm_graph_input_rs : public llm_graph_input_i {
 public:
     llm_graph_input_rs(const llama_memory_recurrent_context * mctx) : mctx(mctx) {}
@@ -475,6 +488,9 @@ struct llm_graph_context {
 
     std::unique_ptr<llm_graph_result> res;
 
+    // per-token rows of the per-sequence control vectors, created by build_cvec() when needed
+    mutable llm_graph_input_cvec * inp_cvec = nullptr;
+
     llm_graph_context(const llm_graph_params & params);
     virtual ~llm_graph_context() = default;
 
@@ -548,6 +564,7 @@ struct llm_graph_context {
     ggml_tensor * build_inp_out_ids() const;
     ggml_tensor * build_inp_mean() const;
     ggml_tensor * build_inp_cls() const;
+    ggml_tensor * build_inp_cvec(int64_t n_rows) const;
 
     ggml_tensor * build_inp_cross_embd() const;
     ggml_tensor * build_inp_pos_bucket_enc() const;
@@ -22,6 +22,7 @@ public:
                          bool   swa_full,
                      uint32_t   kv_size,
                      uint32_t   n_seq_max,
+                     uint32_t   n_seq_aux,
                      uint32_t   n_ubatch,
                      uint32_t   n_pad);
 
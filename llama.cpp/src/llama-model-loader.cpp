@@ -316,8 +316,9 @@ namespace GGUFMeta {
             result.clear();
 
             for (size_t i = 0; i < n_items; i++) {
-                const T value = gguf_get_arr_str(ctx, kid, i);
-                result.emplace_back(value);
+                size_t len = 0;
+                const char * str = gguf_get_arr_str_view(ctx, kid, i, &len);
+                result.emplace_back(str, len);
             }
         } else {
             result.resize(arr_info.length);
@@ -360,8 +361,9 @@ namespace GGUFMeta {
             const size_t n_items = gguf_get_arr_n(ctx, kid);
 
             for (size_t i = 0; i < n_items; i++) {
-                const T value = gguf_get_arr_str(ctx, kid, i);
-                result[i] = value;
+                size_t len = 0;
+                const char * str = gguf_get_arr_str_view(ctx, kid, i, &len);
+                result[i].assign(str, len);
             }
         } else {
             std::copy((const T*)arr_info.data, (const T *)arr_info.data + arr_info.length, result.begin());
@@ -490,6 +492,7 @@ llama_model_loader::llama_model_loader(
     struct gguf_init_params params = {
         /*.no_alloc = */ true,
         /*.ctx      = */ &ctx,
+        /*.no_mmap  = */ !use_mmap,
     };
 
     meta.reset(gguf_init_from_file(fname.c_str(), params));
@@ -550,6 +553,7 @@ llama_model_loader::llama_model_loader(
             struct gguf_init_params split_params = {
                 /*.no_alloc = */ true,
                 /*.ctx      = */ &ctx,
+                /*.no_mmap  = */ !use_mmap,
             };
             gguf_context_ptr ctx_gguf { gguf_init_from_file(fname_split, split_params) };
             if (!ctx_gguf) {
@@ -686,8 +690,8 @@ llama_model_loader::llama_model_loader(
                 ? format("%s[%s,%zu]", gguf_type_name(type), gguf_type_name(gguf_get_arr_type(meta.get(), i)), gguf_get_arr_n(meta.get(), i))
                 : gguf_type_name(type);
 
-            std::string value          = gguf_kv_to_str(meta.get(), i);
             const size_t MAX_VALUE_LEN = 40;
+            std::string value          = gguf_kv_to_str(meta.get(), i, MAX_VALUE_LEN);
             if (value.size() > MAX_VALUE_LEN) {
                 value = format("%s...", value.substr(0, MAX_VALUE_LEN - 3).c_str());
             }
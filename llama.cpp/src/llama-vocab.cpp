@@ -18,6 +18,7 @@
 #include <map>
 #include <queue>
 #include <set>
+#include <string_view>
 #include <unordered_map>
 
 //
@@ -1435,7 +1436,10 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
 
             const int n_merges = gguf_get_arr_n(ctx, merges_keyidx);
             for (int i = 0; i < n_merges; i++) {
-                const std::string word = gguf_get_arr_str(ctx, merges_keyidx, i);
+                size_t len = 0;
+                const char * str = gguf_get_arr_str_view(ctx, merges_keyidx, i, &len);
+
+                const std::string_view word(str, len);
                 //GGML_ASSERT(unicode_cpts_from_utf8(word).size() > 0);
 
                 std::string first;
@@ -1443,12 +1447,12 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
 
                 const size_t pos = word.find(' ', 1);
 
-                if (pos != std::string::npos) {
+                if (pos != std::string_view::npos) {
                     first  = word.substr(0, pos);
                     second = word.substr(pos + 1);
                 }
 
-                bpe_ranks.emplace(std::make_pair(first, second), i);
+                bpe_ranks.emplace(std::make_pair(std::move(first), std::move(second)), i);
             }
 
             // default special tokens
@@ -1709,9 +1713,13 @@ void llama_vocab::impl::load(llama_model_loader & ml, const LLM_KV & kv) {
 
     uint32_t n_tokens = gguf_get_arr_n(ctx, token_idx);
     id_to_token.resize(n_tokens);
+    token_to_id.reserve(n_tokens);
 
     for (uint32_t i = 0; i < n_tokens; i++) {
-        std::string word = gguf_get_arr_str(ctx, token_idx, i);
+        size_t len = 0;
+        const char * str = gguf_get_arr_str_view(ctx, token_idx, i, &len);
+
+        std::string word(str, len);
         if (word.empty()) {
             LLAMA_LOG_WARN("%s: empty token at index %u\n", __func__, i);
             word = "[EMPTY_" + std::to_string(i) + "]";
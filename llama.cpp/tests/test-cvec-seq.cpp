@@ -0,0 +1,187 @@
+// decode two sequences with different per-sequence control vectors in one batch and check that the logits of each
+// sequence match a run where its vector is the context-wide control vector
+
+#include "llama.h"
+#include "get-model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static std::vector<llama_token> make_prompt(const llama_vocab * vocab) {
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+
+    std::vector<llama_token> res;
+    for (int i = 0; i < 16; ++i) {
+        res.push_back((llama_token) ((100 + 37*i) % n_vocab));
+    }
+
+    return res;
+}
+
+static llama_context * make_context(llama_model * model) {
+    llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx     = 256;
+    cparams.n_batch   = 64;
+    cparams.n_ubatch  = 64;
+    cparams.n_seq_max = 2;
+
+    return llama_init_from_model(model, cparams);
+}
+
+// decode the prompt in the given sequences of one batch and return the logits of the last token of each
+static std::vector<std::vector<float>> decode(llama_context * ctx, const std::vector<llama_token> & prompt, const std::vector<llama_seq_id> & seqs) {
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(ctx)));
+
+    llama_batch batch = llama_batch_init((int32_t) (prompt.size()*seqs.size()), 0, 1);
+
+    for (llama_seq_id s : seqs) {
+        for (size_t i = 0; i < prompt.size(); ++i) {
+            const int32_t j = batch.n_tokens++;
+            batch.token   [j]    = prompt[i];
+            batch.pos     [j]    = (llama_pos) i;
+            batch.n_seq_id[j]    = 1;
+            batch.seq_id  [j][0] = s;
+            batch.logits  [j]    = i + 1 == prompt.size();
+        }
+    }
+
+    std::vector<std::vector<float>> res;
+
+    if (llama_decode(ctx, batch) == 0) {
+        for (size_t k = 0; k < seqs.size(); ++k) {
+            const float * logits = llama_get_logits_ith(ctx, (int32_t) ((k + 1)*prompt.size() - 1));
+            res.emplace_back(logits, logits + n_vocab);
+        }
+    }
+
+    llama_batch_free(batch);
+
+    return res;
+}
+
+static float max_diff(const std::vector<float> & a, const std::vector<float> & b) {
+    float res = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        res = std::max(res, std::fabs(a[i] - b[i]));
+    }
+    return res;
+}
+
+int main(int argc, char ** argv) {
+    auto * model_path = get_model_or_exit(argc, argv);
+
+    llama_backend_init();
+
+    llama_model * model = llama_model_load_from_file(model_path, llama_model_default_params());
+    if (model == nullptr) {
+        fprintf(stderr, "failed to load model %s\n", model_path);
+        return 1;
+    }
+
+    const int32_t n_embd  = llama_model_n_embd(model);
+    const int32_t n_layer = llama_model_n_layer(model);
+
+    const std::vector<llama_token> prompt = make_prompt(llama_model_get_vocab(model));
+
+    // the control vectors start at layer 1
+    std::mt19937 rng(42);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+
+    std::vector<float> cvec[2];
+    for (auto & v : cvec) {
+        v.resize((size_t) n_embd*(n_layer - 1));
+        for (float & x : v) {
+            x = dist(rng);
+        }
+    }
+
+    const size_t len = cvec[0].size();
+
+    // reference: each vector as the context-wide control vector, one sequence per batch
+    std::vector<float> ref[2];
+    for (int k = 0; k < 2; ++k) {
+        llama_context * ctx = make_context(model);
+        if (llama_apply_adapter_cvec(ctx, cvec[k].data(), len, n_embd, 1, n_layer - 1) != 0) {
+            fprintf(stderr, "failed to apply the control vector\n");
+            return 1;
+        }
+
+        const auto res = decode(ctx, prompt, { 0 });
+        if (res.empty()) {
+            fprintf(stderr, "failed to decode\n");
+            return 1;
+        }
+        ref[k] = res[0];
+
+        llama_free(ctx);
+    }
+
+    // the test is meaningless if the vectors do not change the logits
+    const float diff_ref = max_diff(ref[0], ref[1]);
+
+    bool ok = true;
+
+    auto check = [&](const char * name, const std::vector<float> & logits, const std::vector<float> & expected) {
+        const float diff = max_diff(logits, expected);
+        if (!(diff <= 1e-3f*diff_ref)) {
+            fprintf(stderr, "%s: max diff = %g, max diff between the vectors = %g\n", name, diff, diff_ref);
+            ok = false;
+        }
+    };
+
+    if (!(diff_ref > 1e-2f)) {
+        fprintf(stderr, "the control vectors do not change the logits\n");
+        ok = false;
+    }
+
+    // both vectors per sequence, in one batch
+    {
+        llama_context * ctx = make_context(model);
+        for (int k = 0; k < 2; ++k) {
+            if (llama_apply_adapter_cvec_seq(ctx, k, cvec[k].data(), len, n_embd, 1, n_layer - 1) != 0) {
+                fprintf(stderr, "failed to apply the control vector of sequence %d\n", k);
+                return 1;
+            }
+        }
+
+        const auto res = decode(ctx, prompt, { 0, 1 });
+        if (res.size() != 2) {
+            fprintf(stderr, "failed to decode\n");
+            return 1;
+        }
+        check("seq 0 (per-seq)", res[0], ref[0]);
+        check("seq 1 (per-seq)", res[1], ref[1]);
+
+        llama_free(ctx);
+    }
+
+    // the context-wide vector for sequence 0 and a per-sequence vector for sequence 1, in one batch
+    {
+        llama_context * ctx = make_context(model);
+        if (llama_apply_adapter_cvec    (ctx,    cvec[0].data(), len, n_embd, 1, n_layer - 1) != 0 ||
+            llama_apply_adapter_cvec_seq(ctx, 1, cvec[1].data(), len, n_embd, 1, n_layer - 1) != 0) {
+            fprintf(stderr, "failed to apply the control vectors\n");
+            return 1;
+        }
+
+        const auto res = decode(ctx, prompt, { 0, 1 });
+        if (res.size() != 2) {
+            fprintf(stderr, "failed to decode\n");
+            return 1;
+        }
+        check("seq 0 (context-wide)", res[0], ref[0]);
+        check("seq 1 (per-seq)",      res[1], ref[1]);
+
+        llama_free(ctx);
+    }
+
+    llama_model_free(model);
+    llama_backend_free();
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+// the CPU backend can prefetch and pin the experts selected by the router of MUL_MAT_ID nodes
+// check that the results are the same with the expert residency manager enabled and disabled, and that the selected
+// experts of the weights, which are all in RAM, are reported as resident
+
+#include "ggml.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void init_tensor(ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> data(ggml_nelements(t));
+    for (float & v : data) {
+        v = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+    } else {
+        ggml_quantize_chunk(t->type, data.data(), t->data, 0, ggml_nrows(t), t->ne[0], nullptr);
+    }
+}
+
+static std::vector<float> get_data(const ggml_tensor * t) {
+    std::vector<float> res(ggml_nelements(t));
+    memcpy(res.data(), t->data, ggml_nbytes(t));
+    return res;
+}
+
+static bool test_expert_cache(ggml_type type, int64_t n_tokens, size_t mlock_size, int n_threads) {
+    const int64_t n_embd        = 256;
+    const int64_t n_ff          = 96;
+    const int64_t n_expert      = 8;
+    const int64_t n_expert_used = 2;
+
+    ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    ggml_context * ctx = ggml_init(params);
+
+    std::mt19937 rng(42);
+
+    ggml_tensor * router = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_expert);
+    ggml_tensor * up     = ggml_new_tensor_3d(ctx, type,          n_embd, n_ff,   n_expert);
+    ggml_tensor * gate   = ggml_new_tensor_3d(ctx, type,          n_embd, n_ff,   n_expert);
+    ggml_tensor * down   = ggml_new_tensor_3d(ctx, type,          n_ff,   n_embd, n_expert);
+    ggml_tensor * x      = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_tokens);
+    init_tensor(router, rng);
+    init_tensor(up,     rng);
+    init_tensor(gate,   rng);
+    init_tensor(down,   rng);
+
+    // the expert ids are computed in the graph, as in the MoE layers of the models
+    ggml_tensor * logits = ggml_mul_mat(ctx, router, x);
+    ggml_tensor * ids    = ggml_top_k(ctx, logits, n_expert_used);
+
+    ggml_tensor * cur = ggml_reshape_3d(ctx, x, n_embd, 1, n_tokens);
+
+    ggml_tensor * h = ggml_mul(ctx, ggml_silu(ctx, ggml_mul_mat_id(ctx, gate, cur, ids)), ggml_mul_mat_id(ctx, up, cur, ids));
+    ggml_tensor * out = ggml_mul_mat_id(ctx, down, h, ids);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+
+    ggml_backend_t backend_ref = ggml_backend_cpu_init();
+    ggml_backend_t backend     = ggml_backend_cpu_init();
+    ggml_backend_cpu_set_n_threads(backend_ref, n_threads);
+    ggml_backend_cpu_set_n_threads(backend,     n_threads);
+    ggml_backend_cpu_set_expert_residency(backend, true, mlock_size);
+
+    bool ok = true;
+
+    // enough evaluations for the pinned experts to be updated
+    for (int it = 0; it < 40 && ok; ++it) {
+        init_tensor(x, rng);
+
+        GGML_ASSERT(ggml_backend_graph_compute(backend_ref, gf) == GGML_STATUS_SUCCESS);
+        const std::vector<float> ref = get_data(out);
+
+        GGML_ASSERT(ggml_backend_graph_compute(backend, gf) == GGML_STATUS_SUCCESS);
+        const std::vector<float> res = get_data(out);
+
+        if (memcmp(ref.data(), res.data(), ref.size()*sizeof(float)) != 0) {
+            fprintf(stderr, "%s: type = %s, n_tokens = %lld, mlock_size = %zu, n_threads = %d: different results in evaluation %d\n",
+                __func__, ggml_type_name(type), (long long) n_tokens, mlock_size, n_threads, it);
+            ok = false;
+        }
+    }
+
+    ggml_cpu_expert_stats stats;
+    ggml_backend_cpu_get_expert_stats(backend, &stats);
+
+    // every evaluation selects at least n_expert_used experts of each of the 3 weights
+    if (ok && (stats.n_lookups < 40*3*n_expert_used || stats.n_hits != stats.n_lookups)) {
+        fprintf(stderr, "%s: type = %s, n_tokens = %lld, mlock_size = %zu, n_threads = %d: n_lookups = %llu, n_hits = %llu\n",
+            __func__, ggml_type_name(type), (long long) n_tokens, mlock_size, n_threads,
+            (unsigned long long) stats.n_lookups, (unsigned long long) stats.n_hits);
+        ok = false;
+    }
+
+    ggml_backend_free(backend);
+    ggml_backend_free(backend_ref);
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(void) {
+    bool ok = true;
+
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_Q4_0 }) {
+        for (int n_threads : { 1, 3 }) {
+            for (int64_t n_tokens : { 1, 3, 32 }) {
+                for (size_t mlock_size : { (size_t) 0, (size_t) 256*1024 }) {
+                    ok = test_expert_cache(type, n_tokens, mlock_size, n_threads) && ok;
+                }
+            }
+        }
+    }
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -715,6 +715,7 @@ static std::pair<int, int> test_handcrafted_file(const unsigned int seed) {
         struct gguf_init_params gguf_params = {
             /*no_alloc =*/ false,
             /*ctx      =*/ hft >= offset_has_data ? &ctx : nullptr,
+            /*no_mmap  =*/ false,
         };
 
         struct gguf_context * gguf_ctx = gguf_init_from_file_impl(file, gguf_params);
@@ -972,6 +973,12 @@ static bool all_kv_in_other(const gguf_context * ctx, const gguf_context * other
                     if (str != str_other) {
                         ok = false;
                     }
+
+                    size_t len = 0;
+                    const char * view = gguf_get_arr_str_view(other, idx_other, arr_i, &len);
+                    if (std::string(view, len) != str_other) {
+                        ok = false;
+                    }
                 }
                 continue;
             }
@@ -1070,10 +1077,12 @@ static bool same_tensor_data(const struct ggml_context * orig, const struct ggml
     return ok;
 }
 
-static std::pair<int, int> test_roundtrip(ggml_backend_dev_t dev, const unsigned int seed, const bool only_meta) {
+// file_start: number of bytes in the file before the GGUF data, the file is read from that position
+static std::pair<int, int> test_roundtrip(
+        ggml_backend_dev_t dev, const unsigned int seed, const bool only_meta, const bool no_mmap, const size_t file_start) {
     ggml_backend_t backend = ggml_backend_dev_init(dev, nullptr);
-    printf("%s: device=%s, backend=%s, only_meta=%s\n",
-        __func__, ggml_backend_dev_description(dev), ggml_backend_name(backend), only_meta ? "yes" : "no");
+    printf("%s: device=%s, backend=%s, only_meta=%s, no_mmap=%s, file_start=%zu\n",
+        __func__, ggml_backend_dev_description(dev), ggml_backend_name(backend), only_meta ? "yes" : "no", no_mmap ? "yes" : "no", file_start);
 
     int npass = 0;
     int ntest = 0;
@@ -1088,6 +1097,17 @@ static std::pair<int, int> test_roundtrip(ggml_backend_dev_t dev, const unsigned
         bbuf       = result.buffer;
     }
 
+    // a string array with more metadata than the first buffered read
+    {
+        std::vector<std::string>  data_cpp(50000);
+        std::vector<const char *> data_c(data_cpp.size());
+        for (size_t j = 0; j < data_cpp.size(); ++j) {
+            data_cpp[j] = "token_" + std::to_string(j);
+            data_c[j]   = data_cpp[j].c_str();
+        }
+        gguf_set_arr_str(gguf_ctx_0, "my_key_large_str_arr", data_c.data(), data_c.size());
+    }
+
     FILE * file = tmpfile();
 
 #ifdef _WIN32
@@ -1101,16 +1121,20 @@ static std::pair<int, int> test_roundtrip(ggml_backend_dev_t dev, const unsigned
 #endif // _WIN32
 
     {
+        const std::vector<int8_t> prefix(file_start, 0x5a);
+        GGML_ASSERT(fwrite(prefix.data(), 1, prefix.size(), file) == prefix.size());
+
         std::vector<int8_t> buf;
         gguf_write_to_buf(gguf_ctx_0, buf, only_meta);
         GGML_ASSERT(fwrite(buf.data(), 1, buf.size(), file) == buf.size());
-        rewind(file);
+        GGML_ASSERT(fseek(file, file_start, SEEK_SET) == 0);
     }
 
     struct ggml_context * ctx_1 = nullptr;
     struct gguf_init_params gguf_params = {
         /*no_alloc =*/ false,
         /*ctx      =*/ only_meta ? nullptr : &ctx_1,
+        /*no_mmap  =*/ no_mmap,
     };
     struct gguf_context * gguf_ctx_1 = gguf_init_from_file_impl(file, gguf_params);
 
@@ -1322,9 +1346,13 @@ int main(int argc, char ** argv) {
         ggml_backend_dev_t dev = ggml_backend_dev_get(i);
 
         for (bool only_meta : {true, false}) {
-            std::pair<int, int> result = test_roundtrip(dev, seed, only_meta);
-            npass += result.first;
-            ntest += result.second;
+            for (bool no_mmap : {false, true}) {
+                for (size_t file_start : {0, 37}) {
+                    std::pair<int, int> result = test_roundtrip(dev, seed, only_meta, no_mmap, file_start);
+                    npass += result.first;
+                    ntest += result.second;
+                }
+            }
         }
 
         {
@@ -731,6 +731,53 @@ static void test_failure_left_recursion() {
     fprintf(stderr, "  ✅︎ Passed\n");
 }
 
+static void test_grammar_cache() {
+    fprintf(stderr, "⚫ Testing the cache of compiled grammars:\n");
+
+    // grammars built from the same source share the compiled rules
+    const std::string grammar_str = R"""(root ::= "cached" [0-9]+)""";
+
+    llama_grammar * grammar_0 = build_grammar(grammar_str);
+    llama_grammar * grammar_1 = build_grammar(grammar_str);
+    assert(grammar_0 != nullptr && grammar_1 != nullptr);
+    assert(&llama_grammar_get_rules(grammar_0) == &llama_grammar_get_rules(grammar_1));
+
+    // a cached grammar still matches independently of the other grammars with the same rules
+    assert(match_string("cached42", grammar_0));
+    assert(!match_string("cached", grammar_1));
+
+    llama_grammar_free_impl(grammar_1);
+
+    // fill the cache with more grammars than it can hold, using the first one after each of them
+    // the least recently used grammars are evicted, the one in use stays in the cache
+    const int n_grammars = 1000;
+
+    std::vector<llama_grammar *> others;
+    for (int i = 0; i < n_grammars; ++i) {
+        others.push_back(build_grammar("root ::= \"other" + std::to_string(i) + "\""));
+
+        llama_grammar * grammar = build_grammar(grammar_str);
+        assert(&llama_grammar_get_rules(grammar) == &llama_grammar_get_rules(grammar_0));
+        llama_grammar_free_impl(grammar);
+    }
+
+    // the first of the other grammars has been evicted, so it is compiled again, the last one is still cached
+    llama_grammar * first = build_grammar("root ::= \"other0\"");
+    llama_grammar * last  = build_grammar("root ::= \"other" + std::to_string(n_grammars - 1) + "\"");
+    assert(&llama_grammar_get_rules(first) != &llama_grammar_get_rules(others.front()));
+    assert(&llama_grammar_get_rules(last)  == &llama_grammar_get_rules(others.back()));
+    assert(match_string("other0", first));
+
+    llama_grammar_free_impl(first);
+    llama_grammar_free_impl(last);
+    for (llama_grammar * grammar : others) {
+        llama_grammar_free_impl(grammar);
+    }
+    llama_grammar_free_impl(grammar_0);
+
+    fprintf(stderr, "  ✅︎ Passed\n");
+}
+
 static void test_json_schema() {
     // Note that this is similar to the regular grammar tests,
     //  but we convert each json schema to a grammar before parsing.
@@ -1304,6 +1351,7 @@ int main() {
     test_failure_missing_root();
     test_failure_missing_reference();
     test_failure_left_recursion();
+    test_grammar_cache();
     test_json_schema();
     fprintf(stdout, "All tests passed.\n");
     return 0;
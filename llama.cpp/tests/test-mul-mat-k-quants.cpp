@@ -0,0 +1,111 @@
+// the CPU backend computes MUL_MAT with Q4_K, Q5_K and Q6_K weights and more than one src1 column with the llamafile
+// tiles, which test-backend-ops does not check since it uses the CPU backend as the reference
+// compare the results with the vec_dot of the type, applied to the same Q8_K activations
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void init_tensor(ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> data(ggml_nelements(t));
+    for (float & v : data) {
+        v = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+    } else {
+        ggml_quantize_chunk(t->type, data.data(), t->data, 0, ggml_nrows(t), t->ne[0], nullptr);
+    }
+}
+
+static bool test_mul_mat(ggml_type type, int64_t m, int64_t n, int64_t k, int64_t n_batch, int n_threads) {
+    ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    ggml_context * ctx = ggml_init(params);
+
+    std::mt19937 rng(42);
+
+    ggml_tensor * a = ggml_new_tensor_3d(ctx, type,          k, m, n_batch);
+    ggml_tensor * b = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, k, n, n_batch);
+    init_tensor(a, rng);
+    init_tensor(b, rng);
+
+    ggml_tensor * c = ggml_mul_mat(ctx, a, b);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, c);
+
+    ggml_cplan cplan = ggml_graph_plan(gf, n_threads, nullptr);
+    std::vector<uint8_t> work_data(cplan.work_size);
+    cplan.work_data = work_data.data();
+
+    GGML_ASSERT(ggml_graph_compute(gf, &cplan) == GGML_STATUS_SUCCESS);
+
+    // reference: the dot product of each row of a with each column of b, quantized to the vec_dot type
+    const auto * traits   = ggml_get_type_traits_cpu(type);
+    const auto * traits_b = ggml_get_type_traits_cpu(traits->vec_dot_type);
+
+    std::vector<uint8_t> b_q(ggml_row_size(traits->vec_dot_type, k));
+
+    double err_sum = 0.0;
+    double ref_sum = 0.0;
+
+    for (int64_t i2 = 0; i2 < n_batch; ++i2) {
+        for (int64_t j = 0; j < n; ++j) {
+            traits_b->from_float((const float *) ((const char *) b->data + j*b->nb[1] + i2*b->nb[2]), b_q.data(), k);
+
+            for (int64_t i = 0; i < m; ++i) {
+                float ref;
+                traits->vec_dot(k, &ref, 0, (const char *) a->data + i*a->nb[1] + i2*a->nb[2], 0, b_q.data(), 0, 1);
+
+                const float res = *(const float *) ((const char *) c->data + i*c->nb[0] + j*c->nb[1] + i2*c->nb[2]);
+
+                err_sum += (double) (res - ref)*(res - ref);
+                ref_sum += (double) ref*ref;
+            }
+        }
+    }
+
+    ggml_free(ctx);
+
+    // only the order of the float additions differs
+    const double nmse = err_sum/ref_sum;
+    if (!(nmse < 1e-10)) {
+        fprintf(stderr, "%s: type = %s, m = %lld, n = %lld, k = %lld, n_batch = %lld, n_threads = %d: nmse = %g\n",
+            __func__, ggml_type_name(type), (long long) m, (long long) n, (long long) k, (long long) n_batch, n_threads, nmse);
+        return false;
+    }
+
+    return true;
+}
+
+int main(void) {
+    bool ok = true;
+
+    for (ggml_type type : { GGML_TYPE_Q4_K, GGML_TYPE_Q5_K, GGML_TYPE_Q6_K }) {
+        for (int n_threads : { 1, 3 }) {
+            // m and n not multiples of the tile sizes
+            for (int64_t n : { 2, 3, 4, 5, 7, 16, 37 }) {
+                ok = test_mul_mat(type, 67, n, 512, 1, n_threads) && ok;
+            }
+            ok = test_mul_mat(type, 128, 64, 1024, 2, n_threads) && ok;
+            ok = test_mul_mat(type,   5,  9,  256, 1, n_threads) && ok;
+        }
+    }
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+// the CPU backend converts the src1 of a MUL_MAT once and reuses it for the following MUL_MATs with the same src1
+// check that the results are the same as when each node is computed in a graph of its own, where nothing is shared
+
+#include "ggml.h"
+#include "ggml-cpu.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static void init_tensor(ggml_tensor * t, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> data(ggml_nelements(t));
+    for (float & v : data) {
+        v = dist(rng);
+    }
+
+    if (t->type == GGML_TYPE_F32) {
+        memcpy(t->data, data.data(), ggml_nbytes(t));
+    } else {
+        ggml_quantize_chunk(t->type, data.data(), t->data, 0, ggml_nrows(t), t->ne[0], nullptr);
+    }
+}
+
+static void compute(ggml_cgraph * gf, int n_threads) {
+    ggml_cplan cplan = ggml_graph_plan(gf, n_threads, nullptr);
+
+    std::vector<uint8_t> work_data(cplan.work_size);
+    cplan.work_data = work_data.data();
+
+    GGML_ASSERT(ggml_graph_compute(gf, &cplan) == GGML_STATUS_SUCCESS);
+}
+
+static std::vector<float> get_data(const ggml_tensor * t) {
+    std::vector<float> res(ggml_nelements(t));
+    memcpy(res.data(), t->data, ggml_nbytes(t));
+    return res;
+}
+
+static bool test_shared_src1(ggml_type type, int n_threads) {
+    ggml_init_params params = {
+        /* .mem_size   = */ 64*1024*1024,
+        /* .mem_buffer = */ NULL,
+        /* .no_alloc   = */ false,
+    };
+
+    ggml_context * ctx = ggml_init(params);
+
+    std::mt19937 rng(42);
+
+    const int n_embd   = 256;
+    const int n_tokens = 16;
+
+    ggml_tensor * x = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, n_embd, n_tokens);
+    init_tensor(x, rng);
+
+    ggml_tensor * w[4];
+    for (ggml_tensor *& t : w) {
+        t = ggml_new_tensor_2d(ctx, type, n_embd, 64);
+        init_tensor(t, rng);
+    }
+
+    // ops that use the whole work buffer between the MUL_MATs
+    ggml_tensor * k1 = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, 8, 4, 4);
+    ggml_tensor * a1 = ggml_new_tensor_2d(ctx, GGML_TYPE_F32, 64, 4);
+    ggml_tensor * k2 = ggml_new_tensor_4d(ctx, GGML_TYPE_F16, 3, 3, 4, 4);
+    ggml_tensor * a2 = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, 16, 16, 4);
+    init_tensor(k1, rng);
+    init_tensor(a1, rng);
+    init_tensor(a2, rng);
+    {
+        std::vector<ggml_fp16_t> data(ggml_nelements(k2));
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = ggml_fp32_to_fp16(std::uniform_real_distribution<float>(-1.0f, 1.0f)(rng));
+        }
+        memcpy(k2->data, data.data(), ggml_nbytes(k2));
+    }
+
+    ggml_tensor * nodes[7];
+    nodes[0] = ggml_mul_mat(ctx, w[0], x);
+    nodes[1] = ggml_conv_transpose_1d(ctx, k1, a1, 1, 0, 1);
+    nodes[2] = ggml_mul_mat(ctx, w[1], x);
+    nodes[3] = ggml_conv_transpose_2d_p0(ctx, k2, a2, 2);
+    nodes[4] = ggml_mul_mat(ctx, w[2], x);
+    // the in-place op changes src1, so the next MUL_MAT has to convert it again
+    nodes[5] = ggml_scale_inplace(ctx, x, 0.5f);
+    nodes[6] = ggml_mul_mat(ctx, w[3], nodes[5]);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    for (ggml_tensor * t : nodes) {
+        ggml_build_forward_expand(gf, t);
+    }
+
+    const std::vector<float> x0 = get_data(x);
+
+    // all nodes in one graph, with the shared src1
+    compute(gf, n_threads);
+
+    std::vector<std::vector<float>> results;
+    for (ggml_tensor * t : nodes) {
+        results.push_back(get_data(t));
+    }
+
+    // each node on its own (with the in-place op for the last MUL_MAT)
+    bool ok = true;
+
+    for (size_t i = 0; i < sizeof(nodes)/sizeof(nodes[0]); i++) {
+        memcpy(x->data, x0.data(), ggml_nbytes(x));
+
+        ggml_cgraph * gf_node = ggml_new_graph(ctx);
+        ggml_build_forward_expand(gf_node, nodes[i]);
+
+        compute(gf_node, n_threads);
+
+        const std::vector<float> ref = get_data(nodes[i]);
+        if (memcmp(ref.data(), results[i].data(), ref.size()*sizeof(float)) != 0) {
+            fprintf(stderr, "%s: type = %s, n_threads = %d: node %zu (%s) differs\n",
+                __func__, ggml_type_name(type), n_threads, i, ggml_op_desc(nodes[i]));
+            ok = false;
+        }
+    }
+
+    ggml_free(ctx);
+
+    return ok;
+}
+
+int main(void) {
+    bool ok = true;
+
+    for (ggml_type type : { GGML_TYPE_Q4_0, GGML_TYPE_Q4_K, GGML_TYPE_F16 }) {
+        for (int n_threads : { 1, 2, 4 }) {
+            ok = test_shared_src1(type, n_threads) && ok;
+        }
+    }
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,284 @@
+// tests the vector index: add, save, load (read and mmap), search and recall of the approximate search,
+// and that corrupted index files are rejected on load
+
+#include "vector-index.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static const char * fname = "test-vector-index.tmp";
+
+// clustered vectors, so that the nearest neighbors are not trivially far apart
+static std::vector<float> make_vectors(int64_t n, int n_embd, std::mt19937 & rng) {
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+
+    const int n_clusters = 16;
+
+    std::vector<float> centers(n_clusters*n_embd);
+    for (float & v : centers) {
+        v = dist(rng);
+    }
+
+    std::vector<float> res(n*n_embd);
+    for (int64_t i = 0; i < n; ++i) {
+        const float * c = centers.data() + (rng() % n_clusters)*n_embd;
+        for (int j = 0; j < n_embd; ++j) {
+            res[i*n_embd + j] = c[j] + 0.5f*dist(rng);
+        }
+    }
+
+    return res;
+}
+
+static bool same_results(const std::vector<common_vindex_result> & a, const std::vector<common_vindex_result> & b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].id != b[i].id || a[i].score != b[i].score) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool test_index(ggml_type type, bool use_mmap) {
+    const int     n_embd    = 64;
+    const int64_t n         = 2000;
+    const int     n_queries = 100;
+    const int     k         = 10;
+
+    std::mt19937 rng(1234);
+
+    const std::vector<float> data    = make_vectors(n,         n_embd, rng);
+    const std::vector<float> queries = make_vectors(n_queries, n_embd, rng);
+
+    common_vindex_params params;
+    params.n_embd = n_embd;
+    params.type   = type;
+    params.source = 0x0123456789abcdefULL;
+
+    common_vindex_ptr vindex = common_vindex_init(params);
+
+    for (int64_t i = 0; i < n; ++i) {
+        if (common_vindex_add(vindex.get(), data.data() + i*n_embd) != i) {
+            fprintf(stderr, "%s: unexpected id for vector %lld\n", __func__, (long long) i);
+            return false;
+        }
+    }
+
+    // a stored vector is its own nearest neighbor
+    for (int64_t i = 0; i < n; i += 97) {
+        const auto res = common_vindex_search(vindex.get(), data.data() + i*n_embd, 1);
+        if (res.size() != 1 || res[0].id != i) {
+            fprintf(stderr, "%s: vector %lld is not its own nearest neighbor\n", __func__, (long long) i);
+            return false;
+        }
+    }
+
+    // recall of the approximate search against the exhaustive search
+    int64_t n_found = 0;
+    for (int q = 0; q < n_queries; ++q) {
+        const auto res     = common_vindex_search      (vindex.get(), queries.data() + q*n_embd, k);
+        const auto res_ref = common_vindex_search_exact(vindex.get(), queries.data() + q*n_embd, k);
+
+        for (const auto & r : res_ref) {
+            for (const auto & a : res) {
+                if (a.id == r.id) {
+                    n_found++;
+                    break;
+                }
+            }
+        }
+    }
+
+    const double recall = (double) n_found/(n_queries*k);
+    if (recall < 0.9) {
+        fprintf(stderr, "%s: recall@%d = %.3f is too low\n", __func__, k, recall);
+        return false;
+    }
+
+    // the loaded index returns the same results as the one in memory
+    if (!common_vindex_save(vindex.get(), fname)) {
+        return false;
+    }
+
+    common_vindex_ptr loaded = common_vindex_load(fname, use_mmap);
+    if (!loaded) {
+        fprintf(stderr, "%s: failed to load the saved index\n", __func__);
+        return false;
+    }
+
+    if (common_vindex_size  (loaded.get()) != n      ||
+        common_vindex_n_embd(loaded.get()) != n_embd ||
+        common_vindex_type  (loaded.get()) != type   ||
+        common_vindex_source(loaded.get()) != params.source) {
+        fprintf(stderr, "%s: the loaded index has different parameters\n", __func__);
+        return false;
+    }
+
+    for (int q = 0; q < n_queries; ++q) {
+        const float * query = queries.data() + q*n_embd;
+        if (!same_results(common_vindex_search      (vindex.get(), query, k), common_vindex_search      (loaded.get(), query, k)) ||
+            !same_results(common_vindex_search_exact(vindex.get(), query, k), common_vindex_search_exact(loaded.get(), query, k))) {
+            fprintf(stderr, "%s: the loaded index returns different results for query %d\n", __func__, q);
+            return false;
+        }
+    }
+
+    // adding to a loaded (possibly mapped) index
+    const std::vector<float> extra = make_vectors(1, n_embd, rng);
+    if (common_vindex_add(loaded.get(), extra.data()) != n) {
+        fprintf(stderr, "%s: unexpected id when adding to the loaded index\n", __func__);
+        return false;
+    }
+
+    const auto res = common_vindex_search(loaded.get(), extra.data(), 1);
+    if (res.size() != 1 || res[0].id != n) {
+        fprintf(stderr, "%s: the vector added to the loaded index is not found\n", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+// header fields, see vindex_file_header
+enum {
+    OFF_N_EMBD    = 8,
+    OFF_M         = 16,
+    OFF_MAX_LEVEL = 28,
+    OFF_N         = 32,
+    OFF_ENTRY     = 40,
+    OFF_LINKS_UP  = 48,
+    HEADER_SIZE   = 72,
+    FILE_ALIGN    = 64,
+};
+
+static size_t pad(size_t x) {
+    return (x + FILE_ALIGN - 1)/FILE_ALIGN*FILE_ALIGN;
+}
+
+static std::vector<uint8_t> read_file(const char * path) {
+    std::vector<uint8_t> res;
+    FILE * f = fopen(path, "rb");
+    if (f) {
+        uint8_t buf[4096];
+        size_t  nr;
+        while ((nr = fread(buf, 1, sizeof(buf), f)) > 0) {
+            res.insert(res.end(), buf, buf + nr);
+        }
+        fclose(f);
+    }
+    return res;
+}
+
+static void write_file(const char * path, const std::vector<uint8_t> & data) {
+    FILE * f = fopen(path, "wb");
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+template <typename T>
+static void set_field(std::vector<uint8_t> & data, size_t off, T value) {
+    memcpy(data.data() + off, &value, sizeof(value));
+}
+
+static bool test_corrupted() {
+    const int     n_embd = 16;
+    const int64_t n      = 200;
+
+    std::mt19937 rng(42);
+    const std::vector<float> data = make_vectors(n, n_embd, rng);
+
+    common_vindex_params params;
+    params.n_embd = n_embd;
+    params.type   = GGML_TYPE_F32;
+
+    common_vindex_ptr vindex = common_vindex_init(params);
+    for (int64_t i = 0; i < n; ++i) {
+        common_vindex_add(vindex.get(), data.data() + i*n_embd);
+    }
+    if (!common_vindex_save(vindex.get(), fname)) {
+        return false;
+    }
+
+    const std::vector<uint8_t> orig = read_file(fname);
+
+    // offset of the bottom layer links of node 0, see common_vindex::get_layout
+    const size_t off_links0 = pad(pad(pad(pad(HEADER_SIZE) + n*n_embd*sizeof(float)) + n*sizeof(float)) + n*sizeof(int8_t));
+
+    struct corruption {
+        const char * name;
+        void (*apply)(std::vector<uint8_t> & data, size_t off_links0);
+    };
+
+    const corruption corruptions[] = {
+        { "truncated",      [](std::vector<uint8_t> & d, size_t)     { d.resize(d.size()/2); } },
+        { "n_embd = 0",     [](std::vector<uint8_t> & d, size_t)     { set_field<int32_t>(d, OFF_N_EMBD, 0); } },
+        { "n_embd large",   [](std::vector<uint8_t> & d, size_t)     { set_field<int32_t>(d, OFF_N_EMBD, INT32_MAX); } },
+        { "M = 0",          [](std::vector<uint8_t> & d, size_t)     { set_field<int32_t>(d, OFF_M, 0); } },
+        { "M large",        [](std::vector<uint8_t> & d, size_t)     { set_field<int32_t>(d, OFF_M, 1 << 30); } },
+        { "n negative",     [](std::vector<uint8_t> & d, size_t)     { set_field<int64_t>(d, OFF_N, -1); } },
+        { "n large",        [](std::vector<uint8_t> & d, size_t)     { set_field<int64_t>(d, OFF_N, INT64_MAX/2); } },
+        { "entry",          [](std::vector<uint8_t> & d, size_t)     { set_field<int64_t>(d, OFF_ENTRY, n); } },
+        { "max_level",      [](std::vector<uint8_t> & d, size_t)     { set_field<int32_t>(d, OFF_MAX_LEVEL, 100); } },
+        { "n_links_up",     [](std::vector<uint8_t> & d, size_t)     { set_field<uint64_t>(d, OFF_LINKS_UP, 0); } },
+        { "link count",     [](std::vector<uint8_t> & d, size_t off) { set_field<int32_t>(d, off, 1000); } },
+        { "link id",        [](std::vector<uint8_t> & d, size_t off) { set_field<int32_t>(d, off, 1); set_field<int32_t>(d, off + 4, (int32_t) n); } },
+        { "link id < 0",    [](std::vector<uint8_t> & d, size_t off) { set_field<int32_t>(d, off, 1); set_field<int32_t>(d, off + 4, -1); } },
+    };
+
+    bool ok = true;
+
+    for (const auto & c : corruptions) {
+        std::vector<uint8_t> bad = orig;
+        c.apply(bad, off_links0);
+        write_file(fname, bad);
+
+        for (bool use_mmap : { false, true }) {
+            if (common_vindex_load(fname, use_mmap)) {
+                fprintf(stderr, "%s: index with corrupted %s loaded with use_mmap = %d\n", __func__, c.name, use_mmap);
+                ok = false;
+            }
+        }
+    }
+
+    // the unmodified file still loads
+    write_file(fname, orig);
+    for (bool use_mmap : { false, true }) {
+        if (!common_vindex_load(fname, use_mmap)) {
+            fprintf(stderr, "%s: failed to load the original index with use_mmap = %d\n", __func__, use_mmap);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+int main(void) {
+    bool ok = true;
+
+    for (ggml_type type : { GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_I8 }) {
+        for (bool use_mmap : { false, true }) {
+            if (!test_index(type, use_mmap)) {
+                fprintf(stderr, "test_index failed: type = %s, use_mmap = %d\n", ggml_type_name(type), use_mmap);
+                ok = false;
+            }
+        }
+    }
+
+    if (!test_corrupted()) {
+        fprintf(stderr, "test_corrupted failed\n");
+        ok = false;
+    }
+
+    std::remove(fname);
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+
+    return ok ? 0 : 1;
+}
@@ -4,16 +4,387 @@
 #include "llama.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <deque>
+#include <fstream>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 static void print_usage(int, char ** argv) {
     LOG("\nexample usage:\n");
     LOG("\n    %s -m model.gguf -c 2048 -b 2048 -ub 512 -npp 128,256,512 -ntg 128,256 -npl 1,2,4,8,16,32 [-pps]\n", argv[0]);
+    LOG("\n    %s -m model.gguf -c 16384 -np 8 -npp 128,512,2048 -ntg 64,256 --workload-rate 2 --slo-ttft 1000 --slo-itl 100\n", argv[0]);
     LOG("\n");
 }
 
+//
+// workload mode
+//
+
+struct bench_request {
+    double t_arrival = 0.0; // seconds since the start of the workload
+    int    n_prompt  = 0;
+    int    n_gen     = 0;
+
+    int    n_past    = 0;    // prompt tokens processed so far
+    int    n_decoded = 0;    // tokens generated so far
+    double t_first   = -1.0; // time of the first generated token
+    double t_last    = -1.0; // time of the last generated token
+};
+
+struct bench_sample {
+    double t;
+    int    n_running;
+    int    n_queued;
+    int    n_kv; // cells used by the running requests
+};
+
+static bool workload_load_trace(const std::string & fname, std::vector<bench_request> & reqs) {
+    std::ifstream f(fname);
+    if (!f) {
+        LOG_ERR("%s: failed to open trace file '%s'\n", __func__, fname.c_str());
+        return false;
+    }
+
+    std::string line;
+    int i_line = 0;
+    while (std::getline(f, line)) {
+        ++i_line;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        bench_request req;
+        std::istringstream ss(line);
+        if (!(ss >> req.t_arrival >> req.n_prompt >> req.n_gen)) {
+            LOG_ERR("%s: %s:%d: expected \"t_arrival n_prompt n_gen\"\n", __func__, fname.c_str(), i_line);
+            return false;
+        }
+        reqs.push_back(req);
+    }
+
+    std::stable_sort(reqs.begin(), reqs.end(), [](const bench_request & a, const bench_request & b) {
+        return a.t_arrival < b.t_arrival;
+    });
+
+    return true;
+}
+
+static std::vector<bench_request> workload_generate(const common_params & params) {
+    std::vector<bench_request> reqs;
+
+    std::mt19937 rng(params.sampling.seed);
+    std::exponential_distribution<double> dist_dt(params.workload_rate);
+    std::uniform_int_distribution<size_t> dist_pp(0, params.n_pp.size() - 1);
+    std::uniform_int_distribution<size_t> dist_tg(0, params.n_tg.size() - 1);
+
+    double t = 0.0;
+    for (int i = 0; i < params.workload_n_req; ++i) {
+        t += dist_dt(rng);
+
+        bench_request req;
+        req.t_arrival = t;
+        req.n_prompt  = params.n_pp[dist_pp(rng)];
+        req.n_gen     = params.n_tg[dist_tg(rng)];
+        reqs.push_back(req);
+    }
+
+    return reqs;
+}
+
+// nearest-rank percentile, p in [0, 100]
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) {
+        return 0.0;
+    }
+    std::sort(v.begin(), v.end());
+    const size_t i = std::min(v.size() - 1, (size_t) std::max(0.0, std::ceil(p/100.0*v.size()) - 1));
+    return v[i];
+}
+
+static double mean(const std::vector<double> & v) {
+    double sum = 0.0;
+    for (double x : v) {
+        sum += x;
+    }
+    return v.empty() ? 0.0 : sum/v.size();
+}
+
+// requests arrive over time, wait in a FIFO queue for a free slot and are batched continuously like in llama-server:
+// every iteration decodes one token for each generating request and fills the rest of the batch with pending prompt tokens
+static bool run_workload(const common_params & params, llama_context * ctx, llama_batch & batch) {
+    auto * mem = llama_get_memory(ctx);
+
+    const int32_t n_kv_max   = llama_n_ctx(ctx);
+    const int32_t n_batch    = std::min<int32_t>(llama_n_batch(ctx), n_kv_max);
+    const int32_t n_slots    = params.n_parallel;
+    const int32_t n_ctx_slot = n_kv_max / n_slots;
+
+    std::vector<bench_request> reqs;
+    if (!params.workload_trace.empty()) {
+        if (!workload_load_trace(params.workload_trace, reqs)) {
+            return false;
+        }
+    } else {
+        if (params.n_pp.empty() || params.n_tg.empty()) {
+            LOG_ERR("%s: --workload-rate requires the request lengths in -npp and -ntg\n", __func__);
+            return false;
+        }
+        reqs = workload_generate(params);
+    }
+
+    // requests that can never fit in a slot are dropped up front instead of stalling the queue
+    {
+        const size_t n_all = reqs.size();
+        reqs.erase(std::remove_if(reqs.begin(), reqs.end(), [&](const bench_request & req) {
+            return req.n_prompt < 1 || req.n_gen < 1 || req.n_prompt + req.n_gen > n_ctx_slot;
+        }), reqs.end());
+        if (reqs.size() != n_all) {
+            LOG_WRN("%s: skipped %zu requests that do not fit in n_ctx_slot = %d\n", __func__, n_all - reqs.size(), n_ctx_slot);
+        }
+    }
+
+    if (reqs.empty()) {
+        LOG_ERR("%s: no requests to run\n", __func__);
+        return false;
+    }
+
+    const int n_req = (int) reqs.size();
+
+    std::vector<int> slots(n_slots, -1); // request index per slot
+    std::vector<bool> has_output(n_slots, false);
+    std::deque<int> queue;
+
+    std::vector<double> itl;
+    std::vector<bench_sample> samples;
+
+    int    i_next = 0;
+    int    n_done = 0;
+    double t_end  = 0.0;
+
+    const int64_t t_start_us = ggml_time_us();
+    const auto t_now = [&]() { return (ggml_time_us() - t_start_us) / 1e6; };
+
+    llama_memory_clear(mem, false);
+
+    while (n_done < n_req) {
+        while (i_next < n_req && reqs[i_next].t_arrival <= t_now()) {
+            queue.push_back(i_next++);
+        }
+
+        int n_running = 0;
+        for (int s = 0; s < n_slots; ++s) {
+            if (slots[s] < 0 && !queue.empty()) {
+                slots[s] = queue.front();
+                queue.pop_front();
+            }
+            n_running += slots[s] >= 0;
+        }
+
+        if (n_running == 0) {
+            // idle - wait for the next arrival
+            samples.push_back({ t_now(), 0, 0, 0 });
+            const double dt = reqs[i_next].t_arrival - t_now();
+            if (dt > 0.0) {
+                std::this_thread::sleep_for(std::chrono::microseconds((int64_t) (dt*1e6)));
+            }
+            continue;
+        }
+
+        common_batch_clear(batch);
+
+        // generating requests first, so that prompt processing does not stall them
+        for (int s = 0; s < n_slots; ++s) {
+            has_output[s] = false;
+            if (slots[s] < 0) {
+                continue;
+            }
+            const auto & req = reqs[slots[s]];
+            if (req.n_decoded > 0) {
+                common_batch_add(batch, 0, req.n_prompt + req.n_decoded - 1, { s }, true);
+                has_output[s] = true;
+            }
+        }
+
+        for (int s = 0; s < n_slots && batch.n_tokens < n_batch; ++s) {
+            if (slots[s] < 0) {
+                continue;
+            }
+            auto & req = reqs[slots[s]];
+            if (req.n_decoded > 0) {
+                continue;
+            }
+            const int n_chunk = std::min(req.n_prompt - req.n_past, n_batch - batch.n_tokens);
+            for (int i = 0; i < n_chunk; ++i) {
+                common_batch_add(batch, 0, req.n_past + i, { s }, false);
+            }
+            req.n_past += n_chunk;
+            if (req.n_past == req.n_prompt) {
+                batch.logits[batch.n_tokens - 1] = true;
+                has_output[s] = true;
+            }
+        }
+
+        const int ret = llama_decode(ctx, batch);
+        if (ret != 0) {
+            LOG_ERR("%s: failed to decode the batch, n_tokens = %d, ret = %d\n", __func__, batch.n_tokens, ret);
+            return false;
+        }
+        llama_synchronize(ctx);
+
+        const double t = t_now();
+
+        int n_kv = 0;
+        for (int s = 0; s < n_slots; ++s) {
+            if (slots[s] < 0) {
+                continue;
+            }
+            auto & req = reqs[slots[s]];
+            if (has_output[s]) {
+                if (req.n_decoded == 0) {
+                    req.t_first = t;
+                } else {
+                    itl.push_back(t - req.t_last);
+                }
+                req.t_last = t;
+                req.n_decoded++;
+            }
+            if (req.n_decoded == req.n_gen) {
+                llama_memory_seq_rm(mem, s, -1, -1);
+                slots[s] = -1;
+                n_done++;
+                t_end = t;
+                continue;
+            }
+            n_kv += req.n_past + std::max(0, req.n_decoded - 1);
+        }
+
+        int n_active = 0;
+        for (int s = 0; s < n_slots; ++s) {
+            n_active += slots[s] >= 0;
+        }
+        samples.push_back({ t, n_active, (int) queue.size(), n_kv });
+    }
+
+    // report
+
+    std::vector<double> ttft;
+    std::vector<double> e2e;
+
+    int n_good = 0;
+    int64_t n_prompt_total = 0;
+    int64_t n_gen_total    = 0;
+
+    for (const auto & req : reqs) {
+        const double req_ttft = req.t_first - req.t_arrival;
+        const double req_itl  = req.n_gen > 1 ? (req.t_last - req.t_first)/(req.n_gen - 1) : 0.0;
+
+        ttft.push_back(req_ttft);
+        e2e.push_back(req.t_last - req.t_arrival);
+
+        n_prompt_total += req.n_prompt;
+        n_gen_total    += req.n_gen;
+
+        const bool ok_ttft = params.workload_slo_ttft <= 0.0f || req_ttft*1e3 <= params.workload_slo_ttft;
+        const bool ok_itl  = params.workload_slo_itl  <= 0.0f || req_itl *1e3 <= params.workload_slo_itl;
+        n_good += ok_ttft && ok_itl;
+    }
+
+    // KV utilization over time, in equal intervals of the run
+    const int n_buckets = 10;
+
+    struct bucket {
+        int    n       = 0;
+        double running = 0.0;
+        double queued  = 0.0;
+        double kv      = 0.0;
+        double kv_max  = 0.0;
+    };
+
+    std::vector<bucket> timeline(n_buckets);
+
+    double kv_mean = 0.0;
+    double kv_max  = 0.0;
+
+    for (const auto & smp : samples) {
+        const double kv = (double) smp.n_kv/n_kv_max;
+        auto & b = timeline[std::min(n_buckets - 1, (int) (smp.t/t_end*n_buckets))];
+        b.n++;
+        b.running += smp.n_running;
+        b.queued  += smp.n_queued;
+        b.kv      += kv;
+        b.kv_max   = std::max(b.kv_max, kv);
+        kv_mean   += kv;
+        kv_max     = std::max(kv_max, kv);
+    }
+    kv_mean /= std::max<size_t>(1, samples.size());
+
+    for (auto & b : timeline) {
+        if (b.n > 0) {
+            b.running /= b.n;
+            b.queued  /= b.n;
+            b.kv      /= b.n;
+        }
+    }
+
+    const double goodput = n_good/t_end;
+
+    if (params.batched_bench_output_jsonl) {
+        std::string str_timeline;
+        for (int i = 0; i < n_buckets; ++i) {
+            const auto & b = timeline[i];
+            str_timeline += string_format("%s{\"t\": %f, \"running\": %f, \"queued\": %f, \"kv\": %f, \"kv_max\": %f}",
+                    i > 0 ? ", " : "", (i + 1)*t_end/n_buckets, b.running, b.queued, b.kv, b.kv_max);
+        }
+
+        LOG(
+            "{\"n_kv_max\": %d, \"n_batch\": %d, \"n_ubatch\": %d, \"flash_attn\": %d, \"n_gpu_layers\": %d, \"n_threads\": %d, \"n_threads_batch\": %d, "
+            "\"n_slots\": %d, \"n_req\": %d, \"t\": %f, \"speed_pp\": %f, \"speed_tg\": %f, \"throughput\": %f, \"goodput\": %f, \"n_good\": %d, "
+            "\"ttft_p50\": %f, \"ttft_p90\": %f, \"ttft_p99\": %f, \"itl_p50\": %f, \"itl_p90\": %f, \"itl_p99\": %f, \"e2e_p50\": %f, \"e2e_p90\": %f, \"e2e_p99\": %f, "
+            "\"kv_mean\": %f, \"kv_max\": %f, \"timeline\": [%s]}\n",
+            n_kv_max, params.n_batch, params.n_ubatch, params.flash_attn, params.n_gpu_layers, params.cpuparams.n_threads, params.cpuparams_batch.n_threads,
+            n_slots, n_req, t_end, n_prompt_total/t_end, n_gen_total/t_end, n_req/t_end, goodput, n_good,
+            percentile(ttft, 50)*1e3, percentile(ttft, 90)*1e3, percentile(ttft, 99)*1e3,
+            percentile(itl,  50)*1e3, percentile(itl,  90)*1e3, percentile(itl,  99)*1e3,
+            percentile(e2e,  50)*1e3, percentile(e2e,  90)*1e3, percentile(e2e,  99)*1e3,
+            kv_mean, kv_max, str_timeline.c_str());
+        return true;
+    }
+
+    LOG("\n");
+    LOG("%s: n_kv_max = %d, n_batch = %d, n_ubatch = %d, flash_attn = %d, n_gpu_layers = %d, n_slots = %d, n_ctx_slot = %d\n", __func__,
+            n_kv_max, params.n_batch, params.n_ubatch, params.flash_attn, params.n_gpu_layers, n_slots, n_ctx_slot);
+    LOG("%s: n_req = %d, t = %.3f s, S_PP = %.2f t/s, S_TG = %.2f t/s, throughput = %.3f req/s\n", __func__,
+            n_req, t_end, n_prompt_total/t_end, n_gen_total/t_end, n_req/t_end);
+    LOG("%s: goodput = %.3f req/s (%d/%d requests with TTFT <= %.0f ms and ITL <= %.0f ms)\n", __func__,
+            goodput, n_good, n_req, params.workload_slo_ttft, params.workload_slo_itl);
+    LOG("\n");
+    LOG("|%8s | %10s | %10s | %10s | %10s | %10s |\n", "metric", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    LOG("|%8s-|-%10s-|-%10s-|-%10s-|-%10s-|-%10s-|\n", "--------", "----------", "----------", "----------", "----------", "----------");
+    const auto print_row = [](const char * name, const std::vector<double> & v) {
+        LOG("|%8s | %10.2f | %10.2f | %10.2f | %10.2f | %10.2f |\n", name,
+                mean(v)*1e3, percentile(v, 50)*1e3, percentile(v, 90)*1e3, percentile(v, 99)*1e3, percentile(v, 100)*1e3);
+    };
+    print_row("TTFT", ttft);
+    print_row("ITL",  itl);
+    print_row("E2E",  e2e);
+    LOG("\n");
+    LOG("|%8s | %8s | %8s | %8s | %8s |\n", "t s", "running", "queued", "KV %", "KV max %");
+    LOG("|%8s-|-%8s-|-%8s-|-%8s-|-%8s-|\n", "--------", "--------", "--------", "--------", "--------");
+    for (int i = 0; i < n_buckets; ++i) {
+        const auto & b = timeline[i];
+        LOG("|%8.2f | %8.2f | %8.2f | %8.2f | %8.2f |\n", (i + 1)*t_end/n_buckets, b.running, b.queued, 100.0*b.kv, 100.0*b.kv_max);
+    }
+    LOG("|%8s | %8s | %8s | %8.2f | %8.2f |\n", "all", "", "", 100.0*kv_mean, 100.0*kv_max);
+
+    return true;
+}
+
 int main(int argc, char ** argv) {
     common_params params;
 
@@ -25,7 +396,10 @@ int main(int argc, char ** argv) {
 
     int is_pp_shared = params.is_pp_shared;
 
-    std::vector<int> n_pp = params.n_pp;
+    const bool is_workload = params.workload_rate > 0.0f || !params.workload_trace.empty();
+
+    // in workload mode -npp and -ntg are the request lengths to sample from and the grid is not run
+    std::vector<int> n_pp = is_workload ? std::vector<int>() : params.n_pp;
     std::vector<int> n_tg = params.n_tg;
     std::vector<int> n_pl = params.n_pl;
 
@@ -48,7 +422,11 @@ int main(int argc, char ** argv) {
     llama_context_params ctx_params = common_context_params_to_llama(params);
 
     // ensure enough sequences are available
-    ctx_params.n_seq_max = n_pl.empty() ? 1 : *std::max_element(n_pl.begin(), n_pl.end());
+    if (is_workload) {
+        ctx_params.n_seq_max = params.n_parallel;
+    } else {
+        ctx_params.n_seq_max = n_pl.empty() ? 1 : *std::max_element(n_pl.begin(), n_pl.end());
+    }
 
     llama_context * ctx = llama_init_from_model(model, ctx_params);
 
@@ -102,7 +480,11 @@ int main(int argc, char ** argv) {
         }
     }
 
-    if (!params.batched_bench_output_jsonl) {
+    if (is_workload && !run_workload(params, ctx, batch)) {
+        return 1;
+    }
+
+    if (!params.batched_bench_output_jsonl && !is_workload) {
         LOG("\n");
         LOG("%s: n_kv_max = %d, n_batch = %d, n_ubatch = %d, flash_attn = %d, is_pp_shared = %d, n_gpu_layers = %d, n_threads = %u, n_threads_batch = %u\n", __func__, n_kv_max, params.n_batch, params.n_ubatch, params.flash_attn, params.is_pp_shared, params.n_gpu_layers, ctx_params.n_threads, ctx_params.n_threads_batch);
         LOG("\n");
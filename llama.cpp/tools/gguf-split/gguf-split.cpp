@@ -363,6 +363,7 @@ static void gguf_split(const split_params & split_params) {
     struct gguf_init_params params = {
         /*.no_alloc = */ true,
         /*.ctx      = */ &ctx_meta,
+        /*.no_mmap  = */ false,
     };
 
     std::ifstream f_input(split_params.input.c_str(), std::ios::binary);
@@ -426,6 +427,7 @@ static void gguf_merge(const split_params & split_params) {
         struct gguf_init_params params = {
             /*.no_alloc = */ true,
             /*.ctx      = */ &ctx_meta,
+            /*.no_mmap  = */ false,
         };
 
         if (i_split > 0) {
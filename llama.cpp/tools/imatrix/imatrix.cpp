@@ -5,6 +5,7 @@
 
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
@@ -14,6 +15,8 @@
 #include <fstream>
 #include <unordered_map>
 #include <algorithm>
+#include <atomic>
+#include <functional>
 
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
@@ -25,7 +28,7 @@ static void print_usage(int, char ** argv) {
             "       -m model.gguf -f some-text.txt [-o imatrix.dat] [--process-output] \\\n"
             "       [--no-ppl] [--chunk 123] [--output-frequency 10] [--save-frequency 0] \\\n"
             "       [--in-file imatrix-prev-0.dat --in-file imatrix-prev-1.dat ...] \\\n"
-            "       [--parse-special]\n" , argv[0]);
+            "       [--n-shards 4 --shard-index 0] [--parse-special]\n" , argv[0]);
     LOG("\n");
 }
 
@@ -35,6 +38,79 @@ struct Stats {
     int ncall = 0;
 };
 
+// threads that are started once and reused for every callback, instead of being created for each tensor
+class IMatrixWorkers {
+public:
+    ~IMatrixWorkers() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv_start.notify_all();
+        for (auto & t : m_threads) {
+            t.join();
+        }
+    }
+
+    // run fn(ith) for ith in [0, n_threads) and wait for all of them - the calling thread runs ith = 0
+    void run(int n_threads, const std::function<void(int)> & fn) {
+        while ((int) m_threads.size() < n_threads - 1) {
+            m_threads.emplace_back(&IMatrixWorkers::worker, this, (int) m_threads.size() + 1);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_fn        = &fn;
+            m_n_threads = n_threads;
+            m_n_pending = n_threads - 1;
+            m_gen++;
+        }
+        m_cv_start.notify_all();
+
+        fn(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv_done.wait(lock, [&] { return m_n_pending == 0; });
+        m_fn = nullptr;
+    }
+
+private:
+    void worker(int ith) {
+        uint64_t gen = 0;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv_start.wait(lock, [&] { return m_stop || m_gen != gen; });
+            if (m_stop) {
+                return;
+            }
+            gen = m_gen;
+            if (ith >= m_n_threads) {
+                continue;
+            }
+
+            const auto * fn = m_fn;
+            lock.unlock();
+            (*fn)(ith);
+            lock.lock();
+
+            if (--m_n_pending == 0) {
+                m_cv_done.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread>          m_threads;
+    std::mutex                        m_mutex;
+    std::condition_variable           m_cv_start;
+    std::condition_variable           m_cv_done;
+    const std::function<void(int)> *  m_fn        = nullptr;
+    int                               m_n_threads = 0;
+    int                               m_n_pending = 0;
+    uint64_t                          m_gen       = 0;
+    bool                              m_stop      = false;
+};
+
 class IMatrixCollector {
 public:
     IMatrixCollector() = default;
@@ -43,14 +119,30 @@ public:
     void save_imatrix(int ncall = -1) const;
     bool load_imatrix(const char * fname);
 private:
+    void accumulate(Stats & e, const std::string & wname);
+    void save_imatrix_raw(const std::string & fname) const;
+    bool load_imatrix_raw(std::ifstream & in, const char * fname);
+
     std::unordered_map<std::string, Stats> m_stats;
     common_params                          m_params;
     std::mutex                             m_mutex;
     int                                    m_last_call = 0;
     std::vector<char>                      m_src1_data;
     std::vector<char>                      m_ids; // the expert ids from ggml_mul_mat_id
+
+    // the rows of src1 to accumulate and their offset in the statistics of the current tensor
+    std::vector<const float *>             m_rows;
+    std::vector<size_t>                    m_row_offs;
+    int64_t                                m_n_cols = 0;
+
+    IMatrixWorkers                         m_workers;
 };
 
+// magic number at the start of the files written with --n-shards - in the legacy format this is the number of entries,
+// so older versions refuse to load them
+static const int32_t IMATRIX_RAW_MAGIC   = -1;
+static const int32_t IMATRIX_RAW_VERSION =  1;
+
 // remove any prefix and suffixes from the name
 // CUDA0#blk.0.attn_k.weight#0 => blk.0.attn_k.weight
 static std::string filter_tensor_name(const char * name) {
@@ -102,6 +194,10 @@ bool IMatrixCollector::collect_imatrix(struct ggml_tensor * t, bool ask, void *
     const char * data = is_host ? (const char *) src1->data : m_src1_data.data();
     GGML_ASSERT(src1->nb[0] == ggml_element_size(src1));
 
+    m_rows.clear();
+    m_row_offs.clear();
+    m_n_cols = src1->ne[0];
+
     // this has been adapted to the new format of storing merged experts in a single 3d tensor
     // ref: https://github.com/ggml-org/llama.cpp/pull/6387
     if (t->op == GGML_OP_MUL_MAT_ID) {
@@ -133,41 +229,26 @@ bool IMatrixCollector::collect_imatrix(struct ggml_tensor * t, bool ask, void *
             exit(1); //GGML_ABORT("fatal error");
         }
         LOG_DBGV(2, "%s[%d]: %32s, %s, %5d x %5d, %d\n", __func__, m_last_call, wname.c_str(), ggml_op_name(t->op), (int)src1->ne[0], (int)src1->ne[2], (int)src1->type);
-        // loop over all possible experts, regardless if they are used or not in the batch
-        for (int ex = 0; ex < n_as; ++ex) {
-            size_t e_start = ex*src1->ne[0];
-
+        for (int row = 0; row < (int)src1->ne[2]; ++row) {
             for (int idx = 0; idx < n_ids; ++idx) {
-                for (int row = 0; row < (int)src1->ne[2]; ++row) {
-                    const int excur = *(const int32_t *) (m_ids.data() + row*ids->nb[1] + idx*ids->nb[0]);
-
-                    GGML_ASSERT(excur >= 0 && excur < n_as); // sanity check
-
-                    if (excur != ex) continue;
-
-                    const int64_t i11 = idx % src1->ne[1];
-                    const int64_t i12 = row;
-                    const float * x = (const float *)(data + i11*src1->nb[1] + i12*src1->nb[2]);
-
-                    for (int j = 0; j < (int)src1->ne[0]; ++j) {
-                        e.values[e_start + j] += x[j]*x[j];
-                        e.counts[e_start + j]++;
-                        if (!std::isfinite(e.values[e_start + j])) {
-                            LOG("\n");
-                            LOG_ERR("%f detected in %s\n", e.values[e_start + j], wname.c_str());
-                            exit(1);
-                        }
-                    }
-                }
+                const int excur = *(const int32_t *) (m_ids.data() + row*ids->nb[1] + idx*ids->nb[0]);
+
+                GGML_ASSERT(excur >= 0 && excur < n_as); // sanity check
+
+                const int64_t i11 = idx % src1->ne[1];
+                const int64_t i12 = row;
+                m_rows.push_back((const float *)(data + i11*src1->nb[1] + i12*src1->nb[2]));
+                m_row_offs.push_back(excur*src1->ne[0]);
             }
-            if (e.ncall > m_last_call) {
-                m_last_call = e.ncall;
-                if (m_last_call % m_params.n_out_freq == 0) {
-                    save_imatrix();
-                }
-                if (m_params.n_save_freq > 0 && m_last_call%m_params.n_save_freq == 0) {
-                    save_imatrix(m_last_call);
-                }
+        }
+        accumulate(e, wname);
+        if (e.ncall > m_last_call) {
+            m_last_call = e.ncall;
+            if (m_last_call % m_params.n_out_freq == 0) {
+                save_imatrix();
+            }
+            if (m_params.n_save_freq > 0 && m_last_call%m_params.n_save_freq == 0) {
+                save_imatrix(m_last_call);
             }
         }
     } else {
@@ -183,16 +264,10 @@ bool IMatrixCollector::collect_imatrix(struct ggml_tensor * t, bool ask, void *
         ++e.ncall;
         LOG_DBGV(2, "%s[%d]: %32s, %s, %5d x %5d, %d\n", __func__, m_last_call, wname.c_str(), ggml_op_name(t->op), (int)src1->ne[0], (int)src1->ne[1], (int)src1->type);
         for (int row = 0; row < (int)src1->ne[1]; ++row) {
-            const float * x = (const float *) (data + row * src1->nb[1]);
-            for (int j = 0; j < (int)src1->ne[0]; ++j) {
-                e.values[j] += x[j]*x[j];
-                e.counts[j]++;
-                if (!std::isfinite(e.values[j])) {
-                    LOG_ERR("%f detected in %s\n", e.values[j], wname.c_str());
-                    exit(1);
-                }
-            }
+            m_rows.push_back((const float *) (data + row * src1->nb[1]));
+            m_row_offs.push_back(0);
         }
+        accumulate(e, wname);
         if (e.ncall > m_last_call) {
             m_last_call = e.ncall;
             if (m_last_call % m_params.n_out_freq == 0) {
@@ -207,6 +282,63 @@ bool IMatrixCollector::collect_imatrix(struct ggml_tensor * t, bool ask, void *
     return true;
 }
 
+// add the squares of the collected rows to the statistics
+// the columns are split between the threads, so that every thread owns a disjoint shard of the statistics and the inner
+// loops are simple enough to be vectorized by the compiler
+void IMatrixCollector::accumulate(Stats & e, const std::string & wname) {
+    const int64_t n_cols = m_n_cols;
+    const int64_t n_rows = m_rows.size();
+
+    // columns per shard, multiple of a cache line of floats
+    const int n_threads = std::max(1, std::min(m_params.cpuparams.n_threads, (int) ((n_rows*n_cols) / (1 << 16)) + 1));
+    const int64_t n_per_thread = GGML_PAD((n_cols + n_threads - 1) / n_threads, 16);
+
+    std::atomic<bool> finite(true);
+
+    auto compute = [&](int ith) {
+        const int64_t j0 = std::min(n_cols, ith*n_per_thread);
+        const int64_t j1 = std::min(n_cols, j0 + n_per_thread);
+        if (j0 >= j1) {
+            return;
+        }
+
+        for (int64_t r = 0; r < n_rows; ++r) {
+            const float * x = m_rows[r];
+            float       * v = e.values.data() + m_row_offs[r];
+            int         * c = e.counts.data() + m_row_offs[r];
+            for (int64_t j = j0; j < j1; ++j) {
+                v[j] += x[j]*x[j];
+            }
+            for (int64_t j = j0; j < j1; ++j) {
+                c[j]++;
+            }
+        }
+
+        // check once per call instead of once per element, so that the loops above stay vectorizable
+        for (size_t off = 0; off < e.values.size(); off += n_cols) {
+            for (int64_t j = j0; j < j1; ++j) {
+                if (!std::isfinite(e.values[off + j])) {
+                    finite = false;
+                    return;
+                }
+            }
+        }
+    };
+
+    m_workers.run(n_threads, compute);
+
+    if (!finite) {
+        for (float v : e.values) {
+            if (!std::isfinite(v)) {
+                LOG("\n");
+                LOG_ERR("%f detected in %s\n", v, wname.c_str());
+                break;
+            }
+        }
+        exit(1);
+    }
+}
+
 void IMatrixCollector::save_imatrix(int ncall) const {
     auto fname = m_params.out_file;
 
@@ -215,6 +347,12 @@ void IMatrixCollector::save_imatrix(int ncall) const {
         fname += std::to_string(ncall);
     }
 
+    // the shards of a multi-process collection are merged later, so they keep the raw sums and counts of all entries
+    if (m_params.n_shards > 1) {
+        save_imatrix_raw(fname);
+        return;
+    }
+
     // avoid writing imatrix entries that do not have full data
     // this can happen with MoE models where some of the experts end up not being exercised by the provided training data
 
@@ -292,6 +430,101 @@ void IMatrixCollector::save_imatrix(int ncall) const {
     LOG_DBGV(1, "%s: stored collected data after %d chunks in %s\n", __func__, m_last_call, fname.c_str());
 }
 
+// raw format:
+//   int32 magic, int32 version, int32 n_entries
+//   n_entries x { int32 len, char name[len], int32 ncall, int32 nval, float values[nval], int32 counts[nval] }
+//   int32 last_call, int32 len, char prompt_file[len]
+// values and counts are the sums of the squared activations and the number of rows that contributed to them
+void IMatrixCollector::save_imatrix_raw(const std::string & fname) const {
+    std::ofstream out(fname, std::ios::binary);
+
+    const int32_t n_entries = m_stats.size();
+    out.write((const char *) &IMATRIX_RAW_MAGIC,   sizeof(IMATRIX_RAW_MAGIC));
+    out.write((const char *) &IMATRIX_RAW_VERSION, sizeof(IMATRIX_RAW_VERSION));
+    out.write((const char *) &n_entries,           sizeof(n_entries));
+    for (const auto & kv : m_stats) {
+        const auto & stat = kv.second;
+        int len = kv.first.size();
+        out.write((const char *) &len, sizeof(len));
+        out.write(kv.first.c_str(), len);
+        out.write((const char *) &stat.ncall, sizeof(stat.ncall));
+        int nval = stat.values.size();
+        out.write((const char *) &nval, sizeof(nval));
+        out.write((const char *) stat.values.data(), nval*sizeof(float));
+        out.write((const char *) stat.counts.data(), nval*sizeof(int));
+    }
+
+    out.write((const char *) &m_last_call, sizeof(m_last_call));
+    {
+        int len = m_params.prompt_file.size();
+        out.write((const char *) &len, sizeof(len));
+        out.write(m_params.prompt_file.c_str(), len);
+    }
+
+    LOGV(1, "\n");
+    LOG_DBGV(1, "%s: stored raw data of shard %d/%d after %d chunks in %s\n", __func__, m_params.i_shard, m_params.n_shards, m_last_call, fname.c_str());
+}
+
+bool IMatrixCollector::load_imatrix_raw(std::ifstream & in, const char * fname) {
+    int32_t version;
+    int32_t n_entries;
+    in.read((char *) &version,   sizeof(version));
+    in.read((char *) &n_entries, sizeof(n_entries));
+    if (in.fail() || version != IMATRIX_RAW_VERSION) {
+        LOG_ERR("%s: unsupported raw imatrix version in %s\n", __func__, fname);
+        return false;
+    }
+    for (int i = 0; i < n_entries; ++i) {
+        int len;
+        in.read((char *) &len, sizeof(len));
+        std::string name(std::max(len, 0), '\0');
+        in.read(&name[0], len);
+        int ncall;
+        int nval;
+        in.read((char *) &ncall, sizeof(ncall));
+        in.read((char *) &nval,  sizeof(nval));
+        if (in.fail() || len < 0 || nval < 0) {
+            LOG_ERR("%s: failed reading entry %d from %s\n", __func__, i, fname);
+            m_stats = {};
+            return false;
+        }
+
+        std::vector<float> values(nval);
+        std::vector<int>   counts(nval);
+        in.read((char *) values.data(), nval*sizeof(float));
+        in.read((char *) counts.data(), nval*sizeof(int));
+        if (in.fail()) {
+            LOG_ERR("%s: failed reading data for entry %d from %s\n", __func__, i, fname);
+            m_stats = {};
+            return false;
+        }
+
+        auto & e = m_stats[name];
+        if (e.values.empty()) {
+            e.values.resize(nval, 0);
+            e.counts.resize(nval, 0);
+        } else if (e.values.size() != (size_t) nval) {
+            LOG_ERR("%s: inconsistent size for %s (%d vs %d)\n", __func__, name.c_str(), (int) e.values.size(), nval);
+            m_stats = {};
+            return false;
+        }
+
+        for (int j = 0; j < nval; ++j) {
+            e.values[j] += values[j];
+            e.counts[j] += counts[j];
+        }
+        e.ncall += ncall;
+    }
+
+    int last_call = 0;
+    in.read((char *) &last_call, sizeof(last_call));
+    if (!in.fail()) {
+        m_last_call += last_call;
+    }
+
+    return true;
+}
+
 bool IMatrixCollector::load_imatrix(const char * fname) {
     std::ifstream in(fname, std::ios::binary);
     if (!in) {
@@ -300,6 +533,9 @@ bool IMatrixCollector::load_imatrix(const char * fname) {
     }
     int n_entries;
     in.read((char*)&n_entries, sizeof(n_entries));
+    if (!in.fail() && n_entries == IMATRIX_RAW_MAGIC) {
+        return load_imatrix_raw(in, fname);
+    }
     if (in.fail() || n_entries < 1) {
         LOG_ERR("%s: no data in file %s\n", __func__, fname);
         return false;
@@ -478,7 +714,15 @@ static bool compute_imatrix(llama_context * ctx, const common_params & params) {
     double nll = 0.0;
     double nll2 = 0.0;
 
-    LOG_INF("%s: computing over %d chunks with batch_size %d\n", __func__, n_chunk, n_batch);
+    // with multiple shards, this process only evaluates every n_shards-th chunk
+    const int n_chunk_shard = (n_chunk - params.i_shard + params.n_shards - 1) / params.n_shards;
+
+    if (params.n_shards > 1) {
+        LOG_INF("%s: computing over %d of %d chunks (shard %d of %d) with batch_size %d\n", __func__,
+                n_chunk_shard, n_chunk, params.i_shard, params.n_shards, n_batch);
+    } else {
+        LOG_INF("%s: computing over %d chunks with batch_size %d\n", __func__, n_chunk, n_batch);
+    }
 
     std::vector<std::thread> workers(std::thread::hardware_concurrency() - 1);
 
@@ -489,7 +733,7 @@ static bool compute_imatrix(llama_context * ctx, const common_params & params) {
         logits.reserve((size_t)n_ctx * n_vocab);
     }
 
-    for (int i = 0; i < n_chunk; ++i) {
+    for (int i = params.i_shard; i < n_chunk; i += params.n_shards) {
         const int start =     i * n_ctx;
         const int end   = start + n_ctx;
 
@@ -538,10 +782,10 @@ static bool compute_imatrix(llama_context * ctx, const common_params & params) {
 
         const auto t_end = std::chrono::high_resolution_clock::now();
 
-        if (i == 0) {
+        if (i == params.i_shard) {
             const float t_total = std::chrono::duration<float>(t_end - t_start).count();
             LOG_INF("%s: %.2f seconds per pass - ETA ", __func__, t_total);
-            int total_seconds = (int)(t_total * n_chunk);
+            int total_seconds = (int)(t_total * n_chunk_shard);
             if (total_seconds >= 60*60) {
                 LOG("%d hours ", total_seconds / (60*60));
                 total_seconds = total_seconds % (60*60);
@@ -596,6 +840,11 @@ int main(int argc, char ** argv) {
 
     params.n_batch = std::min(params.n_batch, params.n_ctx);
 
+    if (params.n_shards < 1 || params.i_shard < 0 || params.i_shard >= params.n_shards) {
+        LOG_ERR("%s: invalid shard %d of %d\n", __func__, params.i_shard, params.n_shards);
+        return 1;
+    }
+
     g_collector.set_params(params);
 
     for (const auto & in_file : params.in_files) {
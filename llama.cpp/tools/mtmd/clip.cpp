@@ -2007,6 +2007,7 @@ struct clip_model_loader {
         struct gguf_init_params params = {
             /*.no_alloc = */ true,
             /*.ctx      = */ &meta,
+            /*.no_mmap  = */ false,
         };
 
         ctx_gguf = gguf_context_ptr(gguf_init_from_file(fname, params));
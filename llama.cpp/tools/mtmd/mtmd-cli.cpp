@@ -132,6 +132,8 @@ struct mtmd_cli_context {
         mparams.print_timings = true;
         mparams.n_threads = params.cpuparams.n_threads;
         mparams.verbosity = params.verbosity > 0 ? GGML_LOG_LEVEL_DEBUG : GGML_LOG_LEVEL_INFO;
+        mparams.embd_cache_size = (size_t) params.mmproj_cache_mb * 1024 * 1024;
+        mparams.embd_cache_dir = params.mmproj_cache_dir.empty() ? nullptr : params.mmproj_cache_dir.c_str();
         ctx_vision.reset(mtmd_init_from_file(clip_path, model, mparams));
         if (!ctx_vision.get()) {
             LOG_ERR("Failed to load vision model from %s\n", clip_path);
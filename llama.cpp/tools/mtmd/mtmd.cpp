@@ -6,11 +6,19 @@
 #include "llama.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <limits>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 // represents raw image data, layout is RGBRGBRGB...
@@ -91,9 +99,235 @@ mtmd_context_params mtmd_context_params_default() {
     params.verbosity = GGML_LOG_LEVEL_INFO;
     params.image_marker = MTMD_DEFAULT_IMAGE_MARKER;
     params.media_marker = mtmd_default_marker();
+    params.embd_cache_size = 0;
+    params.embd_cache_dir = nullptr;
     return params;
 }
 
+// key of the embedding cache: the identity of the encoder and two independent hashes of its input
+struct mtmd_embd_key {
+    uint64_t model   = 0;
+    uint64_t hash[2] = { 0, 0 };
+
+    bool operator==(const mtmd_embd_key & other) const {
+        return model == other.model && hash[0] == other.hash[0] && hash[1] == other.hash[1];
+    }
+};
+
+struct mtmd_embd_key_hash {
+    size_t operator()(const mtmd_embd_key & key) const {
+        return (size_t) key.hash[0];
+    }
+};
+
+// cache of encoder outputs (LRU in memory, optionally persisted to disk)
+struct mtmd_embd_cache {
+    static constexpr uint32_t FILE_MAGIC   = 0x4345544d; // "MTEC"
+    static constexpr uint32_t FILE_VERSION = 2;
+
+    size_t      max_size; // in bytes
+    std::string dir;
+
+    size_t cur_size = 0;
+
+    using entry = std::pair<mtmd_embd_key, std::vector<float>>;
+
+    std::list<entry> lru; // most recently used first
+    std::unordered_map<mtmd_embd_key, std::list<entry>::iterator, mtmd_embd_key_hash> index;
+
+    std::mutex mutex;
+
+    mtmd_embd_cache(size_t max_size, const char * dir) : max_size(max_size), dir(dir ? dir : "") {}
+
+    // n_embd is the expected number of floats, used to validate the cached data
+    bool get(const mtmd_embd_key & key, size_t n_embd, std::vector<float> & out) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = index.find(key);
+        if (it != index.end() && it->second->second.size() == n_embd) {
+            lru.splice(lru.begin(), lru, it->second);
+            out = it->second->second;
+            return true;
+        }
+
+        if (dir.empty()) {
+            return false;
+        }
+
+        std::ifstream fin(file_path(key), std::ios::binary);
+        if (!fin) {
+            return false;
+        }
+
+        // the file name is derived from the key, the full key in the header rules out collisions
+        uint32_t      magic   = 0;
+        uint32_t      version = 0;
+        mtmd_embd_key key_file;
+        uint64_t      n       = 0;
+        fin.read((char *) &magic,            sizeof(magic));
+        fin.read((char *) &version,          sizeof(version));
+        fin.read((char *) &key_file.model,   sizeof(key_file.model));
+        fin.read((char *) &key_file.hash[0], sizeof(key_file.hash[0]));
+        fin.read((char *) &key_file.hash[1], sizeof(key_file.hash[1]));
+        fin.read((char *) &n,                sizeof(n));
+        if (!fin || magic != FILE_MAGIC || version != FILE_VERSION || !(key_file == key) || n != n_embd) {
+            return false;
+        }
+
+        out.resize(n);
+        fin.read((char *) out.data(), n*sizeof(float));
+        if (!fin) {
+            return false;
+        }
+
+        insert(key, out);
+
+        return true;
+    }
+
+    void put(const mtmd_embd_key & key, const std::vector<float> & embd) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        insert(key, embd);
+
+        if (dir.empty()) {
+            return;
+        }
+
+        // write to a temporary file first, so that concurrent readers never see a partial entry
+        const std::string path     = file_path(key);
+        const std::string path_tmp = path + ".tmp";
+        {
+            std::ofstream fout(path_tmp, std::ios::binary);
+            const uint64_t n = embd.size();
+            fout.write((const char *) &FILE_MAGIC,   sizeof(FILE_MAGIC));
+            fout.write((const char *) &FILE_VERSION, sizeof(FILE_VERSION));
+            fout.write((const char *) &key.model,    sizeof(key.model));
+            fout.write((const char *) &key.hash[0],  sizeof(key.hash[0]));
+            fout.write((const char *) &key.hash[1],  sizeof(key.hash[1]));
+            fout.write((const char *) &n,            sizeof(n));
+            fout.write((const char *) embd.data(),   n*sizeof(float));
+            if (!fout) {
+                LOG_WRN("%s: failed to write embedding cache file %s\n", __func__, path_tmp.c_str());
+                return;
+            }
+        }
+        if (std::rename(path_tmp.c_str(), path.c_str()) != 0) {
+            LOG_WRN("%s: failed to rename %s: %s\n", __func__, path_tmp.c_str(), strerror(errno));
+            std::remove(path_tmp.c_str());
+        }
+    }
+
+private:
+    void insert(const mtmd_embd_key & key, const std::vector<float> & embd) {
+        const size_t size = embd.size()*sizeof(float);
+        if (size > max_size || index.find(key) != index.end()) {
+            return;
+        }
+
+        while (cur_size + size > max_size && !lru.empty()) {
+            cur_size -= lru.back().second.size()*sizeof(float);
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+
+        lru.emplace_front(key, embd);
+        index[key] = lru.begin();
+        cur_size += size;
+    }
+
+    std::string file_path(const mtmd_embd_key & key) const {
+        char name[48];
+        snprintf(name, sizeof(name), "%016" PRIx64 "%016" PRIx64 ".bin", key.hash[0], key.hash[1]);
+        return dir + "/" + name;
+    }
+};
+
+// two independent 64-bit hashes (FNV-1a and a multiply-xorshift) over a stream of 64-bit values
+struct mtmd_hasher {
+    uint64_t h0 = 0xcbf29ce484222325ULL; // FNV-1a offset basis
+    uint64_t h1 = 0x9e3779b97f4a7c15ULL;
+
+    void mix(uint64_t v) {
+        h0 ^= v;
+        h0 *= 0x100000001b3ULL; // FNV prime
+        h0 ^= h0 >> 32;
+
+        h1 += v;
+        h1 ^= h1 >> 30;
+        h1 *= 0xbf58476d1ce4e5b9ULL;
+        h1 ^= h1 >> 27;
+    }
+
+    void mix(const std::string & str) {
+        mix((uint64_t) str.size());
+        for (char c : str) {
+            mix((uint64_t) (unsigned char) c);
+        }
+    }
+};
+
+// identity of the encoder: the mmproj file (path, size and modification time) and the encoder parameters,
+// so that different mmproj files never share cache entries
+static uint64_t mtmd_encoder_id(const char * mmproj_fname, const clip_ctx * ctx_v, const clip_ctx * ctx_a) {
+    mtmd_hasher hasher;
+
+    std::error_code ec;
+    const std::filesystem::path path = std::filesystem::absolute(mmproj_fname, ec);
+    hasher.mix(ec ? std::string(mmproj_fname) : path.string());
+    hasher.mix((uint64_t) std::filesystem::file_size(mmproj_fname, ec));
+    hasher.mix((uint64_t) std::filesystem::last_write_time(mmproj_fname, ec).time_since_epoch().count());
+
+    for (const clip_ctx * ctx : { ctx_v, ctx_a }) {
+        if (!ctx) {
+            hasher.mix((uint64_t) 0);
+            continue;
+        }
+        hasher.mix((uint64_t) clip_get_projector_type(ctx));
+        hasher.mix((uint64_t) clip_n_mmproj_embd(ctx));
+        hasher.mix((uint64_t) clip_get_hidden_size(ctx));
+        hasher.mix((uint64_t) clip_get_image_size(ctx));
+        hasher.mix((uint64_t) clip_get_patch_size(ctx));
+    }
+
+    return hasher.h0 ^ hasher.h1;
+}
+
+// key of the preprocessed encoder input in the embedding cache
+static mtmd_embd_key mtmd_embd_key_batch(const clip_image_f32_batch & batch, uint64_t encoder_id, projector_type proj) {
+    mtmd_hasher hasher;
+
+    hasher.mix(encoder_id);
+    hasher.mix((uint64_t) proj);
+    hasher.mix((uint64_t) batch.is_audio);
+    for (const auto & entry : batch.entries) {
+        hasher.mix((uint64_t) entry->nx);
+        hasher.mix((uint64_t) entry->ny);
+
+        // hash 2 floats at a time
+        const size_t n = entry->buf.size();
+        const float * data = entry->buf.data();
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            uint64_t v;
+            std::memcpy(&v, data + i, sizeof(v));
+            hasher.mix(v);
+        }
+        for (; i < n; ++i) {
+            uint32_t v;
+            std::memcpy(&v, data + i, sizeof(v));
+            hasher.mix(v);
+        }
+    }
+
+    mtmd_embd_key key;
+    key.model   = encoder_id;
+    key.hash[0] = hasher.h0;
+    key.hash[1] = hasher.h1;
+
+    return key;
+}
+
 struct mtmd_context {
     struct clip_ctx * ctx_v; // vision
     struct clip_ctx * ctx_a; // audio
@@ -130,6 +364,9 @@ struct mtmd_context {
     // for whisper, we pre-calculate the mel filter bank
     whisper_preprocessor::whisper_filters w_filters;
 
+    std::unique_ptr<mtmd_embd_cache> embd_cache; // optional
+    uint64_t encoder_id = 0; // identity of the mmproj in the keys of the embedding cache
+
     // TODO @ngxson : add timings
 
     mtmd_context(const char * mmproj_fname,
@@ -185,6 +422,11 @@ struct mtmd_context {
         if (ctx_a) {
             init_audio();
         }
+
+        if (ctx_params.embd_cache_size > 0 || ctx_params.embd_cache_dir) {
+            embd_cache.reset(new mtmd_embd_cache(ctx_params.embd_cache_size, ctx_params.embd_cache_dir));
+            encoder_id = mtmd_encoder_id(mmproj_fname, ctx_v, ctx_a);
+        }
     }
 
     void init_vision() {
@@ -370,6 +612,10 @@ struct mtmd_tokenizer {
 
     mtmd_input_chunks cur;
 
+    // preprocessed images, one entry per bitmap (empty for audio)
+    std::vector<clip_image_f32_batch> batches_f32;
+    std::vector<uint8_t>              batches_ok;
+
     mtmd_tokenizer(mtmd_context * ctx,
             const mtmd_input_text * text,
             const mtmd_bitmap ** bitmaps,
@@ -385,6 +631,7 @@ struct mtmd_tokenizer {
 
     int32_t tokenize(mtmd_input_chunks * output) {
         cur.entries.clear();
+        preprocess_images();
         std::vector<std::string> parts = split_text(input_text, ctx->media_marker);
         size_t i_bm = 0; // index of the current bitmap
         for (auto & part : parts) {
@@ -395,8 +642,7 @@ struct mtmd_tokenizer {
                             __func__, bitmaps.size(), parts.size() - 1);
                     return 1;
                 }
-                const mtmd_bitmap * bitmap = bitmaps[i_bm++];
-                int32_t res = add_media(bitmap);
+                int32_t res = add_media(i_bm++);
                 if (res != 0) {
                     return res;
                 }
@@ -467,7 +713,60 @@ struct mtmd_tokenizer {
         }
     }
 
-    int32_t add_media(const mtmd_bitmap * bitmap) {
+    // preprocessing (resize, normalize, slicing) is independent for each image, so it is done in parallel
+    void preprocess_images() {
+        batches_f32.clear();
+        batches_f32.resize(bitmaps.size());
+        batches_ok.assign(bitmaps.size(), 0);
+
+        if (!ctx->ctx_v) {
+            return;
+        }
+
+        std::vector<size_t> images;
+        for (size_t i = 0; i < bitmaps.size(); i++) {
+            if (!bitmaps[i]->is_audio) {
+                images.push_back(i);
+            }
+        }
+
+        std::atomic<size_t> next{0};
+        auto worker = [&]() {
+            for (size_t j = next++; j < images.size(); j = next++) {
+                const size_t i = images[j];
+                batches_ok[i] = preprocess_image(bitmaps[i], batches_f32[i]);
+            }
+        };
+
+        const int n_threads = std::min<int>(ctx->n_threads, images.size());
+        if (n_threads <= 1) {
+            worker();
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        for (int t = 1; t < n_threads; t++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto & w : workers) {
+            w.join();
+        }
+    }
+
+    bool preprocess_image(const mtmd_bitmap * bitmap, clip_image_f32_batch & batch_f32) const {
+        // convert mtmd_bitmap to clip_image_u8
+        clip_image_u8_ptr img_u8(clip_image_u8_init());
+        img_u8->nx = bitmap->nx;
+        img_u8->ny = bitmap->ny;
+        img_u8->buf.resize(bitmap->data.size());
+        std::memcpy(img_u8->buf.data(), bitmap->data.data(), img_u8->nx * img_u8->ny * 3);
+
+        return clip_image_preprocess(ctx->ctx_v, img_u8.get(), &batch_f32);
+    }
+
+    int32_t add_media(size_t i_bm) {
+        const mtmd_bitmap * bitmap = bitmaps[i_bm];
         if (!bitmap->is_audio) {
             // handle image
 
@@ -480,17 +779,9 @@ struct mtmd_tokenizer {
                 add_text(ctx->img_beg, true); // add image begin token
             }
 
-            // convert mtmd_bitmap to clip_image_u8
-            clip_image_u8_ptr img_u8(clip_image_u8_init());
-            img_u8->nx = bitmap->nx;
-            img_u8->ny = bitmap->ny;
-            img_u8->buf.resize(bitmap->data.size());
-            std::memcpy(img_u8->buf.data(), bitmap->data.data(), img_u8->nx * img_u8->ny * 3);
-
-            // preprocess image
-            clip_image_f32_batch batch_f32;
-            bool ok = clip_image_preprocess(ctx->ctx_v, img_u8.get(), &batch_f32);
-            if (!ok) {
+            // image was preprocessed by preprocess_images()
+            clip_image_f32_batch batch_f32 = std::move(batches_f32[i_bm]);
+            if (!batches_ok[i_bm]) {
                 LOG_ERR("Unable to preprocess image\n");
                 return 2;
             }
@@ -753,12 +1044,24 @@ int32_t mtmd_encode_chunk(mtmd_context * ctx, const mtmd_input_chunk * chunk) {
             return 1;
         }
         int n_mmproj_embd = ctx->n_embd_text;
-        ctx->image_embd_v.resize(chunk->tokens_audio->n_tokens * n_mmproj_embd);
+        const size_t n_embd = chunk->tokens_audio->n_tokens * n_mmproj_embd;
+        mtmd_embd_key key;
+        if (ctx->embd_cache) {
+            key = mtmd_embd_key_batch(chunk->tokens_audio->batch_f32, ctx->encoder_id, ctx->proj_type_a());
+            if (ctx->embd_cache->get(key, n_embd, ctx->image_embd_v)) {
+                LOG_DBG("%s: audio embeddings loaded from cache\n", __func__);
+                return 0;
+            }
+        }
+        ctx->image_embd_v.resize(n_embd);
         bool ok = clip_image_batch_encode(
             ctx->ctx_a,
             ctx->n_threads,
             &chunk->tokens_audio->batch_f32,
             ctx->image_embd_v.data());
+        if (ok && ctx->embd_cache) {
+            ctx->embd_cache->put(key, ctx->image_embd_v);
+        }
         return ok ? 0 : 1;
     }
 
@@ -773,7 +1076,16 @@ int32_t mtmd_encode(mtmd_context * ctx, const mtmd_image_tokens * image_tokens)
         return 1;
     }
     int n_mmproj_embd = clip_n_mmproj_embd(ctx_clip);
-    ctx->image_embd_v.resize(image_tokens->n_tokens() * n_mmproj_embd);
+    const size_t n_embd = image_tokens->n_tokens() * n_mmproj_embd;
+    mtmd_embd_key key;
+    if (ctx->embd_cache) {
+        key = mtmd_embd_key_batch(image_tokens->batch_f32, ctx->encoder_id, ctx->proj_type_v());
+        if (ctx->embd_cache->get(key, n_embd, ctx->image_embd_v)) {
+            LOG_DBG("%s: image embeddings loaded from cache\n", __func__);
+            return 0;
+        }
+    }
+    ctx->image_embd_v.resize(n_embd);
     bool ok = false;
 
     if (clip_is_llava(ctx_clip) || clip_is_minicpmv(ctx_clip) || clip_is_glm(ctx_clip)) {
@@ -795,6 +1107,10 @@ int32_t mtmd_encode(mtmd_context * ctx, const mtmd_image_tokens * image_tokens)
             ctx->image_embd_v.data());
     }
 
+    if (ok && ctx->embd_cache) {
+        ctx->embd_cache->put(key, ctx->image_embd_v);
+    }
+
     return ok ? 0 : 1;
 }
 
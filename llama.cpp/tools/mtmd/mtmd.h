@@ -82,6 +82,11 @@ struct mtmd_context_params {
     enum ggml_log_level verbosity;
     const char * image_marker; // deprecated, use media_marker instead
     const char * media_marker;
+
+    // cache of encoder outputs, keyed by a hash of the preprocessed image/audio
+    // repeated images (for ex. in a multi-turn conversation) are then encoded only once
+    size_t       embd_cache_size; // max size of the in-memory cache in bytes, 0 = disabled
+    const char * embd_cache_dir;  // directory used to persist the cache on disk, nullptr = disabled
 };
 
 MTMD_API const char * mtmd_default_marker(void);
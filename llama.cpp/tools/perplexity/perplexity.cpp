@@ -13,6 +13,7 @@
 #include <ctime>
 #include <fstream>
 #include <mutex>
+#include <numeric>
 #include <random>
 #include <sstream>
 #include <thread>
@@ -170,6 +171,90 @@ static void process_logits(std::ostream& out, int n_vocab, const float * logits,
     out.write((const char *)log_probs.data(), n_token*nv*sizeof(uint16_t));
 }
 
+// top-k base log-prob files (--kl-divergence-top-k) store per token:
+//   - the log-prob of the next token (f32)
+//   - the log of the probability mass outside of the top-k (f32)
+//   - the ids of the top-k tokens in descending order of probability (i32)
+//   - their log-probs, quantized to -KLD_TOP_K_SCALE*log_prob (u16), i.e. down to -32 with a resolution of 1/2048
+#define KLD_TOP_K_SCALE 2048.0f
+
+static size_t kld_top_k_record_size(int top_k) {
+    return GGML_PAD(2*sizeof(float) + top_k*(sizeof(int32_t) + sizeof(uint16_t)), sizeof(float));
+}
+
+static double log_softmax_top_k(int n_vocab, const float * logits, int top_k, int tok, std::vector<int32_t> & ids, uint8_t * record) {
+    float max_logit = logits[0];
+    for (int i = 1; i < n_vocab; ++i) {
+        max_logit = std::max(max_logit, logits[i]);
+    }
+
+    ids.resize(n_vocab);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::nth_element(ids.begin(), ids.begin() + top_k, ids.end(), [logits](int32_t a, int32_t b) {
+        return logits[a] > logits[b];
+    });
+    std::sort(ids.begin(), ids.begin() + top_k, [logits](int32_t a, int32_t b) {
+        return logits[a] > logits[b];
+    });
+
+    double sum_exp_top  = 0.0;
+    double sum_exp_tail = 0.0;
+    for (int i = 0; i < top_k; ++i) {
+        sum_exp_top += expf(logits[ids[i]] - max_logit);
+    }
+    for (int i = top_k; i < n_vocab; ++i) {
+        sum_exp_tail += expf(logits[ids[i]] - max_logit);
+    }
+    const float log_sum_exp = log(sum_exp_top + sum_exp_tail);
+
+    float    * d  = (float *) record;
+    int32_t  * id = (int32_t *) (d + 2);
+    uint16_t * q  = (uint16_t *) (id + top_k);
+
+    d[0] = logits[tok] - max_logit - log_sum_exp;
+    d[1] = sum_exp_tail > 0.0 ? log(sum_exp_tail) - log_sum_exp : -INFINITY;
+    for (int i = 0; i < top_k; ++i) {
+        // clamp to the range of the u16 - masked logits give -inf and rounding can give slightly more than 0
+        const float log_prob = std::min(0.0f, std::max(-32.0f, logits[ids[i]] - max_logit - log_sum_exp));
+        id[i] = ids[i];
+        q[i]  = std::min(65535, nearest_int(-KLD_TOP_K_SCALE*log_prob));
+    }
+
+    return -d[0];
+}
+
+static void process_logits_top_k(std::ostream& out, int n_vocab, const float * logits, const int * tokens, int n_token, int top_k,
+        std::vector<std::thread> & workers, std::vector<uint8_t> & records, double & nll, double & nll2) {
+    std::mutex mutex;
+    const size_t record_size = kld_top_k_record_size(top_k);
+    int counter = 0;
+    auto compute = [&mutex, &counter, &records, &nll, &nll2, n_vocab, logits, tokens, n_token, top_k, record_size] () {
+        std::vector<int32_t> ids;
+        double local_nll  = 0;
+        double local_nll2 = 0;
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            int i = counter++;
+            if (i >= n_token) {
+                nll += local_nll; nll2 += local_nll2;
+                break;
+            }
+            lock.unlock();
+            const double v = log_softmax_top_k(n_vocab, logits + size_t(i)*n_vocab, top_k, tokens[i+1], ids, records.data() + i*record_size);
+            local_nll += v;
+            local_nll2 += v*v;
+        }
+    };
+    for (auto & w : workers) {
+        w = std::thread(compute);
+    }
+    compute();
+    for (auto & w : workers) {
+        w.join();
+    }
+    out.write((const char *)records.data(), n_token*record_size);
+}
+
 struct kl_divergence_result {
     double sum_nll          = 0.0;
     double sum_nll2         = 0.0;
@@ -182,10 +267,39 @@ struct kl_divergence_result {
     double sum_p_diff2      = 0.0;
     double sum_p_diff4      = 0.0;
     float  max_p_diff       = 0.0f;
+    double sum_tail_base    = 0.0;
     size_t n_same_top       = 0.0;
     size_t count            = 0.0;
 };
 
+static std::pair<double, float> kld_accumulate(kl_divergence_result & kld, float nll, float nll_base, double sum, bool same_top) {
+    kld.sum_nll  += nll;
+    kld.sum_nll2 += nll*nll;
+
+    kld.sum_nll_base  += nll_base;
+    kld.sum_nll_base2 += nll_base*nll_base;
+
+    kld.sum_nll_nll_base += nll*nll_base;
+
+    kld.sum_kld  += sum;
+    kld.sum_kld2 += sum*sum;
+    ++kld.count;
+    if (same_top) {
+        ++kld.n_same_top;
+    }
+
+    const float p_base = expf(-nll_base);
+    const float p = expf(-nll);
+    const float p_diff = p - p_base;
+    kld.sum_p_diff  += p_diff;
+    const double p_diff2 = p_diff*p_diff;
+    kld.sum_p_diff2 += p_diff2;
+    kld.sum_p_diff4 += p_diff2*p_diff2;
+    kld.max_p_diff = std::max(kld.max_p_diff, std::fabs(p_diff));
+
+    return std::make_pair(sum, p_diff);
+}
+
 static std::pair<double, float> log_softmax(int n_vocab, const float * logits, const uint16_t * base_log_prob, int tok, kl_divergence_result & kld) {
     float max_logit = logits[0];
     int imax = 0;
@@ -206,14 +320,7 @@ static std::pair<double, float> log_softmax(int n_vocab, const float * logits, c
     base_log_prob += 4;
 
     const float nll = max_logit + log_sum_exp - logits[tok];
-    kld.sum_nll  += nll;
-    kld.sum_nll2 += nll*nll;
-
     const float nll_base = -(scale*base_log_prob[tok] + min_log_prob);
-    kld.sum_nll_base  += nll_base;
-    kld.sum_nll_base2 += nll_base*nll_base;
-
-    kld.sum_nll_nll_base += nll*nll_base;
 
     max_logit += log_sum_exp;
     double sum = 0;
@@ -230,32 +337,60 @@ static std::pair<double, float> log_softmax(int n_vocab, const float * logits, c
             sum += p_base * (p_log_base - logits[i] + max_logit);
         }
     }
-    kld.sum_kld  += sum;
-    kld.sum_kld2 += sum*sum;
-    ++kld.count;
-    if (imax == imax_base) {
-        ++kld.n_same_top;
+
+    return kld_accumulate(kld, nll, nll_base, sum, imax == imax_base);
+}
+
+static std::pair<double, float> log_softmax_top_k(int n_vocab, const float * logits, const uint8_t * base_record, int top_k, int tok, kl_divergence_result & kld) {
+    float max_logit = logits[0];
+    int imax = 0;
+    for (int i = 1; i < n_vocab; ++i) {
+        if (logits[i] > max_logit) {
+            max_logit = logits[i];
+            imax = i;
+        }
     }
+    double sum_exp = 0.0;
+    for (int i = 0; i < n_vocab; ++i) {
+        sum_exp += expf(logits[i] - max_logit);
+    }
+    const float log_sum_exp = log(sum_exp);
 
-    const float p_base = expf(-nll_base);
-    const float p = expf(-nll);
-    const float p_diff = p - p_base;
-    kld.sum_p_diff  += p_diff;
-    const double p_diff2 = p_diff*p_diff;
-    kld.sum_p_diff2 += p_diff2;
-    kld.sum_p_diff4 += p_diff2*p_diff2;
-    kld.max_p_diff = std::max(kld.max_p_diff, std::fabs(p_diff));
+    const float    * d  = (const float *) base_record;
+    const int32_t  * id = (const int32_t *) (d + 2);
+    const uint16_t * q  = (const uint16_t *) (id + top_k);
 
-    return std::make_pair(sum, p_diff);
+    const float nll = max_logit + log_sum_exp - logits[tok];
+    const float nll_base = -d[0];
+
+    max_logit += log_sum_exp;
+    double sum = 0;
+    double p_top = 0;
+    for (int i = 0; i < top_k; ++i) {
+        const float p_log_base = -q[i]/KLD_TOP_K_SCALE;
+        const float p_log = logits[id[i]] - max_logit;
+        sum   += expf(p_log_base) * (p_log_base - p_log);
+        p_top += expf(p_log);
+    }
+
+    // the tokens outside of the top-k are compared as a single bucket - this underestimates the KL divergence by the
+    // base tail mass times the KL divergence between the renormalized tails
+    const double p_tail_base = expf(d[1]);
+    if (p_tail_base > 0.0) {
+        sum += p_tail_base * (d[1] - log(std::max(1.0 - p_top, 1e-9)));
+    }
+    kld.sum_tail_base += p_tail_base;
+
+    return kld_accumulate(kld, nll, nll_base, sum, top_k > 0 && imax == id[0]);
 }
 
 static void process_logits(int n_vocab, const float * logits, const int * tokens, int n_token,
-        std::vector<std::thread> & workers, const std::vector<uint16_t> & base_log_probs, kl_divergence_result & kld,
+        std::vector<std::thread> & workers, const uint8_t * base_log_probs, int top_k, kl_divergence_result & kld,
         float * kld_values, float * p_diff_values) {
     std::mutex mutex;
-    const int nv = 2*((n_vocab + 1)/2) + 4;
+    const size_t record_size = top_k > 0 ? kld_top_k_record_size(top_k) : (2*((n_vocab + 1)/2) + 4)*sizeof(uint16_t);
     int counter = 0;
-    auto compute = [&mutex, &counter, &base_log_probs, &kld, n_vocab, logits, tokens, n_token, nv, kld_values, p_diff_values] () {
+    auto compute = [&mutex, &counter, base_log_probs, &kld, n_vocab, logits, tokens, n_token, top_k, record_size, kld_values, p_diff_values] () {
         kl_divergence_result local_kld;
         while (true) {
             std::unique_lock<std::mutex> lock(mutex);
@@ -271,13 +406,17 @@ static void process_logits(int n_vocab, const float * logits, const int * tokens
                 kld.sum_p_diff       += local_kld.sum_p_diff;
                 kld.sum_p_diff2      += local_kld.sum_p_diff2;
                 kld.sum_p_diff4      += local_kld.sum_p_diff4;
+                kld.sum_tail_base    += local_kld.sum_tail_base;
                 kld.n_same_top       += local_kld.n_same_top;
                 kld.max_p_diff        = std::max(kld.max_p_diff, local_kld.max_p_diff);
                 kld.count            += local_kld.count;
                 break;
             }
             lock.unlock();
-            std::pair<double, float> v = log_softmax(n_vocab, logits + size_t(i)*n_vocab, base_log_probs.data() + i*nv, tokens[i+1], local_kld);
+            const uint8_t * base = base_log_probs + i*record_size;
+            std::pair<double, float> v = top_k > 0
+                ? log_softmax_top_k(n_vocab, logits + size_t(i)*n_vocab, base, top_k, tokens[i+1], local_kld)
+                : log_softmax(n_vocab, logits + size_t(i)*n_vocab, (const uint16_t *) base, tokens[i+1], local_kld);
             kld_values[i]    = (float)v.first;
             p_diff_values[i] = v.second;
         }
@@ -461,8 +600,13 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
             LOG_ERR("%s: failed to open %s for writing\n", __func__, params.logits_file.c_str());
             return {};
         }
-        LOG_INF("%s: saving all logits to %s\n", __func__, params.logits_file.c_str());
-        logits_stream.write("_logits_", 8);
+        if (params.kl_divergence_top_k > 0) {
+            LOG_INF("%s: saving the top-%d log-probs to %s\n", __func__, params.kl_divergence_top_k, params.logits_file.c_str());
+            logits_stream.write("_logitk_", 8);
+        } else {
+            LOG_INF("%s: saving all logits to %s\n", __func__, params.logits_file.c_str());
+            logits_stream.write("_logits_", 8);
+        }
         logits_stream.write(reinterpret_cast<const char *>(&n_ctx), sizeof(n_ctx));
     }
 
@@ -515,13 +659,21 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
 
     std::vector<std::thread> workers(std::thread::hardware_concurrency() - 1);
 
+    const int top_k = std::min(params.kl_divergence_top_k, n_vocab);
+
     std::vector<uint16_t> log_probs;
+    std::vector<uint8_t>  log_probs_top_k;
     if (!params.logits_file.empty()) {
         logits_stream.write((const char *)&n_vocab, sizeof(n_vocab));
         logits_stream.write((const char *)&n_chunk, sizeof(n_chunk));
+        if (top_k > 0) {
+            logits_stream.write((const char *)&top_k, sizeof(top_k));
+            log_probs_top_k.resize(n_ctx * kld_top_k_record_size(top_k));
+        } else {
+            const int nv = 2*((n_vocab + 1)/2) + 4;
+            log_probs.resize(n_ctx * nv);
+        }
         logits_stream.write((const char *)tokens.data(), n_chunk*n_ctx*sizeof(tokens[0]));
-        const int nv = 2*((n_vocab + 1)/2) + 4;
-        log_probs.resize(n_ctx * nv);
     }
 
     // We get the logits for all the tokens in the context window (params.n_ctx)
@@ -612,7 +764,11 @@ static results_perplexity perplexity(llama_context * ctx, const common_params &
             const float * all_logits = num_batches > 1 ? logits.data() : llama_get_logits_ith(ctx, seq*n_ctx + first);
 
             llama_token * tokens_data = tokens.data() + start + seq*n_ctx + first;
-            if (!params.logits_file.empty()) {
+            if (!params.logits_file.empty() && top_k > 0) {
+                process_logits_top_k(logits_stream, n_vocab, all_logits,
+                        tokens_data, n_ctx - 1 - first, top_k,
+                        workers, log_probs_top_k, nll, nll2);
+            } else if (!params.logits_file.empty()) {
                 process_logits(logits_stream, n_vocab, all_logits,
                         tokens_data, n_ctx - 1 - first,
                         workers, log_probs, nll, nll2);
@@ -1685,6 +1841,52 @@ static void multiple_choice_score(llama_context * ctx, const common_params & par
     LOG_INF("\n");
 }
 
+// reads the base log-probs chunk by chunk - the next chunk is read on a background thread while the current one is evaluated
+struct kld_base_reader {
+    std::ifstream & in;
+    const size_t    chunk_size;
+    int             n_left;
+
+    std::vector<uint8_t> cur;
+    std::vector<uint8_t> next;
+    bool                 next_ok = false;
+    std::thread          worker;
+
+    kld_base_reader(std::ifstream & in, size_t chunk_size, int n_chunk) : in(in), chunk_size(chunk_size), n_left(n_chunk) {
+        prefetch();
+    }
+
+    ~kld_base_reader() {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+
+    void prefetch() {
+        if (n_left-- <= 0) {
+            return;
+        }
+        next.resize(chunk_size);
+        worker = std::thread([this] {
+            next_ok = !in.read((char *) next.data(), chunk_size).fail();
+        });
+    }
+
+    // returns the log-probs of the next chunk, or nullptr if they could not be read
+    const uint8_t * read() {
+        if (!worker.joinable()) {
+            return nullptr;
+        }
+        worker.join();
+        if (!next_ok) {
+            return nullptr;
+        }
+        cur.swap(next);
+        prefetch();
+        return cur.data();
+    }
+};
+
 static void kl_divergence(llama_context * ctx, const common_params & params) {
     const llama_model * model = llama_get_model(ctx);
     const llama_vocab * vocab = llama_model_get_vocab(model);
@@ -1698,10 +1900,12 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
         LOG_ERR("%s: failed to open %s\n", __func__, params.logits_file.c_str());
         return;
     }
+    bool has_top_k = false;
     {
         char check[9]; check[8] = 0;
         in.read(check, 8);
-        if (in.fail() || strncmp("_logits_", check, 8) != 0) {
+        has_top_k = !in.fail() && strncmp("_logitk_", check, 8) == 0;
+        if (in.fail() || (strncmp("_logits_", check, 8) != 0 && !has_top_k)) {
             LOG_ERR("%s: %s does not look like a file containing log-probabilities\n", __func__, params.logits_file.c_str());
             return;
         }
@@ -1716,9 +1920,13 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
 
     int n_vocab;
     int n_chunk;
+    int top_k = 0;
     in.read((char *)&n_vocab, sizeof(n_vocab));
     in.read((char *)&n_chunk, sizeof(n_chunk));
-    if (in.fail()) {
+    if (has_top_k) {
+        in.read((char *)&top_k, sizeof(top_k));
+    }
+    if (in.fail() || (has_top_k && (top_k <= 0 || top_k > n_vocab))) {
         LOG_ERR("%s: failed reading n_vocab, n_chunk from %s\n", __func__, params.logits_file.c_str());
         return;
     }
@@ -1738,7 +1946,13 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
     const bool add_bos = llama_vocab_get_add_bos(vocab);
     GGML_ASSERT(!llama_vocab_get_add_eos(vocab));
 
-    std::vector<uint16_t> log_probs_uint16(size_t(n_ctx - 1 - n_ctx/2) * nv);
+    if (top_k > 0) {
+        LOG_INF("%s: base log-probs: top-%d per token\n", __func__, top_k);
+    }
+
+    const size_t record_size = top_k > 0 ? kld_top_k_record_size(top_k) : nv*sizeof(uint16_t);
+    kld_base_reader base_reader(in, size_t(n_ctx - 1 - n_ctx/2) * record_size, n_chunk);
+
     std::vector<float>    kld_values(size_t(n_ctx - 1 - n_ctx/2)*n_chunk);
     std::vector<float> p_diff_values(size_t(n_ctx - 1 - n_ctx/2)*n_chunk);
     std::vector<float> logits;
@@ -1776,7 +1990,8 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
 
         const auto t_start = std::chrono::high_resolution_clock::now();
 
-        if (in.read((char *)log_probs_uint16.data(), log_probs_uint16.size()*sizeof(uint16_t)).fail()) {
+        const uint8_t * base_log_probs = base_reader.read();
+        if (base_log_probs == nullptr) {
             LOG_ERR("%s: failed reading log-probs for chunk %d\n", __func__, i);
             return;
         }
@@ -1838,7 +2053,7 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
         const int first = n_ctx/2;
         const float * all_logits = num_batches > 1 ? logits.data() : llama_get_logits(ctx);
         process_logits(n_vocab, all_logits + size_t(first)*n_vocab, tokens.data() + start + first, n_ctx - 1 - first,
-                workers, log_probs_uint16, kld, kld_ptr, p_diff_ptr);
+                workers, base_log_probs, top_k, kld, kld_ptr, p_diff_ptr);
         p_diff_ptr += n_ctx - 1 - first;
         kld_ptr    += n_ctx - 1 - first;
 
@@ -1933,6 +2148,10 @@ static void kl_divergence(llama_context * ctx, const common_params & params) {
     LOG(" 5.0%%   KLD: %10.6f\n", percentile(kld_values, 0.050f));
     LOG(" 1.0%%   KLD: %10.6f\n", percentile(kld_values, 0.010f));
     LOG("Minimum KLD: %10.6f\n", kld_values.front());
+    if (top_k > 0) {
+        // the KLD above only compares the tail of the base distribution as a whole
+        LOG("Mean base probability outside of the top-%d: %10.6f\n", top_k, kld.sum_tail_base/kld.count);
+    }
 
     LOG("\n");
 
@@ -8,6 +8,7 @@
 #include "log.h"
 #include "sampling.h"
 #include "speculative.h"
+#include "vector-index.h"
 #include "mtmd.h"
 #include "mtmd-helper.h"
 
@@ -24,8 +25,10 @@
 #include <cstddef>
 #include <cinttypes>
 #include <deque>
+#include <fstream>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <signal.h>
 #include <thread>
 #include <unordered_map>
@@ -112,6 +115,7 @@ struct slot_params {
     bool stream        = true;
     bool cache_prompt  = true; // remember the prompt to avoid reprocessing all prompt
     bool return_tokens = false;
+    bool lookahead     = true; // use lookahead decoding when enabled with --lookahead
 
     int32_t n_keep    =  0; // number of tokens to keep from initial prompt
     int32_t n_discard =  0; // number of tokens after n_keep that may be discarded when shifting context, 0 defaults to half
@@ -123,6 +127,8 @@ struct slot_params {
 
     std::vector<common_adapter_lora_info> lora;
 
+    std::vector<float> control_vectors; // scale of each --control-vector for this request, empty = the server-wide mix
+
     std::vector<std::string> antiprompt;
     std::vector<std::string> response_fields;
     bool timings_per_token = false;
@@ -203,9 +209,11 @@ struct slot_params {
             {"speculative.n_max",         speculative.n_max},
             {"speculative.n_min",         speculative.n_min},
             {"speculative.p_min",         speculative.p_min},
+            {"lookahead",                 lookahead},
             {"timings_per_token",         timings_per_token},
             {"post_sampling_probs",       post_sampling_probs},
             {"lora",                      lora},
+            {"control_vectors",           control_vectors},
         };
     }
 };
@@ -238,6 +246,9 @@ struct server_task {
     // used by SERVER_TASK_TYPE_SET_LORA
     std::vector<common_adapter_lora_info> set_lora;
 
+    // used to measure the time spent in the queue
+    int64_t t_created = ggml_time_us();
+
     server_task(server_task_type type) : type(type) {}
 
     static slot_params params_from_json_cmpl(
@@ -262,6 +273,7 @@ struct server_task {
         params.stream           = json_value(data, "stream",             false);
         params.cache_prompt     = json_value(data, "cache_prompt",       true);
         params.return_tokens    = json_value(data, "return_tokens",      false);
+        params.lookahead        = json_value(data, "lookahead",          true);
         params.n_predict        = json_value(data, "n_predict",          json_value(data, "max_tokens", defaults.n_predict));
         params.n_indent         = json_value(data, "n_indent",           defaults.n_indent);
         params.n_keep           = json_value(data, "n_keep",             defaults.n_keep);
@@ -319,6 +331,14 @@ struct server_task {
             params.lora = params_base.lora_adapters;
         }
 
+        if (data.contains("control_vectors")) {
+            if (data.at("control_vectors").is_array()) {
+                params.control_vectors = parse_cvec_request(params_base.control_vectors.size(), data.at("control_vectors"));
+            } else {
+                throw std::runtime_error("Error: 'control_vectors' must be an array of objects with 'id' and 'scale' fields");
+            }
+        }
+
         // TODO: add more sanity checks for the input parameters
 
         if (params.sampling.penalty_last_n < -1) {
@@ -1238,6 +1258,121 @@ struct server_task_result_apply_lora : server_task_result {
     }
 };
 
+// lookahead (Jacobi) decoding state of a slot, based on examples/lookahead
+// a window of W guesses is refined by one Jacobi iteration per generation step, the trajectories of its columns
+// give n-grams of size N and up to G of the n-grams that start with the current token are verified in the same batch
+// ref: https://lmsys.org/blog/2023-11-21-lookahead-decoding/
+struct slot_lookahead {
+    int32_t W = 0;
+    int32_t N = 0;
+    int32_t G = 0;
+
+    // for each first token, a ring buffer of up to G observed n-grams without their first token
+    struct ngram_ring {
+        int32_t cnt  = 0;
+        int32_t head = 0;
+
+        std::vector<llama_token> tokens; // [G][N - 1]
+    };
+
+    std::unordered_map<llama_token, ngram_ring> ngrams;
+
+    // the guesses of the last N - 1 Jacobi iterations
+    std::vector<std::vector<llama_token>> tokens_j; // [N - 1][W]
+
+    // state of the current step, the sequences are borrowed from the server for a single batch
+    std::vector<llama_seq_id> seqs;      // [W + n_verify] - the window columns followed by the verified n-grams
+    int32_t                   n_verify = 0;
+
+    std::vector<std::vector<llama_token>> verify_tokens;  // [n_verify][N]
+    std::vector<std::vector<int32_t>>     verify_i_batch; // [n_verify][N]
+    std::vector<int32_t>                  i_batch_last;   // [W] - outputs of the last level of the window
+
+    int32_t i_batch_end = 0; // all the tokens of the step are in the batch before this index
+
+    bool enabled() const {
+        return W > 0;
+    }
+
+    bool active() const {
+        return !seqs.empty();
+    }
+
+    void init(int32_t w, int32_t n, int32_t g) {
+        W = w;
+        N = n;
+        G = g;
+    }
+
+    // start a new generation, the window is seeded with prompt tokens
+    void reset(const llama_tokens & prompt) {
+        ngrams.clear();
+
+        tokens_j.assign(N - 1, std::vector<llama_token>(W, 0));
+        if (prompt.empty()) {
+            return;
+        }
+        for (int j = 0; j < N - 1; j++) {
+            for (int i = 0; i < W; i++) {
+                tokens_j[j][i] = prompt[prompt.size() - 1 - (j*W + i) % prompt.size()];
+            }
+        }
+    }
+
+    int32_t n_ngrams(llama_token id) const {
+        const auto it = ngrams.find(id);
+        return it == ngrams.end() ? 0 : it->second.cnt;
+    }
+
+    const llama_token * get_ngram(llama_token id, int32_t g) const {
+        return ngrams.at(id).tokens.data() + g*(N - 1);
+    }
+
+    void add_ngram(llama_token first, const llama_token * ngram) {
+        auto & ring = ngrams[first];
+        if (ring.tokens.empty()) {
+            ring.tokens.resize(G*(N - 1));
+        }
+
+        // filter-out repeating n-grams
+        for (int k = 0; k < ring.cnt; ++k) {
+            if (std::equal(ngram, ngram + N - 1, ring.tokens.begin() + k*(N - 1))) {
+                return;
+            }
+        }
+
+        std::copy(ngram, ngram + N - 1, ring.tokens.begin() + ring.head*(N - 1));
+
+        ring.cnt  = std::min(G, ring.cnt + 1);
+        ring.head = (ring.head + 1) % G;
+    }
+
+    // one Jacobi iteration after the token of level v of the step has been accepted
+    // for v == 0 the last level is taken from the outputs of the batch and the observed n-grams are collected
+    void update(int v, const std::vector<llama_token> & next) {
+        const std::vector<llama_token> tokens_prev = tokens_j[0];
+
+        for (int j = 0; j < N - 2; j++) {
+            tokens_j[j] = tokens_j[j + 1];
+        }
+
+        if (v > 0) {
+            tokens_j[N - 2] = tokens_j[0];
+            return;
+        }
+
+        tokens_j[N - 2] = next;
+
+        std::vector<llama_token> ngram(N - 1);
+        for (int f = 0; f < W; ++f) {
+            for (int j = 0; j < N - 1; ++j) {
+                ngram[j] = tokens_j[j][f];
+            }
+            add_ngram(tokens_prev[f], ngram.data());
+        }
+    }
+};
+
 struct server_slot {
     int id;
     int id_task = -1;
@@ -1255,8 +1390,12 @@ struct server_slot {
 
     common_speculative * spec = nullptr;
 
+    slot_lookahead la;
+
     std::vector<common_adapter_lora_info> lora;
 
+    std::vector<float> control_vectors; // applied to the sequence of the slot
+
     // the index relative to completion multi-task request
     size_t index = 0;
 
@@ -1312,8 +1451,10 @@ struct server_slot {
     // stats
     size_t n_sent_text        = 0; // number of sent text character
 
+    int64_t t_task_created;
     int64_t t_start_process_prompt;
     int64_t t_start_generation;
+    int64_t t_last_token;
 
     double t_prompt_processing; // ms
     double t_token_generation;  // ms
@@ -1324,6 +1465,10 @@ struct server_slot {
     int32_t n_draft_total = 0;      // Total draft tokens generated
     int32_t n_draft_accepted = 0;   // Draft tokens actually accepted
 
+    // Lookahead decoding stats
+    int32_t n_lookahead_steps  = 0; // generation steps that decoded a lookahead window
+    int32_t n_lookahead_tokens = 0; // tokens generated by these steps
+
     void reset() {
         SLT_DBG(*this, "%s", "\n");
 
@@ -1348,6 +1493,9 @@ struct server_slot {
         // clear speculative decoding stats
         n_draft_total = 0;
         n_draft_accepted = 0;
+
+        n_lookahead_steps  = 0;
+        n_lookahead_tokens = 0;
     }
 
     bool need_embd() const {
@@ -1394,6 +1542,11 @@ struct server_slot {
         return ctx_dft && params.speculative.n_max > 0 && params.cache_prompt;
     }
 
+    bool can_lookahead() const {
+        // the borrowed sequences use the server-wide control vector
+        return la.enabled() && params.lookahead && need_logits() && params.control_vectors.empty();
+    }
+
     void add_token(const completion_token_output & token) {
         if (!is_processing()) {
             SLT_WRN(*this, "%s", "slot is not processing\n");
@@ -1502,6 +1655,14 @@ struct server_slot {
                     draft_ratio, n_draft_accepted, n_draft_total
             );
         }
+
+        if (n_lookahead_steps > 0) {
+            SLT_INF(*this,
+                    "\n"
+                    "lookahead: %5d steps, %5d tokens (%0.3f tokens per step)\n",
+                    n_lookahead_steps, n_lookahead_tokens, (float) n_lookahead_tokens / n_lookahead_steps
+            );
+        }
     }
 
     json to_json() const {
@@ -1510,6 +1671,13 @@ struct server_slot {
             {"id_task",       id_task},
             {"n_ctx",         n_ctx},
             {"speculative",   can_speculate()},
+            {"lookahead",
+                {
+                    {"enabled",  can_lookahead()},
+                    {"n_steps",  n_lookahead_steps},
+                    {"n_tokens", n_lookahead_tokens},
+                }
+            },
             {"is_processing", is_processing()},
             {"params",        params.to_json()},
             {"prompt",        prompt_tokens.detokenize(ctx, true)},
@@ -1526,6 +1694,64 @@ struct server_slot {
     }
 };
 
+// cumulative histogram, exported as a Prometheus histogram
+// the observations are recorded with relaxed atomics by the update loop, so that the HTTP threads can read them without
+// synchronizing with it
+struct server_histogram {
+    const std::vector<double> bounds; // upper bounds of the buckets, the last bucket (+Inf) is implicit
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<double> sum { 0.0 };
+
+    explicit server_histogram(std::vector<double> bounds) : bounds(std::move(bounds)), counts(new std::atomic<uint64_t>[this->bounds.size() + 1]) {
+        for (size_t i = 0; i <= this->bounds.size(); ++i) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // HDR-style buckets: n_sub buckets per power of 2, from min to at least max
+    static std::vector<double> bounds_exp(double min, double max, int n_sub) {
+        std::vector<double> res;
+        for (int i = 0; res.empty() || res.back() < max; ++i) {
+            res.push_back(min * std::exp2((double) i / n_sub));
+        }
+        return res;
+    }
+
+    static std::vector<double> bounds_lin(double step, int n) {
+        std::vector<double> res;
+        for (int i = 1; i <= n; ++i) {
+            res.push_back(step * i);
+        }
+        return res;
+    }
+
+    void observe(double value, uint64_t n = 1) {
+        const size_t i = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+
+        counts[i].fetch_add(n, std::memory_order_relaxed);
+
+        // single writer - no need for a compare-exchange loop
+        sum.store(sum.load(std::memory_order_relaxed) + value*n, std::memory_order_relaxed);
+    }
+
+    void to_prometheus(std::ostream & os, const std::string & name, const std::string & help) const {
+        os << "# HELP llamacpp:" << name << " " << help << "\n"
+           << "# TYPE llamacpp:" << name << " histogram\n";
+
+        uint64_t count = 0;
+        for (size_t i = 0; i <= bounds.size(); ++i) {
+            count += counts[i].load(std::memory_order_relaxed);
+
+            const std::string le = i < bounds.size() ? string_format("%g", bounds[i]) : "+Inf";
+            os << "llamacpp:" << name << "_bucket{le=\"" << le << "\"} " << count << "\n";
+        }
+
+        os << "llamacpp:" << name << "_sum "   << sum.load(std::memory_order_relaxed) << "\n"
+           << "llamacpp:" << name << "_count " << count << "\n";
+    }
+};
+
 struct server_metrics {
     int64_t t_start = 0;
 
@@ -1543,15 +1769,39 @@ struct server_metrics {
     uint64_t n_decode_total     = 0;
     uint64_t n_busy_slots_total = 0;
 
+    // latencies in seconds
+    server_histogram queue_wait     { server_histogram::bounds_exp(1e-4, 1e3, 2) };
+    server_histogram ttft           { server_histogram::bounds_exp(1e-4, 1e3, 2) };
+    server_histogram itl            { server_histogram::bounds_exp(1e-4, 1e2, 2) };
+    server_histogram prompt_per_tok { server_histogram::bounds_exp(1e-6, 1e0, 2) };
+
+    // ratios
+    server_histogram batch_fill     { server_histogram::bounds_lin(0.05, 20) };
+    server_histogram slot_kv_usage  { server_histogram::bounds_lin(0.05, 20) };
+
     void init() {
         t_start = ggml_time_us();
     }
 
+    void on_task_started(const server_task & task) {
+        queue_wait.observe((ggml_time_us() - task.t_created) / 1e6);
+    }
+
     void on_prompt_eval(const server_slot & slot) {
         n_prompt_tokens_processed_total += slot.n_prompt_tokens_processed;
         n_prompt_tokens_processed       += slot.n_prompt_tokens_processed;
         t_prompt_processing             += slot.t_prompt_processing;
         t_prompt_processing_total       += slot.t_prompt_processing;
+
+        ttft.observe((slot.t_start_generation - slot.t_task_created) / 1e6);
+        if (slot.n_prompt_tokens_processed > 0) {
+            prompt_per_tok.observe(slot.t_prompt_processing / 1e3 / slot.n_prompt_tokens_processed);
+        }
+    }
+
+    // n_tokens > 1 when several tokens are accepted at once (speculative decoding)
+    void on_tokens_generated(const server_slot & slot, int64_t t_current, int n_tokens) {
+        itl.observe((t_current - slot.t_last_token) / 1e6 / n_tokens, n_tokens);
     }
 
     void on_prediction(const server_slot & slot) {
@@ -1561,13 +1811,26 @@ struct server_metrics {
         t_tokens_generation_total  += slot.t_token_generation;
     }
 
-    void on_decoded(const std::vector<server_slot> & slots) {
+    void on_embd_batch(int32_t n_tokens, int32_t n_ubatch, uint64_t t_ms) {
+        n_decode_total++;
+        batch_fill.observe((double) n_tokens / n_ubatch);
+
+        n_prompt_tokens_processed_total += n_tokens;
+        n_prompt_tokens_processed       += n_tokens;
+        t_prompt_processing             += t_ms;
+        t_prompt_processing_total       += t_ms;
+    }
+
+    void on_decoded(const std::vector<server_slot> & slots, int32_t n_tokens, int32_t n_batch) {
         n_decode_total++;
         for (const auto & slot : slots) {
             if (slot.is_processing()) {
                 n_busy_slots_total++;
+                slot_kv_usage.observe((double) slot.n_past / slot.n_ctx);
             }
         }
+
+        batch_fill.observe((double) n_tokens / n_batch);
     }
 
     void reset_bucket() {
@@ -1896,6 +2159,19 @@ struct server_context {
 
     llama_batch batch {};
 
+    // the --control-vector files loaded one by one, mixed per request with the "control_vectors" field
+    std::vector<common_control_vector_data> control_vectors;
+
+    // embedding and rerank tasks that are evaluated together in a single batch, one sequence per task
+    // the sequences [n_parallel, n_parallel + n_seq_embd) are reserved for them (see update_embeddings())
+    std::vector<server_task> queue_embd;
+    llama_batch batch_embd {};
+    int32_t n_seq_embd = 0;
+
+    // sequences available to the lookahead steps of the slots (see update_slots())
+    std::vector<llama_seq_id> seq_la_free;
+    int32_t la_next = 0; // the slot that gets the first chance to start a lookahead step, for fairness
+
     bool clean_kv_cache = true;
     bool add_bos_token  = true;
     bool has_eos_token  = false;
@@ -1917,6 +2193,11 @@ struct server_context {
     common_chat_templates_ptr chat_templates;
     oaicompat_parser_options  oai_parser_opt;
 
+    // nearest neighbor index of the embeddings for the /vector endpoints
+    common_vindex_ptr vindex;
+    std::shared_mutex vindex_mutex;
+    bool              vindex_modified = false;
+
     ~server_context() {
         mtmd_free(mctx);
 
@@ -1935,6 +2216,7 @@ struct server_context {
         }
 
         llama_batch_free(batch);
+        llama_batch_free(batch_embd);
     }
 
     bool load_model(const common_params & params) {
@@ -1942,6 +2224,35 @@ struct server_context {
 
         params_base = params;
 
+        if (!params_base.embedding) {
+            params_base.n_seq_embd = 0;
+        } else if (params_base.n_seq_embd < 0) {
+            params_base.n_seq_embd = std::max(0, std::min(32, (int32_t) llama_max_parallel_sequences() - params_base.n_parallel));
+        }
+
+        params_base.n_seq_spec = 0;
+        if (params_base.speculative.lookahead_w > 0) {
+            auto & sp = params_base.speculative;
+
+            if (sp.lookahead_g <= 0) {
+                sp.lookahead_g = sp.lookahead_w;
+            }
+
+            // each lookahead step borrows W + G sequences, as many as the sequence limit allows are shared by the slots
+            const int32_t n_seq_step = sp.lookahead_w + sp.lookahead_g;
+            const int32_t n_seq_free = (int32_t) llama_max_parallel_sequences() - params_base.n_parallel - std::max(0, params_base.n_seq_embd);
+
+            if (!sp.model.path.empty() || !sp.model.hf_repo.empty()) {
+                SRV_WRN("%s", "lookahead decoding is not supported with a draft model - disabling\n");
+            } else if (!params_base.mmproj.path.empty() || !params_base.mmproj.url.empty()) {
+                SRV_WRN("%s", "lookahead decoding is not supported with multimodal models - disabling\n");
+            } else if (n_seq_free < n_seq_step) {
+                SRV_WRN("not enough free sequences for lookahead decoding (%d < W + G = %d) - disabling\n", n_seq_free, n_seq_step);
+            } else {
+                params_base.n_seq_spec = std::min(n_seq_step*params_base.n_parallel, (n_seq_free/n_seq_step)*n_seq_step);
+            }
+        }
+
         llama_init = common_init_from_params(params_base);
 
         model = llama_init.model.get();
@@ -1959,6 +2270,15 @@ struct server_context {
         add_bos_token = llama_vocab_get_add_bos(vocab);
         has_eos_token = llama_vocab_eos(vocab) != LLAMA_TOKEN_NULL;
 
+        for (const auto & info : params_base.control_vectors) {
+            auto cvec = common_control_vector_load({ { 1.0f, info.fname } });
+            if (cvec.n_embd == -1) {
+                SRV_ERR("failed to load control vector '%s'\n", info.fname.c_str());
+                return false;
+            }
+            control_vectors.push_back(std::move(cvec));
+        }
+
         if (!params_base.speculative.model.path.empty() || !params_base.speculative.model.hf_repo.empty()) {
             SRV_INF("loading draft model '%s'\n", params_base.speculative.model.path.c_str());
 
@@ -1969,6 +2289,7 @@ struct server_context {
             params_dft.n_ctx        = params_base.speculative.n_ctx == 0 ? params_base.n_ctx / params_base.n_parallel : params_base.speculative.n_ctx;
             params_dft.n_gpu_layers = params_base.speculative.n_gpu_layers;
             params_dft.n_parallel   = 1;
+            params_dft.n_seq_embd   = 0;
             params_dft.cache_type_k = params_base.speculative.cache_type_k;
             params_dft.cache_type_v = params_base.speculative.cache_type_v;
 
@@ -2012,6 +2333,8 @@ struct server_context {
             mparams.print_timings = false;
             mparams.n_threads     = params_base.cpuparams.n_threads;
             mparams.verbosity     = params_base.verbosity > 0 ? GGML_LOG_LEVEL_DEBUG : GGML_LOG_LEVEL_INFO;
+            mparams.embd_cache_size = (size_t) params_base.mmproj_cache_mb * 1024 * 1024;
+            mparams.embd_cache_dir  = params_base.mmproj_cache_dir.empty() ? nullptr : params_base.mmproj_cache_dir.c_str();
             mctx = mtmd_init_from_file(mmproj_path.c_str(), model, mparams);
             if (mctx == nullptr) {
                 SRV_ERR("failed to load multimodal model, '%s'\n", mmproj_path.c_str());
@@ -2047,9 +2370,61 @@ struct server_context {
             }
         }
 
+        if (!params_base.vindex_path.empty() && !load_vindex()) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool load_vindex() {
+        const std::string & path = params_base.vindex_path;
+
+        if (!params_base.embedding || llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_NONE || llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_RANK) {
+            SRV_ERR("%s\n", "the vector index requires --embeddings and a pooled embedding model");
+            return false;
+        }
+
+        const int32_t n_embd = llama_model_n_embd(model);
+
+        if (std::ifstream(path).good()) {
+            vindex = common_vindex_load(path, params_base.use_mmap);
+            if (!vindex) {
+                return false;
+            }
+            if (common_vindex_n_embd(vindex.get()) != n_embd) {
+                SRV_ERR("vector index '%s' has %d dimensions, the model has %d\n", path.c_str(), common_vindex_n_embd(vindex.get()), n_embd);
+                return false;
+            }
+            SRV_INF("loaded vector index '%s', %" PRId64 " vectors\n", path.c_str(), common_vindex_size(vindex.get()));
+        } else {
+            common_vindex_params vparams;
+            vparams.n_embd = n_embd;
+            vparams.type   = params_base.vindex_type;
+
+            vindex = common_vindex_init(vparams);
+            if (!vindex) {
+                return false;
+            }
+            SRV_INF("created vector index '%s', type = %s\n", path.c_str(), ggml_type_name(vparams.type));
+        }
+
         return true;
     }
 
+    void save_vindex() {
+        std::unique_lock<std::shared_mutex> lock(vindex_mutex);
+
+        if (!vindex || !vindex_modified) {
+            return;
+        }
+
+        if (common_vindex_save(vindex.get(), params_base.vindex_path)) {
+            SRV_INF("saved vector index '%s', %" PRId64 " vectors\n", params_base.vindex_path.c_str(), common_vindex_size(vindex.get()));
+            vindex_modified = false;
+        }
+    }
+
     void init() {
         const int32_t n_ctx_slot = n_ctx / params_base.n_parallel;
 
@@ -2081,6 +2456,12 @@ struct server_context {
                 }
             }
 
+            if (params_base.n_seq_spec > 0) {
+                const auto & sp = params_base.speculative;
+
+                slot.la.init(sp.lookahead_w, sp.lookahead_n, sp.lookahead_g);
+            }
+
             SLT_INF(slot, "new slot n_ctx_slot = %d\n", slot.n_ctx);
 
             slot.params.sampling = params_base.sampling;
@@ -2101,7 +2482,26 @@ struct server_context {
         // note that n_batch can be > n_ctx (e.g. for non-causal attention models such as BERT where the KV cache is not used)
         {
             const int32_t n_batch = llama_n_batch(ctx);
-            batch = llama_batch_init(std::max(n_batch, params_base.n_parallel), 0, 1);
+            batch = llama_batch_init(std::max(n_batch, params_base.n_parallel), 0, n_seq_spec_step());
+        }
+
+        // the sequences after the ones of the slots and of the batched embeddings are lent to the lookahead steps
+        if (params_base.n_seq_spec > 0) {
+            const int32_t seq_first = params_base.n_parallel + std::max(0, params_base.n_seq_embd);
+            for (int32_t s = seq_first + params_base.n_seq_spec - 1; s >= seq_first; --s) {
+                seq_la_free.push_back(s);
+            }
+
+            SRV_INF("lookahead decoding: W = %d, N = %d, G = %d, n_seq_spec = %d\n",
+                    params_base.speculative.lookahead_w, params_base.speculative.lookahead_n, params_base.speculative.lookahead_g, params_base.n_seq_spec);
+        }
+
+        // without pooling, the embeddings of each token are returned and the requests are processed by the slots
+        if (params_base.n_seq_embd > 0 && llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_NONE) {
+            n_seq_embd = params_base.n_seq_embd;
+            batch_embd = llama_batch_init(llama_n_ubatch(ctx), 0, 1);
+
+            SRV_INF("batching embedding requests, n_seq_embd = %d\n", n_seq_embd);
         }
 
         metrics.init();
@@ -2191,7 +2591,214 @@ struct server_context {
         return ret;
     }
 
+    // set the control vector of a sequence to the mix of the loaded control vectors with the given scales
+    // an empty list restores the server-wide control vector
+    bool apply_control_vectors(llama_seq_id seq_id, const std::vector<float> & scales) {
+        if (scales.empty()) {
+            return llama_apply_adapter_cvec_seq(ctx, seq_id, nullptr, 0, llama_model_n_embd(model), -1, -1) == 0;
+        }
+
+        std::vector<float> data;
+        for (size_t i = 0; i < scales.size(); ++i) {
+            const auto & cvec = control_vectors[i];
+            if (data.size() < cvec.data.size()) {
+                data.resize(cvec.data.size(), 0.0f);
+            }
+            for (size_t j = 0; j < cvec.data.size(); ++j) {
+                data[j] += scales[i] * cvec.data[j];
+            }
+        }
+
+        return llama_apply_adapter_cvec_seq(ctx, seq_id, data.data(), data.size(), llama_model_n_embd(model),
+                params_base.control_vector_layer_start, params_base.control_vector_layer_end) == 0;
+    }
+
+    // max number of sequences of a token in the main batch
+    int32_t n_seq_spec_step() const {
+        if (params_base.n_seq_spec <= 0) {
+            return 1;
+        }
+
+        return 1 + params_base.speculative.lookahead_w + params_base.speculative.lookahead_g;
+    }
+
+    // queue a lookahead step of a generating slot after its sampled token, at most n_max tokens in the batch
+    // returns false if there are not enough free sequences or space in the batch
+    bool lookahead_add(server_slot & slot, int32_t n_max) {
+        auto & la = slot.la;
+
+        const int32_t W = la.W;
+        const int32_t N = la.N;
+
+        const llama_token id = slot.sampled;
+        const llama_pos   P  = slot.n_past - 1; // position of the sampled token
+
+        const int32_t n_window = (W - 1) + W*(N - 2);
+
+        int32_t g_cur = std::min(la.n_ngrams(id), (int32_t) seq_la_free.size() - W);
+
+        // back off the verification and then the whole step when the batch is busy with other work
+        g_cur = std::min(g_cur, (n_max - batch.n_tokens - n_window) / (N - 1));
+        if (g_cur < 0 || batch.n_tokens + n_window + g_cur*(N - 1) > n_max) {
+            return false;
+        }
+
+        auto * mem = llama_get_memory(ctx);
+
+        la.n_verify = g_cur;
+        la.seqs.resize(W + g_cur);
+        for (auto & s : la.seqs) {
+            s = seq_la_free.back();
+            seq_la_free.pop_back();
+
+            llama_memory_seq_cp(mem, slot.id, s, -1, -1);
+        }
+
+        // the sampled token is the first token of the window and of all the verified n-grams
+        {
+            const int32_t i = slot.i_batch;
+
+            batch.n_seq_id[i] = 1 + W + g_cur;
+            for (int32_t k = 0; k < W + g_cur; ++k) {
+                batch.seq_id[i][1 + k] = la.seqs[k];
+            }
+        }
+
+        // verification n-grams - queued before the window for less KV cache fragmentation
+        la.verify_tokens .assign(g_cur, std::vector<llama_token>(N));
+        la.verify_i_batch.assign(g_cur, std::vector<int32_t>(N));
+        for (int32_t g = 0; g < g_cur; ++g) {
+            la.verify_tokens [g][0] = id;
+            la.verify_i_batch[g][0] = slot.i_batch;
+        }
+        for (int32_t j = 0; j < N - 1; ++j) {
+            for (int32_t g = 0; g < g_cur; ++g) {
+                const llama_token t = la.get_ngram(id, g)[j];
+
+                la.verify_tokens [g][j + 1] = t;
+                la.verify_i_batch[g][j + 1] = batch.n_tokens;
+
+                common_batch_add(batch, t, P + j + 1, { la.seqs[W + g] }, true);
+            }
+        }
+
+        // the remaining W - 1 tokens of the first level of the window
+        std::vector<llama_seq_id> seq_id_look;
+        for (int32_t i = 1; i < W; ++i) {
+            seq_id_look.assign(la.seqs.begin() + i, la.seqs.begin() + W);
+
+            common_batch_add(batch, la.tokens_j[0][i], P + i, seq_id_look, false);
+        }
+
+        // the rest of the levels, the last one gives the next guesses
+        la.i_batch_last.resize(W);
+        for (int32_t j = 1; j < N - 1; ++j) {
+            for (int32_t i = 0; i < W; ++i) {
+                if (j == N - 2) {
+                    la.i_batch_last[i] = batch.n_tokens;
+                }
+
+                common_batch_add(batch, la.tokens_j[j][i], P + j + i, { la.seqs[i] }, j == N - 2);
+            }
+        }
+
+        la.i_batch_end = batch.n_tokens;
+
+        return true;
+    }
+
+    // return the borrowed sequences of the lookahead step of a slot
+    void lookahead_release(server_slot & slot) {
+        auto * mem = llama_get_memory(ctx);
+
+        for (const llama_seq_id s : slot.la.seqs) {
+            llama_memory_seq_rm(mem, s, -1, -1);
+            seq_la_free.push_back(s);
+        }
+
+        slot.la.seqs.clear();
+        slot.la.n_verify = 0;
+    }
+
+    // sample the token of the slot and accept the longest matching verification n-gram of its lookahead step
+    // i_view is the offset of the decoded batch view, the batch indices of the returned tokens are stored in idxs
+    llama_tokens lookahead_sample_and_accept(server_slot & slot, int32_t i_view, std::vector<int32_t> & idxs) {
+        auto & la = slot.la;
+
+        const int32_t W = la.W;
+        const int32_t N = la.N;
+
+        llama_tokens ids;
+
+        std::vector<bool>        active(la.n_verify, true);
+        std::vector<llama_token> next(W);
+
+        int32_t g_best = -1;
+        int32_t idx    = slot.i_batch;
+
+        for (int32_t v = 0; v < N; ++v) {
+            const llama_token id = common_sampler_sample(slot.smpl, ctx, idx - i_view);
+
+            common_sampler_accept(slot.smpl, id, true);
+
+            ids.push_back(id);
+            idxs.push_back(idx);
+
+            // one Jacobi iteration of the window, the new guesses are the greedy predictions of the last level
+            if (v == 0) {
+                const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+                for (int32_t i = 0; i < W; ++i) {
+                    const float * logits = llama_get_logits_ith(ctx, la.i_batch_last[i] - i_view);
+
+                    next[i] = std::max_element(logits, logits + n_vocab) - logits;
+                }
+            }
+            la.update(v, next);
+
+            if (llama_vocab_is_eog(vocab, id) || (slot.n_remaining > 0 && (int32_t) ids.size() >= slot.n_remaining)) {
+                break;
+            }
+
+            // continue with the first n-gram that is still consistent with the accepted tokens
+            idx = -1;
+            for (int32_t g = 0; g < la.n_verify; ++g) {
+                active[g] = active[g] && v < N - 1 && la.verify_tokens[g][v + 1] == id;
+                if (active[g] && idx < 0) {
+                    idx    = la.verify_i_batch[g][v + 1];
+                    g_best = g;
+                }
+            }
+
+            if (idx < 0) {
+                break;
+            }
+        }
+
+        // the accepted tokens of the best n-gram are moved to the sequence of the slot
+        const int32_t n_accept = ids.size() - 1;
+        if (n_accept > 0) {
+            llama_memory_seq_cp(llama_get_memory(ctx), la.seqs[W + g_best], slot.id, slot.n_past, slot.n_past + n_accept);
+
+            slot.n_past += n_accept;
+            slot.cache_tokens.insert({ ids.begin(), ids.end() - 1 });
+        }
+
+        lookahead_release(slot);
+
+        slot.n_lookahead_steps  += 1;
+        slot.n_lookahead_tokens += ids.size();
+
+        if (!active.empty()) {
+            slot.n_draft_total    += N - 1;
+            slot.n_draft_accepted += n_accept;
+        }
+
+        return ids;
+    }
+
     bool launch_slot_with_task(server_slot & slot, server_task && task) {
+        metrics.on_task_started(task);
+
         slot.reset();
         slot.id_task       = task.id;
         slot.index         = task.index;
@@ -2199,12 +2806,24 @@ struct server_context {
         slot.params        = std::move(task.params);
         slot.prompt_tokens = std::move(task.prompt_tokens);
 
+        slot.t_task_created = task.t_created;
+
         if (!are_lora_equal(slot.params.lora, slot.lora)) {
             // if lora is changed, we cannot reuse cached tokens
             slot.cache_tokens.clear();
             slot.lora = slot.params.lora;
         }
 
+        if (slot.params.control_vectors != slot.control_vectors) {
+            // the control vectors are per sequence, so the slot can still be batched with the others
+            if (!apply_control_vectors(slot.id, slot.params.control_vectors)) {
+                send_error(task, "Failed to apply the control vectors", ERROR_TYPE_SERVER);
+                return false;
+            }
+            slot.cache_tokens.clear();
+            slot.control_vectors = slot.params.control_vectors;
+        }
+
         if (!slot.prompt_tokens.validate(ctx)) {
             send_error(task, "Prompt contains invalid tokens", ERROR_TYPE_INVALID_REQUEST);
             return false;
@@ -2240,6 +2859,11 @@ struct server_context {
             slot.batch_spec = llama_batch_init(slot.params.speculative.n_max + 1, 0, 1);
         }
 
+        if (slot.can_lookahead()) {
+            // the n-gram pool is specific to the request, the window starts from the prompt tokens
+            slot.la.reset(slot.prompt_tokens.get_text_tokens());
+        }
+
         slot.state = SLOT_STATE_STARTED;
 
         SLT_INF(slot, "%s", "processing task\n");
@@ -2639,6 +3263,45 @@ struct server_context {
         queue_results.send(std::move(res));
     }
 
+    void send_embedding(const server_task & task, const float * embd) {
+        auto res = std::make_unique<server_task_result_embd>();
+        res->id        = task.id;
+        res->index     = task.index;
+        res->n_tokens  = task.prompt_tokens.size();
+        res->oaicompat = task.params.oaicompat;
+
+        const int n_embd = llama_model_n_embd(model);
+
+        if (embd == NULL) {
+            SRV_ERR("failed to get embeddings, id_task = %d\n", task.id);
+
+            res->embedding.push_back(std::vector<float>(n_embd, 0.0f));
+        } else {
+            std::vector<float> embd_res(n_embd, 0.0f);
+            common_embd_normalize(embd, embd_res.data(), n_embd, 2);
+            res->embedding.push_back(std::move(embd_res));
+        }
+
+        queue_results.send(std::move(res));
+    }
+
+    void send_rerank(const server_task & task, const float * embd) {
+        auto res = std::make_unique<server_task_result_rerank>();
+        res->id       = task.id;
+        res->index    = task.index;
+        res->n_tokens = task.prompt_tokens.size();
+
+        if (embd == NULL) {
+            SRV_ERR("failed to get embeddings, id_task = %d\n", task.id);
+
+            res->score = -1e6;
+        } else {
+            res->score = embd[0];
+        }
+
+        queue_results.send(std::move(res));
+    }
+
     //
     // Functions to create new task(s) and receive result(s)
     //
@@ -2749,6 +3412,11 @@ struct server_context {
             case SERVER_TASK_TYPE_EMBEDDING:
             case SERVER_TASK_TYPE_RERANK:
                 {
+                    if (can_batch_embd(task)) {
+                        queue_embd.push_back(std::move(task));
+                        break;
+                    }
+
                     const int id_slot = task.id_selected_slot;
 
                     server_slot * slot = id_slot != -1 ? get_slot_by_id(id_slot) : get_available_slot(task);
@@ -2781,6 +3449,10 @@ struct server_context {
                             break;
                         }
                     }
+
+                    queue_embd.erase(std::remove_if(queue_embd.begin(), queue_embd.end(), [&](const server_task & t) {
+                        return t.id == task.id_target;
+                    }), queue_embd.end());
                 } break;
             case SERVER_TASK_TYPE_NEXT_RESPONSE:
                 {
@@ -2958,7 +3630,136 @@ struct server_context {
         }
     }
 
+    bool can_batch_embd(const server_task & task) const {
+        if (n_seq_embd <= 0 || task.id_selected_slot != -1) {
+            return false;
+        }
+
+        if (task.type != SERVER_TASK_TYPE_EMBEDDING && task.type != SERVER_TASK_TYPE_RERANK) {
+            return false;
+        }
+
+        // media chunks are evaluated by the slots
+        for (size_t i = 0; i < task.prompt_tokens.size(); ++i) {
+            if (task.prompt_tokens[i] == LLAMA_TOKEN_NULL) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // evaluate as many of the queued embedding and rerank tasks as fit in a single ubatch
+    void update_embeddings() {
+        const int32_t n_ubatch = llama_n_ubatch(ctx);
+
+        // longest inputs first - the shorter ones fill the remaining space of the batch
+        std::stable_sort(queue_embd.begin(), queue_embd.end(), [](const server_task & a, const server_task & b) {
+            return a.prompt_tokens.size() > b.prompt_tokens.size();
+        });
+
+        std::vector<server_task> batched;
+        std::vector<server_task> pending;
+
+        common_batch_clear(batch_embd);
+
+        for (auto & task : queue_embd) {
+            const int32_t n_tokens = task.prompt_tokens.size();
+
+            if (n_tokens == 0) {
+                send_error(task, "empty input", ERROR_TYPE_INVALID_REQUEST);
+                continue;
+            }
+
+            if (n_tokens > n_ubatch) {
+                send_error(task, "input is too large to process. increase the physical batch size", ERROR_TYPE_SERVER);
+                continue;
+            }
+
+            if (!task.prompt_tokens.validate(ctx)) {
+                send_error(task, "Prompt contains invalid tokens", ERROR_TYPE_INVALID_REQUEST);
+                continue;
+            }
+
+            if ((int32_t) batched.size() >= n_seq_embd || batch_embd.n_tokens + n_tokens > n_ubatch) {
+                pending.push_back(std::move(task));
+                continue;
+            }
+
+            const llama_seq_id seq_id = params_base.n_parallel + batched.size();
+
+            for (int32_t i = 0; i < n_tokens; ++i) {
+                common_batch_add(batch_embd, task.prompt_tokens[i], i, { seq_id }, true);
+            }
+
+            batched.push_back(std::move(task));
+        }
+
+        queue_embd = std::move(pending);
+
+        if (!batched.empty()) {
+            SRV_DBG("decoding embedding batch, n_seqs = %d, n_tokens = %d, n_pending = %d\n", (int) batched.size(), batch_embd.n_tokens, (int) queue_embd.size());
+
+            // same as for the slots - the adapters are not configurable per embedding request
+            common_set_adapter_lora(ctx, batched[0].params.lora);
+
+            llama_set_embeddings(ctx, true);
+
+            for (const auto & task : batched) {
+                metrics.on_task_started(task);
+            }
+
+            const int64_t t_start = ggml_time_us();
+
+            const int ret = llama_decode(ctx, batch_embd);
+
+            if (ret == 0) {
+                metrics.on_embd_batch(batch_embd.n_tokens, n_ubatch, (uint64_t) (ggml_time_us() - t_start) / 1000);
+
+                for (size_t i = 0; i < batched.size(); ++i) {
+                    const float * embd = llama_get_embeddings_seq(ctx, params_base.n_parallel + i);
+
+                    if (batched[i].type == SERVER_TASK_TYPE_RERANK) {
+                        send_rerank(batched[i], embd);
+                    } else {
+                        send_embedding(batched[i], embd);
+                    }
+                }
+            } else if (ret == 1 && std::any_of(slots.begin(), slots.end(), [](const server_slot & slot) { return slot.is_processing(); })) {
+                // the KV cache is used by the slots - retry when they have made progress
+                SRV_WRN("failed to find free space in the KV cache for %d embedding tasks, retrying later\n", (int) batched.size());
+
+                for (auto & task : batched) {
+                    queue_embd.push_back(std::move(task));
+                }
+            } else {
+                SRV_ERR("failed to decode embedding batch, ret = %d\n", ret);
+
+                for (const auto & task : batched) {
+                    send_error(task, ret == 1 ? "Context size has been exceeded." : "Compute error.");
+                }
+            }
+
+            llama_memory_t mem = llama_get_memory(ctx);
+            if (mem) {
+                for (size_t i = 0; i < batched.size(); ++i) {
+                    llama_memory_seq_rm(mem, params_base.n_parallel + i, -1, -1);
+                }
+            }
+        }
+
+        if (!queue_embd.empty()) {
+            server_task task(SERVER_TASK_TYPE_NEXT_RESPONSE);
+            task.id = queue_tasks.get_new_id();
+            queue_tasks.post(std::move(task));
+        }
+    }
+
     void update_slots() {
+        if (!queue_embd.empty()) {
+            update_embeddings();
+        }
+
         // check if all slots are idle
         {
             bool all_idle = true;
@@ -2971,6 +3772,10 @@ struct server_context {
             }
 
             if (all_idle) {
+                if (!queue_embd.empty()) {
+                    return;
+                }
+
                 SRV_INF("%s", "all slots are idle\n");
                 if (clean_kv_cache) {
                     kv_cache_clear();
@@ -3034,6 +3839,13 @@ struct server_context {
             }
         }
 
+        // return the sequences of lookahead steps that were not sampled, e.g. after a failed decode
+        for (server_slot & slot : slots) {
+            if (slot.la.active()) {
+                lookahead_release(slot);
+            }
+        }
+
         // start populating the batch for this iteration
         common_batch_clear(batch);
 
@@ -3372,6 +4184,30 @@ struct server_context {
             }
         }
 
+        // finally, add lookahead steps for the generating slots in the space that is left in the current ubatch
+        if (!seq_la_free.empty()) {
+            const int32_t n_la_max = std::min(n_batch, n_ubatch);
+
+            for (size_t k = 0; k < slots.size(); ++k) {
+                server_slot & slot = slots[(la_next + k) % slots.size()];
+
+                if (slot.state != SLOT_STATE_GENERATING || slot.i_batch < 0 || !slot.can_lookahead()) {
+                    continue;
+                }
+
+                // leave space for the window and for 1 extra token to allow context shifts
+                if (slot.n_past + slot.la.W + slot.la.N >= slot.n_ctx || slot.n_remaining == 1) {
+                    continue;
+                }
+
+                if (!lookahead_add(slot, n_la_max)) {
+                    break;
+                }
+            }
+
+            la_next = (la_next + 1) % slots.size();
+        }
+
         if (batch.n_tokens == 0) {
             SRV_WRN("%s", "no tokens to decode\n");
             return;
@@ -3404,7 +4240,7 @@ struct server_context {
 
             const int ret = llama_decode(ctx, batch_view);
 
-            metrics.on_decoded(slots);
+            metrics.on_decoded(slots, n_tokens, llama_n_batch(ctx));
 
             if (ret != 0) {
                 {
@@ -3476,42 +4312,63 @@ struct server_context {
                     continue; // continue loop of slots
                 }
 
-                const int tok_idx = slot.i_batch - i;
+                llama_tokens         ids;
+                std::vector<int32_t> idxs;
+
+                if (slot.la.active() && slot.la.i_batch_end <= i + n_tokens) {
+                    ids = lookahead_sample_and_accept(slot, i, idxs);
+                } else {
+                    if (slot.la.active()) {
+                        // the lookahead step was split by a smaller n_batch - only the sampled token is used
+                        lookahead_release(slot);
+                    }
 
-                llama_token id = common_sampler_sample(slot.smpl, ctx, tok_idx);
+                    const llama_token id = common_sampler_sample(slot.smpl, ctx, slot.i_batch - i);
+
+                    common_sampler_accept(slot.smpl, id, true);
+
+                    ids .push_back(id);
+                    idxs.push_back(slot.i_batch);
+                }
 
                 slot.i_batch = -1;
 
-                common_sampler_accept(slot.smpl, id, true);
+                for (size_t k = 0; k < ids.size(); ++k) {
+                    const int tok_idx = idxs[k] - i;
 
-                slot.n_decoded += 1;
+                    slot.n_decoded += 1;
 
-                const int64_t t_current = ggml_time_us();
+                    const int64_t t_current = ggml_time_us();
 
-                if (slot.n_decoded == 1) {
-                    slot.t_start_generation = t_current;
-                    slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
-                    metrics.on_prompt_eval(slot);
-                }
+                    if (slot.n_decoded == 1) {
+                        slot.t_start_generation = t_current;
+                        slot.t_prompt_processing = (slot.t_start_generation - slot.t_start_process_prompt) / 1e3;
+                        metrics.on_prompt_eval(slot);
+                    } else {
+                        metrics.on_tokens_generated(slot, t_current, 1);
+                    }
 
-                slot.t_token_generation = (t_current - slot.t_start_generation) / 1e3;
+                    slot.t_last_token = t_current;
 
-                completion_token_output result;
-                result.tok          = id;
-                result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
-                result.prob         = 1.0f; // TODO: set it here instead of doing inside populate_token_probs
+                    slot.t_token_generation = (t_current - slot.t_start_generation) / 1e3;
 
-                if (slot.params.sampling.n_probs > 0) {
-                    populate_token_probs(slot, result, slot.params.post_sampling_probs, params_base.special, tok_idx);
-                }
+                    completion_token_output result;
+                    result.tok          = ids[k];
+                    result.text_to_send = common_token_to_piece(ctx, result.tok, accept_special_token(slot, result.tok));
+                    result.prob         = 1.0f; // TODO: set it here instead of doing inside populate_token_probs
 
-                if (!process_token(result, slot)) {
-                    // release slot because of stop condition
-                    slot.release();
-                    slot.print_timings();
-                    send_final_response(slot);
-                    metrics.on_prediction(slot);
-                    continue;
+                    if (slot.params.sampling.n_probs > 0) {
+                        populate_token_probs(slot, result, slot.params.post_sampling_probs, params_base.special, tok_idx);
+                    }
+
+                    if (!process_token(result, slot)) {
+                        // release slot because of stop condition
+                        slot.release();
+                        slot.print_timings();
+                        send_final_response(slot);
+                        metrics.on_prediction(slot);
+                        break;
+                    }
                 }
             }
 
@@ -3587,6 +4444,14 @@ struct server_context {
                 slot.n_past    += ids.size();
                 slot.n_decoded += ids.size();
 
+                {
+                    const int64_t t_current = ggml_time_us();
+
+                    metrics.on_tokens_generated(slot, t_current, ids.size());
+
+                    slot.t_last_token = t_current;
+                }
+
                 // update how many tokens out of those tested were accepted
                 slot.n_draft_accepted += ids.size() - 1;
 
@@ -3981,6 +4846,18 @@ int main(int argc, char ** argv) {
             }
         }
 
+        // the histograms are cumulative and can be read directly
+        {
+            const auto & m = ctx_server.metrics;
+
+            m.queue_wait    .to_prometheus(prometheus, "queue_wait_seconds",          "Time spent by the requests in the queue before being processed.");
+            m.ttft          .to_prometheus(prometheus, "time_to_first_token_seconds", "Time from the reception of the request to the first generated token.");
+            m.itl           .to_prometheus(prometheus, "inter_token_seconds",         "Time between two consecutive generated tokens.");
+            m.prompt_per_tok.to_prometheus(prometheus, "prompt_seconds_per_token",    "Prompt processing time per token.");
+            m.batch_fill    .to_prometheus(prometheus, "batch_fill_ratio",            "Number of tokens per llama_decode() call relative to the batch size.");
+            m.slot_kv_usage .to_prometheus(prometheus, "slot_kv_usage_ratio",         "Context usage of the busy slots, sampled at each llama_decode() call.");
+        }
+
         res.set_header("Process-Start-Time-Unix", std::to_string(res_metrics->t_start));
 
         res.set_content(prometheus.str(), "text/plain; version=0.0.4");
@@ -4655,6 +5532,125 @@ int main(int argc, char ** argv) {
         res_ok(res, root);
     };
 
+    // embed the prompts of a /vector request with one pooled embedding per prompt
+    const auto embed_prompts = [&ctx_server, &res_error](const httplib::Request & req, httplib::Response & res, const json & body, std::vector<std::vector<float>> & embd) {
+        if (!ctx_server.vindex) {
+            res_error(res, format_error_response("This server does not have a vector index. Start it with `--embeddings --vector-index FNAME`", ERROR_TYPE_NOT_SUPPORTED));
+            return false;
+        }
+
+        json prompt;
+        if (body.count("input") != 0) {
+            prompt = body.at("input");
+        } else if (body.contains("content")) {
+            prompt = body.at("content");
+        } else {
+            res_error(res, format_error_response("\"input\" or \"content\" must be provided", ERROR_TYPE_INVALID_REQUEST));
+            return false;
+        }
+
+        auto tokenized_prompts = tokenize_input_prompts(ctx_server.vocab, prompt, true, true);
+        for (const auto & tokens : tokenized_prompts) {
+            if (tokens.empty()) {
+                res_error(res, format_error_response("Input content cannot be empty", ERROR_TYPE_INVALID_REQUEST));
+                return false;
+            }
+        }
+
+        bool error = false;
+        std::unordered_set<int> task_ids;
+        {
+            std::vector<server_task> tasks;
+            for (size_t i = 0; i < tokenized_prompts.size(); i++) {
+                server_task task = server_task(SERVER_TASK_TYPE_EMBEDDING);
+
+                task.id            = ctx_server.queue_tasks.get_new_id();
+                task.index         = i;
+                task.prompt_tokens = server_tokens(tokenized_prompts[i], ctx_server.mctx != nullptr);
+
+                tasks.push_back(std::move(task));
+            }
+
+            task_ids = server_task::get_list_id(tasks);
+            ctx_server.queue_results.add_waiting_tasks(tasks);
+            ctx_server.queue_tasks.post(std::move(tasks));
+        }
+
+        embd.resize(tokenized_prompts.size());
+
+        ctx_server.receive_multi_results(task_ids, [&](std::vector<server_task_result_ptr> & results) {
+            for (auto & res : results) {
+                auto * res_embd = dynamic_cast<server_task_result_embd*>(res.get());
+                GGML_ASSERT(res_embd != nullptr);
+                embd[res_embd->index] = std::move(res_embd->embedding[0]);
+            }
+        }, [&](const json & error_data) {
+            res_error(res, error_data);
+            error = true;
+        }, req.is_connection_closed);
+
+        ctx_server.queue_results.remove_waiting_task_ids(task_ids);
+
+        return !error;
+    };
+
+    const auto handle_vector_add = [&ctx_server, &embed_prompts, &res_ok](const httplib::Request & req, httplib::Response & res) {
+        const json body = json::parse(req.body);
+
+        std::vector<std::vector<float>> embd;
+        if (!embed_prompts(req, res, body, embd)) {
+            return;
+        }
+
+        json ids = json::array();
+        int64_t n_vectors;
+        {
+            std::unique_lock<std::shared_mutex> lock(ctx_server.vindex_mutex);
+            for (const auto & e : embd) {
+                ids.push_back(common_vindex_add(ctx_server.vindex.get(), e.data()));
+            }
+            ctx_server.vindex_modified = true;
+            n_vectors = common_vindex_size(ctx_server.vindex.get());
+        }
+
+        res_ok(res, {
+            {"ids",       ids},
+            {"n_vectors", n_vectors},
+        });
+    };
+
+    const auto handle_vector_search = [&ctx_server, &embed_prompts, &res_ok](const httplib::Request & req, httplib::Response & res) {
+        const json body = json::parse(req.body);
+
+        const int32_t top_k = json_value(body, "top_k", 5);
+        const int32_t ef    = json_value(body, "ef",    0);
+
+        std::vector<std::vector<float>> embd;
+        if (!embed_prompts(req, res, body, embd)) {
+            return;
+        }
+
+        json responses = json::array();
+        {
+            std::shared_lock<std::shared_mutex> lock(ctx_server.vindex_mutex);
+            for (size_t i = 0; i < embd.size(); ++i) {
+                json results = json::array();
+                for (const auto & r : common_vindex_search(ctx_server.vindex.get(), embd[i].data(), top_k, ef)) {
+                    results.push_back({
+                        {"id",    r.id},
+                        {"score", r.score},
+                    });
+                }
+                responses.push_back({
+                    {"index",   i},
+                    {"results", results},
+                });
+            }
+        }
+
+        res_ok(res, responses);
+    };
+
     const auto handle_embeddings = [&handle_embeddings_impl](const httplib::Request & req, httplib::Response & res) {
         handle_embeddings_impl(req, res, OAICOMPAT_TYPE_NONE);
     };
@@ -4847,6 +5843,8 @@ int main(int argc, char ** argv) {
     svr->Post("/embedding",           handle_embeddings); // legacy
     svr->Post("/embeddings",          handle_embeddings);
     svr->Post("/v1/embeddings",       handle_embeddings_oai);
+    svr->Post("/vector/add",          handle_vector_add);
+    svr->Post("/vector/search",       handle_vector_search);
     svr->Post("/rerank",              handle_rerank);
     svr->Post("/reranking",           handle_rerank);
     svr->Post("/v1/rerank",           handle_rerank);
@@ -4967,6 +5965,8 @@ int main(int argc, char ** argv) {
     // this call blocks the main thread until queue_tasks.terminate() is called
     ctx_server.queue_tasks.start_loop();
 
+    ctx_server.save_vindex();
+
     clean_up();
     t.join();
 
@@ -255,3 +255,55 @@ def test_embedding_openai_library_base64():
     # make sure the decoded data is the same as the original
     for x, y in zip(floats, vec0):
         assert abs(x - y) < EPSILON
+
+
+def test_embedding_batched_requests():
+    global server
+    server.pooling = 'mean'
+    server.n_slots = 1
+    server.start()
+    prompts = [
+        "I believe the meaning of life is",
+        "Write a joke about AI",
+        "This is a test",
+        "This is another test",
+        "The quick brown fox jumps over the lazy dog",
+    ]
+    # concurrent requests are decoded together in the sequences reserved for embeddings
+    results = parallel_function_calls([
+        (server.make_request, ("POST", "/embeddings", {"content": prompt})) for prompt in prompts
+    ])
+    server.stop()
+
+    # same results when every request is decoded on its own
+    server.n_seq_embd = 0
+    server.start()
+    for prompt, res in zip(prompts, results):
+        assert res.status_code == 200
+        ref = server.make_request("POST", "/embeddings", data={"content": prompt})
+        assert ref.status_code == 200
+        for x, y in zip(res.body[0]['embedding'][0], ref.body[0]['embedding'][0]):
+            assert abs(x - y) < EPSILON
+
+
+def test_embedding_reserved_seqs_do_not_change_completion():
+    # the sequences reserved for batching embeddings are not counted in the context of the completion slots
+    contents = []
+    for embeddings in [False, True]:
+        server = ServerPreset.tinyllama2()
+        server.n_slots = 1
+        server.server_embeddings = embeddings
+        server.pooling = 'mean' if embeddings else None
+        server.start()
+        res = server.make_request("POST", "/completion", data={
+            "prompt": "I believe the meaning of life is",
+            "temperature": 0.0,
+            "top_k": 1,
+        })
+        assert res.status_code == 200
+        contents.append(res.body["content"])
+        res = server.make_request("GET", "/props")
+        assert res.status_code == 200
+        assert res.body["default_generation_settings"]["n_ctx"] == server.n_ctx
+        server.stop()
+    assert contents[0] == contents[1]
@@ -0,0 +1,83 @@
+import pytest
+from utils import *
+
+# lookahead decoding only accepts the tokens that greedy sampling would have produced,
+# so the output must be the same as with plain decoding
+
+server = ServerPreset.stories15m_moe()
+
+PROMPTS = [
+    "I believe the meaning of life is",
+    "Once upon a time, there was a little girl",
+    "The cat sat on the mat and",
+]
+
+
+def create_server():
+    global server
+    server = ServerPreset.stories15m_moe()
+    server.n_predict = 64
+
+
+@pytest.fixture(scope="module", autouse=True)
+def fixture_create_server():
+    return create_server()
+
+
+def get_content(prompt: str, lookahead: bool = True) -> str:
+    res = server.make_request("POST", "/completion", data={
+        "prompt": prompt,
+        "temperature": 0.0,
+        "top_k": 1,
+        "lookahead": lookahead,
+    })
+    assert res.status_code == 200
+    return res.body["content"]
+
+
+def test_with_and_without_lookahead():
+    global server
+    server.start()
+    content_no_lookahead = [get_content(prompt) for prompt in PROMPTS]
+    server.stop()
+
+    create_server()
+    server.lookahead = 4
+    server.start()
+    for prompt, content in zip(PROMPTS, content_no_lookahead):
+        assert get_content(prompt) == content
+
+
+@pytest.mark.parametrize("lookahead", [2, 4, 8])
+def test_different_window_sizes(lookahead: int):
+    global server
+    server.lookahead = lookahead
+    server.start()
+    for prompt in PROMPTS:
+        assert get_content(prompt) == get_content(prompt, lookahead=False)
+
+
+def test_lookahead_parallel_requests():
+    global server
+    server.lookahead = 4
+    server.n_slots = 2
+    server.start()
+    expected = [get_content(prompt, lookahead=False) for prompt in PROMPTS]
+    results = parallel_function_calls([
+        (get_content, (prompt,)) for prompt in PROMPTS
+    ])
+    assert results == expected
+
+
+def test_lookahead_slot_ctx_not_exceeded():
+    global server
+    server.lookahead = 4
+    server.n_ctx = 64
+    server.start()
+    res = server.make_request("POST", "/completion", data={
+        "prompt": "Hello " * 56,
+        "temperature": 0.0,
+        "top_k": 1,
+    })
+    assert res.status_code == 200
+    assert len(res.body["content"]) > 0
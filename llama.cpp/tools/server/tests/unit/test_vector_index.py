@@ -0,0 +1,84 @@
+import os
+import pytest
+from utils import *
+
+server = ServerPreset.bert_bge_small()
+
+VINDEX_PATH = "./tmp/vindex.bin"
+
+DOCUMENTS = [
+    "The cat sat on the mat.",
+    "Stock markets fell sharply on Monday.",
+    "A kitten is sleeping on the rug.",
+    "The central bank raised interest rates.",
+]
+
+
+@pytest.fixture(scope="module", autouse=True)
+def create_server():
+    global server
+    server = ServerPreset.bert_bge_small()
+    server.pooling = 'mean'
+    server.vector_index = VINDEX_PATH
+    os.makedirs("./tmp", exist_ok=True)
+    if os.path.exists(VINDEX_PATH):
+        os.remove(VINDEX_PATH)
+
+
+def test_vector_add_search():
+    global server
+    server.start()
+    res = server.make_request("POST", "/vector/add", data={
+        "content": DOCUMENTS,
+    })
+    assert res.status_code == 200
+    assert res.body["ids"] == [0, 1, 2, 3]
+    assert res.body["n_vectors"] == len(DOCUMENTS)
+
+    res = server.make_request("POST", "/vector/search", data={
+        "content": ["a cat on a mat", "the economy"],
+        "top_k": 2,
+    })
+    assert res.status_code == 200
+    assert len(res.body) == 2
+    assert [r["id"] for r in res.body[0]["results"]] == [0, 2]
+    assert set(r["id"] for r in res.body[1]["results"]) == {1, 3}
+    for d in res.body:
+        scores = [r["score"] for r in d["results"]]
+        assert scores == sorted(scores, reverse=True)
+
+
+def test_vector_search_exact_match():
+    global server
+    server.start()
+    server.make_request("POST", "/vector/add", data={
+        "content": DOCUMENTS,
+    })
+    res = server.make_request("POST", "/vector/search", data={
+        "content": DOCUMENTS[1],
+        "top_k": 1,
+    })
+    assert res.status_code == 200
+    assert res.body[0]["results"][0]["id"] == 1
+    assert res.body[0]["results"][0]["score"] > 0.99
+
+
+def test_vector_search_without_content():
+    global server
+    server.start()
+    res = server.make_request("POST", "/vector/search", data={
+        "top_k": 2,
+    })
+    assert res.status_code == 400
+    assert "error" in res.body
+
+
+def test_vector_index_requires_option():
+    global server
+    server.vector_index = None
+    server.start()
+    res = server.make_request("POST", "/vector/search", data={
+        "content": "a cat on a mat",
+    })
+    assert res.status_code == 501
+    assert "error" in res.body
@@ -64,6 +64,7 @@ class ServerProcess:
     n_predict: int | None = None
     n_prompts: int | None = 0
     slot_save_path: str | None = None
+    vector_index: str | None = None
     id_slot: int | None = None
     cache_prompt: bool | None = None
     n_slots: int | None = None
@@ -76,12 +77,14 @@ class ServerProcess:
     server_metrics: bool | None = False
     server_slots: bool | None = False
     pooling: str | None = None
+    n_seq_embd: int | None = None
     draft: int | None = None
     api_key: str | None = None
     lora_files: List[str] | None = None
     disable_ctx_shift: int | None = False
     draft_min: int | None = None
     draft_max: int | None = None
+    lookahead: int | None = None
     no_webui: bool | None = None
     jinja: bool | None = None
     reasoning_format: Literal['deepseek', 'none', 'nothink'] | None = None
@@ -153,6 +156,8 @@ class ServerProcess:
             server_args.append("--slots")
         if self.pooling:
             server_args.extend(["--pooling", self.pooling])
+        if self.n_seq_embd is not None:
+            server_args.extend(["--embd-batch-seqs", self.n_seq_embd])
         if self.model_alias:
             server_args.extend(["--alias", self.model_alias])
         if self.n_ctx:
@@ -169,6 +174,8 @@ class ServerProcess:
             server_args.extend(["--n-predict", self.n_predict])
         if self.slot_save_path:
             server_args.extend(["--slot-save-path", self.slot_save_path])
+        if self.vector_index:
+            server_args.extend(["--vector-index", self.vector_index])
         if self.n_ga:
             server_args.extend(["--grp-attn-n", self.n_ga])
         if self.n_ga_w:
@@ -186,6 +193,8 @@ class ServerProcess:
             server_args.extend(["--draft-max", self.draft_max])
         if self.draft_min:
             server_args.extend(["--draft-min", self.draft_min])
+        if self.lookahead:
+            server_args.extend(["--lookahead", self.lookahead])
         if self.no_webui:
             server_args.append("--no-webui")
         if self.jinja:
@@ -1068,6 +1068,23 @@ static std::vector<common_adapter_lora_info> parse_lora_request(
     return lora;
 }
 
+// scale of each loaded control vector, the ones that are not listed get 0.0
+static std::vector<float> parse_cvec_request(size_t n_cvec, const json & data) {
+    std::vector<float> scales(n_cvec, 0.0f);
+
+    for (const auto & entry : data) {
+        int id      = json_value(entry, "id", -1);
+        float scale = json_value(entry, "scale", 0.0f);
+        if (0 <= id && id < (int) n_cvec) {
+            scales[id] = scale;
+        } else {
+            throw std::runtime_error("invalid control vector id");
+        }
+    }
+
+    return scales;
+}
+
 //
 // utils for interacting with libmtmd
 // (may need to refactor in near future)
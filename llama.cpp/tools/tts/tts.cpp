@@ -11,9 +11,11 @@
 
 #include <algorithm>
 #include <cmath>
+#include <complex>
 #include <cstdio>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <regex>
 #include <string>
 #include <thread>
@@ -89,28 +91,60 @@ struct wav_header {
     uint32_t data_size;
 };
 
-static bool save_wav16(const std::string & fname, const std::vector<float> & data, int sample_rate) {
-    std::ofstream file(fname, std::ios::binary);
-    if (!file) {
-        LOG_ERR("%s: Failed to open file '%s' for writing.\n", __func__, fname.c_str());
-        return false;
+// writes 16-bit PCM samples as they are produced - the sizes in the header are updated when the file is closed
+struct wav_writer {
+    std::ofstream file;
+    wav_header    header;
+
+    size_t n_samples = 0;
+
+    bool open(const std::string & fname, int sample_rate) {
+        file.open(fname, std::ios::binary);
+        if (!file) {
+            LOG_ERR("%s: Failed to open file '%s' for writing.\n", __func__, fname.c_str());
+            return false;
+        }
+
+        header.sample_rate = sample_rate;
+        header.byte_rate = header.sample_rate * header.num_channels * (header.bits_per_sample / 8);
+        header.block_align = header.num_channels * (header.bits_per_sample / 8);
+        header.data_size = 0;
+        header.chunk_size = 36;
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        return file.good();
+    }
+
+    void write(const float * data, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            int16_t pcm_sample = static_cast<int16_t>(std::clamp(data[i] * 32767.0, -32768.0, 32767.0));
+            file.write(reinterpret_cast<const char*>(&pcm_sample), sizeof(pcm_sample));
+        }
+        n_samples += n;
     }
 
-    wav_header header;
-    header.sample_rate = sample_rate;
-    header.byte_rate = header.sample_rate * header.num_channels * (header.bits_per_sample / 8);
-    header.block_align = header.num_channels * (header.bits_per_sample / 8);
-    header.data_size = data.size() * (header.bits_per_sample / 8);
-    header.chunk_size = 36 + header.data_size;
+    bool close() {
+        header.data_size = n_samples * (header.bits_per_sample / 8);
+        header.chunk_size = 36 + header.data_size;
+
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.close();
 
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        return !file.fail();
+    }
+};
 
-    for (const auto & sample : data) {
-        int16_t pcm_sample = static_cast<int16_t>(std::clamp(sample * 32767.0, -32768.0, 32767.0));
-        file.write(reinterpret_cast<const char*>(&pcm_sample), sizeof(pcm_sample));
+static bool save_wav16(const std::string & fname, const std::vector<float> & data, int sample_rate) {
+    wav_writer wav;
+    if (!wav.open(fname, sample_rate)) {
+        return false;
     }
 
-    return file.good();
+    wav.write(data.data(), data.size());
+
+    return wav.close();
 }
 
 static void fill_hann_window(int length, bool periodic, float * output) {
@@ -123,158 +157,295 @@ static void fill_hann_window(int length, bool periodic, float * output) {
     }
 }
 
-// very poor-man fft
-static void twiddle(float * real, float * imag, int k, int N) {
-    float angle = 2 * M_PI * k / N;
-    *real = cos(angle);
-    *imag = sin(angle);
+//
+// Spectral utils
+//
+
+using cplx = std::complex<float>;
+
+// avoids the NaN/Inf handling of operator* for std::complex, which is not vectorized
+static inline cplx cmul(cplx a, cplx b) {
+    return cplx(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
 }
 
-static void irfft(int n, const float * inp_cplx, float * out_real) {
-    int N = n / 2 + 1;
+// mixed-radix inverse complex FFT (unnormalized) with precomputed twiddle factors
+struct fft_plan {
+    int n = 0;
 
-    std::vector<float> real_input(N);
-    std::vector<float> imag_input(N);
-    for (int i = 0; i < N; ++i) {
-        real_input[i] = inp_cplx[2 * i];
-        imag_input[i] = inp_cplx[2 * i + 1];
-    }
+    std::vector<int>  factors;
+    std::vector<cplx> tw; // exp(2*pi*i*k/n)
 
-    std::vector<float> real_output(n);
-    std::vector<float> imag_output(n);
+    int max_factor = 0;
 
-    for (int k = 0; k < n; ++k) {
-        real_output[k] = 0.0f;
-        imag_output[k] = 0.0f;
-        for (int m = 0; m < N; ++m) {
-            float twiddle_real;
-            float twiddle_imag;
+    explicit fft_plan(int n) : n(n), tw(n) {
+        for (int k = 0; k < n; ++k) {
+            const double angle = 2.0*M_PI*k/n;
+            tw[k] = cplx(cos(angle), sin(angle));
+        }
 
-            twiddle(&twiddle_real, &twiddle_imag, k * m, n);
+        int m = n;
+        for (int p : { 4, 2, 3, 5 }) {
+            while (m % p == 0) {
+                factors.push_back(p);
+                m /= p;
+            }
+        }
+        for (int p = 7; m > 1; p += 2) {
+            while (m % p == 0) {
+                factors.push_back(p);
+                m /= p;
+            }
+        }
 
-            real_output[k] += real_input[m] * twiddle_real - imag_input[m] * twiddle_imag;
-            imag_output[k] += real_input[m] * twiddle_imag + imag_input[m] * twiddle_real;
+        for (int p : factors) {
+            max_factor = std::max(max_factor, p);
         }
     }
 
-    for (int i = 0; i < n; ++i) {
-        out_real[i] = real_output[i] / N;
+    // out must not alias inp
+    void inverse(const cplx * inp, cplx * out) const {
+        std::vector<cplx> scratch(max_factor);
+        transform(inp, out, n, 1, factors.data(), 1, scratch.data());
     }
-}
 
-//
-//  y = torch.nn.functional.fold(
-//       data, output_size=(1, output_size), kernel_size=(1, self.win_length), stride=(1, self.hop_length),
-//  )[:, 0, 0, pad:-pad]
-//
-// data.shape =  torch.Size([1, 1280, 261])
-// output_size =  84480
-// win_length =  1280
-// hop_length =  320
-// pad =  480
-//
-static void fold(const std::vector<float> & data, int64_t n_out, int64_t n_win, int64_t n_hop, int64_t n_pad, std::vector<float> & output) {
-    int64_t output_height = n_out;
-    int64_t kernel_w = n_win;
-    int64_t stride_w = n_hop;
-    int64_t width    = n_out;
-
-    output.resize(width, 0.0f);
-
-    int64_t col_idx = 0;
-    for (int64_t w_col = 0; w_col < width; ++w_col) {
-        int64_t start = w_col * stride_w - n_pad;
-        int64_t end   = start + kernel_w;
-
-        for (int64_t w_im = start; w_im < end; ++w_im) {
-            if (w_im >= 0 && w_im < output_height && col_idx < (int64_t) data.size()) {
-                output[w_im] += data[col_idx];
+private:
+    // decimation in time - the m outputs are combined from the p transforms of the inputs with stride*p
+    void transform(const cplx * inp, cplx * out, int m, int stride, const int * f, int tw_stride, cplx * scratch) const {
+        if (m == 1) {
+            out[0] = inp[0];
+            return;
+        }
+
+        const int p  = f[0];
+        const int ms = m/p;
+
+        for (int q = 0; q < p; ++q) {
+            transform(inp + q*stride, out + q*ms, ms, stride*p, f + 1, tw_stride*p, scratch);
+        }
+
+        if (p == 2) {
+            for (int k = 0; k < ms; ++k) {
+                const cplx a = out[k];
+                const cplx b = cmul(out[k + ms], tw[k*tw_stride]);
+                out[k]      = a + b;
+                out[k + ms] = a - b;
+            }
+        } else if (p == 4) {
+            for (int k = 0; k < ms; ++k) {
+                const cplx a0 = out[k];
+                const cplx a1 = cmul(out[k +   ms], tw[1*k*tw_stride]);
+                const cplx a2 = cmul(out[k + 2*ms], tw[2*k*tw_stride]);
+                const cplx a3 = cmul(out[k + 3*ms], tw[3*k*tw_stride]);
+                const cplx b0 = a0 + a2;
+                const cplx b1 = a0 - a2;
+                const cplx b2 = a1 + a3;
+                const cplx b3 = cplx(a3.imag() - a1.imag(), a1.real() - a3.real()); // i*(a1 - a3)
+                out[k]        = b0 + b2;
+                out[k +   ms] = b1 + b3;
+                out[k + 2*ms] = b0 - b2;
+                out[k + 3*ms] = b1 - b3;
             }
-            col_idx++;
+        } else {
+            const int tw_p = n/p; // exp(2*pi*i/p)
+            for (int k = 0; k < ms; ++k) {
+                for (int q = 0; q < p; ++q) {
+                    scratch[q] = cmul(out[k + q*ms], tw[q*k*tw_stride]);
+                }
+                for (int s = 0; s < p; ++s) {
+                    cplx acc = scratch[0];
+                    for (int q = 1; q < p; ++q) {
+                        acc += cmul(scratch[q], tw[((q*s) % p)*tw_p]);
+                    }
+                    out[k + s*ms] = acc;
+                }
+            }
+        }
+    }
+};
+
+// inverse real FFT of even size n, computed with a complex FFT of size n/2
+//   out_real[j] = 1/n * sum_k X[k]*exp(2*pi*i*j*k/n), with X[n - k] = conj(X[k])
+// same as torch.fft.irfft - the imaginary parts of X[0] and X[n/2] are ignored
+struct irfft_plan {
+    int n;
+
+    fft_plan          fft;
+    std::vector<cplx> tw; // exp(2*pi*i*k/n), k < n/2
+
+    explicit irfft_plan(int n) : n(n), fft(n/2), tw(n/2) {
+        for (int k = 0; k < n/2; ++k) {
+            const double angle = 2.0*M_PI*k/n;
+            tw[k] = cplx(cos(angle), sin(angle));
         }
     }
 
-    output.resize(n_out - 2 * n_pad);
-}
+    // inp_cplx contains n/2 + 1 interleaved complex values
+    void compute(const float * inp_cplx, float * out_real, std::vector<cplx> & work) const {
+        const int m = n/2;
 
-// TODO: not optimized at all
-static std::vector<float> embd_to_audio(
-        const float * embd,
-        const int n_codes,
-        const int n_embd,
-        const int n_thread) {
-    const int n_fft = 1280;
-    const int n_hop = 320;
-    const int n_win = 1280;
-    const int n_pad = (n_win - n_hop)/2;
-    const int n_out = (n_codes - 1)*n_hop + n_win;
+        work.resize(2*m);
 
-    std::vector<float> hann(n_fft);
+        cplx * z_spec = work.data();
+        cplx * z      = work.data() + m;
 
-    fill_hann_window(hann.size(), true, hann.data());
+        auto X = [&](int k) {
+            return cplx(inp_cplx[2*k], k == 0 || k == m ? 0.0f : inp_cplx[2*k + 1]);
+        };
 
-    int n_spec = n_embd*n_codes;
+        // pack the even and odd samples as the real and imaginary parts of a half-size signal
+        for (int k = 0; k < m; ++k) {
+            const cplx a = X(k);
+            const cplx b = std::conj(X(m - k));
+            const cplx e = a + b;
+            const cplx o = cmul(a - b, tw[k]);
+            z_spec[k] = cplx(e.real() - o.imag(), e.imag() + o.real());
+        }
 
-    std::vector<float> E (n_spec);
-    std::vector<float> S (n_spec);
-    std::vector<float> ST(n_spec);
+        fft.inverse(z_spec, z);
 
-    for (int l = 0; l < n_codes; ++l) {
-        for (int k = 0; k < n_embd; ++k) {
-            E[k*n_codes + l] = embd[l*n_embd + k];
+        const float scale = 1.0f/n;
+        for (int j = 0; j < m; ++j) {
+            out_real[2*j + 0] = z[j].real()*scale;
+            out_real[2*j + 1] = z[j].imag()*scale;
         }
     }
+};
+
+//
+// inverse STFT of the vocoder output, computed incrementally as new frames become available
+//
+//   frame l contributes the samples [l*n_hop - n_pad, l*n_hop - n_pad + n_win) of the audio
+//
+// this is the same as:
+//
+//   y = torch.nn.functional.fold(
+//        data, output_size=(1, output_size), kernel_size=(1, self.win_length), stride=(1, self.hop_length),
+//   )[:, 0, 0, pad:-pad]
+//
+// followed by the normalization with the folded squared window
+//
+struct istft_stream {
+    const int n_fft;
+    const int n_hop;
+    const int n_win;
+    const int n_pad;
+    const int n_thread;
 
-    for (int k = 0; k < n_embd/2; ++k) {
-        for (int l = 0; l < n_codes; ++l) {
-            float mag = E[(k           )*n_codes + l];
-            float phi = E[(k + n_embd/2)*n_codes + l];
+    irfft_plan irfft;
 
-            mag = exp(mag);
+    std::vector<float> hann;
 
-            if (mag > 1e2) {
-                mag = 1e2;
-            }
-            S[2*(k*n_codes + l) + 0] = mag*cosf(phi);
-            S[2*(k*n_codes + l) + 1] = mag*sinf(phi);
-        }
-    }
+    // overlap-added samples and squared windows, starting at the sample r0 of the unpadded signal
+    std::vector<float> acc;
+    std::vector<float> env;
+    int64_t r0 = 0;
 
-    for (int l = 0; l < n_codes; ++l) {
-        for (int k = 0; k < n_embd/2; ++k) {
-            ST[l*n_embd + 2*k + 0] = S[2*(k*n_codes + l) + 0];
-            ST[l*n_embd + 2*k + 1] = S[2*(k*n_codes + l) + 1];
-        }
+    int64_t n_frames = 0; // frames added so far
+    int64_t n_out    = 0; // samples returned so far
+
+    std::vector<float> frames; // scratch: windowed irfft outputs
+
+    istft_stream(int n_fft, int n_hop, int n_win, int n_thread)
+        : n_fft(n_fft), n_hop(n_hop), n_win(n_win), n_pad((n_win - n_hop)/2), n_thread(std::max(1, n_thread)), irfft(n_fft), hann(n_fft) {
+        fill_hann_window(hann.size(), true, hann.data());
     }
 
-    std::vector<float> res  (n_codes*n_fft);
-    std::vector<float> hann2(n_codes*n_fft);
+    // add the next n frames and append the samples that no later frame contributes to, to out
+    void add(const float * embd, int n, int n_embd, std::vector<float> & out) {
+        frames.resize((size_t) n*n_fft);
+
+        // the frames are independent - split them between the threads
+        auto compute = [&](int ith, int nth) {
+            std::vector<float> spec(n_embd);
+            std::vector<cplx>  work;
+
+            for (int l = ith; l < n; l += nth) {
+                const float * e = embd + (size_t) l*n_embd;
+                for (int k = 0; k < n_embd/2; ++k) {
+                    const float mag = std::min(expf(e[k]), 1e2f);
+                    const float phi = e[k + n_embd/2];
+
+                    spec[2*k + 0] = mag*cosf(phi);
+                    spec[2*k + 1] = mag*sinf(phi);
+                }
 
-    std::vector<std::thread> workers(n_thread);
-    for (int i = 0; i < n_thread; ++i) {
-        workers[i] = std::thread([&, i]() {
-            for (int l = i; l < n_codes; l += n_thread) {
-                irfft(n_fft, ST.data() + l*n_embd, res.data() + l*n_fft);
+                float * y = frames.data() + (size_t) l*n_fft;
+                irfft.compute(spec.data(), y, work);
                 for (int j = 0; j < n_fft; ++j) {
-                    res  [l*n_fft + j] *= hann[j];
-                    hann2[l*n_fft + j]  = hann[j] * hann[j];
+                    y[j] *= hann[j];
                 }
             }
-        });
+        };
+
+        const int nth = std::min(n_thread, std::max(1, n/4));
+        std::vector<std::thread> workers;
+        for (int ith = 1; ith < nth; ++ith) {
+            workers.emplace_back(compute, ith, nth);
+        }
+        compute(0, nth);
+        for (auto & w : workers) {
+            w.join();
+        }
+
+        // overlap-add
+        const int64_t r_end = (n_frames + n - 1)*n_hop + n_win;
+        acc.resize(r_end - r0, 0.0f);
+        env.resize(r_end - r0, 0.0f);
+
+        for (int l = 0; l < n; ++l) {
+            const int64_t r = (n_frames + l)*n_hop - r0;
+            const float * y = frames.data() + (size_t) l*n_fft;
+            for (int j = 0; j < n_win; ++j) {
+                acc[r + j] += y[j];
+                env[r + j] += hann[j]*hann[j];
+            }
+        }
+
+        n_frames += n;
+
+        // the next frame starts at n_frames*n_hop
+        emit(n_frames*n_hop - n_pad, out);
     }
-    for (int i = 0; i < n_thread; ++i) {
-        workers[i].join();
+
+    // append the remaining samples to out
+    void flush(std::vector<float> & out) {
+        emit(n_frames*n_hop, out);
     }
 
-    std::vector<float> audio;
-    std::vector<float> env;
+private:
+    void emit(int64_t n_end, std::vector<float> & out) {
+        if (n_end <= n_out) {
+            return;
+        }
+
+        for (int64_t t = n_out; t < n_end; ++t) {
+            const int64_t i = t + n_pad - r0;
+            out.push_back(acc[i]/env[i]);
+        }
 
-    fold(res,   n_out, n_win, n_hop, n_pad, audio);
-    fold(hann2, n_out, n_win, n_hop, n_pad, env); // TODO: can be done once
+        const int64_t n_drop = n_end + n_pad - r0;
+        acc.erase(acc.begin(), acc.begin() + n_drop);
+        env.erase(env.begin(), env.begin() + n_drop);
 
-    for (size_t i = 0; i < audio.size(); ++i) {
-        audio[i] /= env[i];
+        r0   += n_drop;
+        n_out = n_end;
     }
+};
+
+static std::vector<float> embd_to_audio(
+        const float * embd,
+        const int n_codes,
+        const int n_embd,
+        const int n_thread) {
+    const int n_fft = 1280;
+    const int n_hop = 320;
+    const int n_win = 1280;
+
+    std::vector<float> audio;
+
+    istft_stream istft(n_fft, n_hop, n_win, n_thread);
+    istft.add(embd, n_codes, n_embd, audio);
+    istft.flush(audio);
 
     return audio;
 }
@@ -535,6 +706,139 @@ static std::string audio_data_from_speaker(json speaker, const outetts_version t
     return audio_data;
 }
 
+//
+// streaming vocoder
+//
+// the audio codes are converted to speech while they are being generated, in overlapping windows - every window has
+// some context codes on the left and lookahead codes on the right, so that the convolutions of the vocoder see
+// (almost) the same inputs as when the whole utterance is processed at once
+//
+
+struct tts_stream {
+    static constexpr int n_ctx_left  = 32;  // codes of left context
+    static constexpr int n_lookahead = 16;  // codes of right context
+    static constexpr int n_chunk_max = 256;
+
+    static constexpr int n_sr = 24000; // sampling rate
+
+    llama_context * ctx;
+
+    const int n_embd;
+
+    istft_stream istft;
+    wav_writer   wav;
+    llama_batch  batch;
+
+    std::vector<llama_token> codes; // audio codes generated so far
+
+    int n_done  = 0;  // codes already converted to audio
+    int n_chunk = 16; // codes converted per window, grows up to n_chunk_max to reduce the overhead of the context
+
+    int64_t t_start_us = 0;
+    int64_t t_first_us = 0; // time of the first audio
+    int64_t t_voc_us   = 0; // time spent in the vocoder
+
+    std::vector<float> audio; // scratch
+
+    tts_stream(llama_context * ctx, int n_thread)
+        : ctx(ctx),
+          n_embd(llama_model_n_embd(llama_get_model(ctx))),
+          istft(1280, 320, 1280, n_thread),
+          batch(llama_batch_init(n_ctx_left + n_chunk_max + n_lookahead, 0, 1)) {
+    }
+
+    ~tts_stream() {
+        llama_batch_free(batch);
+    }
+
+    bool open(const std::string & fname) {
+        t_start_us = ggml_time_us();
+        return wav.open(fname, n_sr);
+    }
+
+    bool push(llama_token token) {
+        // ignore all non-audio tokens (i.e. < 151672 || > 155772)
+        if (token < 151672 || token > 155772) {
+            return true;
+        }
+
+        codes.push_back(token - 151672);
+
+        return process(false);
+    }
+
+    bool close() {
+        if (!process(true)) {
+            return false;
+        }
+
+        audio.clear();
+        istft.flush(audio);
+        write(audio);
+
+        return wav.close();
+    }
+
+private:
+    bool process(bool last) {
+        while (true) {
+            const int n_avail = codes.size();
+
+            if (!last && n_avail < n_done + n_chunk + n_lookahead) {
+                return true;
+            }
+
+            const int n = last ? std::min(n_avail - n_done, n_chunk_max) : n_chunk;
+            if (n <= 0) {
+                return true;
+            }
+
+            const int i0 = std::max(0, n_done - n_ctx_left);
+            const int i1 = std::min(n_avail, n_done + n + n_lookahead);
+
+            const int64_t t_voc_start = ggml_time_us();
+
+            common_batch_clear(batch);
+            for (int i = i0; i < i1; ++i) {
+                common_batch_add(batch, codes[i], i - i0, { 0 }, true);
+            }
+
+            if (llama_encode(ctx, batch) != 0) {
+                LOG_ERR("%s: llama_encode() failed\n", __func__);
+                return false;
+            }
+
+            llama_synchronize(ctx);
+
+            const float * embd = llama_get_embeddings(ctx) + (size_t) (n_done - i0)*n_embd;
+
+            audio.clear();
+            istft.add(embd, n, n_embd, audio);
+            write(audio);
+
+            t_voc_us += ggml_time_us() - t_voc_start;
+
+            n_done += n;
+            n_chunk = std::min(2*n_chunk, n_chunk_max);
+        }
+    }
+
+    void write(std::vector<float> & data) {
+        // zero out first 0.25 seconds
+        for (size_t i = 0; i < data.size() && wav.n_samples + i < n_sr/4; ++i) {
+            data[i] = 0.0f;
+        }
+
+        if (t_first_us == 0 && !data.empty()) {
+            t_first_us = ggml_time_us();
+            LOG("\n");
+            LOG_INF("%s: time to first audio:   %.3f ms\n", __func__, (t_first_us - t_start_us) / 1000.0f);
+        }
+
+        wav.write(data.data(), data.size());
+    }
+};
+
 int main(int argc, char ** argv) {
     common_params params;
 
@@ -609,6 +913,19 @@ int main(int argc, char ** argv) {
 
     const auto t_main_start = ggml_time_us();
 
+    // convert the codes to audio while they are being generated
+    std::unique_ptr<tts_stream> stream;
+    if (params.vocoder.stream) {
+        if (n_parallel > 1) {
+            LOG_WRN("%s: streaming is not supported with %d parallel sequences - disabling\n", __func__, n_parallel);
+        } else {
+            stream.reset(new tts_stream(ctx_cts, params.cpuparams.n_threads));
+            if (!stream->open(params.out_file)) {
+                return ENOENT;
+            }
+        }
+    }
+
     std::vector<llama_token> codes;
     std::vector<llama_token> guide_tokens;
 
@@ -896,6 +1213,10 @@ lovely<|t_0.56|><|code_start|><|634|><|596|><|1766|><|1556|><|1306|><|1285|><|14
 
                 codes.push_back(new_token_id);
 
+                if (stream && !stream->push(new_token_id)) {
+                    return 1;
+                }
+
                 const auto * cands = common_sampler_get_candidates(smpl[i]);
 
                 // is it an end of generation? -> mark the stream as finished
@@ -1009,6 +1330,20 @@ lovely<|t_0.56|><|code_start|><|634|><|596|><|1766|><|1556|><|1306|><|1285|><|14
         LOG_INF("%s: codes audio size: %d\n", __func__, (int) codes.size());
     }
 
+    if (stream) {
+        if (!stream->close()) {
+            return ENOENT;
+        }
+
+        LOG_INF("%s: time for vocoder:      %.3f ms\n", __func__, stream->t_voc_us / 1000.0f);
+        LOG_INF("%s: total time:            %.3f ms\n", __func__, (ggml_time_us() - t_main_start) / 1000.0f);
+        LOG_INF("%s: audio written to file '%s'\n", __func__, params.out_file.c_str());
+
+        llama_backend_free();
+
+        return 0;
+    }
+
     for (auto & token : codes) {
         token -= 151672;
     }
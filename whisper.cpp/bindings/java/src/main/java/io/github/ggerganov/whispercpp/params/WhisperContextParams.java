@@ -40,6 +40,9 @@ public class WhisperContextParams extends Structure {
     /** DTW memory size (internal use) */
     public NativeLong dtw_mem_size;
 
+    /** Map GGUF model files in memory and use the CPU weights in place (default = true) */
+    public CBool use_mmap;
+
     /** Use GPU for inference */
     public void useGpu(boolean enable) {
         use_gpu = enable ? CBool.TRUE : CBool.FALSE;
@@ -55,6 +58,11 @@ public class WhisperContextParams extends Structure {
         dtw_token_timestamps = enable ? CBool.TRUE : CBool.FALSE;
     }
 
+    /** Map GGUF model files in memory */
+    public void useMmap(boolean enable) {
+        use_mmap = enable ? CBool.TRUE : CBool.FALSE;
+    }
+
     /** Set DTW alignment heads preset */
     public void setDtwAheadsPreset(int preset) {
         dtw_aheads_preset = preset;
@@ -70,7 +78,8 @@ public class WhisperContextParams extends Structure {
             "dtw_aheads_preset",
             "dtw_n_top",
             "dtw_aheads",
-            "dtw_mem_size"
+            "dtw_mem_size",
+            "use_mmap"
         );
     }
 
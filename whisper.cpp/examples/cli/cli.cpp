@@ -43,6 +43,7 @@ struct whisper_params {
     int32_t best_of       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).greedy.best_of;
     int32_t beam_size     = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH).beam_search.beam_size;
     int32_t audio_ctx     = 0;
+    int32_t n_draft       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).n_draft;
 
     float word_thold      =  0.01f;
     float entropy_thold   =  2.40f;
@@ -76,12 +77,15 @@ struct whisper_params {
     bool log_score       = false;
     bool use_gpu         = true;
     bool flash_attn      = false;
+    bool use_mmap        = true;
     bool suppress_nst    = false;
+    bool stream_audio    = false;
 
     std::string language  = "en";
     std::string prompt;
     std::string font_path = "/System/Library/Fonts/Supplemental/Courier New Bold.ttf";
     std::string model     = "models/ggml-base.en.bin";
+    std::string model_draft;
     std::string grammar;
     std::string grammar_rule;
 
@@ -187,12 +191,16 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-dl"   || arg == "--detect-language") { params.detect_language = true; }
         else if (                  arg == "--prompt")          { params.prompt          = ARGV_NEXT; }
         else if (arg == "-m"    || arg == "--model")           { params.model           = ARGV_NEXT; }
+        else if (arg == "-md"   || arg == "--model-draft")     { params.model_draft     = ARGV_NEXT; }
+        else if (                  arg == "--draft")           { params.n_draft         = std::stoi(ARGV_NEXT); }
         else if (arg == "-f"    || arg == "--file")            { params.fname_inp.emplace_back(ARGV_NEXT); }
+        else if (arg == "-sa"   || arg == "--stream-audio")    { params.stream_audio    = true; }
         else if (arg == "-oved" || arg == "--ov-e-device")     { params.openvino_encode_device = ARGV_NEXT; }
         else if (arg == "-dtw"  || arg == "--dtw")             { params.dtw             = ARGV_NEXT; }
         else if (arg == "-ls"   || arg == "--log-score")       { params.log_score       = true; }
         else if (arg == "-ng"   || arg == "--no-gpu")          { params.use_gpu         = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")      { params.flash_attn      = true; }
+        else if (arg == "-nmm"  || arg == "--no-mmap")         { params.use_mmap        = false; }
         else if (arg == "-sns"  || arg == "--suppress-nst")    { params.suppress_nst    = true; }
         else if (                  arg == "--suppress-regex")  { params.suppress_regex  = ARGV_NEXT; }
         else if (                  arg == "--grammar")         { params.grammar         = ARGV_NEXT; }
@@ -266,12 +274,16 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -dl,       --detect-language   [%-7s] exit after automatically detecting language\n",    params.detect_language ? "true" : "false");
     fprintf(stderr, "             --prompt PROMPT     [%-7s] initial prompt (max n_text_ctx/2 tokens)\n",       params.prompt.c_str());
     fprintf(stderr, "  -m FNAME,  --model FNAME       [%-7s] model path\n",                                     params.model.c_str());
+    fprintf(stderr, "  -md FNAME, --model-draft FNAME [%-7s] draft model for speculative decoding (greedy sampling)\n", params.model_draft.c_str());
+    fprintf(stderr, "  --draft N                      [%-7d] number of tokens to draft for speculative decoding\n", params.n_draft);
     fprintf(stderr, "  -f FNAME,  --file FNAME        [%-7s] input audio file path\n",                            "");
+    fprintf(stderr, "  -sa,       --stream-audio      [%-7s] decode the audio while transcribing it, with bounded memory\n", params.stream_audio ? "true" : "false");
     fprintf(stderr, "  -oved D,   --ov-e-device DNAME [%-7s] the OpenVINO device used for encode inference\n",  params.openvino_encode_device.c_str());
     fprintf(stderr, "  -dtw MODEL --dtw MODEL         [%-7s] compute token-level timestamps\n",                 params.dtw.c_str());
     fprintf(stderr, "  -ls,       --log-score         [%-7s] log best decoder scores of tokens\n",              params.log_score?"true":"false");
     fprintf(stderr, "  -ng,       --no-gpu            [%-7s] disable GPU\n",                                    params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,       --flash-attn        [%-7s] flash attention\n",                                params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -nmm,      --no-mmap           [%-7s] do not map GGUF models in memory\n",              params.use_mmap ? "false" : "true");
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n",                     params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  --suppress-regex REGEX         [%-7s] regular expression matching tokens to suppress\n", params.suppress_regex.c_str());
     fprintf(stderr, "  --grammar GRAMMAR              [%-7s] GBNF grammar to guide decoding\n",                 params.grammar.c_str());
@@ -985,6 +997,27 @@ int main(int argc, char ** argv) {
         exit(0);
     }
 
+    if (params.stream_audio && (params.diarize || params.vad)) {
+        fprintf(stderr, "error: cannot use --stream-audio with --diarize or --vad\n");
+        whisper_print_usage(argc, argv, params);
+        exit(0);
+    }
+
+    if (params.stream_audio && params.n_processors > 1) {
+        fprintf(stderr, "%s: WARNING: --stream-audio uses a single processor\n", __func__);
+        params.n_processors = 1;
+    }
+
+    // speculative decoding is only used with greedy sampling, and the default beam size would silently disable it
+    if (!params.model_draft.empty() && params.beam_size > 1) {
+        fprintf(stderr, "%s: WARNING: --model-draft uses greedy sampling, ignoring --beam-size %d\n", __func__, params.beam_size);
+        params.beam_size = 1;
+    }
+
+    if (!params.model_draft.empty() && !params.grammar.empty()) {
+        fprintf(stderr, "%s: WARNING: --grammar uses beam search, the draft model will not be used\n", __func__);
+    }
+
     if (params.no_prints) {
         whisper_log_set(cb_log_disable, NULL);
     }
@@ -994,6 +1027,7 @@ int main(int argc, char ** argv) {
 
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
+    cparams.use_mmap   = params.use_mmap;
 
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
@@ -1028,6 +1062,22 @@ int main(int argc, char ** argv) {
     // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
     whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
 
+    struct whisper_context * ctx_draft = nullptr;
+
+    if (!params.model_draft.empty()) {
+        // the DTW heads are specific to the model
+        whisper_context_params cparams_draft = cparams;
+        cparams_draft.dtw_token_timestamps = false;
+
+        ctx_draft = whisper_init_from_file_with_params(params.model_draft.c_str(), cparams_draft);
+
+        if (ctx_draft == nullptr) {
+            fprintf(stderr, "error: failed to initialize the draft whisper context\n");
+            whisper_free(ctx);
+            return 3;
+        }
+    }
+
     if (!params.grammar.empty()) {
         auto & grammar = params.grammar_parsed;
         if (is_file_exist(params.grammar.c_str())) {
@@ -1105,7 +1155,15 @@ int main(int argc, char ** argv) {
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
+        // with --stream-audio, the audio is decoded on a background thread while it is transcribed and pcmf32 stays empty
+        audio_reader reader;
+
+        if (params.stream_audio) {
+            if (!reader.open(fname_inp)) {
+                fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
+                continue;
+            }
+        } else if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
             fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
             continue;
         }
@@ -1129,13 +1187,23 @@ int main(int argc, char ** argv) {
 
             // print some info about the processing
             fprintf(stderr, "\n");
-            fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
-                    params.n_threads, params.n_processors, params.beam_size, params.best_of,
-                    params.language.c_str(),
-                    params.translate ? "translate" : "transcribe",
-                    params.tinydiarize ? "tdrz = 1, " : "",
-                    params.no_timestamps ? 0 : 1);
+            if (params.stream_audio) {
+                fprintf(stderr, "%s: streaming '%s', %d threads, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
+                        __func__, fname_inp.c_str(),
+                        params.n_threads, params.beam_size, params.best_of,
+                        params.language.c_str(),
+                        params.translate ? "translate" : "transcribe",
+                        params.tinydiarize ? "tdrz = 1, " : "",
+                        params.no_timestamps ? 0 : 1);
+            } else {
+                fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
+                        __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
+                        params.n_threads, params.n_processors, params.beam_size, params.best_of,
+                        params.language.c_str(),
+                        params.translate ? "translate" : "transcribe",
+                        params.tinydiarize ? "tdrz = 1, " : "",
+                        params.no_timestamps ? 0 : 1);
+            }
 
             if (params.print_colors) {
                 fprintf(stderr, "%s: color scheme: red (low confidence), yellow (medium), green (high confidence)\n", __func__);
@@ -1195,6 +1263,14 @@ int main(int argc, char ** argv) {
             wparams.vad            = params.vad;
             wparams.vad_model_path = params.vad_model.c_str();
 
+            wparams.draft_ctx = ctx_draft;
+            wparams.n_draft   = params.n_draft;
+
+            if (params.stream_audio) {
+                wparams.audio_read_callback           = audio_reader::read_callback;
+                wparams.audio_read_callback_user_data = &reader;
+            }
+
             wparams.vad_params.threshold               = params.vad_threshold;
             wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
             wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
@@ -1271,7 +1347,9 @@ int main(int argc, char ** argv) {
             output_ext(txt, pcmf32s);
             output_ext(vtt, pcmf32s);
             output_ext(srt, pcmf32s);
-            output_ext(wts, pcmf32s, fname_inp.c_str(), float(pcmf32.size() + 1000)/WHISPER_SAMPLE_RATE, fout_factory.fname_out.c_str());
+            const int64_t n_samples = params.stream_audio ? reader.n_read() : (int64_t) pcmf32.size();
+
+            output_ext(wts, pcmf32s, fname_inp.c_str(), float(n_samples + 1000)/WHISPER_SAMPLE_RATE, fout_factory.fname_out.c_str());
             output_ext(csv, pcmf32s);
             output_func(output_json, ".json", params.output_jsn, pcmf32s);
             output_ext(lrc, pcmf32s);
@@ -1290,6 +1368,7 @@ int main(int argc, char ** argv) {
         whisper_print_timings(ctx);
     }
     whisper_free(ctx);
+    whisper_free(ctx_draft);
 
     return 0;
 }
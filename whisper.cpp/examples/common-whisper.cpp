@@ -31,22 +31,21 @@
 #include <io.h>
 #endif
 
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <mutex>
+#include <thread>
 
 #ifdef WHISPER_FFMPEG
 // as implemented in ffmpeg_trancode.cpp only embedded in common lib if whisper built with ffmpeg support
 extern bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data);
 #endif
 
-bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
-    std::vector<uint8_t> audio_data; // used for pipe input from stdin or ffmpeg decoding output
-
+// open a decoder for fname - audio_data holds the encoded audio when it is decoded from memory and must outlive the decoder
+static bool audio_decoder_init(const std::string & fname, const ma_decoder_config & decoder_config, ma_decoder & decoder, std::vector<uint8_t> & audio_data) {
     ma_result result;
-    ma_decoder_config decoder_config;
-    ma_decoder decoder;
-
-    decoder_config = ma_decoder_config_init(ma_format_f32, stereo ? 2 : 1, WHISPER_SAMPLE_RATE);
 
     if (fname == "-") {
 		#ifdef _WIN32
@@ -94,6 +93,22 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
 #endif
     }
 
+    return true;
+}
+
+bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
+    std::vector<uint8_t> audio_data; // used for pipe input from stdin or ffmpeg decoding output
+
+    ma_result result;
+    ma_decoder_config decoder_config;
+    ma_decoder decoder;
+
+    decoder_config = ma_decoder_config_init(ma_format_f32, stereo ? 2 : 1, WHISPER_SAMPLE_RATE);
+
+    if (!audio_decoder_init(fname, decoder_config, decoder, audio_data)) {
+        return false;
+    }
+
     ma_uint64 frame_count;
     ma_uint64 frames_read;
 
@@ -133,6 +148,153 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
     return true;
 }
 
+struct audio_reader_impl {
+    std::string          fname;
+    std::vector<uint8_t> audio_data;
+
+    ma_decoder decoder;
+
+    std::thread             worker;
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    // decoded audio that has not been read yet - the first chunk is read from offset on
+    std::deque<std::vector<float>> chunks;
+    size_t offset     = 0;
+    size_t n_buffered = 0;
+    size_t n_max      = 0;
+
+    int64_t n_read = 0;
+
+    bool done   = false; // the decoder reached the end of the audio
+    bool failed = false;
+    bool stop   = false; // the reader is being closed
+};
+
+// producer - decode and resample the audio one chunk at a time, waiting while the buffer is full
+static void audio_reader_worker(audio_reader_impl * impl) {
+    const ma_uint64 n_chunk = WHISPER_SAMPLE_RATE/4;
+
+    while (true) {
+        std::vector<float> chunk(n_chunk);
+
+        ma_uint64 frames_read = 0;
+        const ma_result result = ma_decoder_read_pcm_frames(&impl->decoder, chunk.data(), n_chunk, &frames_read);
+
+        std::unique_lock<std::mutex> lock(impl->mutex);
+
+        if (result != MA_SUCCESS && result != MA_AT_END) {
+            fprintf(stderr, "error: failed to read the frames of the audio data (%s)\n", ma_result_description(result));
+            impl->failed = true;
+        }
+
+        if (frames_read == 0 || impl->failed) {
+            impl->done = true;
+            impl->cv.notify_all();
+            return;
+        }
+
+        chunk.resize(frames_read);
+
+        impl->cv.wait(lock, [impl] { return impl->stop || impl->n_buffered < impl->n_max; });
+        if (impl->stop) {
+            return;
+        }
+
+        impl->chunks.push_back(std::move(chunk));
+        impl->n_buffered += frames_read;
+        impl->cv.notify_all();
+    }
+}
+
+audio_reader::audio_reader() = default;
+
+audio_reader::~audio_reader() {
+    close();
+}
+
+bool audio_reader::open(const std::string & fname, int buffer_ms) {
+    close();
+
+    impl.reset(new audio_reader_impl);
+    impl->fname = fname; // the decoder may read from the name, see audio_decoder_init()
+    impl->n_max = std::max(1, buffer_ms)*(size_t) WHISPER_SAMPLE_RATE/1000;
+
+    const ma_decoder_config decoder_config = ma_decoder_config_init(ma_format_f32, 1, WHISPER_SAMPLE_RATE);
+
+    if (!audio_decoder_init(impl->fname, decoder_config, impl->decoder, impl->audio_data)) {
+        impl.reset();
+        return false;
+    }
+
+    impl->worker = std::thread(audio_reader_worker, impl.get());
+
+    return true;
+}
+
+void audio_reader::close() {
+    if (!impl) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(impl->mutex);
+        impl->stop = true;
+    }
+    impl->cv.notify_all();
+
+    impl->worker.join();
+
+    ma_decoder_uninit(&impl->decoder);
+
+    impl.reset();
+}
+
+int audio_reader::read(float * samples, int n_samples) {
+    if (!impl) {
+        return -1;
+    }
+
+    std::unique_lock<std::mutex> lock(impl->mutex);
+
+    impl->cv.wait(lock, [this] { return impl->n_buffered > 0 || impl->done; });
+
+    if (impl->n_buffered == 0) {
+        return impl->failed ? -1 : 0;
+    }
+
+    int n = 0;
+    while (n < n_samples && !impl->chunks.empty()) {
+        const auto & chunk = impl->chunks.front();
+
+        const size_t n_cur = std::min((size_t) (n_samples - n), chunk.size() - impl->offset);
+        memcpy(samples + n, chunk.data() + impl->offset, n_cur*sizeof(float));
+
+        n            += n_cur;
+        impl->offset += n_cur;
+
+        if (impl->offset == chunk.size()) {
+            impl->chunks.pop_front();
+            impl->offset = 0;
+        }
+    }
+
+    impl->n_buffered -= n;
+    impl->n_read     += n;
+
+    impl->cv.notify_all();
+
+    return n;
+}
+
+int64_t audio_reader::n_read() const {
+    return impl ? impl->n_read : 0;
+}
+
+int audio_reader::read_callback(float * samples, int n_samples, void * user_data) {
+    return ((audio_reader *) user_data)->read(samples, n_samples);
+}
+
 //  500 -> 00:05.000
 // 6000 -> 01:00.000
 std::string to_timestamp(int64_t t, bool comma) {
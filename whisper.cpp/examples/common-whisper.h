@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 
 // Read WAV audio file and store the PCM data into pcmf32
@@ -14,6 +15,40 @@ bool read_audio_data(
         std::vector<std::vector<float>> & pcmf32s,
         bool stereo);
 
+// Decode an audio file in chunks on a background thread, converting it to 16 kHz mono PCM
+// At most buffer_ms of decoded audio are kept in memory - the decoder waits until the consumer catches up
+// Use with whisper_full_params.audio_read_callback to overlap the decoding with the inference:
+//
+//   audio_reader reader;
+//   reader.open(fname);
+//   wparams.audio_read_callback           = audio_reader::read_callback;
+//   wparams.audio_read_callback_user_data = &reader;
+//
+struct audio_reader_impl;
+
+class audio_reader {
+public:
+    audio_reader();
+    ~audio_reader();
+
+    // fname can be "-" to read from stdin
+    bool open(const std::string & fname, int buffer_ms = 60000);
+    void close();
+
+    // read up to n_samples, blocking until they are decoded
+    // returns the number of samples read, 0 at the end of the audio or -1 on error
+    int read(float * samples, int n_samples);
+
+    // number of samples read so far
+    int64_t n_read() const;
+
+    // whisper_audio_read_callback - user_data is the audio_reader
+    static int read_callback(float * samples, int n_samples, void * user_data);
+
+private:
+    std::unique_ptr<audio_reader_impl> impl;
+};
+
 // convert timestamp to string, 6000 -> 01:00.000
 std::string to_timestamp(int64_t t, bool comma = false);
 
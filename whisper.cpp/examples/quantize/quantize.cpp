@@ -1,9 +1,11 @@
 #include "ggml.h"
 #include "ggml-backend.h"
+#include "gguf.h"
 
 #include "common.h"
 #include "common-ggml.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstdio>
@@ -176,11 +178,214 @@ static bool whisper_model_quantize(const std::string & fname_inp, const std::str
     return true;
 }
 
+// convert a ggml model to GGUF
+//
+// the hparams, mel filters and vocab are stored as key-value pairs and the tensor data is aligned, so that the model
+// can be mapped in memory and used in place (see whisper_model_load_gguf)
+static bool whisper_model_convert_gguf(const std::string & fname_inp, const std::string & fname_out) {
+    printf("%s: converting model '%s' to GGUF\n", __func__, fname_inp.c_str());
+
+    auto finp = std::ifstream(fname_inp, std::ios::binary);
+    if (!finp) {
+        fprintf(stderr, "%s: failed to open '%s' for reading\n", __func__, fname_inp.c_str());
+        return false;
+    }
+
+    // verify magic
+    {
+        uint32_t magic;
+        finp.read((char *) &magic, sizeof(magic));
+        if (magic != GGML_FILE_MAGIC) {
+            fprintf(stderr, "%s: invalid model file '%s' (bad magic)\n", __func__, fname_inp.c_str());
+            return false;
+        }
+    }
+
+    gguf_context * gctx = gguf_init_empty();
+
+    gguf_set_val_str(gctx, "general.architecture", "whisper");
+
+    whisper_hparams hparams;
+
+    // hparams
+    {
+        finp.read((char *) &hparams.n_vocab,       sizeof(hparams.n_vocab));
+        finp.read((char *) &hparams.n_audio_ctx,   sizeof(hparams.n_audio_ctx));
+        finp.read((char *) &hparams.n_audio_state, sizeof(hparams.n_audio_state));
+        finp.read((char *) &hparams.n_audio_head,  sizeof(hparams.n_audio_head));
+        finp.read((char *) &hparams.n_audio_layer, sizeof(hparams.n_audio_layer));
+        finp.read((char *) &hparams.n_text_ctx,    sizeof(hparams.n_text_ctx));
+        finp.read((char *) &hparams.n_text_state,  sizeof(hparams.n_text_state));
+        finp.read((char *) &hparams.n_text_head,   sizeof(hparams.n_text_head));
+        finp.read((char *) &hparams.n_text_layer,  sizeof(hparams.n_text_layer));
+        finp.read((char *) &hparams.n_mels,        sizeof(hparams.n_mels));
+        finp.read((char *) &hparams.ftype,         sizeof(hparams.ftype));
+
+        gguf_set_val_u32(gctx, "whisper.n_vocab",       hparams.n_vocab);
+        gguf_set_val_u32(gctx, "whisper.n_audio_ctx",   hparams.n_audio_ctx);
+        gguf_set_val_u32(gctx, "whisper.n_audio_state", hparams.n_audio_state);
+        gguf_set_val_u32(gctx, "whisper.n_audio_head",  hparams.n_audio_head);
+        gguf_set_val_u32(gctx, "whisper.n_audio_layer", hparams.n_audio_layer);
+        gguf_set_val_u32(gctx, "whisper.n_text_ctx",    hparams.n_text_ctx);
+        gguf_set_val_u32(gctx, "whisper.n_text_state",  hparams.n_text_state);
+        gguf_set_val_u32(gctx, "whisper.n_text_head",   hparams.n_text_head);
+        gguf_set_val_u32(gctx, "whisper.n_text_layer",  hparams.n_text_layer);
+        gguf_set_val_u32(gctx, "whisper.n_mels",        hparams.n_mels);
+
+        gguf_set_val_u32(gctx, "general.file_type",            hparams.ftype % GGML_QNT_VERSION_FACTOR);
+        gguf_set_val_u32(gctx, "general.quantization_version", hparams.ftype / GGML_QNT_VERSION_FACTOR);
+    }
+
+    // mel filters
+    {
+        whisper_filters filters;
+
+        finp.read((char *) &filters.n_mel, sizeof(filters.n_mel));
+        finp.read((char *) &filters.n_fft, sizeof(filters.n_fft));
+
+        filters.data.resize(filters.n_mel * filters.n_fft);
+        finp.read((char *) filters.data.data(), filters.data.size() * sizeof(float));
+
+        gguf_set_val_u32 (gctx, "whisper.filters.n_mel", filters.n_mel);
+        gguf_set_val_u32 (gctx, "whisper.filters.n_fft", filters.n_fft);
+        gguf_set_arr_data(gctx, "whisper.filters.data", GGUF_TYPE_FLOAT32, filters.data.data(), filters.data.size());
+    }
+
+    // vocab - the tokens are raw bytes (not necessarily valid UTF-8 and possibly containing zeros), so they are
+    // stored as a byte array and an array of lengths instead of an array of strings
+    {
+        int32_t n_vocab = 0;
+        finp.read((char *) &n_vocab, sizeof(n_vocab));
+
+        std::vector<uint32_t> len(n_vocab);
+        std::vector<uint8_t>  data;
+
+        for (int i = 0; i < n_vocab; i++) {
+            finp.read((char *) &len[i], sizeof(len[i]));
+
+            data.resize(data.size() + len[i]);
+            finp.read((char *) data.data() + data.size() - len[i], len[i]);
+        }
+
+        gguf_set_arr_data(gctx, "whisper.vocab.len",  GGUF_TYPE_UINT32, len.data(),  len.size());
+        gguf_set_arr_data(gctx, "whisper.vocab.data", GGUF_TYPE_UINT8,  data.data(), data.size());
+    }
+
+    if (!finp) {
+        fprintf(stderr, "%s: failed to read model header from '%s'\n", __func__, fname_inp.c_str());
+        gguf_free(gctx);
+        return false;
+    }
+
+    // first pass: tensor meta data
+    const size_t n_tensors_max = 10 + 15 + 15*hparams.n_audio_layer + 24*hparams.n_text_layer;
+
+    ggml_init_params params = {
+        /*.mem_size   =*/ n_tensors_max * ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
+
+    ggml_context * ctx = ggml_init(params);
+
+    std::vector<std::pair<ggml_tensor *, std::streampos>> tensors;
+
+    while (true) {
+        int32_t n_dims;
+        int32_t length;
+        int32_t ttype;
+
+        finp.read(reinterpret_cast<char *>(&n_dims), sizeof(n_dims));
+        finp.read(reinterpret_cast<char *>(&length), sizeof(length));
+        finp.read(reinterpret_cast<char *>(&ttype),  sizeof(ttype));
+
+        if (finp.eof()) {
+            break;
+        }
+
+        if (n_dims < 1 || n_dims > 4 || length <= 0 || length >= GGML_MAX_NAME || ttype < 0 || ttype >= GGML_TYPE_COUNT ||
+            tensors.size() >= n_tensors_max) {
+            fprintf(stderr, "%s: invalid tensor in model file '%s'\n", __func__, fname_inp.c_str());
+            ggml_free(ctx);
+            gguf_free(gctx);
+            return false;
+        }
+
+        int64_t ne[4] = { 1, 1, 1, 1 };
+        for (int i = 0; i < n_dims; ++i) {
+            int32_t ne_cur;
+            finp.read(reinterpret_cast<char *>(&ne_cur), sizeof(ne_cur));
+            ne[i] = ne_cur;
+        }
+
+        std::string name(length, 0);
+        finp.read(&name[0], length);
+
+        ggml_tensor * tensor = ggml_new_tensor(ctx, (ggml_type) ttype, n_dims, ne);
+        ggml_set_name(tensor, name.c_str());
+
+        gguf_add_tensor(gctx, tensor);
+
+        tensors.emplace_back(tensor, finp.tellg());
+
+        finp.seekg(ggml_nbytes(tensor), std::ios::cur);
+    }
+
+    finp.clear();
+
+    printf("%s: writing %zu tensors to '%s'\n", __func__, tensors.size(), fname_out.c_str());
+
+    if (!gguf_write_to_file(gctx, fname_out.c_str(), /*only_meta =*/ true)) {
+        fprintf(stderr, "%s: failed to write '%s'\n", __func__, fname_out.c_str());
+        ggml_free(ctx);
+        gguf_free(gctx);
+        return false;
+    }
+
+    // second pass: copy the tensor data, padded to the GGUF alignment
+    auto fout = std::ofstream(fname_out, std::ios::binary | std::ios::app);
+
+    const size_t alignment = gguf_get_alignment(gctx);
+
+    std::vector<char> buf;
+
+    size_t total_size = 0;
+
+    for (const auto & t : tensors) {
+        const size_t nbytes = ggml_nbytes(t.first);
+
+        buf.resize(GGML_PAD(nbytes, alignment));
+        std::fill(buf.begin() + nbytes, buf.end(), 0);
+
+        finp.seekg(t.second);
+        finp.read(buf.data(), nbytes);
+        fout.write(buf.data(), buf.size());
+
+        total_size += nbytes;
+    }
+
+    const bool ok = finp && fout;
+
+    if (!ok) {
+        fprintf(stderr, "%s: failed to copy the tensor data to '%s'\n", __func__, fname_out.c_str());
+    } else {
+        printf("%s: model size  = %8.2f MB\n", __func__, total_size/1024.0/1024.0);
+    }
+
+    ggml_free(ctx);
+    gguf_free(gctx);
+
+    return ok;
+}
+
 int main(int argc, char ** argv) {
     ggml_backend_load_all();
 
-    if (argc != 4) {
+    const bool to_gguf = argc >= 3 && std::regex_search(argv[2], std::regex("\\.gguf$"));
+
+    if (argc != 4 && !(argc == 3 && to_gguf)) {
         fprintf(stderr, "usage: %s model-f32.bin model-quant.bin type\n", argv[0]);
+        fprintf(stderr, "       %s model.bin model.gguf [type]\n", argv[0]);
         ggml_print_ftypes(stderr);
         return 1;
     }
@@ -195,7 +400,7 @@ int main(int argc, char ** argv) {
     const std::string fname_inp = argv[1];
     const std::string fname_out = argv[2];
 
-    const ggml_ftype ftype = ggml_parse_ftype(argv[3]);
+    const ggml_ftype ftype = argc == 4 ? ggml_parse_ftype(argv[3]) : GGML_FTYPE_UNKNOWN;
 
     const int64_t t_main_start_us = ggml_time_us();
 
@@ -205,9 +410,30 @@ int main(int argc, char ** argv) {
     {
         const int64_t t_start_us = ggml_time_us();
 
-        if (!whisper_model_quantize(fname_inp, fname_out, ggml_ftype(ftype))) {
-            fprintf(stderr, "%s: failed to quantize model from '%s'\n", __func__, fname_inp.c_str());
-            return 1;
+        if (!to_gguf) {
+            if (!whisper_model_quantize(fname_inp, fname_out, ggml_ftype(ftype))) {
+                fprintf(stderr, "%s: failed to quantize model from '%s'\n", __func__, fname_inp.c_str());
+                return 1;
+            }
+        } else if (argc == 3) {
+            if (!whisper_model_convert_gguf(fname_inp, fname_out)) {
+                fprintf(stderr, "%s: failed to convert model from '%s'\n", __func__, fname_inp.c_str());
+                return 1;
+            }
+        } else {
+            // quantize to a temporary ggml file first
+            const std::string fname_tmp = fname_out + ".tmp";
+
+            const bool ok =
+                whisper_model_quantize    (fname_inp, fname_tmp, ggml_ftype(ftype)) &&
+                whisper_model_convert_gguf(fname_tmp, fname_out);
+
+            std::remove(fname_tmp.c_str());
+
+            if (!ok) {
+                fprintf(stderr, "%s: failed to quantize model from '%s'\n", __func__, fname_inp.c_str());
+                return 1;
+            }
         }
 
         t_quantize_us = ggml_time_us() - t_start_us;
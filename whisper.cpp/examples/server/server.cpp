@@ -8,8 +8,12 @@
 #include <cfloat>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
 #include <fstream>
+#include <mutex>
+#include <shared_mutex>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -65,7 +69,11 @@ struct server_params
     int32_t read_timeout  = 600;
     int32_t write_timeout = 600;
 
+    int32_t n_parallel    = 1;  // number of requests processed concurrently, one whisper_state each
+    int32_t batch_window  = 10; // ms to wait for more requests before starting a batch
+
     bool ffmpeg_converter = false;
+    bool batch_encode     = false;
 };
 
 struct whisper_params {
@@ -102,6 +110,7 @@ struct whisper_params {
     bool no_timestamps   = false;
     bool use_gpu         = true;
     bool flash_attn      = false;
+    bool use_mmap        = true;
     bool suppress_nst    = false;
     bool no_context      = false;
 
@@ -173,11 +182,15 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  --request-path PATH,           [%-7s] Request path for all requests\n", sparams.request_path.c_str());
     fprintf(stderr, "  --inference-path PATH,         [%-7s] Inference path for all requests\n", sparams.inference_path.c_str());
     fprintf(stderr, "  --convert,                     [%-7s] Convert audio to WAV, requires ffmpeg on the server\n", sparams.ffmpeg_converter ? "true" : "false");
+    fprintf(stderr, "  -np N,     --parallel N        [%-7d] number of requests processed in parallel\n", sparams.n_parallel);
+    fprintf(stderr, "  -be,       --batch-encode      [%-7s] encode queued requests together in one batch\n", sparams.batch_encode ? "true" : "false");
+    fprintf(stderr, "  -bw N,     --batch-window N    [%-7d] ms to wait for more requests before starting a batch\n", sparams.batch_window);
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n", params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  -nth N,    --no-speech-thold N [%-7.2f] no speech threshold\n",   params.no_speech_thold);
     fprintf(stderr, "  -nc,       --no-context        [%-7s] do not use previous audio context\n", params.no_context ? "true" : "false");
     fprintf(stderr, "  -ng,       --no-gpu            [%-7s] do not use gpu\n", params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,       --flash-attn        [%-7s] flash attention\n", params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -nmm,      --no-mmap           [%-7s] do not map GGUF models in memory\n", params.use_mmap ? "false" : "true");
     // Voice Activity Detection (VAD) parameters
     fprintf(stderr, "\nVoice Activity Detection (VAD) options:\n");
     fprintf(stderr, "             --vad                           [%-7s] enable Voice Activity Detection (VAD)\n",            params.vad ? "true" : "false");
@@ -234,6 +247,7 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (arg == "-dtw"  || arg == "--dtw")             { params.dtw             = argv[++i]; }
         else if (arg == "-ng"   || arg == "--no-gpu")          { params.use_gpu         = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")      { params.flash_attn      = true; }
+        else if (arg == "-nmm"  || arg == "--no-mmap")         { params.use_mmap        = false; }
         else if (arg == "-sns"  || arg == "--suppress-nst")    { params.suppress_nst    = true; }
         else if (arg == "-nth"  || arg == "--no-speech-thold") { params.no_speech_thold = std::stof(argv[++i]); }
         else if (arg == "-nc"   || arg == "--no-context")      { params.no_context      = true; }
@@ -245,6 +259,9 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (                  arg == "--request-path")    { sparams.request_path = argv[++i]; }
         else if (                  arg == "--inference-path")  { sparams.inference_path = argv[++i]; }
         else if (                  arg == "--convert")         { sparams.ffmpeg_converter     = true; }
+        else if (arg == "-np"   || arg == "--parallel")        { sparams.n_parallel  = std::max(1, std::stoi(argv[++i])); }
+        else if (arg == "-be"   || arg == "--batch-encode")    { sparams.batch_encode = true; }
+        else if (arg == "-bw"   || arg == "--batch-window")    { sparams.batch_window = std::stoi(argv[++i]); }
 
         // Voice Activity Detection (VAD)
         else if (                  arg == "--vad")                         { params.vad                         = true; }
@@ -371,11 +388,11 @@ void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct wh
     }
 }
 
-void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
     const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -391,8 +408,8 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps) {
@@ -404,29 +421,29 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
         }
 
         if (params.print_colors) {
-            for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
                 if (params.print_special == false) {
-                    const whisper_token id = whisper_full_get_token_id(ctx, i, j);
+                    const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
                     if (id >= whisper_token_eot(ctx)) {
                         continue;
                     }
                 }
 
-                const char * text = whisper_full_get_token_text(ctx, i, j);
-                const float  p    = whisper_full_get_token_p   (ctx, i, j);
+                const char * text = whisper_full_get_token_text_from_state(ctx, state, i, j);
+                const float  p    = whisper_full_get_token_p_from_state   (state, i, j);
 
                 const int col = std::max(0, std::min((int) k_colors.size() - 1, (int) (std::pow(p, 3)*float(k_colors.size()))));
 
                 printf("%s%s%s%s", speaker.c_str(), k_colors[col].c_str(), text, "\033[0m");
             }
         } else {
-            const char * text = whisper_full_get_segment_text(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
 
             printf("%s%s", speaker.c_str(), text);
         }
 
         if (params.tinydiarize) {
-            if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
+            if (whisper_full_get_segment_speaker_turn_next_from_state(state, i)) {
                 printf("%s", params.tdrz_speaker_turn.c_str());
             }
         }
@@ -439,17 +456,54 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
     }
 }
 
-std::string output_str(struct whisper_context * ctx, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+// the results of a request - stored in a state of the pool, or in the default state for whisper_full_parallel()
+struct server_result {
+    whisper_context * ctx;
+    whisper_state   * state; // nullptr - default state
+
+    int n_segments() const {
+        return state ? whisper_full_n_segments_from_state(state) : whisper_full_n_segments(ctx);
+    }
+    int lang_id() const {
+        return state ? whisper_full_lang_id_from_state(state) : whisper_full_lang_id(ctx);
+    }
+    const char * segment_text(int i) const {
+        return state ? whisper_full_get_segment_text_from_state(state, i) : whisper_full_get_segment_text(ctx, i);
+    }
+    int64_t segment_t0(int i) const {
+        return state ? whisper_full_get_segment_t0_from_state(state, i) : whisper_full_get_segment_t0(ctx, i);
+    }
+    int64_t segment_t1(int i) const {
+        return state ? whisper_full_get_segment_t1_from_state(state, i) : whisper_full_get_segment_t1(ctx, i);
+    }
+    float segment_no_speech_prob(int i) const {
+        return state ? whisper_full_get_segment_no_speech_prob_from_state(state, i) : whisper_full_get_segment_no_speech_prob(ctx, i);
+    }
+    int n_tokens(int i) const {
+        return state ? whisper_full_n_tokens_from_state(state, i) : whisper_full_n_tokens(ctx, i);
+    }
+    const char * token_text(int i, int j) const {
+        return state ? whisper_full_get_token_text_from_state(ctx, state, i, j) : whisper_full_get_token_text(ctx, i, j);
+    }
+    whisper_token_data token_data(int i, int j) const {
+        return state ? whisper_full_get_token_data_from_state(state, i, j) : whisper_full_get_token_data(ctx, i, j);
+    }
+    int lang_auto_detect(int n_threads, float * lang_probs) const {
+        return state ? whisper_lang_auto_detect_with_state(ctx, state, 0, n_threads, lang_probs) : whisper_lang_auto_detect(ctx, 0, n_threads, lang_probs);
+    }
+};
+
+std::string output_str(const server_result & result_ctx, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
     std::stringstream result;
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = result_ctx.n_segments();
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
+        const char * text = result_ctx.segment_text(i);
         std::string speaker = "";
 
         if (params.diarize && pcmf32s.size() == 2)
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+            const int64_t t0 = result_ctx.segment_t0(i);
+            const int64_t t1 = result_ctx.segment_t1(i);
             speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
         }
 
@@ -601,6 +655,214 @@ void get_req_parameters(const Request & req, whisper_params & params)
     }
 }
 
+// a transcription request, waiting for or processed by a state of the pool
+struct server_task {
+    whisper_full_params wparams;
+
+    const std::vector<float> * pcmf32 = nullptr;
+
+    whisper_state * state = nullptr; // assigned when the task is scheduled
+
+    int  ret  = 0;
+    bool done = false;
+
+    int64_t t_queued_us = 0;
+    int64_t t_start_us  = 0;
+    int64_t t_end_us    = 0;
+};
+
+struct server_metrics {
+    uint64_t n_requests         = 0;
+    uint64_t n_batches          = 0; // batches of more than one request
+    uint64_t n_batched_requests = 0;
+
+    double t_audio_s = 0.0;
+
+    int64_t t_queue_us   = 0;
+    int64_t t_process_us = 0;
+};
+
+// a pool of whisper_states that share one whisper_context
+// requests wait in a FIFO queue for a free state. with batching, the request at the front of the queue takes the
+// requests queued behind it along and they are processed with whisper_full_batch()
+struct server_pool {
+    whisper_context * ctx = nullptr;
+
+    int n_batch_max    = 1;
+    int t_batch_window = 0; // ms
+
+    std::vector<whisper_state *> states;
+    std::vector<whisper_state *> free_states;
+
+    std::deque<server_task *> queue;
+
+    int n_processing = 0;
+
+    server_metrics metrics;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    bool init(whisper_context * ctx_new, int n_states) {
+        ctx = ctx_new;
+
+        for (int i = 0; i < n_states; ++i) {
+            whisper_state * state = whisper_init_state(ctx);
+            if (state == nullptr) {
+                return false;
+            }
+            states.push_back(state);
+        }
+
+        free_states = states;
+
+        return true;
+    }
+
+    void free() {
+        for (auto * state : states) {
+            whisper_free_state(state);
+        }
+        states.clear();
+        free_states.clear();
+    }
+
+    // blocks until the task has been processed - the caller must release() it after reading the results
+    void process(server_task & task) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        task.t_queued_us = ggml_time_us();
+        queue.push_back(&task);
+
+        cv.wait(lock, [&] {
+            return task.state != nullptr || (queue.front() == &task && !free_states.empty());
+        });
+
+        if (task.state != nullptr) {
+            // taken along by the batch of another request
+            cv.wait(lock, [&] { return task.done; });
+            return;
+        }
+
+        // give the requests that arrive at about the same time a chance to join the batch
+        if (n_batch_max > 1 && t_batch_window > 0) {
+            cv.wait_for(lock, std::chrono::milliseconds(t_batch_window), [&] {
+                return (int) queue.size() >= std::min<int>(n_batch_max, free_states.size());
+            });
+        }
+
+        std::vector<server_task *> batch;
+
+        const int64_t t_start_us = ggml_time_us();
+
+        while (!queue.empty() && !free_states.empty() && (int) batch.size() < n_batch_max) {
+            server_task * cur = queue.front();
+            queue.pop_front();
+
+            cur->state      = free_states.back();
+            cur->t_start_us = t_start_us;
+            free_states.pop_back();
+
+            batch.push_back(cur);
+        }
+
+        n_processing += batch.size();
+
+        // the next request in the queue can be scheduled on the remaining states
+        cv.notify_all();
+
+        lock.unlock();
+
+        std::vector<int> results(batch.size(), 0);
+
+        if (batch.size() == 1) {
+            results[0] = whisper_full_with_state(ctx, task.state, task.wparams, task.pcmf32->data(), task.pcmf32->size());
+        } else {
+            std::vector<whisper_state *>      states_batch;
+            std::vector<whisper_full_params> wparams_batch;
+            std::vector<const float *>        samples_batch;
+            std::vector<int>                  n_samples_batch;
+
+            for (auto * cur : batch) {
+                states_batch.push_back(cur->state);
+                wparams_batch.push_back(cur->wparams);
+                samples_batch.push_back(cur->pcmf32->data());
+                n_samples_batch.push_back(cur->pcmf32->size());
+            }
+
+            whisper_full_batch(ctx, states_batch.data(), wparams_batch.data(), samples_batch.data(), n_samples_batch.data(), batch.size(), results.data());
+        }
+
+        lock.lock();
+
+        const int64_t t_end_us = ggml_time_us();
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            server_task * cur = batch[i];
+
+            cur->ret      = results[i];
+            cur->done     = true;
+            cur->t_end_us = t_end_us;
+
+            metrics.n_requests++;
+            metrics.t_audio_s    += double(cur->pcmf32->size())/WHISPER_SAMPLE_RATE;
+            metrics.t_queue_us   += cur->t_start_us - cur->t_queued_us;
+            metrics.t_process_us += cur->t_end_us   - cur->t_start_us;
+        }
+
+        if (batch.size() > 1) {
+            metrics.n_batches++;
+            metrics.n_batched_requests += batch.size();
+        }
+
+        n_processing -= batch.size();
+
+        cv.notify_all();
+    }
+
+    void release(server_task & task) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        free_states.push_back(task.state);
+        task.state = nullptr;
+
+        cv.notify_all();
+    }
+
+    std::string metrics_str() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        struct metric {
+            const char * name;
+            const char * type;
+            const char * help;
+            double       value;
+        };
+
+        const metric all_metrics[] = {
+            { "requests_total",                 "counter", "Number of processed requests.",                            (double) metrics.n_requests },
+            { "requests_processing",            "gauge",   "Number of requests being processed.",                      (double) n_processing },
+            { "requests_deferred",              "gauge",   "Number of requests waiting for a free state.",             (double) queue.size() },
+            { "batches_total",                  "counter", "Number of batches of more than one request.",              (double) metrics.n_batches },
+            { "batched_requests_total",         "counter", "Number of requests processed in a batch.",                 (double) metrics.n_batched_requests },
+            { "audio_seconds_total",            "counter", "Duration of the processed audio.",                         metrics.t_audio_s },
+            { "queue_time_seconds_total",       "counter", "Time spent by the requests waiting for a free state.",     metrics.t_queue_us/1e6 },
+            { "processing_time_seconds_total",  "counter", "Time spent processing the requests.",                      metrics.t_process_us/1e6 },
+            { "queue_time_seconds_avg",         "gauge",   "Average time spent by a request waiting for a free state.", metrics.n_requests ? metrics.t_queue_us/1e6/metrics.n_requests : 0.0 },
+            { "processing_time_seconds_avg",    "gauge",   "Average time spent processing a request.",                 metrics.n_requests ? metrics.t_process_us/1e6/metrics.n_requests : 0.0 },
+        };
+
+        std::stringstream ss;
+        for (const auto & m : all_metrics) {
+            ss << "# HELP whisper:" << m.name << " " << m.help << "\n"
+               << "# TYPE whisper:" << m.name << " " << m.type << "\n"
+               << "whisper:" << m.name << " " << m.value << "\n";
+        }
+
+        return ss.str();
+    }
+};
+
 }  // namespace
 
 int main(int argc, char ** argv) {
@@ -611,6 +873,9 @@ int main(int argc, char ** argv) {
 
     std::mutex whisper_mutex;
 
+    // held shared by the requests that use the model and exclusively while the model is replaced
+    std::shared_mutex model_mutex;
+
     if (whisper_params_parse(argc, argv, params, sparams) == false) {
         whisper_print_usage(argc, argv, params, sparams);
         return 1;
@@ -636,6 +901,7 @@ int main(int argc, char ** argv) {
 
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
+    cparams.use_mmap   = params.use_mmap;
 
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
@@ -693,6 +959,18 @@ int main(int argc, char ** argv) {
 
     // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
     whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
+
+    // the states used to process the requests concurrently
+    server_pool pool;
+
+    pool.n_batch_max    = sparams.batch_encode ? sparams.n_parallel : 1;
+    pool.t_batch_window = sparams.batch_window;
+
+    if (!pool.init(ctx, sparams.n_parallel)) {
+        fprintf(stderr, "error: failed to initialize whisper states\n");
+        return 3;
+    }
+
     state.store(SERVER_STATE_READY);
 
 
@@ -784,8 +1062,8 @@ int main(int argc, char ** argv) {
     });
 
     svr->Post(sparams.request_path + sparams.inference_path, [&](const Request &req, Response &res){
-        // acquire whisper model mutex lock
-        std::lock_guard<std::mutex> lock(whisper_mutex);
+        // the parameters of this request
+        whisper_params params = default_params;
 
         // first check user requested fields of the request
         if (!req.has_file("file"))
@@ -849,9 +1127,12 @@ int main(int argc, char ** argv) {
         {
             fprintf(stderr, "\n");
             fprintf(stderr, "system_info: n_threads = %d / %d | %s\n",
-                    params.n_threads*params.n_processors, std::thread::hardware_concurrency(), whisper_print_system_info());
+                    params.n_threads*std::max(params.n_processors, sparams.n_parallel), std::thread::hardware_concurrency(), whisper_print_system_info());
         }
 
+        // the model cannot be replaced until the response has been created
+        std::shared_lock<std::shared_mutex> model_lock(model_mutex);
+
         // print some info about the processing
         {
             fprintf(stderr, "\n");
@@ -876,6 +1157,20 @@ int main(int argc, char ** argv) {
             fprintf(stderr, "\n");
         }
 
+        server_task task;
+
+        // return the state to the pool once the response has been created
+        std::unique_ptr<server_task, std::function<void(server_task *)>> task_guard(&task, [&](server_task * t) {
+            if (t->state != nullptr) {
+                pool.release(*t);
+            }
+        });
+
+        // the default state is used when the audio is split across processors
+        std::unique_lock<std::mutex> lock(whisper_mutex, std::defer_lock);
+
+        server_result result_ctx = { ctx, nullptr };
+
         // run the inference
         {
             printf("Running whisper.cpp inference on %s\n", filename.c_str());
@@ -952,7 +1247,26 @@ int main(int argc, char ** argv) {
             };
             wparams.abort_callback_user_data = (void*)&req;
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            int ret = 0;
+
+            if (params.n_processors > 1) {
+                lock.lock();
+                ret = whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors);
+            } else {
+                task.wparams = wparams;
+                task.pcmf32  = &pcmf32;
+
+                pool.process(task);
+
+                ret = task.ret;
+
+                result_ctx.state = task.state;
+
+                fprintf(stderr, "%s: '%s' queued for %.2f ms, processed in %.2f ms\n", __func__, filename.c_str(),
+                        (task.t_start_us - task.t_queued_us)/1e3, (task.t_end_us - task.t_start_us)/1e3);
+            }
+
+            if (ret != 0) {
                 // handle failure or early abort
                 if (req.is_connection_closed()) {
                     // log client disconnect
@@ -972,17 +1286,17 @@ int main(int argc, char ** argv) {
         // return results to user
         if (params.response_format == text_format)
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(result_ctx, params, pcmf32s);
             res.set_content(results.c_str(), "text/html; charset=utf-8");
         }
         else if (params.response_format == srt_format)
         {
             std::stringstream ss;
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = result_ctx.n_segments();
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const char * text = result_ctx.segment_text(i);
+                const int64_t t0 = result_ctx.segment_t0(i);
+                const int64_t t1 = result_ctx.segment_t1(i);
                 std::string speaker = "";
 
                 if (params.diarize && pcmf32s.size() == 2)
@@ -1000,11 +1314,11 @@ int main(int argc, char ** argv) {
 
             ss << "WEBVTT\n\n";
 
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = result_ctx.n_segments();
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const char * text = result_ctx.segment_text(i);
+                const int64_t t0 = result_ctx.segment_t0(i);
+                const int64_t t1 = result_ctx.segment_t1(i);
                 std::string speaker = "";
 
                 if (params.diarize && pcmf32s.size() == 2)
@@ -1020,13 +1334,13 @@ int main(int argc, char ** argv) {
             res.set_content(ss.str(), "text/vtt");
         } else if (params.response_format == vjson_format) {
             /* try to match openai/whisper's Python format */
-            std::string results = output_str(ctx, params, pcmf32s); 
+            std::string results = output_str(result_ctx, params, pcmf32s); 
             // Get language probabilities
             std::vector<float> lang_probs(whisper_lang_max_id() + 1, 0.0f);
-            const auto detected_lang_id = whisper_lang_auto_detect(ctx, 0, params.n_threads, lang_probs.data());
+            const auto detected_lang_id = result_ctx.lang_auto_detect(params.n_threads, lang_probs.data());
             json jres = json{
                 {"task", params.translate ? "translate" : "transcribe"},
-                {"language", whisper_lang_str_full(whisper_full_lang_id(ctx))},
+                {"language", whisper_lang_str_full(result_ctx.lang_id())},
                 {"duration", float(pcmf32.size())/WHISPER_SAMPLE_RATE},
                 {"text", results},
                 {"segments", json::array()},
@@ -1040,29 +1354,29 @@ int main(int argc, char ** argv) {
                     jres["language_probabilities"][whisper_lang_str(i)] = lang_probs[i];
                 }
             }
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = result_ctx.n_segments();
             for (int i = 0; i < n_segments; ++i)
             {
                 json segment = json{
                     {"id", i},
-                    {"text", whisper_full_get_segment_text(ctx, i)},
+                    {"text", result_ctx.segment_text(i)},
                 };
 
                 if (!params.no_timestamps) {
-                    segment["start"] = whisper_full_get_segment_t0(ctx, i) * 0.01;
-                    segment["end"] = whisper_full_get_segment_t1(ctx, i) * 0.01;
+                    segment["start"] = result_ctx.segment_t0(i) * 0.01;
+                    segment["end"] = result_ctx.segment_t1(i) * 0.01;
                 }
 
                 float total_logprob = 0;
-                const int n_tokens = whisper_full_n_tokens(ctx, i);
+                const int n_tokens = result_ctx.n_tokens(i);
                 for (int j = 0; j < n_tokens; ++j) {
-                    whisper_token_data token = whisper_full_get_token_data(ctx, i, j);
+                    whisper_token_data token = result_ctx.token_data(i, j);
                     if (token.id >= whisper_token_eot(ctx)) {
                         continue;
                     }
 
                     segment["tokens"].push_back(token.id);
-                    json word = json{{"word", whisper_full_get_token_text(ctx, i, j)}};
+                    json word = json{{"word", result_ctx.token_text(i, j)}};
                     if (!params.no_timestamps) {
                         word["start"] = token.t0 * 0.01;
                         word["end"] = token.t1 * 0.01;
@@ -1078,7 +1392,7 @@ int main(int argc, char ** argv) {
 
                 // TODO compression_ratio and no_speech_prob are not implemented yet
                 // segment["compression_ratio"] = 0;
-                segment["no_speech_prob"] = whisper_full_get_segment_no_speech_prob(ctx, i);
+                segment["no_speech_prob"] = result_ctx.segment_no_speech_prob(i);
 
                 jres["segments"].push_back(segment);
             }
@@ -1088,19 +1402,17 @@ int main(int argc, char ** argv) {
         // TODO add more output formats
         else
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(result_ctx, params, pcmf32s);
             json jres = json{
                 {"text", results}
             };
             res.set_content(jres.dump(-1, ' ', false, json::error_handler_t::replace),
                             "application/json");
         }
-
-        // reset params to their defaults
-        params = default_params;
     });
     svr->Post(sparams.request_path + "/load", [&](const Request &req, Response &res){
-        std::lock_guard<std::mutex> lock(whisper_mutex);
+        // wait for the requests in progress
+        std::unique_lock<std::shared_mutex> lock(model_mutex);
         state.store(SERVER_STATE_LOADING_MODEL);
         if (!req.has_file("model"))
         {
@@ -1119,6 +1431,7 @@ int main(int argc, char ** argv) {
         }
 
         // clean up
+        pool.free();
         whisper_free(ctx);
 
         // whisper init
@@ -1133,6 +1446,11 @@ int main(int argc, char ** argv) {
         // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
         whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
 
+        if (!pool.init(ctx, sparams.n_parallel)) {
+            fprintf(stderr, "error: failed to initialize whisper states\n");
+            exit(1);
+        }
+
         state.store(SERVER_STATE_READY);
         const std::string success = "Load was successful!";
         res.set_content(success, "application/text");
@@ -1140,6 +1458,10 @@ int main(int argc, char ** argv) {
         // check if the model is in the file system
     });
 
+    svr->Get(sparams.request_path + "/metrics", [&](const Request &, Response &res){
+        res.set_content(pool.metrics_str(), "text/plain; version=0.0.4");
+    });
+
     svr->Get(sparams.request_path + "/health", [&](const Request &, Response &res){
         server_state current_state = state.load();
         if (current_state == SERVER_STATE_READY) {
@@ -1215,6 +1537,7 @@ int main(int argc, char ** argv) {
     // clean up function, to be called before exit
     auto clean_up = [&]() {
         whisper_print_timings(ctx);
+        pool.free();
         whisper_free(ctx);
     };
 
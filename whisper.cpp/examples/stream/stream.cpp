@@ -1,6 +1,8 @@
 // Real-time speech recognition of input from a microphone
 //
 // A very quick-n-dirty implementation serving mainly as a proof of concept.
+// With --step > 0 the audio is transcribed incrementally with whisper_stream, otherwise a simple VAD triggers
+// the transcription of the last --length ms of audio.
 //
 #include "common-sdl.h"
 #include "common.h"
@@ -134,8 +136,6 @@ int main(int argc, char ** argv) {
 
     const bool use_vad = n_samples_step <= 0; // sliding window mode uses VAD
 
-    const int n_new_line = !use_vad ? std::max(1, params.length_ms / params.step_ms - 1) : 1; // number of steps to print new line
-
     params.no_timestamps  = !use_vad;
     params.no_context    |= use_vad;
     params.max_tokens     = 0;
@@ -169,11 +169,8 @@ int main(int argc, char ** argv) {
     }
 
     std::vector<float> pcmf32    (n_samples_30s, 0.0f);
-    std::vector<float> pcmf32_old;
     std::vector<float> pcmf32_new(n_samples_30s, 0.0f);
 
-    std::vector<whisper_token> prompt_tokens;
-
     // print some info about the processing
     {
         fprintf(stderr, "\n");
@@ -196,7 +193,7 @@ int main(int argc, char ** argv) {
                 params.no_timestamps ? 0 : 1);
 
         if (!use_vad) {
-            fprintf(stderr, "%s: n_new_line = %d, no_context = %d\n", __func__, n_new_line, params.no_context);
+            fprintf(stderr, "%s: incremental streaming, no_context = %d\n", __func__, params.no_context);
         } else {
             fprintf(stderr, "%s: using VAD, will transcribe on speech activity\n", __func__);
         }
@@ -204,7 +201,49 @@ int main(int argc, char ** argv) {
         fprintf(stderr, "\n");
     }
 
+    whisper_full_params wparams = whisper_full_default_params(params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+    wparams.print_progress   = false;
+    wparams.print_special    = params.print_special;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.translate        = params.translate;
+    wparams.single_segment   = !use_vad;
+    wparams.max_tokens       = params.max_tokens;
+    wparams.language         = params.language.c_str();
+    wparams.n_threads        = params.n_threads;
+    wparams.beam_search.beam_size = params.beam_size;
+
+    wparams.audio_ctx        = params.audio_ctx;
+
+    wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+
+    // disable temperature fallback
+    //wparams.temperature_inc  = -1.0f;
+    wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
+
+    // the stream decodes with timestamps to find the segment boundaries at which the audio buffer can be trimmed
+    struct whisper_stream * stream = nullptr;
+    if (!use_vad) {
+        whisper_full_params sparams_full = wparams;
+
+        sparams_full.no_timestamps = false;
+        sparams_full.no_context    = params.no_context;
+
+        whisper_stream_params sparams = whisper_stream_default_params();
+
+        sparams.length_ms = params.length_ms;
+        sparams.keep_ms   = params.keep_ms;
+
+        stream = whisper_stream_init(ctx, sparams_full, sparams);
+        if (stream == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper stream\n");
+            return 2;
+        }
+    }
+
     int n_iter = 0;
+    int n_segments_printed = 0;
 
     bool is_running = true;
 
@@ -217,6 +256,29 @@ int main(int argc, char ** argv) {
         }
     }
 
+    // print the newly finalized segments of the stream on separate lines and the pending text on the last line
+    auto print_stream = [&]() {
+        printf("\33[2K\r");
+
+        // print long empty line to clear the previous line
+        printf("%s", std::string(100, ' ').c_str());
+
+        printf("\33[2K\r");
+
+        for (; n_segments_printed < whisper_stream_n_segments(stream); ++n_segments_printed) {
+            const char * text = whisper_stream_get_segment_text(stream, n_segments_printed);
+
+            printf("%s\n", text);
+
+            if (params.fname_out.length() > 0) {
+                fout << text << std::endl;
+            }
+        }
+
+        printf("%s%s", whisper_stream_get_text_committed(stream), whisper_stream_get_text_tentative(stream));
+        fflush(stdout);
+    };
+
     wav_writer wavWriter;
     // save wav file
     if (params.save_audio) {
@@ -271,23 +333,26 @@ int main(int argc, char ** argv) {
                 std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
 
-            const int n_samples_new = pcmf32_new.size();
+            if (!is_running) {
+                break;
+            }
 
-            // take up to params.length_ms audio from previous iteration
-            const int n_samples_take = std::min((int) pcmf32_old.size(), std::max(0, n_samples_keep + n_samples_len - n_samples_new));
+            // only the new audio is processed by the mel spectrogram, the encoder sees the audio buffered in the stream
+            whisper_stream_push(stream, pcmf32_new.data(), pcmf32_new.size());
 
-            //printf("processing: take = %d, new = %d, old = %d\n", n_samples_take, n_samples_new, (int) pcmf32_old.size());
+            if (whisper_stream_update(stream) != 0) {
+                fprintf(stderr, "%s: failed to process audio\n", argv[0]);
+                return 6;
+            }
 
-            pcmf32.resize(n_samples_new + n_samples_take);
+            print_stream();
 
-            for (int i = 0; i < n_samples_take; i++) {
-                pcmf32[i] = pcmf32_old[pcmf32_old.size() - n_samples_take + i];
-            }
+            ++n_iter;
 
-            memcpy(pcmf32.data() + n_samples_take, pcmf32_new.data(), n_samples_new*sizeof(float));
+            continue;
+        }
 
-            pcmf32_old = pcmf32;
-        } else {
+        {
             const auto t_now  = std::chrono::high_resolution_clock::now();
             const auto t_diff = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_last).count();
 
@@ -312,30 +377,6 @@ int main(int argc, char ** argv) {
 
         // run the inference
         {
-            whisper_full_params wparams = whisper_full_default_params(params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
-
-            wparams.print_progress   = false;
-            wparams.print_special    = params.print_special;
-            wparams.print_realtime   = false;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.translate        = params.translate;
-            wparams.single_segment   = !use_vad;
-            wparams.max_tokens       = params.max_tokens;
-            wparams.language         = params.language.c_str();
-            wparams.n_threads        = params.n_threads;
-            wparams.beam_search.beam_size = params.beam_size;
-
-            wparams.audio_ctx        = params.audio_ctx;
-
-            wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
-
-            // disable temperature fallback
-            //wparams.temperature_inc  = -1.0f;
-            wparams.temperature_inc  = params.no_fallback ? 0.0f : wparams.temperature_inc;
-
-            wparams.prompt_tokens    = params.no_context ? nullptr : prompt_tokens.data();
-            wparams.prompt_n_tokens  = params.no_context ? 0       : prompt_tokens.size();
-
             if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 return 6;
@@ -343,21 +384,12 @@ int main(int argc, char ** argv) {
 
             // print result;
             {
-                if (!use_vad) {
-                    printf("\33[2K\r");
-
-                    // print long empty line to clear the previous line
-                    printf("%s", std::string(100, ' ').c_str());
+                const int64_t t1 = (t_last - t_start).count()/1000000;
+                const int64_t t0 = std::max(0.0, t1 - pcmf32.size()*1000.0/WHISPER_SAMPLE_RATE);
 
-                    printf("\33[2K\r");
-                } else {
-                    const int64_t t1 = (t_last - t_start).count()/1000000;
-                    const int64_t t0 = std::max(0.0, t1 - pcmf32.size()*1000.0/WHISPER_SAMPLE_RATE);
-
-                    printf("\n");
-                    printf("### Transcription %d START | t0 = %d ms | t1 = %d ms\n", n_iter, (int) t0, (int) t1);
-                    printf("\n");
-                }
+                printf("\n");
+                printf("### Transcription %d START | t0 = %d ms | t1 = %d ms\n", n_iter, (int) t0, (int) t1);
+                printf("\n");
 
                 const int n_segments = whisper_full_n_segments(ctx);
                 for (int i = 0; i < n_segments; ++i) {
@@ -395,39 +427,26 @@ int main(int argc, char ** argv) {
                     fout << std::endl;
                 }
 
-                if (use_vad) {
-                    printf("\n");
-                    printf("### Transcription %d END\n", n_iter);
-                }
+                printf("\n");
+                printf("### Transcription %d END\n", n_iter);
             }
 
             ++n_iter;
 
-            if (!use_vad && (n_iter % n_new_line) == 0) {
-                printf("\n");
-
-                // keep part of the audio for next iteration to try to mitigate word boundary issues
-                pcmf32_old = std::vector<float>(pcmf32.end() - n_samples_keep, pcmf32.end());
-
-                // Add tokens of the last full length segment as the prompt
-                if (!params.no_context) {
-                    prompt_tokens.clear();
-
-                    const int n_segments = whisper_full_n_segments(ctx);
-                    for (int i = 0; i < n_segments; ++i) {
-                        const int token_count = whisper_full_n_tokens(ctx, i);
-                        for (int j = 0; j < token_count; ++j) {
-                            prompt_tokens.push_back(whisper_full_get_token_id(ctx, i, j));
-                        }
-                    }
-                }
-            }
             fflush(stdout);
         }
     }
 
     audio.pause();
 
+    if (stream) {
+        whisper_stream_flush(stream);
+        print_stream();
+        printf("\n");
+
+        whisper_stream_free(stream);
+    }
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
@@ -126,6 +126,8 @@ extern "C" {
         struct whisper_aheads dtw_aheads;
 
         size_t dtw_mem_size; // TODO: remove
+
+        bool use_mmap; // map GGUF model files in memory and use the CPU weights in place
     };
 
     typedef struct whisper_token_data {
@@ -202,6 +204,8 @@ extern "C" {
 
     // Various functions for loading a ggml whisper model.
     // Allocate (almost) all memory needed for the model.
+    // whisper_init_from_file_with_params() also accepts GGUF files (see whisper-quantize) - these are mapped in
+    // memory when params.use_mmap is set, so that the weights in CPU memory are used directly from the page cache
     // Return NULL on failure
     WHISPER_API struct whisper_context * whisper_init_from_file_with_params  (const char * path_model,              struct whisper_context_params params);
     WHISPER_API struct whisper_context * whisper_init_from_buffer_with_params(void * buffer, size_t buffer_size,    struct whisper_context_params params);
@@ -318,6 +322,18 @@ extern "C" {
                                int   offset,
                                int   n_threads);
 
+    // Run the Whisper encoder on n_states independent states at once.
+    // The mel windows starting at offsets[i] are stacked along a batch dimension, so that the weights are read once per
+    // batch instead of once per state. The states must use the same audio context.
+    // Make sure to call whisper_pcm_to_mel_with_state() or whisper_set_mel_with_state() on each state first.
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_batch(
+            struct whisper_context * ctx,
+             struct whisper_state ** states,
+                         const int * offsets,
+                               int   n_states,
+                               int   n_threads);
+
     // Run the Whisper decoder to obtain the logits and probabilities for the next token.
     // Make sure to call whisper_encode() first.
     // tokens + n_tokens is the provided context for the decoder.
@@ -481,6 +497,12 @@ extern "C" {
                              float * logits,
                               void * user_data);
 
+    // Audio read callback
+    // If not NULL, whisper_full() pulls the audio from it instead of using the samples argument
+    // Write up to n_samples of 16 kHz mono PCM to samples and return the number of samples written,
+    // 0 at the end of the audio or a negative value on error. The callback may block until the audio is available
+    typedef int (*whisper_audio_read_callback)(float * samples, int n_samples, void * user_data);
+
     // Parameters for the whisper_full() function
     // If you change the order or add new parameters, make sure to update the default values in whisper.cpp:
     // whisper_full_default_params()
@@ -587,6 +609,16 @@ extern "C" {
         const char * vad_model_path;              // Path to VAD model
 
         whisper_vad_params vad_params;
+
+        // speculative decoding - used with greedy sampling at temperature 0, the output does not change
+        // the draft model must have the same vocabulary as the model (e.g. a distilled or a smaller model)
+        struct whisper_context * draft_ctx; // draft model (nullptr = disabled)
+        int                      n_draft;   // max number of tokens proposed by the draft model per decoder call
+
+        // called whenever more audio is needed - each window is transcribed as soon as it has been read and only the
+        // audio of the current window is kept in memory. not supported with VAD and multiple processors
+        whisper_audio_read_callback audio_read_callback;
+        void * audio_read_callback_user_data;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
@@ -612,11 +644,32 @@ extern "C" {
                            const float * samples,
                                    int   n_samples);
 
+    // Transcribe n_states independent inputs, one per state, with the parameters params[i], using a batched encoder.
+    // Only the encoder pass of the first 30 s window of every input is batched, with whisper_encode_batch().
+    // The decoder is not batched: each state then runs whisper_full_with_state() on its own thread with
+    // params[i].n_threads threads, which also encodes the later windows of inputs longer than 30 s one at a time.
+    // The callbacks are invoked from several threads and the state argument identifies the input.
+    // If results is not NULL, results[i] receives the return code of state i.
+    // Returns 0 if all states succeeded, otherwise the first non-zero return code.
+    // Not thread safe for the same states.
+    WHISPER_API int whisper_full_batch(
+                struct whisper_context * ctx,
+                 struct whisper_state ** states,
+      const struct whisper_full_params * params,
+                          const float ** samples,
+                             const int * n_samples,
+                                   int   n_states,
+                                   int * results);
+
     // Split the input audio in chunks and process each chunk separately using whisper_full_with_state()
     // Result is stored in the default state of the context
     // Not thread safe if executed in parallel on the same context.
     // It seems this approach can offer some speedup in some cases.
     // However, the transcription accuracy can be worse at the beginning and end of each chunk.
+    // With params.vad, the audio is split on the silences detected by the VAD instead: the speech segments are packed
+    // into windows of up to 30 seconds that are transcribed with whisper_full_batch(), n_processors at a time.
+    // Speech segments longer than 30 seconds are split into equal parts of up to 30 seconds.
+    // Only the first window of each batch gets the text of the preceding window as context.
     WHISPER_API int whisper_full_parallel(
                 struct whisper_context * ctx,
             struct whisper_full_params   params,
@@ -670,6 +723,68 @@ extern "C" {
     WHISPER_API float whisper_full_get_token_p           (struct whisper_context * ctx, int i_segment, int i_token);
     WHISPER_API float whisper_full_get_token_p_from_state(struct whisper_state * state, int i_segment, int i_token);
 
+    //
+    // Streaming
+    //
+    // Incremental transcription of a live audio stream:
+    //  - whisper_stream_push() computes the mel spectrogram of the new samples only
+    //  - whisper_stream_update() encodes the buffered audio with an audio context sized to its length, decodes it
+    //    greedily after the tokens committed so far and commits the tokens on which the last n_agree hypotheses agree
+    //  - when a committed segment is closed by a timestamp token, it is finalized and its audio is dropped from the buffer
+    //
+    // The KV cache of the text prompt and of the committed tokens is reused between updates until the buffer is trimmed.
+    // The stream uses the state for its own purposes - do not use the state for anything else until it is freed.
+    //
+
+    struct whisper_stream;
+
+    struct whisper_stream_params {
+        int  length_ms; // maximum buffered audio - if no segment has been finalized by then, the buffer is finalized as is
+        int  keep_ms;   // audio kept from the end of the buffer when it is finalized because of length_ms
+        int  n_agree;   // number of consecutive hypotheses that have to agree before a token is committed
+        bool reuse_kv;  // reuse the self-attention KV cache of the prompt and the committed tokens between updates
+    };
+
+    WHISPER_API struct whisper_stream_params whisper_stream_default_params(void);
+
+    // The decoding parameters are taken from params (language, translate, no_context, n_threads, audio_ctx, ...)
+    // Sampling is always greedy and without temperature fallback.
+    // whisper_stream_init() uses the default state of the context
+    WHISPER_API struct whisper_stream * whisper_stream_init(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+          struct whisper_stream_params   sparams);
+
+    WHISPER_API struct whisper_stream * whisper_stream_init_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+          struct whisper_stream_params   sparams);
+
+    WHISPER_API void whisper_stream_free(struct whisper_stream * stream);
+
+    // Append new audio samples (16 kHz mono PCM) to the stream
+    WHISPER_API int whisper_stream_push(struct whisper_stream * stream, const float * samples, int n_samples);
+
+    // Transcribe the buffered audio. Newly finalized segments are appended to the segments of the stream.
+    // Returns 0 on success
+    WHISPER_API int whisper_stream_update(struct whisper_stream * stream);
+
+    // Finalize all buffered text, e.g. at the end of the audio, and clear the audio buffer
+    WHISPER_API int whisper_stream_flush(struct whisper_stream * stream);
+
+    // Finalized segments since the start of the stream. Times are in centiseconds since the start of the stream
+    WHISPER_API int          whisper_stream_n_segments       (struct whisper_stream * stream);
+    WHISPER_API const char * whisper_stream_get_segment_text (struct whisper_stream * stream, int i_segment);
+    WHISPER_API int64_t      whisper_stream_get_segment_t0   (struct whisper_stream * stream, int i_segment);
+    WHISPER_API int64_t      whisper_stream_get_segment_t1   (struct whisper_stream * stream, int i_segment);
+
+    // Text of the buffered audio that is not finalized yet:
+    //  - committed: agreed upon by the last n_agree hypotheses, will not change anymore
+    //  - tentative: the rest of the latest hypothesis, may change with the next update
+    WHISPER_API const char * whisper_stream_get_text_committed(struct whisper_stream * stream);
+    WHISPER_API const char * whisper_stream_get_text_tentative(struct whisper_stream * stream);
+
     //
     // Voice Activity Detection (VAD)
     //
@@ -689,11 +804,24 @@ extern "C" {
     WHISPER_API struct whisper_vad_context * whisper_vad_init_from_file_with_params(const char * path_model,              struct whisper_vad_context_params params);
     WHISPER_API struct whisper_vad_context * whisper_vad_init_with_params          (struct whisper_model_loader * loader, struct whisper_vad_context_params params);
 
+    // Computes the speech probability of each window of the audio (the last window is zero-padded)
+    // Resets the streaming state
     WHISPER_API bool whisper_vad_detect_speech(
             struct whisper_vad_context * vctx,
                            const float * samples,
                                    int   n_samples);
 
+    // Streaming VAD: the audio can be pushed in pieces of any size and the LSTM state is carried across the calls
+    // Returns the number of windows completed by this call, -1 on failure
+    // whisper_vad_probs() returns the probabilities of these windows - the remaining samples are kept for the next call
+    WHISPER_API int whisper_vad_stream_push(
+            struct whisper_vad_context * vctx,
+                           const float * samples,
+                                   int   n_samples);
+
+    // Clears the LSTM state and the buffered samples
+    WHISPER_API void whisper_vad_stream_reset(struct whisper_vad_context * vctx);
+
     WHISPER_API int     whisper_vad_n_probs(struct whisper_vad_context * vctx);
     WHISPER_API float * whisper_vad_probs  (struct whisper_vad_context * vctx);
 
@@ -5,6 +5,7 @@
 #include "ggml-cpp.h"
 #include "ggml-alloc.h"
 #include "ggml-backend.h"
+#include "gguf.h"
 
 #ifdef WHISPER_USE_COREML
 #include "coreml/whisper-encoder.h"
@@ -17,6 +18,7 @@
 #include <atomic>
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cfloat>
 #define _USE_MATH_DEFINES
 #include <cmath>
@@ -36,6 +38,27 @@
 #include <thread>
 #include <vector>
 
+#ifdef __has_include
+    #if __has_include(<unistd.h>)
+        #include <unistd.h>
+        #if defined(_POSIX_MAPPED_FILES)
+            #include <fcntl.h>
+            #include <sys/mman.h>
+            #include <sys/stat.h>
+        #endif
+    #endif
+#endif
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#endif
+
 #if defined(WHISPER_BIG_ENDIAN)
 template<typename T>
 static T byteswap(T value) {
@@ -139,6 +162,7 @@ static void whisper_log_callback_default(ggml_log_level level, const char * text
 
 #define WHISPER_MAX_DECODERS 8
 #define WHISPER_MAX_NODES 4096
+#define WHISPER_MAX_ENCODE_BATCH 4
 
 static std::string format(const char * fmt, ...) {
     va_list ap;
@@ -749,6 +773,106 @@ struct whisper_kv_cache {
     std::vector<uint8_t> ctx_buf;
 };
 
+// read-only memory mapping of a model file
+// the weights of the CPU buffers point directly into the mapping (see whisper_model_load_gguf)
+struct whisper_mmap {
+    void * addr = nullptr;
+    size_t size = 0;
+
+#if defined(_POSIX_MAPPED_FILES)
+    static constexpr bool SUPPORTED = true;
+
+    whisper_mmap(const char * fname) {
+        const int fd = open(fname, O_RDONLY);
+        if (fd == -1) {
+            WHISPER_LOG_WARN("%s: failed to open '%s': %s\n", __func__, fname, strerror(errno));
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return;
+        }
+
+        void * ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (ptr == MAP_FAILED) {
+            WHISPER_LOG_WARN("%s: mmap failed: %s\n", __func__, strerror(errno));
+            return;
+        }
+
+        // start reading the file in the background - the pages that are already cached are used as they are
+        if (posix_madvise(ptr, st.st_size, POSIX_MADV_WILLNEED) != 0) {
+            WHISPER_LOG_WARN("%s: posix_madvise(.., POSIX_MADV_WILLNEED) failed\n", __func__);
+        }
+
+        addr = ptr;
+        size = st.st_size;
+    }
+
+    ~whisper_mmap() {
+        if (addr) {
+            munmap(addr, size);
+        }
+    }
+#elif defined(_WIN32)
+    static constexpr bool SUPPORTED = true;
+
+    whisper_mmap(const char * fname) {
+        std::wstring fname_wide(MultiByteToWideChar(CP_UTF8, 0, fname, -1, nullptr, 0), 0);
+        MultiByteToWideChar(CP_UTF8, 0, fname, -1, &fname_wide[0], (int) fname_wide.size());
+
+        HANDLE hFile = CreateFileW(fname_wide.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            WHISPER_LOG_WARN("%s: failed to open '%s'\n", __func__, fname);
+            return;
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(hFile, &file_size) || file_size.QuadPart <= 0) {
+            CloseHandle(hFile);
+            return;
+        }
+
+        HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(hFile);
+
+        if (hMapping == nullptr) {
+            WHISPER_LOG_WARN("%s: CreateFileMappingA failed: %lu\n", __func__, GetLastError());
+            return;
+        }
+
+        void * ptr = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(hMapping);
+
+        if (ptr == nullptr) {
+            WHISPER_LOG_WARN("%s: MapViewOfFile failed: %lu\n", __func__, GetLastError());
+            return;
+        }
+
+        addr = ptr;
+        size = (size_t) file_size.QuadPart;
+    }
+
+    ~whisper_mmap() {
+        if (addr) {
+            UnmapViewOfFile(addr);
+        }
+    }
+#else
+    static constexpr bool SUPPORTED = false;
+
+    whisper_mmap(const char * fname) {
+        GGML_UNUSED(fname);
+    }
+#endif
+
+    whisper_mmap(const whisper_mmap &) = delete;
+    whisper_mmap & operator=(const whisper_mmap &) = delete;
+};
+
 struct whisper_model {
     e_model type = MODEL_UNKNOWN;
 
@@ -789,6 +913,9 @@ struct whisper_model {
     // the model backend data is read-only and can be shared between processors
     std::vector<ggml_backend_buffer_t> buffers;
 
+    // GGUF model file mapped in memory - must outlive the buffers that point into it
+    std::unique_ptr<whisper_mmap> mapping;
+
     // tensors
     int n_loaded;
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -880,6 +1007,10 @@ struct whisper_state {
     int32_t n_fail_p = 0; // number of logprob threshold failures
     int32_t n_fail_h = 0; // number of entropy threshold failures
 
+    int64_t t_draft_us = 0;
+    int32_t n_draft          = 0; // number of tokens proposed by the draft model
+    int32_t n_draft_accepted = 0; // number of proposed tokens accepted by the model
+
     // number of decoders for which we have constructed the KV cache
     int32_t kv_self_n_dec = 0;
 
@@ -907,10 +1038,17 @@ struct whisper_state {
     whisper_sched sched_cross;
     whisper_sched sched_decode;
 
+    // used when this is the first state passed to whisper_encode_batch()
+    whisper_sched sched_encode_batch;
+
     // result of the encoder
     struct ggml_tensor * embd_conv = nullptr;
     struct ggml_tensor * embd_enc  = nullptr;
 
+    // mel offset and audio context of the window currently stored in kv_cross (-1 - none)
+    int32_t encoded_offset = -1;
+    int32_t encoded_n_ctx  = 0;
+
     // helpers for GPU offloading
     std::vector<float> inp_mel;
     std::vector<float> inp_mask;
@@ -952,6 +1090,11 @@ struct whisper_state {
 
     whisper_vad_context * vad_context = nullptr;
 
+    // speculative decoding
+    whisper_context *          draft_ctx   = nullptr; // the model of draft_state
+    whisper_state *            draft_state = nullptr;
+    std::vector<whisper_token> draft_past;            // the tokens in the KV cache of draft_state
+
     struct vad_segment_info {
         int64_t orig_start;
         int64_t orig_end;
@@ -1166,6 +1309,111 @@ static void whisper_kv_cache_seq_cp(
     }
 }
 
+// replaces all sequences of the cache in a single pass (used by the beam search)
+// after the call, sequence j consists of the cells of sequence src[j] before the call (src[j] < 0 - unchanged)
+// the cells stay shared between the sequences - only the cells that are no longer used by any sequence are freed
+static void whisper_kv_cache_seq_remap(
+        struct whisper_kv_cache & cache,
+        const std::vector<whisper_seq_id> & src) {
+    const int n_seq = src.size();
+
+    uint32_t new_head = cache.size;
+
+    std::set<whisper_seq_id> seq_id;
+
+    for (uint32_t i = 0; i < cache.size; ++i) {
+        auto & cell = cache.cells[i];
+
+        if (cell.pos < 0) {
+            continue;
+        }
+
+        seq_id.clear();
+        for (int j = 0; j < n_seq; ++j) {
+            if (cell.has_seq_id(src[j] < 0 ? j : src[j])) {
+                seq_id.insert(j);
+            }
+        }
+        for (const auto id : cell.seq_id) {
+            if (id >= n_seq) {
+                seq_id.insert(id);
+            }
+        }
+
+        cell.seq_id.swap(seq_id);
+
+        if (cell.seq_id.empty()) {
+            cell.pos = -1;
+            if (new_head == cache.size) new_head = i;
+        }
+    }
+
+    if (new_head != cache.size) cache.head = new_head;
+}
+
+// moves the used cells to the beginning of the cache, so that the attention does not iterate over the free cells
+// left behind by the discarded beams. the cache must be in host memory - otherwise, this is a no-op
+static void whisper_kv_cache_defrag(struct whisper_kv_cache & cache, int n_state, bool v_trans) {
+    if (cache.buffer == nullptr || !ggml_backend_buffer_is_host(cache.buffer)) {
+        return;
+    }
+
+    const int64_t n_layer = ggml_nelements(cache.k)/((int64_t) n_state*cache.size);
+
+    const size_t k_es = ggml_element_size(cache.k);
+    const size_t v_es = ggml_element_size(cache.v);
+
+    uint8_t * k_data = (uint8_t *) cache.k->data;
+    uint8_t * v_data = (uint8_t *) cache.v->data;
+
+    uint32_t i0 = 0;
+    uint32_t i1 = cache.size;
+
+    while (true) {
+        // first free cell
+        while (i0 < i1 && cache.cells[i0].pos >= 0) {
+            i0++;
+        }
+
+        // last used cell
+        do {
+            i1--;
+        } while (i1 > i0 && cache.cells[i1].pos < 0);
+
+        if (i1 <= i0) {
+            break;
+        }
+
+        for (int64_t il = 0; il < n_layer; ++il) {
+            memcpy(k_data + (il*cache.size + i0)*n_state*k_es, k_data + (il*cache.size + i1)*n_state*k_es, n_state*k_es);
+
+            if (v_trans) {
+                uint8_t * v_layer = v_data + il*cache.size*n_state*v_es;
+                for (int s = 0; s < n_state; ++s) {
+                    memcpy(v_layer + (s*cache.size + i0)*v_es, v_layer + (s*cache.size + i1)*v_es, v_es);
+                }
+            } else {
+                memcpy(v_data + (il*cache.size + i0)*n_state*v_es, v_data + (il*cache.size + i1)*n_state*v_es, n_state*v_es);
+            }
+        }
+
+        cache.cells[i0].pos = cache.cells[i1].pos;
+        cache.cells[i0].seq_id.swap(cache.cells[i1].seq_id);
+
+        cache.cells[i1].pos = -1;
+        cache.cells[i1].seq_id.clear();
+
+        i0++;
+    }
+
+    uint32_t n_used = 0;
+    while (n_used < cache.size && cache.cells[n_used].pos >= 0) {
+        n_used++;
+    }
+
+    cache.head = n_used;
+}
+
 static uint32_t whisper_kv_cache_get_padding(const struct whisper_context & wctx) {
     if (!wctx.params.flash_attn || !wctx.params.use_gpu) {
         return 1u;
@@ -1489,208 +1737,129 @@ static ggml_backend_buffer_type_t select_weight_buft(const whisper_hparams & hpa
     return nullptr;
 }
 
-// load the model from a ggml file
-//
-// file format:
-//
-//   - hparams
-//   - pre-computed mel filters
-//   - vocab
-//   - weights
-//
-// see the convert-pt-to-ggml.py script for details
-//
-static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
-    WHISPER_LOG_INFO("%s: loading model\n", __func__);
-
-    const int64_t t_start_us = ggml_time_us();
+static bool whisper_model_init_hparams(whisper_context & wctx) {
+    auto & model   = wctx.model;
+    auto & hparams = model.hparams;
 
-    wctx.t_start_us = t_start_us;
+    assert(hparams.n_text_state == hparams.n_audio_state);
 
-    auto & model = wctx.model;
-    auto & vocab = wctx.vocab;
+    std::string mver = "";
 
-    // verify magic
-    {
-        uint32_t magic;
-        read_safe(loader, magic);
-        if (magic != GGML_FILE_MAGIC) {
-            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
-            return false;
-        }
+    if (hparams.n_audio_layer == 4) {
+        model.type = e_model::MODEL_TINY;
     }
 
-    //load hparams
-    {
-        auto & hparams = model.hparams;
-
-        read_safe(loader, hparams.n_vocab);
-        read_safe(loader, hparams.n_audio_ctx);
-        read_safe(loader, hparams.n_audio_state);
-        read_safe(loader, hparams.n_audio_head);
-        read_safe(loader, hparams.n_audio_layer);
-        read_safe(loader, hparams.n_text_ctx);
-        read_safe(loader, hparams.n_text_state);
-        read_safe(loader, hparams.n_text_head);
-        read_safe(loader, hparams.n_text_layer);
-        read_safe(loader, hparams.n_mels);
-        read_safe(loader, hparams.ftype);
-
-        assert(hparams.n_text_state == hparams.n_audio_state);
-
-        std::string mver = "";
-
-        if (hparams.n_audio_layer == 4) {
-            model.type = e_model::MODEL_TINY;
-        }
-
-        if (hparams.n_audio_layer == 6) {
-            model.type = e_model::MODEL_BASE;
-        }
-
-        if (hparams.n_audio_layer == 12) {
-            model.type = e_model::MODEL_SMALL;
-        }
-
-        if (hparams.n_audio_layer == 24) {
-            model.type = e_model::MODEL_MEDIUM;
-        }
-
-        if (hparams.n_audio_layer == 32) {
-            model.type = e_model::MODEL_LARGE;
+    if (hparams.n_audio_layer == 6) {
+        model.type = e_model::MODEL_BASE;
+    }
 
-            if (hparams.n_vocab == 51866) {
-                mver = " v3";
-            }
-        }
+    if (hparams.n_audio_layer == 12) {
+        model.type = e_model::MODEL_SMALL;
+    }
 
-        const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
+    if (hparams.n_audio_layer == 24) {
+        model.type = e_model::MODEL_MEDIUM;
+    }
 
-        hparams.ftype %= GGML_QNT_VERSION_FACTOR;
+    if (hparams.n_audio_layer == 32) {
+        model.type = e_model::MODEL_LARGE;
 
-        // for the big tensors, we have the option to store the data in 16-bit floats or quantized
-        // in order to save memory and also to speed up the computation
-        wctx.wtype = ggml_ftype_to_ggml_type((ggml_ftype) (model.hparams.ftype));
-        if (wctx.wtype == GGML_TYPE_COUNT) {
-            WHISPER_LOG_ERROR("%s: invalid model (bad ftype value %d)\n", __func__, model.hparams.ftype);
-            return false;
+        if (hparams.n_vocab == 51866) {
+            mver = " v3";
         }
-
-        WHISPER_LOG_INFO("%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
-        WHISPER_LOG_INFO("%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
-        WHISPER_LOG_INFO("%s: n_audio_state = %d\n", __func__, hparams.n_audio_state);
-        WHISPER_LOG_INFO("%s: n_audio_head  = %d\n", __func__, hparams.n_audio_head);
-        WHISPER_LOG_INFO("%s: n_audio_layer = %d\n", __func__, hparams.n_audio_layer);
-        WHISPER_LOG_INFO("%s: n_text_ctx    = %d\n", __func__, hparams.n_text_ctx);
-        WHISPER_LOG_INFO("%s: n_text_state  = %d\n", __func__, hparams.n_text_state);
-        WHISPER_LOG_INFO("%s: n_text_head   = %d\n", __func__, hparams.n_text_head);
-        WHISPER_LOG_INFO("%s: n_text_layer  = %d\n", __func__, hparams.n_text_layer);
-        WHISPER_LOG_INFO("%s: n_mels        = %d\n", __func__, hparams.n_mels);
-        WHISPER_LOG_INFO("%s: ftype         = %d\n", __func__, model.hparams.ftype);
-        WHISPER_LOG_INFO("%s: qntvr         = %d\n", __func__, qntvr);
-        WHISPER_LOG_INFO("%s: type          = %d (%s%s)\n", __func__, model.type, g_model_name.at(model.type).c_str(), mver.c_str());
     }
 
-    // load mel filters
-    {
-        auto & filters = wctx.model.filters;
+    const int32_t qntvr = hparams.ftype / GGML_QNT_VERSION_FACTOR;
 
-        read_safe(loader, filters.n_mel);
-        read_safe(loader, filters.n_fft);
+    hparams.ftype %= GGML_QNT_VERSION_FACTOR;
 
-        filters.data.resize(filters.n_mel * filters.n_fft);
-        loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
-        BYTESWAP_FILTERS(filters);
+    // for the big tensors, we have the option to store the data in 16-bit floats or quantized
+    // in order to save memory and also to speed up the computation
+    wctx.wtype = ggml_ftype_to_ggml_type((ggml_ftype) (model.hparams.ftype));
+    if (wctx.wtype == GGML_TYPE_COUNT) {
+        WHISPER_LOG_ERROR("%s: invalid model (bad ftype value %d)\n", __func__, model.hparams.ftype);
+        return false;
     }
 
-    // load vocab
-    {
-        int32_t n_vocab = 0;
-        read_safe(loader, n_vocab);
-
-        //if (n_vocab != model.hparams.n_vocab) {
-        //    WHISPER_LOG_ERROR("%s: invalid model file '%s' (bad vocab size %d != %d)\n",
-        //            __func__, fname.c_str(), n_vocab, model.hparams.n_vocab);
-        //    return false;
-        //}
-
-        std::string word;
-        std::vector<char> tmp;
+    WHISPER_LOG_INFO("%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
+    WHISPER_LOG_INFO("%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
+    WHISPER_LOG_INFO("%s: n_audio_state = %d\n", __func__, hparams.n_audio_state);
+    WHISPER_LOG_INFO("%s: n_audio_head  = %d\n", __func__, hparams.n_audio_head);
+    WHISPER_LOG_INFO("%s: n_audio_layer = %d\n", __func__, hparams.n_audio_layer);
+    WHISPER_LOG_INFO("%s: n_text_ctx    = %d\n", __func__, hparams.n_text_ctx);
+    WHISPER_LOG_INFO("%s: n_text_state  = %d\n", __func__, hparams.n_text_state);
+    WHISPER_LOG_INFO("%s: n_text_head   = %d\n", __func__, hparams.n_text_head);
+    WHISPER_LOG_INFO("%s: n_text_layer  = %d\n", __func__, hparams.n_text_layer);
+    WHISPER_LOG_INFO("%s: n_mels        = %d\n", __func__, hparams.n_mels);
+    WHISPER_LOG_INFO("%s: ftype         = %d\n", __func__, model.hparams.ftype);
+    WHISPER_LOG_INFO("%s: qntvr         = %d\n", __func__, qntvr);
+    WHISPER_LOG_INFO("%s: type          = %d (%s%s)\n", __func__, model.type, g_model_name.at(model.type).c_str(), mver.c_str());
 
-        tmp.reserve(128);
+    return true;
+}
 
-        for (int i = 0; i < n_vocab; i++) {
-            uint32_t len;
-            read_safe(loader, len);
+// the first n_vocab tokens have been read from the model file - add the special tokens that are not stored in it
+static void whisper_model_init_vocab(whisper_context & wctx, int n_vocab) {
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
 
-            if (len > 0) {
-                tmp.resize(len);
-                loader->read(loader->context, &tmp[0], tmp.size()); // read to buffer
-                word.assign(&tmp[0], tmp.size());
+    std::string word;
+
+    vocab.n_vocab = model.hparams.n_vocab;
+    if (vocab.is_multilingual()) {
+        vocab.token_eot++;
+        vocab.token_sot++;
+
+        // account for variable number of language tokens
+        const int dt = vocab.num_languages() - 98;
+
+        vocab.token_translate  += dt;
+        vocab.token_transcribe += dt;
+        vocab.token_solm       += dt;
+        vocab.token_prev       += dt;
+        vocab.token_nosp       += dt;
+        vocab.token_not        += dt;
+        vocab.token_beg        += dt;
+    }
+
+    if (n_vocab < model.hparams.n_vocab) {
+        WHISPER_LOG_INFO("%s: adding %d extra tokens\n", __func__, model.hparams.n_vocab - n_vocab);
+        for (int i = n_vocab; i < model.hparams.n_vocab; i++) {
+            if (i > vocab.token_beg) {
+                word = "[_TT_" + std::to_string(i - vocab.token_beg) + "]";
+            } else if (i == vocab.token_eot) {
+                word = "[_EOT_]";
+            } else if (i == vocab.token_sot) {
+                word = "[_SOT_]";
+            } else if (i == vocab.token_translate) {
+                word = "[_TRANSLATE_]";
+            } else if (i == vocab.token_transcribe) {
+                word = "[_TRANSCRIBE_]";
+            } else if (i == vocab.token_solm) {
+                word = "[_SOLM_]";
+            } else if (i == vocab.token_prev) {
+                word = "[_PREV_]";
+            } else if (i == vocab.token_nosp) {
+                word = "[_NOSP_]";
+            } else if (i == vocab.token_not) {
+                word = "[_NOT_]";
+            } else if (i == vocab.token_beg) {
+                word = "[_BEG_]";
+            } else if (i > vocab.token_sot && i <= vocab.token_sot + vocab.num_languages()) {
+                word = "[_LANG_" + std::string(whisper_lang_str(i - vocab.token_sot - 1)) + "]";
             } else {
-                // seems like we have an empty-string token in multi-language models (i = 50256)
-                //WHISPER_LOG_WARN("%s: warning: empty-string token in vocab, i = %d\n", __func__, i);
-                word = "";
+                word = "[_extra_token_" + std::to_string(i) + "]";
             }
-
             vocab.token_to_id[word] = i;
             vocab.id_to_token[i] = word;
-
-            //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
         }
+    }
 
-        vocab.n_vocab = model.hparams.n_vocab;
-        if (vocab.is_multilingual()) {
-            vocab.token_eot++;
-            vocab.token_sot++;
-
-            // account for variable number of language tokens
-            const int dt = vocab.num_languages() - 98;
-
-            vocab.token_translate  += dt;
-            vocab.token_transcribe += dt;
-            vocab.token_solm       += dt;
-            vocab.token_prev       += dt;
-            vocab.token_nosp       += dt;
-            vocab.token_not        += dt;
-            vocab.token_beg        += dt;
-        }
-
-        if (n_vocab < model.hparams.n_vocab) {
-            WHISPER_LOG_INFO("%s: adding %d extra tokens\n", __func__, model.hparams.n_vocab - n_vocab);
-            for (int i = n_vocab; i < model.hparams.n_vocab; i++) {
-                if (i > vocab.token_beg) {
-                    word = "[_TT_" + std::to_string(i - vocab.token_beg) + "]";
-                } else if (i == vocab.token_eot) {
-                    word = "[_EOT_]";
-                } else if (i == vocab.token_sot) {
-                    word = "[_SOT_]";
-                } else if (i == vocab.token_translate) {
-                    word = "[_TRANSLATE_]";
-                } else if (i == vocab.token_transcribe) {
-                    word = "[_TRANSCRIBE_]";
-                } else if (i == vocab.token_solm) {
-                    word = "[_SOLM_]";
-                } else if (i == vocab.token_prev) {
-                    word = "[_PREV_]";
-                } else if (i == vocab.token_nosp) {
-                    word = "[_NOSP_]";
-                } else if (i == vocab.token_not) {
-                    word = "[_NOT_]";
-                } else if (i == vocab.token_beg) {
-                    word = "[_BEG_]";
-                } else if (i > vocab.token_sot && i <= vocab.token_sot + vocab.num_languages()) {
-                    word = "[_LANG_" + std::string(whisper_lang_str(i - vocab.token_sot - 1)) + "]";
-                } else {
-                    word = "[_extra_token_" + std::to_string(i) + "]";
-                }
-                vocab.token_to_id[word] = i;
-                vocab.id_to_token[i] = word;
-            }
-        }
+    WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
+}
 
-        WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
-    }
+static std::map<ggml_backend_buffer_type_t, ggml_context *> whisper_model_create_tensors(whisper_context & wctx) {
+    auto & model = wctx.model;
 
     const ggml_type wtype = wctx.wtype;
     const ggml_type vtype = wctx.wtype == GGML_TYPE_F32 ? GGML_TYPE_F32 : GGML_TYPE_F16; // conv type
@@ -1863,34 +2032,142 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         ggml_free(ctx);
     }
 
-    // allocate tensors in the backend buffers
-    for (auto & p : ctx_map) {
-        ggml_backend_buffer_type_t buft = p.first;
-        ggml_context * ctx = p.second;
-        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
-        if (buf) {
-            model.buffers.emplace_back(buf);
+    return ctx_map;
+}
 
-            size_t size_main = ggml_backend_buffer_get_size(buf);
-            WHISPER_LOG_INFO("%s: %12s total size = %8.2f MB\n", __func__, ggml_backend_buffer_name(buf), size_main / 1e6);
-        }
-    }
+// load the model from a ggml file
+//
+// file format:
+//
+//   - hparams
+//   - pre-computed mel filters
+//   - vocab
+//   - weights
+//
+// see the convert-pt-to-ggml.py script for details
+//
+static bool whisper_model_load(struct whisper_model_loader * loader, whisper_context & wctx) {
+    WHISPER_LOG_INFO("%s: loading model\n", __func__);
 
-    // load weights
-    {
-        size_t total_size = 0;
+    const int64_t t_start_us = ggml_time_us();
 
-        model.n_loaded = 0;
+    wctx.t_start_us = t_start_us;
 
-        std::vector<char> read_buf;
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
 
-        while (true) {
-            int32_t n_dims;
-            int32_t length;
-            int32_t ttype;
+    // verify magic
+    {
+        uint32_t magic;
+        read_safe(loader, magic);
+        if (magic != GGML_FILE_MAGIC) {
+            WHISPER_LOG_ERROR("%s: invalid model data (bad magic)\n", __func__);
+            return false;
+        }
+    }
 
-            read_safe(loader, n_dims);
-            read_safe(loader, length);
+    //load hparams
+    {
+        auto & hparams = model.hparams;
+
+        read_safe(loader, hparams.n_vocab);
+        read_safe(loader, hparams.n_audio_ctx);
+        read_safe(loader, hparams.n_audio_state);
+        read_safe(loader, hparams.n_audio_head);
+        read_safe(loader, hparams.n_audio_layer);
+        read_safe(loader, hparams.n_text_ctx);
+        read_safe(loader, hparams.n_text_state);
+        read_safe(loader, hparams.n_text_head);
+        read_safe(loader, hparams.n_text_layer);
+        read_safe(loader, hparams.n_mels);
+        read_safe(loader, hparams.ftype);
+
+        if (!whisper_model_init_hparams(wctx)) {
+            return false;
+        }
+    }
+
+    // load mel filters
+    {
+        auto & filters = wctx.model.filters;
+
+        read_safe(loader, filters.n_mel);
+        read_safe(loader, filters.n_fft);
+
+        filters.data.resize(filters.n_mel * filters.n_fft);
+        loader->read(loader->context, filters.data.data(), filters.data.size() * sizeof(float));
+        BYTESWAP_FILTERS(filters);
+    }
+
+    // load vocab
+    {
+        int32_t n_vocab = 0;
+        read_safe(loader, n_vocab);
+
+        //if (n_vocab != model.hparams.n_vocab) {
+        //    WHISPER_LOG_ERROR("%s: invalid model file '%s' (bad vocab size %d != %d)\n",
+        //            __func__, fname.c_str(), n_vocab, model.hparams.n_vocab);
+        //    return false;
+        //}
+
+        std::string word;
+        std::vector<char> tmp;
+
+        tmp.reserve(128);
+
+        for (int i = 0; i < n_vocab; i++) {
+            uint32_t len;
+            read_safe(loader, len);
+
+            if (len > 0) {
+                tmp.resize(len);
+                loader->read(loader->context, &tmp[0], tmp.size()); // read to buffer
+                word.assign(&tmp[0], tmp.size());
+            } else {
+                // seems like we have an empty-string token in multi-language models (i = 50256)
+                //WHISPER_LOG_WARN("%s: warning: empty-string token in vocab, i = %d\n", __func__, i);
+                word = "";
+            }
+
+            vocab.token_to_id[word] = i;
+            vocab.id_to_token[i] = word;
+
+            //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
+        }
+
+        whisper_model_init_vocab(wctx, n_vocab);
+    }
+
+    std::map<ggml_backend_buffer_type_t, ggml_context *> ctx_map = whisper_model_create_tensors(wctx);
+
+    // allocate tensors in the backend buffers
+    for (auto & p : ctx_map) {
+        ggml_backend_buffer_type_t buft = p.first;
+        ggml_context * ctx = p.second;
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
+        if (buf) {
+            model.buffers.emplace_back(buf);
+
+            size_t size_main = ggml_backend_buffer_get_size(buf);
+            WHISPER_LOG_INFO("%s: %12s total size = %8.2f MB\n", __func__, ggml_backend_buffer_name(buf), size_main / 1e6);
+        }
+    }
+
+    // load weights
+    {
+        size_t total_size = 0;
+
+        model.n_loaded = 0;
+
+        std::vector<char> read_buf;
+
+        while (true) {
+            int32_t n_dims;
+            int32_t length;
+            int32_t ttype;
+
+            read_safe(loader, n_dims);
+            read_safe(loader, length);
             read_safe(loader, ttype);
 
             if (loader->eof(loader->context)) {
@@ -1973,150 +2250,437 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
     return true;
 }
 
-static bool whisper_encode_external(const whisper_state & wstate) {
-    GGML_UNUSED(wstate);
-
-#ifndef WHISPER_USE_COREML
-    const bool use_coreml = false;
-#else
-    const bool use_coreml = wstate.ctx_coreml != nullptr;
-#endif
-
-#ifndef WHISPER_USE_OPENVINO
-    const bool use_openvino = false;
-#else
-    const bool use_openvino = wstate.ctx_openvino != nullptr;
-#endif
+// load the model from a GGUF file
+//
+// the hparams, the mel filters and the vocab of the ggml format are stored as key-value pairs:
+//
+//   - whisper.n_vocab, whisper.n_audio_ctx, ..., whisper.n_mels (uint32) - same as whisper_hparams
+//   - whisper.filters.n_mel, whisper.filters.n_fft (uint32) and whisper.filters.data (float32 array)
+//   - whisper.vocab.len (uint32 array) and whisper.vocab.data (uint8 array) - the tokens are raw bytes
+//   - general.file_type, general.quantization_version (uint32)
+//
+// the tensors have the same names as in the ggml format. use whisper-quantize to convert a ggml model
+//
+// with params.use_mmap, the file is mapped in memory and the tensors in CPU buffers point directly into the mapping
+//
+static bool whisper_model_load_gguf(const char * fname, whisper_context & wctx) {
+    WHISPER_LOG_INFO("%s: loading model\n", __func__);
 
-    return use_coreml || use_openvino;
-}
+    const int64_t t_start_us = ggml_time_us();
 
-static struct ggml_cgraph * whisper_build_graph_conv(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+    wctx.t_start_us = t_start_us;
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
+    auto & model = wctx.model;
+    auto & vocab = wctx.vocab;
 
-    const int n_mels = hparams.n_mels;
+    ggml_context * ctx_meta = nullptr;
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_conv.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_conv.meta.data(),
-        /*.no_alloc   =*/ true,
+    gguf_init_params gparams = {
+        /*.no_alloc =*/ true,
+        /*.ctx      =*/ &ctx_meta,
     };
 
-    struct ggml_context * ctx0 = ggml_init(params);
+    gguf_context_ptr gguf_ctx(gguf_init_from_file(fname, gparams));
+    if (!gguf_ctx) {
+        WHISPER_LOG_ERROR("%s: failed to read GGUF file '%s'\n", __func__, fname);
+        return false;
+    }
 
-    ggml_cgraph * gf = ggml_new_graph(ctx0);
+    ggml_context_ptr ctx_meta_ptr(ctx_meta);
 
-    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
-    ggml_set_name(mel, "mel");
-    ggml_set_input(mel);
+    const gguf_context * gctx = gguf_ctx.get();
 
-    struct ggml_tensor * cur = nullptr;
+    auto get_u32 = [&](const char * key, int32_t & dst) -> bool {
+        const int64_t id = gguf_find_key(gctx, key);
+        if (id < 0 || gguf_get_kv_type(gctx, id) != GGUF_TYPE_UINT32) {
+            WHISPER_LOG_ERROR("%s: missing or invalid key '%s'\n", __func__, key);
+            return false;
+        }
+        dst = (int32_t) gguf_get_val_u32(gctx, id);
+        return true;
+    };
 
-    if (!whisper_encode_external(wstate)) {
-        // convolution + gelu
-        {
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_1_b);
+    auto get_arr = [&](const char * key, gguf_type type, size_t & n) -> const void * {
+        const int64_t id = gguf_find_key(gctx, key);
+        if (id < 0 || gguf_get_kv_type(gctx, id) != GGUF_TYPE_ARRAY || gguf_get_arr_type(gctx, id) != type) {
+            WHISPER_LOG_ERROR("%s: missing or invalid key '%s'\n", __func__, key);
+            return nullptr;
+        }
+        n = gguf_get_arr_n(gctx, id);
+        return gguf_get_arr_data(gctx, id);
+    };
 
-            cur = ggml_gelu(ctx0, cur);
+    // verify architecture
+    {
+        const int64_t id = gguf_find_key(gctx, "general.architecture");
+        if (id < 0 || gguf_get_kv_type(gctx, id) != GGUF_TYPE_STRING || strcmp(gguf_get_val_str(gctx, id), "whisper") != 0) {
+            WHISPER_LOG_ERROR("%s: invalid model file '%s' (not a whisper model)\n", __func__, fname);
+            return false;
+        }
+    }
 
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_2_b);
+    // load hparams
+    {
+        auto & hparams = model.hparams;
 
-            cur = ggml_gelu(ctx0, cur);
-        }
+        int32_t qntvr = 0;
+
+        const bool ok =
+            get_u32("whisper.n_vocab",       hparams.n_vocab)       &&
+            get_u32("whisper.n_audio_ctx",   hparams.n_audio_ctx)   &&
+            get_u32("whisper.n_audio_state", hparams.n_audio_state) &&
+            get_u32("whisper.n_audio_head",  hparams.n_audio_head)  &&
+            get_u32("whisper.n_audio_layer", hparams.n_audio_layer) &&
+            get_u32("whisper.n_text_ctx",    hparams.n_text_ctx)    &&
+            get_u32("whisper.n_text_state",  hparams.n_text_state)  &&
+            get_u32("whisper.n_text_head",   hparams.n_text_head)   &&
+            get_u32("whisper.n_text_layer",  hparams.n_text_layer)  &&
+            get_u32("whisper.n_mels",        hparams.n_mels)        &&
+            get_u32("general.file_type",     hparams.ftype)         &&
+            get_u32("general.quantization_version", qntvr);
 
-        ggml_set_name(cur, "embd_conv");
-        wstate.embd_conv = cur;
-    } else {
-        ggml_build_forward_expand(gf, mel);
+        if (!ok) {
+            return false;
+        }
 
-        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
-        ggml_set_input(cur); // the external encoder will write into this tensor
+        hparams.ftype += qntvr*GGML_QNT_VERSION_FACTOR;
 
-        ggml_set_name(cur, "embd_enc");
-        wstate.embd_enc = cur;
+        if (!whisper_model_init_hparams(wctx)) {
+            return false;
+        }
     }
 
-    ggml_set_output(cur);
+    // load mel filters
+    {
+        auto & filters = model.filters;
 
-    ggml_build_forward_expand(gf, cur);
+        size_t n = 0;
+        const float * data = (const float *) get_arr("whisper.filters.data", GGUF_TYPE_FLOAT32, n);
 
-    ggml_free(ctx0);
+        if (!data || !get_u32("whisper.filters.n_mel", filters.n_mel) || !get_u32("whisper.filters.n_fft", filters.n_fft)) {
+            return false;
+        }
 
-    return gf;
-}
+        if (n != (size_t) filters.n_mel*filters.n_fft) {
+            WHISPER_LOG_ERROR("%s: invalid model file '%s' (bad mel filters size %zu)\n", __func__, fname, n);
+            return false;
+        }
 
-static struct ggml_cgraph * whisper_build_graph_encoder(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+        filters.data.assign(data, data + n);
+    }
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state;
-    const int n_head  = hparams.n_audio_head;
-    const int n_layer = hparams.n_audio_layer;
+    // load vocab
+    {
+        size_t n_vocab = 0;
+        size_t n_data  = 0;
 
-    const int n_state_head = n_state/n_head;
+        const uint32_t * len  = (const uint32_t *) get_arr("whisper.vocab.len",  GGUF_TYPE_UINT32, n_vocab);
+        const char     * data = (const char     *) get_arr("whisper.vocab.data", GGUF_TYPE_UINT8,  n_data);
 
-    auto & kv_pad = wstate.kv_pad;
+        if (!len || !data) {
+            return false;
+        }
 
-    WHISPER_ASSERT(!!kv_pad.buffer);
+        size_t offs = 0;
 
-    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+        for (int i = 0; i < (int) n_vocab; i++) {
+            if (offs + len[i] > n_data) {
+                WHISPER_LOG_ERROR("%s: invalid model file '%s' (bad vocab data)\n", __func__, fname);
+                return false;
+            }
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+            const std::string word(data + offs, len[i]);
+            offs += len[i];
 
-    struct ggml_context * ctx0 = ggml_init(params);
+            vocab.token_to_id[word] = i;
+            vocab.id_to_token[i] = word;
+        }
 
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+        whisper_model_init_vocab(wctx, (int) n_vocab);
+    }
 
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+    std::map<ggml_backend_buffer_type_t, ggml_context *> ctx_map = whisper_model_create_tensors(wctx);
 
-    const float KQscale = 1.0f/sqrtf(float(n_state_head));
+    // file offsets of the weights, in file order
+    std::vector<std::pair<ggml_tensor *, size_t>> weights;
+    std::map<const ggml_tensor *, size_t> offsets;
 
-    // ===================================================================
-    // NOTE: experimenting with partial evaluation of the encoder (ignore)
-    //static int iter = -1;
-    //const int n_iter = 1500/n_ctx;
+    {
+        const size_t data_offset = gguf_get_data_offset(gctx);
 
-    //iter = (iter + 1) % n_iter;
+        for (int64_t i = 0; i < gguf_get_n_tensors(gctx); ++i) {
+            const char * name = gguf_get_tensor_name(gctx, i);
 
-    //if (iter == 0) {
-    //    memset(model.memory_cross_k->data, 0, ggml_nbytes(model.memory_cross_k));
-    //    memset(model.memory_cross_v->data, 0, ggml_nbytes(model.memory_cross_v));
-    //}
+            auto it = model.tensors.find(name);
+            if (it == model.tensors.end()) {
+                WHISPER_LOG_ERROR("%s: unknown tensor '%s' in model file\n", __func__, name);
+                return false;
+            }
 
-    static int iter = 0;
+            ggml_tensor * tensor = it->second;
+            const ggml_tensor * meta = ggml_get_tensor(ctx_meta, name);
 
-    const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
-    const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*n_ctx*iter;
+            if (meta->type != tensor->type || !ggml_are_same_shape(meta, tensor)) {
+                WHISPER_LOG_ERROR("%s: tensor '%s' has wrong type or shape in model file: got %s [%d, %d, %d], expected %s [%d, %d, %d]\n",
+                        __func__, name, ggml_type_name(meta->type), (int) meta->ne[0], (int) meta->ne[1], (int) meta->ne[2],
+                        ggml_type_name(tensor->type), (int) tensor->ne[0], (int) tensor->ne[1], (int) tensor->ne[2]);
+                return false;
+            }
 
-    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, e_pe_offset);
-    cur = ggml_add(ctx0, e_pe, ggml_cont(ctx0, ggml_transpose(ctx0, cur)));
+            const size_t offs = data_offset + gguf_get_tensor_offset(gctx, i);
 
-    // ===================================================================
+            weights.emplace_back(tensor, offs);
+            offsets[tensor] = offs;
+        }
+    }
 
-    // original:
-    //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
+    if (wctx.params.use_mmap && whisper_mmap::SUPPORTED) {
+        model.mapping.reset(new whisper_mmap(fname));
+        if (!model.mapping->addr) {
+            WHISPER_LOG_WARN("%s: failed to map '%s' in memory - reading the weights instead\n", __func__, fname);
+            model.mapping.reset();
+        }
+    }
 
-    struct ggml_tensor * inpL = cur;
+    for (const auto & w : weights) {
+        if (model.mapping && w.second + ggml_nbytes(w.first) > model.mapping->size) {
+            WHISPER_LOG_ERROR("%s: invalid model file '%s' (tensor data is out of bounds)\n", __func__, fname);
+            return false;
+        }
+    }
 
-    for (int il = 0; il < n_layer; ++il) {
-        const auto & layer = model.layers_encoder[il];
+    // use the mapped weights in place for the CPU buffer type, allocate tensors in the backend buffers for the rest
+    ggml_backend_buffer_t buf_mmap = nullptr;
 
-        // norm
+    for (auto & p : ctx_map) {
+        ggml_backend_buffer_type_t buft = p.first;
+        ggml_context * ctx = p.second;
+
+        if (model.mapping && buft == ggml_backend_cpu_buffer_type()) {
+            if (!buf_mmap) {
+                buf_mmap = ggml_backend_cpu_buffer_from_ptr(model.mapping->addr, model.mapping->size);
+                model.buffers.emplace_back(buf_mmap);
+            }
+
+            const size_t align = ggml_backend_buft_get_alignment(buft);
+
+            size_t size_mapped = 0;
+
+            for (ggml_tensor * t = ggml_get_first_tensor(ctx); t != nullptr; t = ggml_get_next_tensor(ctx, t)) {
+                auto it = offsets.find(t);
+                if (it == offsets.end() || it->second % align != 0) {
+                    continue;
+                }
+
+                if (ggml_backend_tensor_alloc(buf_mmap, t, (char *) model.mapping->addr + it->second) != GGML_STATUS_SUCCESS) {
+                    WHISPER_LOG_ERROR("%s: failed to map tensor in memory\n", __func__);
+                    return false;
+                }
+
+                size_mapped += ggml_nbytes(t);
+            }
+
+            WHISPER_LOG_INFO("%s: %12s mapped size = %8.2f MB\n", __func__, ggml_backend_buffer_name(buf_mmap), size_mapped / 1e6);
+        }
+
+        ggml_backend_buffer_t buf = ggml_backend_alloc_ctx_tensors_from_buft(ctx, buft);
+        if (buf) {
+            model.buffers.emplace_back(buf);
+
+            size_t size_main = ggml_backend_buffer_get_size(buf);
+            WHISPER_LOG_INFO("%s: %12s total size = %8.2f MB\n", __func__, ggml_backend_buffer_name(buf), size_main / 1e6);
+        }
+    }
+
+    // load weights
+    {
+        size_t total_size = 0;
+
+        model.n_loaded = 0;
+
+        std::ifstream fin;
+
+        if (!model.mapping) {
+#ifdef _MSC_VER
+            std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+            fin.open(converter.from_bytes(fname), std::ios::binary);
+#else
+            fin.open(fname, std::ios::binary);
+#endif
+            if (!fin) {
+                WHISPER_LOG_ERROR("%s: failed to open '%s'\n", __func__, fname);
+                return false;
+            }
+        }
+
+        std::vector<char> read_buf;
+
+        for (const auto & w : weights) {
+            ggml_tensor * tensor = w.first;
+
+            const size_t offs   = w.second;
+            const size_t nbytes = ggml_nbytes(tensor);
+
+            if (buf_mmap && tensor->buffer == buf_mmap) {
+                // used in place
+            } else if (model.mapping) {
+                ggml_backend_tensor_set(tensor, (const char *) model.mapping->addr + offs, 0, nbytes);
+            } else {
+                fin.seekg(offs);
+
+                if (ggml_backend_buffer_is_host(tensor->buffer)) {
+                    fin.read((char *) tensor->data, nbytes);
+                } else {
+                    read_buf.resize(nbytes);
+                    fin.read(read_buf.data(), nbytes);
+                    ggml_backend_tensor_set(tensor, read_buf.data(), 0, nbytes);
+                }
+
+                if (!fin) {
+                    WHISPER_LOG_ERROR("%s: failed to read tensor data from '%s'\n", __func__, fname);
+                    return false;
+                }
+            }
+
+            total_size += nbytes;
+            model.n_loaded++;
+        }
+
+        WHISPER_LOG_INFO("%s: model size    = %7.2f MB\n", __func__, total_size/1e6);
+
+        if (model.n_loaded == 0) {
+            WHISPER_LOG_WARN("%s: WARN no tensors loaded from model file - assuming empty model for testing\n", __func__);
+        } else if (model.n_loaded != (int) model.tensors.size()) {
+            WHISPER_LOG_ERROR("%s: ERROR not all tensors loaded from model file - expected %zu, got %d\n", __func__, model.tensors.size(), model.n_loaded);
+            return false;
+        }
+    }
+
+    // the weights have been copied to the device buffers
+    if (!buf_mmap) {
+        model.mapping.reset();
+    }
+
+    for (auto & buf : model.buffers) {
+        ggml_backend_buffer_set_usage(buf, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+    }
+
+    wctx.t_load_us = ggml_time_us() - t_start_us;
+
+    return true;
+}
+
+static bool whisper_encode_external(const whisper_state & wstate) {
+    GGML_UNUSED(wstate);
+
+#ifndef WHISPER_USE_COREML
+    const bool use_coreml = false;
+#else
+    const bool use_coreml = wstate.ctx_coreml != nullptr;
+#endif
+
+#ifndef WHISPER_USE_OPENVINO
+    const bool use_openvino = false;
+#else
+    const bool use_openvino = wstate.ctx_openvino != nullptr;
+#endif
+
+    return use_coreml || use_openvino;
+}
+
+static struct ggml_cgraph * whisper_build_graph_conv(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state; GGML_UNUSED(n_state);
+
+    const int n_mels = hparams.n_mels;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_conv.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_conv.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    struct ggml_tensor * mel = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels);
+    ggml_set_name(mel, "mel");
+    ggml_set_input(mel);
+
+    struct ggml_tensor * cur = nullptr;
+
+    if (!whisper_encode_external(wstate)) {
+        // convolution + gelu
+        {
+            cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
+            cur = ggml_add(ctx0, cur, model.e_conv_1_b);
+
+            cur = ggml_gelu(ctx0, cur);
+
+            cur = ggml_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2, 1);
+            cur = ggml_add(ctx0, cur, model.e_conv_2_b);
+
+            cur = ggml_gelu(ctx0, cur);
+        }
+
+        ggml_set_name(cur, "embd_conv");
+        wstate.embd_conv = cur;
+    } else {
+        ggml_build_forward_expand(gf, mel);
+
+        cur = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, n_state, n_ctx);
+        ggml_set_input(cur); // the external encoder will write into this tensor
+
+        ggml_set_name(cur, "embd_enc");
+        wstate.embd_enc = cur;
+    }
+
+    ggml_set_output(cur);
+
+    ggml_build_forward_expand(gf, cur);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// the transformer blocks of the encoder, applied to n_batch independent windows of n_ctx positions
+// inpL: [n_state, n_ctx*n_batch]
+static struct ggml_tensor * whisper_build_encoder_layers(
+        whisper_context & wctx,
+          whisper_state & wstate,
+           ggml_context * ctx0,
+            ggml_cgraph * gf,
+     struct ggml_tensor * cur,
+                    int   n_ctx,
+                    int   n_batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_layer = hparams.n_audio_layer;
+
+    const int n_state_head = n_state/n_head;
+
+    auto & kv_pad = wstate.kv_pad;
+
+    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+
+    const float KQscale = 1.0f/sqrtf(float(n_state_head));
+
+    struct ggml_tensor * inpL = cur;
+
+    for (int il = 0; il < n_layer; ++il) {
+        const auto & layer = model.layers_encoder[il];
+
+        // norm
         {
             cur = ggml_norm(ctx0, inpL, hparams.eps);
 
@@ -2153,10 +2717,10 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
             struct ggml_tensor * Q =
                 ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_ctx),
+                        ggml_reshape_4d(ctx0, Qcur, n_state_head, n_head, n_ctx, n_batch),
                         0, 2, 1, 3);
 
-            if (wctx.params.flash_attn) {
+            if (wctx.params.flash_attn && n_batch == 1) {
                 ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, ggml_view_1d(ctx0, kv_pad.k, n_ctx*n_state, 0)));
                 ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, ggml_view_1d(ctx0, kv_pad.v, n_ctx*n_state, 0)));
 
@@ -2177,11 +2741,34 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
 
                 cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx);
+            } else if (wctx.params.flash_attn) {
+                // the padded buffer holds a single window - pad the keys and values of each window in the graph
+                struct ggml_tensor * K =
+                    ggml_cast(ctx0,
+                            ggml_pad(ctx0,
+                                ggml_cont(ctx0, ggml_permute(ctx0,
+                                        ggml_reshape_4d(ctx0, Kcur, n_state_head, n_head, n_ctx, n_batch),
+                                        0, 2, 1, 3)),
+                                0, n_ctx_pad - n_ctx, 0, 0),
+                            GGML_TYPE_F16);
+
+                struct ggml_tensor * V =
+                    ggml_cast(ctx0,
+                            ggml_pad(ctx0,
+                                ggml_cont(ctx0, ggml_permute(ctx0,
+                                        ggml_reshape_4d(ctx0, Vcur, n_state_head, n_head, n_ctx, n_batch),
+                                        0, 2, 1, 3)),
+                                0, n_ctx_pad - n_ctx, 0, 0),
+                            GGML_TYPE_F16);
+
+                cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
+
+                cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
             } else {
                 struct ggml_tensor * K =
                     ggml_permute(ctx0,
                             ggml_cast(ctx0,
-                                ggml_reshape_3d(ctx0, Kcur, n_state_head, n_head, n_ctx),
+                                ggml_reshape_4d(ctx0, Kcur, n_state_head, n_head, n_ctx, n_batch),
                                 wctx.itype),
                             0, 2, 1, 3);
 
@@ -2193,9 +2780,9 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                 struct ggml_tensor * V =
                     ggml_cast(ctx0,
                             ggml_permute(ctx0,
-                                ggml_reshape_3d(ctx0,
+                                ggml_reshape_4d(ctx0,
                                     Vcur,
-                                    n_state_head, n_head, n_ctx),
+                                    n_state_head, n_head, n_ctx, n_batch),
                                 1, 2, 0, 3),
                             wctx.itype);
 
@@ -2203,7 +2790,7 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
                 struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
 
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx);
+                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx*n_batch);
             }
         }
 
@@ -2266,6 +2853,58 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                 model.e_ln_b);
     }
 
+    return cur;
+}
+
+static struct ggml_cgraph * whisper_build_graph_encoder(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+
+    WHISPER_ASSERT(!!wstate.kv_pad.buffer);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+
+    // ===================================================================
+    // NOTE: experimenting with partial evaluation of the encoder (ignore)
+    //static int iter = -1;
+    //const int n_iter = 1500/n_ctx;
+
+    //iter = (iter + 1) % n_iter;
+
+    //if (iter == 0) {
+    //    memset(model.memory_cross_k->data, 0, ggml_nbytes(model.memory_cross_k));
+    //    memset(model.memory_cross_v->data, 0, ggml_nbytes(model.memory_cross_v));
+    //}
+
+    static int iter = 0;
+
+    const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
+    const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*n_ctx*iter;
+
+    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, e_pe_offset);
+    cur = ggml_add(ctx0, e_pe, ggml_cont(ctx0, ggml_transpose(ctx0, cur)));
+
+    // ===================================================================
+
+    // original:
+    //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
+
+    cur = whisper_build_encoder_layers(wctx, wstate, ctx0, gf, cur, n_ctx, 1);
+
     ggml_build_forward_expand(gf, cur);
 
     wstate.embd_enc = cur;
@@ -2373,6 +3012,20 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 //   - n_threads:  number of threads to use
 //   - mel_offset: offset in the mel spectrogram (i.e. audio offset)
 //
+// copy the 2*n_ctx mel frames starting at mel_offset into dst [n_mel][2*n_ctx], zero-padding past the end
+static void whisper_mel_window(const whisper_mel & mel, int mel_offset, int n_ctx, float * dst) {
+    memset(dst, 0, sizeof(float)*mel.n_mel*2*n_ctx);
+
+    const int i0 = std::min(mel_offset,           mel.n_len);
+    const int i1 = std::min(mel_offset + 2*n_ctx, mel.n_len);
+
+    for (int j = 0; j < mel.n_mel; ++j) {
+        for (int i = i0; i < i1; ++i) {
+            dst[j*2*n_ctx + (i - i0)] = mel.data[j*mel.n_len + i];
+        }
+    }
+}
+
 static bool whisper_encode_internal(
         whisper_context & wctx,
           whisper_state & wstate,
@@ -2382,6 +3035,9 @@ static bool whisper_encode_internal(
                    void * abort_callback_data) {
     const int64_t t_start_us = ggml_time_us();
 
+    // kv_cross is about to be overwritten
+    wstate.encoded_offset = -1;
+
     // conv
     {
         auto & sched = wstate.sched_conv.sched;
@@ -2405,17 +3061,7 @@ static bool whisper_encode_internal(
 
             wstate.inp_mel.resize(ggml_nelements(mel));
 
-            float * dst = wstate.inp_mel.data();
-            memset(dst, 0, ggml_nbytes(mel));
-
-            const int i0 = std::min(mel_offset,           mel_inp.n_len);
-            const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
-
-            for (int j = 0; j < mel_inp.n_mel; ++j) {
-                for (int i = i0; i < i1; ++i) {
-                    dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
-                }
-            }
+            whisper_mel_window(mel_inp, mel_offset, n_ctx, wstate.inp_mel.data());
 
             ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
         }
@@ -2468,17 +3114,232 @@ static bool whisper_encode_internal(
     wstate.t_encode_us += ggml_time_us() - t_start_us;
     wstate.n_encode++;
 
+    wstate.encoded_offset = mel_offset;
+    wstate.encoded_n_ctx  = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
     return !(abort_callback && abort_callback(abort_callback_data));
 }
 
-static struct ggml_cgraph * whisper_build_graph_decoder(
-         whisper_context & wctx,
-         whisper_state   & wstate,
-     const whisper_batch & batch,
-                    bool   save_alignment_heads_QKs,
-                    bool   worst_case) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+// same as whisper_encode_internal, but does nothing if kv_cross already holds the window at mel_offset
+static bool whisper_encode_cached(
+        whisper_context & wctx,
+          whisper_state & wstate,
+              const int   mel_offset,
+              const int   n_threads,
+    ggml_abort_callback   abort_callback,
+                   void * abort_callback_data) {
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    if (wstate.encoded_offset == mel_offset && wstate.encoded_n_ctx == n_ctx) {
+        return !(abort_callback && abort_callback(abort_callback_data));
+    }
+
+    return whisper_encode_internal(wctx, wstate, mel_offset, n_threads, abort_callback, abort_callback_data);
+}
+
+// conv + encoder + cross for n_batch states in a single graph
+// all states must use the same audio context
+static struct ggml_cgraph * whisper_build_graph_encode_batch(
+        whisper_context & wctx,
+        whisper_state  ** states,
+                    int   n_batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    whisper_state & wstate = *states[0];
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_mels  = hparams.n_mels;
+
+    const int n_state_head = n_state/n_head;
+
+    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_encode_batch.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_encode_batch.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * mel = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels, n_batch);
+    ggml_set_name(mel, "mel");
+    ggml_set_input(mel);
+
+    struct ggml_tensor * cur = nullptr;
+
+    // convolution + gelu
+    // note: ggml_conv_1d does not keep the batch dimension separate, so the convolutions are expressed with im2col
+    //       and the weights as the first operand, which also yields the [n_state, n_ctx] layout of the encoder
+    {
+        const auto conv_1d = [&](ggml_tensor * w, ggml_tensor * b, ggml_tensor * x, int s0) {
+            ggml_tensor * im2col = ggml_im2col(ctx0, w, x, s0, 0, w->ne[0]/2, 0, 1, 0, false, GGML_TYPE_F16); // [N, OL, IC*K]
+
+            ggml_tensor * res = ggml_mul_mat(ctx0,
+                    ggml_reshape_2d(ctx0, w, w->ne[0]*w->ne[1], w->ne[2]),
+                    ggml_reshape_2d(ctx0, im2col, im2col->ne[0], im2col->ne[1]*im2col->ne[2])); // [N*OL, OC]
+
+            res = ggml_add(ctx0, res, ggml_reshape_1d(ctx0, b, ggml_nelements(b)));
+
+            return ggml_gelu(ctx0, res);
+        };
+
+        cur = conv_1d(model.e_conv_1_w, model.e_conv_1_b, mel, 1);
+
+        // [n_state, 2*n_ctx, n_batch] -> [2*n_ctx, n_state, n_batch]
+        cur = ggml_cont(ctx0, ggml_permute(ctx0, ggml_reshape_3d(ctx0, cur, n_state, 2*n_ctx, n_batch), 1, 0, 2, 3));
+
+        cur = conv_1d(model.e_conv_2_w, model.e_conv_2_b, cur, 2);
+    }
+
+    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, model.e_pe->nb[1], 0);
+
+    cur = ggml_add(ctx0, ggml_reshape_3d(ctx0, cur, n_state, n_ctx, n_batch), e_pe);
+    cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
+
+    cur = whisper_build_encoder_layers(wctx, wstate, ctx0, gf, cur, n_ctx, n_batch);
+
+    // cross-attention memory - one matrix multiplication for the whole batch, then scatter to the states
+    const float Kscale = pow(float(n_state_head), -0.25);
+
+    for (int il = 0; il < model.hparams.n_text_layer; ++il) {
+        auto & layer = model.layers_decoder[il];
+
+        struct ggml_tensor * Kcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_k_w,
+                cur);
+
+        Kcross = ggml_scale(ctx0, Kcross, Kscale);
+
+        struct ggml_tensor * Vcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_v_w,
+                cur);
+
+        Vcross = ggml_add(ctx0,
+                    Vcross,
+                    layer.cross_attn_v_b);
+
+        for (int ib = 0; ib < n_batch; ++ib) {
+            auto & kv_cross = states[ib]->kv_cross;
+
+            struct ggml_tensor * Kb = ggml_view_1d(ctx0, Kcross, n_state*n_ctx, ib*n_ctx*Kcross->nb[1]);
+            struct ggml_tensor * Vb = ggml_view_2d(ctx0, Vcross, n_state, n_ctx, Vcross->nb[1], ib*n_ctx*Vcross->nb[1]);
+
+            struct ggml_tensor * k;
+            struct ggml_tensor * v;
+
+            if (wctx.params.flash_attn) {
+                Vb = ggml_view_1d(ctx0, Vcross, n_state*n_ctx, ib*n_ctx*Vcross->nb[1]);
+
+                k = ggml_view_1d(ctx0, kv_cross.k, n_state*n_ctx,
+                        (ggml_element_size(kv_cross.k)*n_state)*(il*n_ctx_pad));
+
+                v = ggml_view_1d(ctx0, kv_cross.v, n_state*n_ctx,
+                        (ggml_element_size(kv_cross.v)*n_state)*(il*n_ctx_pad));
+            } else {
+                Vb = ggml_transpose(ctx0, Vb);
+
+                k = ggml_view_1d(ctx0, kv_cross.k, n_state*n_ctx,
+                        (ggml_element_size(kv_cross.k)*n_state)*(il*n_ctx));
+
+                v = ggml_view_2d(ctx0, kv_cross.v, n_ctx, n_state,
+                        (   n_ctx)*ggml_element_size(kv_cross.v),
+                        (il*n_ctx)*ggml_element_size(kv_cross.v)*n_state);
+            }
+
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kb, k));
+            ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vb, v));
+        }
+    }
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+static bool whisper_encode_batch_internal(
+        whisper_context & wctx,
+        whisper_state  ** states,
+              const int * mel_offsets,
+              const int   n_batch,
+              const int   n_threads) {
+    const int64_t t_start_us = ggml_time_us();
+
+    whisper_state & wstate = *states[0];
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    for (int ib = 0; ib < n_batch; ++ib) {
+        states[ib]->encoded_offset = -1;
+    }
+
+    auto & sched = wstate.sched_encode_batch;
+
+    // the compute buffer is sized for the first batch and grows on demand
+    if (!sched.sched) {
+        if (!whisper_sched_graph_init(sched, wstate.backends, [&]() { return whisper_build_graph_encode_batch(wctx, states, n_batch); })) {
+            return false;
+        }
+
+        WHISPER_LOG_INFO("%s: compute buffer (encode batch) = %7.2f MB\n", __func__, whisper_sched_size(sched) / 1e6);
+    }
+
+    ggml_cgraph * gf = whisper_build_graph_encode_batch(wctx, states, n_batch);
+
+    if (!ggml_backend_sched_alloc_graph(sched.sched, gf)) {
+        return false;
+    }
+
+    struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
+
+    // set the input
+    {
+        assert(mel->type == GGML_TYPE_F32);
+
+        wstate.inp_mel.resize(ggml_nelements(mel));
+
+        const int64_t n_mel_batch = mel->ne[0]*mel->ne[1];
+
+        for (int ib = 0; ib < n_batch; ++ib) {
+            assert(states[ib]->mel.n_mel == wctx.model.hparams.n_mels);
+
+            whisper_mel_window(states[ib]->mel, mel_offsets[ib], n_ctx, wstate.inp_mel.data() + ib*n_mel_batch);
+        }
+
+        ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
+    }
+
+    if (!ggml_graph_compute_helper(sched.sched, gf, n_threads)) {
+        return false;
+    }
+
+    // split the time evenly between the states
+    const int64_t t_encode_us = (ggml_time_us() - t_start_us)/n_batch;
+
+    for (int ib = 0; ib < n_batch; ++ib) {
+        states[ib]->t_encode_us += t_encode_us;
+        states[ib]->n_encode++;
+
+        states[ib]->encoded_offset = mel_offsets[ib];
+        states[ib]->encoded_n_ctx  = n_ctx;
+    }
+
+    return true;
+}
+
+static struct ggml_cgraph * whisper_build_graph_decoder(
+         whisper_context & wctx,
+         whisper_state   & wstate,
+     const whisper_batch & batch,
+                    bool   save_alignment_heads_QKs,
+                    bool   worst_case) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
 
     auto & kv_self = wstate.kv_self;
 
@@ -3010,30 +3871,93 @@ static std::string to_timestamp(int64_t t, bool comma = false) {
     return std::string(buf);
 }
 
-#define SIN_COS_N_COUNT WHISPER_N_FFT
+// number of frames transformed together by log_mel_spectrogram_worker_thread()
+#define WHISPER_FFT_BATCH 8
+
 namespace {
-struct whisper_global_cache {
-    // In FFT, we frequently use sine and cosine operations with the same values.
-    // We can use precalculated values to speed up the process.
-    float sin_vals[SIN_COS_N_COUNT];
-    float cos_vals[SIN_COS_N_COUNT];
 
+// FFT of a real-valued input of even size n, computed as a complex FFT of size n/2 followed by a split step
+// the complex FFT is a mixed-radix (2, 3, 4, 5) Stockham autosort FFT with precomputed twiddles
+// the data of WHISPER_FFT_BATCH frames is interleaved ([n][WHISPER_FFT_BATCH]), so that the inner loops vectorize
+struct whisper_rfft_plan {
+    struct stage {
+        int radix;
+        int l; // length of the sub-transforms computed by the previous stages
+
+        std::vector<float> tw_re; // [radix - 1][l]
+        std::vector<float> tw_im;
+    };
+
+    int n = 0;
+    int m = 0; // size of the complex FFT
+
+    std::vector<stage> stages;
+
+    // twiddles of the split step, [m + 1]
+    std::vector<float> split_re;
+    std::vector<float> split_im;
+
+    bool init(int n_fft) {
+        n = n_fft;
+        m = n_fft / 2;
+
+        if (n % 2 != 0) {
+            return false;
+        }
+
+        int rem = m;
+        int l   = 1;
+        while (rem > 1) {
+            int radix = 0;
+            for (int r : { 4, 2, 5, 3 }) {
+                if (rem % r == 0) {
+                    radix = r;
+                    break;
+                }
+            }
+            if (radix == 0) {
+                return false;
+            }
+
+            stage st;
+            st.radix = radix;
+            st.l     = l;
+            for (int v = 1; v < radix; ++v) {
+                for (int k = 0; k < l; ++k) {
+                    const double theta = -2.0*M_PI*v*k/(l*radix);
+                    st.tw_re.push_back(cos(theta));
+                    st.tw_im.push_back(sin(theta));
+                }
+            }
+            stages.push_back(std::move(st));
+
+            rem /= radix;
+            l   *= radix;
+        }
+
+        for (int k = 0; k <= m; ++k) {
+            const double theta = -2.0*M_PI*k/n;
+            split_re.push_back(cos(theta));
+            split_im.push_back(sin(theta));
+        }
+
+        return true;
+    }
+};
+
+struct whisper_global_cache {
     // Hann window (Use cosf to eliminate difference)
     // ref: https://pytorch.org/docs/stable/generated/torch.hann_window.html
     // ref: https://github.com/openai/whisper/blob/main/whisper/audio.py#L147
     float hann_window[WHISPER_N_FFT];
 
+    whisper_rfft_plan rfft;
+
     whisper_global_cache() {
-        fill_sin_cos_table();
         fill_hann_window(sizeof(hann_window)/sizeof(hann_window[0]), true, hann_window);
-    }
 
-    void fill_sin_cos_table() {
-        for (int i = 0; i < SIN_COS_N_COUNT; i++) {
-            double theta = (2 * M_PI * i) / SIN_COS_N_COUNT;
-            sin_vals[i] = sinf(theta);
-            cos_vals[i] = cosf(theta);
-        }
+        const bool ok = rfft.init(WHISPER_N_FFT);
+        GGML_ASSERT(ok && "WHISPER_N_FFT must be even and have no prime factors other than 2, 3 and 5");
     }
 
     void fill_hann_window(int length, bool periodic, float * output) {
@@ -3048,134 +3972,265 @@ struct whisper_global_cache {
 } global_cache;
 }
 
-// naive Discrete Fourier Transform
-// input is real-valued
-// output is complex-valued
-static void dft(const float* in, int N, float* out) {
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
+// one radix-p stage of the Stockham FFT of size m:
+// b[j][k1 + l*k2] = sum_v W_p^(v*k2) * W_(l*p)^(v*k1) * a[j + (m/(l*p))*v][k1]
+static void whisper_fft_stage(const whisper_rfft_plan::stage & st, int m, const float * ar, const float * ai, float * br, float * bi) {
+    constexpr int B = WHISPER_FFT_BATCH;
 
-    for (int k = 0; k < N; k++) {
-        float re = 0;
-        float im = 0;
+    const int p  = st.radix;
+    const int l  = st.l;
+    const int lp = l*p;
+    const int ms = m/lp;
 
-        for (int n = 0; n < N; n++) {
-            int idx = (k * n * sin_cos_step) % (SIN_COS_N_COUNT); // t = 2*M_PI*k*n/N
-            re += in[n]*global_cache.cos_vals[idx]; // cos(t)
-            im -= in[n]*global_cache.sin_vals[idx]; // sin(t)
-        }
+    float xr[5][B];
+    float xi[5][B];
+
+    for (int j = 0; j < ms; ++j) {
+        for (int k1 = 0; k1 < l; ++k1) {
+            for (int v = 0; v < p; ++v) {
+                const float * sr = ar + ((j + ms*v)*l + k1)*B;
+                const float * si = ai + ((j + ms*v)*l + k1)*B;
+
+                if (v == 0) {
+                    for (int b = 0; b < B; ++b) {
+                        xr[v][b] = sr[b];
+                        xi[v][b] = si[b];
+                    }
+                } else {
+                    const float wr = st.tw_re[(v - 1)*l + k1];
+                    const float wi = st.tw_im[(v - 1)*l + k1];
+                    for (int b = 0; b < B; ++b) {
+                        xr[v][b] = sr[b]*wr - si[b]*wi;
+                        xi[v][b] = sr[b]*wi + si[b]*wr;
+                    }
+                }
+            }
 
-        out[k*2 + 0] = re;
-        out[k*2 + 1] = im;
+            float * dr[5];
+            float * di[5];
+            for (int k2 = 0; k2 < p; ++k2) {
+                dr[k2] = br + (j*lp + k1 + l*k2)*B;
+                di[k2] = bi + (j*lp + k1 + l*k2)*B;
+            }
+
+            switch (p) {
+                case 2:
+                    {
+                        for (int b = 0; b < B; ++b) {
+                            dr[0][b] = xr[0][b] + xr[1][b];
+                            di[0][b] = xi[0][b] + xi[1][b];
+                            dr[1][b] = xr[0][b] - xr[1][b];
+                            di[1][b] = xi[0][b] - xi[1][b];
+                        }
+                    } break;
+                case 3:
+                    {
+                        const float s1 = sin(2.0*M_PI/3);
+                        for (int b = 0; b < B; ++b) {
+                            const float sr = xr[1][b] + xr[2][b];
+                            const float si = xi[1][b] + xi[2][b];
+                            const float tr = xr[0][b] - 0.5f*sr;
+                            const float ti = xi[0][b] - 0.5f*si;
+                            const float ur = s1*(xr[1][b] - xr[2][b]);
+                            const float ui = s1*(xi[1][b] - xi[2][b]);
+                            dr[0][b] = xr[0][b] + sr;
+                            di[0][b] = xi[0][b] + si;
+                            dr[1][b] = tr + ui;
+                            di[1][b] = ti - ur;
+                            dr[2][b] = tr - ui;
+                            di[2][b] = ti + ur;
+                        }
+                    } break;
+                case 4:
+                    {
+                        for (int b = 0; b < B; ++b) {
+                            const float t0r = xr[0][b] + xr[2][b];
+                            const float t0i = xi[0][b] + xi[2][b];
+                            const float t1r = xr[0][b] - xr[2][b];
+                            const float t1i = xi[0][b] - xi[2][b];
+                            const float t2r = xr[1][b] + xr[3][b];
+                            const float t2i = xi[1][b] + xi[3][b];
+                            // -i*(x1 - x3)
+                            const float t3r =   xi[1][b] - xi[3][b];
+                            const float t3i = -(xr[1][b] - xr[3][b]);
+                            dr[0][b] = t0r + t2r;
+                            di[0][b] = t0i + t2i;
+                            dr[1][b] = t1r + t3r;
+                            di[1][b] = t1i + t3i;
+                            dr[2][b] = t0r - t2r;
+                            di[2][b] = t0i - t2i;
+                            dr[3][b] = t1r - t3r;
+                            di[3][b] = t1i - t3i;
+                        }
+                    } break;
+                case 5:
+                    {
+                        const float c1 = cos(2.0*M_PI/5);
+                        const float c2 = cos(4.0*M_PI/5);
+                        const float s1 = sin(2.0*M_PI/5);
+                        const float s2 = sin(4.0*M_PI/5);
+                        for (int b = 0; b < B; ++b) {
+                            const float s14r = xr[1][b] + xr[4][b];
+                            const float s14i = xi[1][b] + xi[4][b];
+                            const float s23r = xr[2][b] + xr[3][b];
+                            const float s23i = xi[2][b] + xi[3][b];
+                            const float d14r = xr[1][b] - xr[4][b];
+                            const float d14i = xi[1][b] - xi[4][b];
+                            const float d23r = xr[2][b] - xr[3][b];
+                            const float d23i = xi[2][b] - xi[3][b];
+
+                            const float t1r = xr[0][b] + c1*s14r + c2*s23r;
+                            const float t1i = xi[0][b] + c1*s14i + c2*s23i;
+                            const float t2r = xr[0][b] + c2*s14r + c1*s23r;
+                            const float t2i = xi[0][b] + c2*s14i + c1*s23i;
+
+                            const float u1r = s1*d14r + s2*d23r;
+                            const float u1i = s1*d14i + s2*d23i;
+                            const float u2r = s2*d14r - s1*d23r;
+                            const float u2i = s2*d14i - s1*d23i;
+
+                            dr[0][b] = xr[0][b] + s14r + s23r;
+                            di[0][b] = xi[0][b] + s14i + s23i;
+                            // t -/+ i*u
+                            dr[1][b] = t1r + u1i;
+                            di[1][b] = t1i - u1r;
+                            dr[4][b] = t1r - u1i;
+                            di[4][b] = t1i + u1r;
+                            dr[2][b] = t2r + u2i;
+                            di[2][b] = t2i - u2r;
+                            dr[3][b] = t2r - u2i;
+                            di[3][b] = t2i + u2r;
+                        }
+                    } break;
+                default:
+                    GGML_ABORT("unsupported radix");
+            }
+        }
     }
 }
 
-// Cooley-Tukey FFT
-// poor man's implementation - use something better
-// input is real-valued
-// output is complex-valued
-static void fft(float* in, int N, float* out) {
-    if (N == 1) {
-        out[0] = in[0];
-        out[1] = 0;
-        return;
-    }
+// power spectrum of WHISPER_FFT_BATCH real frames
+// input : re/im - the even/odd samples of the frames, [m][WHISPER_FFT_BATCH], overwritten
+// output: power - |X[k]|^2 for k in [0, m], [m + 1][WHISPER_FFT_BATCH]
+static void whisper_rfft_power(const whisper_rfft_plan & plan, float * re, float * im, float * tmp_re, float * tmp_im, float * power) {
+    constexpr int B = WHISPER_FFT_BATCH;
 
-    const int half_N = N / 2;
-    if (N - half_N*2 == 1) {
-        dft(in, N, out);
-        return;
-    }
+    const int m = plan.m;
 
-    float* even = in + N;
-    for (int i = 0; i < half_N; ++i) {
-        even[i]= in[2*i];
-    }
-    float* even_fft = out + 2 * N;
-    fft(even, half_N, even_fft);
+    float * ar = re;
+    float * ai = im;
+    float * br = tmp_re;
+    float * bi = tmp_im;
 
-    float* odd = even;
-    for (int i = 0; i < half_N; ++i) {
-        odd[i] = in[2*i + 1];
+    for (const auto & st : plan.stages) {
+        whisper_fft_stage(st, m, ar, ai, br, bi);
+        std::swap(ar, br);
+        std::swap(ai, bi);
     }
-    float* odd_fft = even_fft + N;
-    fft(odd, half_N, odd_fft);
 
-    const int sin_cos_step = SIN_COS_N_COUNT / N;
-    for (int k = 0; k < half_N; k++) {
-        int idx = k * sin_cos_step; // t = 2*M_PI*k/N
-        float re = global_cache.cos_vals[idx]; // cos(t)
-        float im = -global_cache.sin_vals[idx]; // sin(t)
+    // split step: X[k] = (Z[k] + conj(Z[m-k]))/2 - i*W_n^k*(Z[k] - conj(Z[m-k]))/2
+    for (int k = 0; k <= m; ++k) {
+        const float * zr = ar + (k % m)*B;
+        const float * zi = ai + (k % m)*B;
+        const float * yr = ar + ((m - k) % m)*B;
+        const float * yi = ai + ((m - k) % m)*B;
+
+        const float wr = plan.split_re[k];
+        const float wi = plan.split_im[k];
 
-        float re_odd = odd_fft[2*k + 0];
-        float im_odd = odd_fft[2*k + 1];
+        for (int b = 0; b < B; ++b) {
+            const float er = 0.5f*(zr[b] + yr[b]);
+            const float ei = 0.5f*(zi[b] - yi[b]);
+            const float or_ =  0.5f*(zi[b] + yi[b]);
+            const float oi  = -0.5f*(zr[b] - yr[b]);
 
-        out[2*k + 0] = even_fft[2*k + 0] + re*re_odd - im*im_odd;
-        out[2*k + 1] = even_fft[2*k + 1] + re*im_odd + im*re_odd;
+            const float xr = er + wr*or_ - wi*oi;
+            const float xi = ei + wr*oi  + wi*or_;
+
+            power[k*B + b] = xr*xr + xi*xi;
+        }
+    }
+}
 
-        out[2*(k + half_N) + 0] = even_fft[2*k + 0] - re*re_odd + im*im_odd;
-        out[2*(k + half_N) + 1] = even_fft[2*k + 1] - re*im_odd - im*re_odd;
+// the mel filters are mostly zero - returns [n_mel][2], the range of the non-zero coefficients of each filter
+static std::vector<int> whisper_mel_filter_range(const whisper_filters & filters, int n_mel) {
+    std::vector<int> filter_range(2*n_mel);
+    for (int j = 0; j < n_mel; j++) {
+        int k0 = 0;
+        int k1 = filters.n_fft;
+        while (k0 < k1 && filters.data[j*filters.n_fft + k0]     == 0.0f) k0++;
+        while (k1 > k0 && filters.data[j*filters.n_fft + k1 - 1] == 0.0f) k1--;
+        filter_range[2*j + 0] = k0;
+        filter_range[2*j + 1] = k1;
     }
+
+    return filter_range;
 }
 
-static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const std::vector<float> & samples,
+// filter_range: [n_mel][2] - the range of the non-zero coefficients of each mel filter
+static void log_mel_spectrogram_worker_thread(int ith, const float * hann, const float * samples,
                                               int n_samples, int frame_size, int frame_step, int n_threads,
-                                              const whisper_filters & filters, whisper_mel & mel) {
-    std::vector<float> fft_in(frame_size * 2, 0.0);
-    std::vector<float> fft_out(frame_size * 2 * 2 * 2);
+                                              const whisper_filters & filters, const std::vector<int> & filter_range,
+                                              whisper_mel & mel) {
+    constexpr int B = WHISPER_FFT_BATCH;
+
+    const whisper_rfft_plan & plan = global_cache.rfft;
 
-    int n_fft = filters.n_fft;
-    int i = ith;
+    const int n_fft = filters.n_fft;
+    const int m     = plan.m;
 
     // make sure n_fft == 1 + (WHISPER_N_FFT / 2), bin_0 to bin_nyquist
     assert(n_fft == 1 + (frame_size / 2));
+    assert(plan.n == frame_size);
 
-    // calculate FFT only when fft_in are not all zero
-    for (; i < std::min(n_samples / frame_step + 1, mel.n_len); i += n_threads) {
-        const int offset = i * frame_step;
+    std::vector<float> fft_buf(4*m*B);
+    std::vector<float> power(n_fft*B);
 
-        // apply Hann window (~10% faster)
-        for (int j = 0; j < std::min(frame_size, n_samples - offset); j++) {
-            fft_in[j] = hann[j] * samples[offset + j];
-        }
+    float * re     = fft_buf.data();
+    float * im     = re + m*B;
+    float * tmp_re = im + m*B;
+    float * tmp_im = tmp_re + m*B;
 
-        // fill the rest with zeros
-        if (n_samples - offset < frame_size) {
-            std::fill(fft_in.begin() + (n_samples - offset), fft_in.end(), 0.0);
-        }
+    // calculate FFT only when fft_in are not all zero
+    const int n_frames = std::min(n_samples / frame_step + 1, mel.n_len);
 
-        // FFT
-        fft(fft_in.data(), frame_size, fft_out.data());
+    for (int i0 = ith*B; i0 < n_frames; i0 += n_threads*B) {
+        const int nb = std::min(B, n_frames - i0);
 
-        // Calculate modulus^2 of complex numbers
-        // Use pow(fft_out[2 * j + 0], 2) + pow(fft_out[2 * j + 1], 2) causes inference quality problem? Interesting.
-        for (int j = 0; j < n_fft; j++) {
-            fft_out[j] = (fft_out[2 * j + 0] * fft_out[2 * j + 0] + fft_out[2 * j + 1] * fft_out[2 * j + 1]);
+        // apply Hann window and pack the even/odd samples into the real/imaginary parts
+        for (int b = 0; b < B; ++b) {
+            const int offset = (i0 + b) * frame_step;
+            const int n      = b < nb ? std::min(frame_size, n_samples - offset) : 0;
+
+            for (int j = 0; j < m; ++j) {
+                re[j*B + b] = 2*j + 0 < n ? hann[2*j + 0] * samples[offset + 2*j + 0] : 0.0f;
+                im[j*B + b] = 2*j + 1 < n ? hann[2*j + 1] * samples[offset + 2*j + 1] : 0.0f;
+            }
         }
 
-        // mel spectrogram
+        whisper_rfft_power(plan, re, im, tmp_re, tmp_im, power.data());
+
+        // mel spectrogram - [n_mel][n_fft] x [n_fft][B] with the zero coefficients of the filters skipped
         for (int j = 0; j < mel.n_mel; j++) {
-            double sum = 0.0;
-            // unroll loop (suggested by GH user @lunixbochs)
-            int k = 0;
-            for (k = 0; k < n_fft - 3; k += 4) {
-                sum +=
-                        fft_out[k + 0] * filters.data[j * n_fft + k + 0] +
-                        fft_out[k + 1] * filters.data[j * n_fft + k + 1] +
-                        fft_out[k + 2] * filters.data[j * n_fft + k + 2] +
-                        fft_out[k + 3] * filters.data[j * n_fft + k + 3];
-            }
-            // handle n_fft remainder
-            for (; k < n_fft; k++) {
-                sum += fft_out[k] * filters.data[j * n_fft + k];
-            }
-            sum = log10(std::max(sum, 1e-10));
-            mel.data[j * mel.n_len + i] = sum;
+            double sum[B] = { 0.0 };
+
+            const float * f = filters.data.data() + j*n_fft;
+
+            for (int k = filter_range[2*j + 0]; k < filter_range[2*j + 1]; k++) {
+                for (int b = 0; b < B; ++b) {
+                    sum[b] += power[k*B + b] * f[k];
+                }
+            }
+
+            for (int b = 0; b < nb; ++b) {
+                mel.data[j * mel.n_len + i0 + b] = log10(std::max(sum[b], 1e-10));
+            }
         }
     }
 
     // Otherwise fft_out are all zero
     double sum = log10(1e-10);
-    for (; i < mel.n_len; i += n_threads) {
+    for (int i = n_frames + ith; i < mel.n_len; i += n_threads) {
         for (int j = 0; j < mel.n_mel; j++) {
             mel.data[j * mel.n_len + i] = sum;
         }
@@ -3224,17 +4279,19 @@ static bool log_mel_spectrogram(
     mel.n_len_org = 1 + (n_samples + stage_2_pad - frame_size) / frame_step;
     mel.data.resize(mel.n_mel * mel.n_len);
 
+    const std::vector<int> filter_range = whisper_mel_filter_range(filters, n_mel);
+
     {
         std::vector<std::thread> workers(n_threads - 1);
         for (int iw = 0; iw < n_threads - 1; ++iw) {
             workers[iw] = std::thread(
-                    log_mel_spectrogram_worker_thread, iw + 1, hann, std::cref(samples_padded),
+                    log_mel_spectrogram_worker_thread, iw + 1, hann, samples_padded.data(),
                     n_samples + stage_2_pad, frame_size, frame_step, n_threads,
-                    std::cref(filters), std::ref(mel));
+                    std::cref(filters), std::cref(filter_range), std::ref(mel));
         }
 
         // main thread
-        log_mel_spectrogram_worker_thread(0, hann, samples_padded, n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, mel);
+        log_mel_spectrogram_worker_thread(0, hann, samples_padded.data(), n_samples + stage_2_pad, frame_size, frame_step, n_threads, filters, filter_range, mel);
 
         for (int iw = 0; iw < n_threads - 1; ++iw) {
             workers[iw].join();
@@ -3275,6 +4332,34 @@ static bool log_mel_spectrogram(
     return true;
 }
 
+// raw log10 mel spectrogram of the frames [i0, i1), zero-padding past the end of the audio - dst: [i1 - i0][n_mel]
+// pcm starts at the first sample of the window of frame 0, i.e. it is preceded by WHISPER_N_FFT/2 samples of padding
+static void whisper_compute_mel_frames(
+        const whisper_filters & filters,
+     const std::vector<int> & filter_range,
+                  const float * pcm,
+                          int   n_pcm,
+                          int   i0,
+                          int   i1,
+                        float * dst) {
+    whisper_mel mel;
+    mel.n_mel     = filters.n_mel;
+    mel.n_len     = i1 - i0;
+    mel.n_len_org = i1 - i0;
+    mel.data.resize(mel.n_mel*mel.n_len);
+
+    const int offset = i0*WHISPER_HOP_LENGTH;
+
+    log_mel_spectrogram_worker_thread(0, global_cache.hann_window, pcm + offset,
+            n_pcm - offset, WHISPER_N_FFT, WHISPER_HOP_LENGTH, 1, filters, filter_range, mel);
+
+    for (int i = 0; i < mel.n_len; ++i) {
+        for (int j = 0; j < mel.n_mel; ++j) {
+            dst[i*mel.n_mel + j] = mel.data[j*mel.n_len + i];
+        }
+    }
+}
+
 // split text into tokens
 //
 // ref: https://github.com/openai/gpt-2/blob/a74da5d99abaaba920de8131d64da2862a8f213b/src/encoder.py#L53
@@ -3633,10 +4718,14 @@ struct whisper_context_params whisper_context_default_params() {
             /*.heads            =*/ NULL,
         },
         /*.dtw_mem_size         =*/ 1024*1024*128,
+
+        /*.use_mmap             =*/ true,
     };
     return result;
 }
 
+static struct whisper_context * whisper_init_no_state_impl(struct whisper_model_loader * loader, const char * path_gguf, struct whisper_context_params params);
+
 struct whisper_context * whisper_init_from_file_with_params_no_state(const char * path_model, struct whisper_context_params params) {
     WHISPER_LOG_INFO("%s: loading model from '%s'\n", __func__, path_model);
 #ifdef _MSC_VER
@@ -3652,6 +4741,27 @@ struct whisper_context * whisper_init_from_file_with_params_no_state(const char
         return nullptr;
     }
 
+    // GGUF files are loaded through gguf_init_from_file() and optionally mapped in memory
+    {
+        char magic[4] = { 0 };
+        fin.read(magic, sizeof(magic));
+
+        if (fin && memcmp(magic, GGUF_MAGIC, sizeof(magic)) == 0) {
+            fin.close();
+
+            auto ctx = whisper_init_no_state_impl(nullptr, path_model, params);
+
+            if (ctx) {
+                ctx->path_model = path_model;
+            }
+
+            return ctx;
+        }
+
+        fin.clear();
+        fin.seekg(0);
+    }
+
     whisper_model_loader loader = {};
 
     loader.context = &fin;
@@ -3719,6 +4829,10 @@ struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * bu
 }
 
 struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_loader * loader, struct whisper_context_params params) {
+    return whisper_init_no_state_impl(loader, nullptr, params);
+}
+
+static struct whisper_context * whisper_init_no_state_impl(struct whisper_model_loader * loader, const char * path_gguf, struct whisper_context_params params) {
     ggml_time_init();
 
     if (params.flash_attn && params.dtw_token_timestamps) {
@@ -3729,6 +4843,7 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
     WHISPER_LOG_INFO("%s: use gpu    = %d\n", __func__, params.use_gpu);
     WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
     WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
+    WHISPER_LOG_INFO("%s: use mmap   = %d\n", __func__, params.use_mmap);
     WHISPER_LOG_INFO("%s: dtw        = %d\n", __func__, params.dtw_token_timestamps);
     WHISPER_LOG_INFO("%s: devices    = %zu\n", __func__, ggml_backend_dev_count());
     WHISPER_LOG_INFO("%s: backends   = %zu\n", __func__, ggml_backend_reg_count());
@@ -3736,15 +4851,18 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
     whisper_context * ctx = new whisper_context;
     ctx->params = params;
 
-    if (!whisper_model_load(loader, *ctx)) {
+    const bool ok = path_gguf ? whisper_model_load_gguf(path_gguf, *ctx) : whisper_model_load(loader, *ctx);
+
+    if (loader) {
         loader->close(loader->context);
+    }
+
+    if (!ok) {
         WHISPER_LOG_ERROR("%s: failed to load model\n", __func__);
         delete ctx;
         return nullptr;
     }
 
-    loader->close(loader->context);
-
     return ctx;
 }
 
@@ -3843,6 +4961,7 @@ void whisper_free_state(struct whisper_state * state) {
         ggml_backend_sched_free(state->sched_encode.sched);
         ggml_backend_sched_free(state->sched_cross.sched);
         ggml_backend_sched_free(state->sched_decode.sched);
+        ggml_backend_sched_free(state->sched_encode_batch.sched);
 
         for (auto & backend : state->backends) {
             ggml_backend_free(backend);
@@ -3856,6 +4975,11 @@ void whisper_free_state(struct whisper_state * state) {
             state->vad_context = nullptr;
         }
 
+        if (state->draft_state != nullptr) {
+            whisper_free_state(state->draft_state);
+            state->draft_state = nullptr;
+        }
+
         delete state;
     }
 }
@@ -3894,6 +5018,8 @@ int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_s
         return -1;
     }
 
+    state->encoded_offset = -1;
+
     return 0;
 }
 
@@ -3919,6 +5045,8 @@ int whisper_set_mel_with_state(
     state->mel.data.resize(n_len*n_mel);
     memcpy(state->mel.data.data(), data, n_len*n_mel*sizeof(float));
 
+    state->encoded_offset = -1;
+
     return 0;
 }
 
@@ -3948,14 +5076,51 @@ int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
     return 0;
 }
 
-int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
-    whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
+int whisper_encode_batch(struct whisper_context * ctx, struct whisper_state ** states, const int * offsets, int n_states, int n_threads) {
+    if (n_states <= 0) {
+        return 0;
+    }
 
-    whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+    const int n_ctx = states[0]->exp_n_audio_ctx;
 
-    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
-        return 1;
+    for (int i = 1; i < n_states; ++i) {
+        if (states[i]->exp_n_audio_ctx != n_ctx) {
+            WHISPER_LOG_ERROR("%s: all states must use the same audio context\n", __func__);
+            return -1;
+        }
+    }
+
+    for (int i0 = 0; i0 < n_states; i0 += WHISPER_MAX_ENCODE_BATCH) {
+        const int n_batch = std::min(n_states - i0, WHISPER_MAX_ENCODE_BATCH);
+
+        // the external encoders process one window at a time
+        if (n_batch == 1 || whisper_encode_external(*states[i0])) {
+            for (int i = i0; i < i0 + n_batch; ++i) {
+                if (!whisper_encode_internal(*ctx, *states[i], offsets[i], n_threads, nullptr, nullptr)) {
+                    WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+                    return -1;
+                }
+            }
+            continue;
+        }
+
+        if (!whisper_encode_batch_internal(*ctx, states + i0, offsets + i0, n_batch, n_threads)) {
+            WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
+    whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
+
+    whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+
+    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false, nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return 1;
     }
 
     return 0;
@@ -4053,7 +5218,7 @@ int whisper_lang_auto_detect_with_state(
     }
 
     // run the encoder
-    if (whisper_encode_with_state(ctx, state, seek, n_threads) != 0) {
+    if (!whisper_encode_cached(*ctx, *state, seek, n_threads, nullptr, nullptr)) {
         WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
         return -6;
     }
@@ -4291,6 +5456,10 @@ void whisper_print_timings(struct whisper_context * ctx) {
         WHISPER_LOG_INFO("%s:   decode time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_decode_us, n_decode, 1e-3f * ctx->state->t_decode_us / n_decode);
         WHISPER_LOG_INFO("%s:   batchd time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_batchd_us, n_batchd, 1e-3f * ctx->state->t_batchd_us / n_batchd);
         WHISPER_LOG_INFO("%s:   prompt time = %8.2f ms / %5d runs ( %8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_prompt_us, n_prompt, 1e-3f * ctx->state->t_prompt_us / n_prompt);
+        if (ctx->state->n_draft > 0) {
+            WHISPER_LOG_INFO("%s:    draft time = %8.2f ms / %5d tokens, %5d accepted ( %6.2f %%)\n", __func__, 1e-3f * ctx->state->t_draft_us,
+                    ctx->state->n_draft, ctx->state->n_draft_accepted, 100.0f * ctx->state->n_draft_accepted / ctx->state->n_draft);
+        }
     }
     WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
 }
@@ -4309,6 +5478,9 @@ void whisper_reset_timings(struct whisper_context * ctx) {
         ctx->state->n_decode = 0;
         ctx->state->n_batchd = 0;
         ctx->state->n_prompt = 0;
+        ctx->state->t_draft_us = 0;
+        ctx->state->n_draft = 0;
+        ctx->state->n_draft_accepted = 0;
     }
 }
 
@@ -4422,24 +5594,35 @@ struct whisper_vad_segments {
     std::vector<whisper_vad_segment> data;
 };
 
+// max number of VAD windows evaluated by a single graph
+#define WHISPER_VAD_MAX_BATCH 256
+
 struct whisper_vad_context {
     int64_t t_vad_us = 0;
 
     int     n_window;
     int     n_context;
     int     n_threads;
+    int     n_batch;
 
     std::vector<ggml_backend_t> backends;
-    ggml_backend_buffer_t       buffer = nullptr;
     whisper_context_params      params;
-    std::vector<uint8_t>        ctx_buf;
     whisper_sched               sched;
 
     whisper_vad_model    model;
     std::string          path_model;
-    struct ggml_tensor * h_state;
-    struct ggml_tensor * c_state;
     std::vector<float>   probs;
+
+    // the LSTM recurrence is evaluated on the host - the graph computes the input gates of a whole batch of windows
+    std::vector<float> lstm_hh_t;    // [n_hidden][4*n_hidden] transposed hidden-to-hidden weights
+    std::vector<float> final_conv_w; // [n_hidden]
+    float              final_conv_b = 0.0f;
+
+    std::vector<float> h_state;
+    std::vector<float> c_state;
+
+    std::vector<float> gates;   // [n_batch][4*n_hidden]
+    std::vector<float> pending; // streaming: samples of the incomplete window
 };
 
 struct whisper_vad_context_params whisper_vad_default_context_params(void) {
@@ -4531,20 +5714,42 @@ static ggml_backend_buffer_type_t select_weight_buft(const whisper_vad_hparams &
     return nullptr;
 }
 
+// 1D convolution of a batch of inputs with the channels in the first dimension: [IC, IL, N] -> [OC, OL, N]
+// (ggml_conv_1d() supports only a single input and produces rows of OL elements, which are slow for the element-wise ops)
+static ggml_tensor * whisper_vad_conv_1d(ggml_context * ctx0, ggml_tensor * a, ggml_tensor * b, int s0, int p0) {
+    // im2col expects the samples in the first dimension
+    if (b->ne[0] == 1) {
+        b = ggml_reshape_3d(ctx0, b, b->ne[1], 1, b->ne[2]);
+    } else {
+        b = ggml_cont(ctx0, ggml_permute(ctx0, b, 1, 0, 2, 3));
+    }
+
+    ggml_tensor * im2col = ggml_im2col(ctx0, a, b, s0, 0, p0, 0, 1, 0, false, GGML_TYPE_F16); // [IC*K, OL, N]
+
+    ggml_tensor * cur = ggml_mul_mat(ctx0,
+            ggml_reshape_2d(ctx0, a, a->ne[0]*a->ne[1], a->ne[2]),
+            ggml_reshape_2d(ctx0, im2col, im2col->ne[0], im2col->ne[1]*im2col->ne[2])); // [OC, OL*N]
+
+    return ggml_reshape_3d(ctx0, cur, cur->ne[0], im2col->ne[1], im2col->ne[2]);
+}
+
 static ggml_tensor * whisper_vad_build_stft_layer(ggml_context * ctx0,
         const whisper_vad_model & model, ggml_tensor * cur) {
     // Apply reflective padding to the input tensor
     ggml_tensor * padded = ggml_pad_reflect_1d(ctx0, cur, 64, 64);
 
-    struct ggml_tensor * stft = ggml_conv_1d(ctx0, model.stft_forward_basis, padded, model.hparams.lstm_input_size, 0, 1);
+    // [n_samples, n_batch] -> [1, n_samples, n_batch] - each window is a separate batch of the convolution
+    padded = ggml_reshape_3d(ctx0, padded, 1, padded->ne[0], padded->ne[1]);
+
+    struct ggml_tensor * stft = whisper_vad_conv_1d(ctx0, model.stft_forward_basis, padded, model.hparams.lstm_input_size, 0);
 
     // Calculate cutoff for real/imaginary parts
     int cutoff = model.stft_forward_basis->ne[2] / 2;
 
     // Extract real part (first half of the STFT output).
-    struct ggml_tensor * real_part = ggml_view_2d(ctx0, stft, 4, cutoff, stft->nb[1], 0);
+    struct ggml_tensor * real_part = ggml_view_3d(ctx0, stft, cutoff, stft->ne[1], stft->ne[2], stft->nb[1], stft->nb[2], 0);
     // Extract imaginary part (second half of the STFT output).
-    struct ggml_tensor * img_part = ggml_view_2d(ctx0, stft, 4, cutoff, stft->nb[1], cutoff * stft->nb[1]);
+    struct ggml_tensor * img_part = ggml_view_3d(ctx0, stft, cutoff, stft->ne[1], stft->ne[2], stft->nb[1], stft->nb[2], cutoff * stft->nb[0]);
 
     // Calculate magnitude: sqrt(real^2 + imag^2)
     struct ggml_tensor * real_squared = ggml_mul(ctx0, real_part, real_part);
@@ -4557,74 +5762,34 @@ static ggml_tensor * whisper_vad_build_stft_layer(ggml_context * ctx0,
 static ggml_tensor * whisper_vad_build_encoder_layer(ggml_context * ctx0,
         const whisper_vad_model & model, ggml_tensor * cur) {
     // First Conv1D: expands to 128 channels.
-    cur = ggml_conv_1d(ctx0, model.encoder_0_weight, cur, 1, 1, 1);
-    cur = ggml_add(ctx0, cur, ggml_reshape_3d(ctx0, model.encoder_0_bias, 1, 128, 1));
+    cur = whisper_vad_conv_1d(ctx0, model.encoder_0_weight, cur, 1, 1);
+    cur = ggml_add(ctx0, cur, model.encoder_0_bias);
     cur = ggml_relu(ctx0, cur);
 
     // Second Conv1D: reduces to 64 channels.
-    cur = ggml_conv_1d(ctx0, model.encoder_1_weight, cur, 2, 1, 1);
-    cur = ggml_add(ctx0, cur, ggml_reshape_3d(ctx0, model.encoder_1_bias, 1, 64, 1));
+    cur = whisper_vad_conv_1d(ctx0, model.encoder_1_weight, cur, 2, 1);
+    cur = ggml_add(ctx0, cur, model.encoder_1_bias);
     cur = ggml_relu(ctx0, cur);
 
     // Third Conv1D: maintains 64 channels
-    cur = ggml_conv_1d(ctx0, model.encoder_2_weight, cur, 2, 1, 1);
-    cur = ggml_add(ctx0, cur, ggml_reshape_3d(ctx0, model.encoder_2_bias, 1, 64, 1));
+    cur = whisper_vad_conv_1d(ctx0, model.encoder_2_weight, cur, 2, 1);
+    cur = ggml_add(ctx0, cur, model.encoder_2_bias);
     cur = ggml_relu(ctx0, cur);
 
     // Fourth Conv1D: expands to 128 channels
-    cur = ggml_conv_1d(ctx0, model.encoder_3_weight, cur, 1, 1, 1);
-    cur = ggml_add(ctx0, cur, ggml_reshape_3d(ctx0, model.encoder_3_bias, 1, 128, 1));
+    cur = whisper_vad_conv_1d(ctx0, model.encoder_3_weight, cur, 1, 1);
+    cur = ggml_add(ctx0, cur, model.encoder_3_bias);
     cur = ggml_relu(ctx0, cur);
 
     return cur;
 }
 
-static ggml_tensor * whisper_vad_build_lstm_layer(ggml_context * ctx0,
-        const whisper_vad_context & vctx, ggml_tensor * cur, ggml_cgraph * gf) {
-    const whisper_vad_model & model = vctx.model;
-    const int hdim = model.hparams.lstm_hidden_size;
-
-    struct ggml_tensor * x_t = ggml_transpose(ctx0, cur);
-
-    // Create operations using the input-to-hidden weights.
-    struct ggml_tensor * inp_gate = ggml_mul_mat(ctx0, model.lstm_ih_weight, x_t);
-    inp_gate = ggml_add(ctx0, inp_gate, model.lstm_ih_bias);
-
-    // Create operations using the hidden-to-hidden weights.
-    struct ggml_tensor * hid_gate = ggml_mul_mat(ctx0, model.lstm_hh_weight, vctx.h_state);
-    hid_gate = ggml_add(ctx0, hid_gate, model.lstm_hh_bias);
-
-    // Create add operation to get preactivations for all gates.
-    struct ggml_tensor * out_gate = ggml_add(ctx0, inp_gate, hid_gate);
-
-    const size_t hdim_size = ggml_row_size(out_gate->type, hdim);
-
-    // Create sigmoid for input gate (using the first 128 bytes from the preactivations).
-    struct ggml_tensor * i_t = ggml_sigmoid(ctx0, ggml_view_1d(ctx0, out_gate, hdim, 0 * hdim_size));
-
-    // Create sigmoid for the forget gate (using the second 128 bytes from the preactivations).
-    struct ggml_tensor * f_t = ggml_sigmoid(ctx0, ggml_view_1d(ctx0, out_gate, hdim, 1 * hdim_size));
-
-    // Create sigmoid for the cell gate (using the third 128 bytes from the preactivations).
-    struct ggml_tensor * g_t = ggml_tanh(ctx0, ggml_view_1d(ctx0, out_gate, hdim, 2 * hdim_size));
-
-    // Create sigmoid for the output gate (using the fourth 128 bytes from the preactivations).
-    struct ggml_tensor * o_t = ggml_sigmoid(ctx0, ggml_view_1d(ctx0, out_gate, hdim, 3 * hdim_size));
-
-    // Update cell state
-    struct ggml_tensor * c_out = ggml_add(ctx0,
-        ggml_mul(ctx0, f_t, vctx.c_state),
-        ggml_mul(ctx0, i_t, g_t));
-    ggml_build_forward_expand(gf, ggml_cpy(ctx0, c_out, vctx.c_state));
-
-    // Update hidden state
-    struct ggml_tensor * out = ggml_mul(ctx0, o_t, ggml_tanh(ctx0, c_out));
-    ggml_build_forward_expand(gf, ggml_cpy(ctx0, out,   vctx.h_state));
-
-    return out;
-}
-
-static struct ggml_cgraph * whisper_vad_build_graph(whisper_vad_context & vctx) {
+// computes the LSTM gate pre-activations from the input of n_batch consecutive windows:
+//
+//   gates = W_ih*x + b_ih + b_hh
+//
+// the recurrent part depends on the previous window and is evaluated on the host by whisper_vad_lstm_step()
+static struct ggml_cgraph * whisper_vad_build_graph(whisper_vad_context & vctx, int n_batch) {
     const auto & model = vctx.model;
 
     struct ggml_init_params params = {
@@ -4637,26 +5802,24 @@ static struct ggml_cgraph * whisper_vad_build_graph(whisper_vad_context & vctx)
 
     ggml_cgraph * gf = ggml_new_graph(ctx0);
 
-    struct ggml_tensor * frame = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, vctx.n_window, 1);
-    ggml_set_name(frame, "frame");
-    ggml_set_input(frame);
+    struct ggml_tensor * frames = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, vctx.n_window, n_batch);
+    ggml_set_name(frames, "frames");
+    ggml_set_input(frames);
 
     struct ggml_tensor * cur = nullptr;
     {
-        cur = whisper_vad_build_stft_layer(ctx0, model, frame);
+        cur = whisper_vad_build_stft_layer(ctx0, model, frames);
 
         cur = whisper_vad_build_encoder_layer(ctx0, model, cur);
 
-        // Extract the first element of the first dimension
-        // (equivalent to pytorch's [:, :, 0])
-        cur = ggml_view_2d(ctx0, cur, 1, 128, cur->nb[1], 0);
+        // the encoder produces a single frame per window (equivalent to pytorch's [:, :, 0])
+        GGML_ASSERT(cur->ne[1] == 1);
+        cur = ggml_reshape_2d(ctx0, cur, cur->ne[0], cur->ne[2]);
 
-        cur = whisper_vad_build_lstm_layer(ctx0, vctx, cur, gf);
-        cur = ggml_relu(ctx0, cur);
-        cur = ggml_conv_1d(ctx0, model.final_conv_weight, cur, 1, 0, 1);
-        cur = ggml_add(ctx0, cur, model.final_conv_bias);
-        cur = ggml_sigmoid(ctx0, cur);
-        ggml_set_name(cur, "prob");
+        cur = ggml_mul_mat(ctx0, model.lstm_ih_weight, cur);
+        cur = ggml_add(ctx0, cur, model.lstm_ih_bias);
+        cur = ggml_add(ctx0, cur, model.lstm_hh_bias);
+        ggml_set_name(cur, "gates");
         ggml_set_output(cur);
     }
 
@@ -4667,6 +5830,104 @@ static struct ggml_cgraph * whisper_vad_build_graph(whisper_vad_context & vctx)
     return gf;
 }
 
+static inline float whisper_vad_sigmoid(float x) {
+    return 1.0f / (1.0f + expf(-x));
+}
+
+// advances the LSTM by one window and returns the speech probability
+// gates: the input gate pre-activations of the window (i, f, g, o), modified in place
+static float whisper_vad_lstm_step(whisper_vad_context & vctx, float * gates) {
+    const int n_hidden = vctx.model.hparams.lstm_hidden_size;
+    const int n_gates  = 4*n_hidden;
+
+    float * h = vctx.h_state.data();
+    float * c = vctx.c_state.data();
+
+    // gates += W_hh*h
+    for (int j = 0; j < n_hidden; ++j) {
+        const float hj = h[j];
+        if (hj == 0.0f) {
+            continue;
+        }
+        const float * w = vctx.lstm_hh_t.data() + (size_t) j*n_gates;
+        for (int k = 0; k < n_gates; ++k) {
+            gates[k] += hj*w[k];
+        }
+    }
+
+    float sum = vctx.final_conv_b;
+
+    for (int k = 0; k < n_hidden; ++k) {
+        const float i_t = whisper_vad_sigmoid(gates[0*n_hidden + k]);
+        const float f_t = whisper_vad_sigmoid(gates[1*n_hidden + k]);
+        const float g_t = tanhf              (gates[2*n_hidden + k]);
+        const float o_t = whisper_vad_sigmoid(gates[3*n_hidden + k]);
+
+        c[k] = f_t*c[k] + i_t*g_t;
+        h[k] = o_t*tanhf(c[k]);
+
+        // relu + final conv
+        sum += vctx.final_conv_w[k]*std::max(h[k], 0.0f);
+    }
+
+    return whisper_vad_sigmoid(sum);
+}
+
+// evaluates n_windows consecutive windows of n_window samples, carrying the LSTM state across the windows
+static bool whisper_vad_eval(whisper_vad_context & vctx, const float * samples, int n_windows, float * probs) {
+    const int n_gates = 4*vctx.model.hparams.lstm_hidden_size;
+
+    auto & sched = vctx.sched.sched;
+
+    const int64_t t_start_vad_us = ggml_time_us();
+
+    ggml_cgraph * gf = nullptr;
+    int n_cur = 0;
+
+    bool ok = true;
+
+    for (int i0 = 0; i0 < n_windows; i0 += vctx.n_batch) {
+        const int n_batch = std::min(vctx.n_batch, n_windows - i0);
+
+        // the graph is reused for all full batches - only the last batch needs a new one
+        if (n_batch != n_cur) {
+            ggml_backend_sched_reset(sched);
+
+            gf = whisper_vad_build_graph(vctx, n_batch);
+            if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+                WHISPER_LOG_ERROR("%s: failed to allocate the compute buffer\n", __func__);
+                ok = false;
+                break;
+            }
+
+            n_cur = n_batch;
+        }
+
+        struct ggml_tensor * frames = ggml_graph_get_tensor(gf, "frames");
+        struct ggml_tensor * gates  = ggml_graph_get_tensor(gf, "gates");
+
+        ggml_backend_tensor_set(frames, samples + (size_t) i0*vctx.n_window, 0, ggml_nbytes(frames));
+
+        if (!ggml_graph_compute_helper(sched, gf, vctx.n_threads, false)) {
+            WHISPER_LOG_ERROR("%s: failed to compute VAD graph\n", __func__);
+            ok = false;
+            break;
+        }
+
+        ggml_backend_tensor_get(gates, vctx.gates.data(), 0, ggml_nbytes(gates));
+
+        for (int i = 0; i < n_batch; ++i) {
+            probs[i0 + i] = whisper_vad_lstm_step(vctx, vctx.gates.data() + (size_t) i*n_gates);
+        }
+    }
+
+    ggml_backend_sched_reset(sched);
+
+    vctx.t_vad_us += ggml_time_us() - t_start_vad_us;
+
+    return ok;
+}
+
 static bool whisper_vad_init_context(whisper_vad_context * vctx) {
 
     auto whisper_context_params = whisper_context_default_params();
@@ -4681,40 +5942,51 @@ static bool whisper_vad_init_context(whisper_vad_context * vctx) {
         return false;
     }
 
-    const int32_t lstm_hidden_size = vctx->model.hparams.lstm_hidden_size;
+    const auto & model = vctx->model;
 
-    vctx->ctx_buf.resize(2u*ggml_tensor_overhead());
+    const int32_t n_hidden = model.hparams.lstm_hidden_size;
+    const int32_t n_gates  = 4*n_hidden;
 
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ vctx->ctx_buf.size(),
-        /*.mem_buffer =*/ vctx->ctx_buf.data(),
-        /*.no_alloc   =*/ true,
-    };
-
-    ggml_context * ctx = ggml_init(params);
-    if (!ctx) {
-        WHISPER_LOG_ERROR("%s: failed to init LSTM state ggml context\n", __func__);
+    if (model.lstm_hh_weight->type != GGML_TYPE_F32 || model.final_conv_bias->type != GGML_TYPE_F32 ||
+        (model.final_conv_weight->type != GGML_TYPE_F32 && model.final_conv_weight->type != GGML_TYPE_F16)) {
+        WHISPER_LOG_ERROR("%s: unsupported LSTM weight types\n", __func__);
         return false;
     }
 
-    // LSTM Hidden state
-    vctx->h_state = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, lstm_hidden_size);
-    ggml_set_name(vctx->h_state, "h_state");
+    // host copies of the weights used by the LSTM recurrence
+    {
+        std::vector<float> w_hh(ggml_nelements(model.lstm_hh_weight));
+        ggml_backend_tensor_get(model.lstm_hh_weight, w_hh.data(), 0, ggml_nbytes(model.lstm_hh_weight));
+
+        vctx->lstm_hh_t.resize(w_hh.size());
+        for (int r = 0; r < n_gates; ++r) {
+            for (int j = 0; j < n_hidden; ++j) {
+                vctx->lstm_hh_t[(size_t) j*n_gates + r] = w_hh[(size_t) r*n_hidden + j];
+            }
+        }
 
-    // LSTM Cell state
-    vctx->c_state = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, lstm_hidden_size);
-    ggml_set_name(vctx->c_state, "c_state");
+        vctx->final_conv_w.resize(n_hidden);
+        if (model.final_conv_weight->type == GGML_TYPE_F16) {
+            std::vector<ggml_fp16_t> tmp(n_hidden);
+            ggml_backend_tensor_get(model.final_conv_weight, tmp.data(), 0, n_hidden*sizeof(ggml_fp16_t));
+            ggml_fp16_to_fp32_row(tmp.data(), vctx->final_conv_w.data(), n_hidden);
+        } else {
+            ggml_backend_tensor_get(model.final_conv_weight, vctx->final_conv_w.data(), 0, n_hidden*sizeof(float));
+        }
 
-    vctx->buffer = ggml_backend_alloc_ctx_tensors(ctx, vctx->backends[0]);
-    if (!vctx->buffer) {
-        WHISPER_LOG_ERROR("%s: failed to allocate memory for the VAD state\n", __func__);
-        return false;
+        ggml_backend_tensor_get(model.final_conv_bias, &vctx->final_conv_b, 0, sizeof(float));
     }
 
+    vctx->n_batch = WHISPER_VAD_MAX_BATCH;
+
+    vctx->h_state.assign(n_hidden, 0.0f);
+    vctx->c_state.assign(n_hidden, 0.0f);
+    vctx->gates.resize((size_t) vctx->n_batch*n_gates);
+
     {
         bool ok = whisper_sched_graph_init(vctx->sched, vctx->backends,
                 [&]() {
-                    return whisper_vad_build_graph(*vctx);
+                    return whisper_vad_build_graph(*vctx, vctx->n_batch);
                 });
 
         if (!ok) {
@@ -5101,82 +6373,71 @@ bool whisper_vad_detect_speech(
         struct whisper_vad_context * vctx,
         const float * samples,
         int n_samples) {
-    int n_chunks = n_samples / vctx->n_window;
-    if (n_samples % vctx->n_window != 0) {
-        n_chunks += 1;  // Add one more chunk for remaining samples.
-    }
+    const int n_full = n_samples / vctx->n_window;
+    const int n_tail = n_samples % vctx->n_window;
+
+    const int n_chunks = n_full + (n_tail > 0 ? 1 : 0);
 
     WHISPER_LOG_INFO("%s: detecting speech in %d samples\n", __func__, n_samples);
     WHISPER_LOG_INFO("%s: n_chunks: %d\n", __func__, n_chunks);
 
-    // Reset LSTM hidden/cell states
-    ggml_backend_buffer_clear(vctx->buffer, 0);
+    whisper_vad_stream_reset(vctx);
 
     vctx->probs.resize(n_chunks);
-    WHISPER_LOG_INFO("%s: props size: %u\n", __func__, n_chunks);
 
-    std::vector<float> window(vctx->n_window, 0.0f);
+    const int64_t t_vad_us = vctx->t_vad_us;
 
-    auto & sched = vctx->sched.sched;
-
-    ggml_cgraph * gf = whisper_vad_build_graph(*vctx);
-
-    if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-        WHISPER_LOG_ERROR("%s: failed to allocate the compute buffer\n", __func__);
+    if (!whisper_vad_eval(*vctx, samples, n_full, vctx->probs.data())) {
         return false;
     }
 
-    struct ggml_tensor * frame = ggml_graph_get_tensor(gf, "frame");
-    struct ggml_tensor * prob  = ggml_graph_get_tensor(gf, "prob");
+    if (n_tail > 0) {
+        // zero-pad the remaining samples
+        std::vector<float> window(vctx->n_window, 0.0f);
+        std::copy(samples + (size_t) n_full*vctx->n_window, samples + n_samples, window.begin());
 
-    // we are going to reuse the graph multiple times for each chunk
-    const int64_t t_start_vad_us = ggml_time_us();
+        if (!whisper_vad_eval(*vctx, window.data(), 1, vctx->probs.data() + n_full)) {
+            return false;
+        }
+    }
 
-    for (int i = 0; i < n_chunks; i++) {
-        const int idx_start = i * vctx->n_window;
-        const int idx_end = std::min(idx_start + vctx->n_window, n_samples);
+    WHISPER_LOG_INFO("%s: vad time = %.2f ms processing %d samples\n", __func__, 1e-3f*(vctx->t_vad_us - t_vad_us), n_samples);
 
-        const int chunk_len = idx_end - idx_start;
+    return true;
+}
 
-        if (chunk_len < vctx->n_window) {
-            WHISPER_LOG_INFO("%s: chunk_len: %d < n_window: %d\n", __func__, chunk_len, vctx->n_window);
-            std::vector<float> partial_chunk(vctx->n_window, 0.0f);
-            std::copy(samples + idx_start, samples + idx_end, partial_chunk.begin());
+int whisper_vad_stream_push(
+        struct whisper_vad_context * vctx,
+        const float * samples,
+        int n_samples) {
+    auto & pending = vctx->pending;
 
-            // Copy the zero-padded chunk to the window.
-            const int samples_to_copy_max = vctx->n_window;
-            const int samples_to_copy_cur = std::min(samples_to_copy_max, (int)partial_chunk.size());
-            std::copy(partial_chunk.begin(), partial_chunk.begin() + samples_to_copy_cur, window.begin());
-            if (samples_to_copy_cur < samples_to_copy_max) {
-                std::fill(window.begin() + samples_to_copy_cur, window.end(), 0.0f);
-            }
-        } else {
-            // Copy current frame samples to the window.
-            const int samples_to_copy = std::min(idx_end - idx_start, vctx->n_window);
-            std::copy(samples + idx_start, samples + idx_start + samples_to_copy, window.begin());
-        }
+    pending.insert(pending.end(), samples, samples + n_samples);
 
-        // Set the frame tensor data with the samples.
-        ggml_backend_tensor_set(frame, window.data(), 0, ggml_nelements(frame) * sizeof(float));
+    const int n_windows = (int) (pending.size() / vctx->n_window);
 
-        // do not reset the scheduler - we will reuse the graph in the next chunk
-        if (!ggml_graph_compute_helper(sched, gf, vctx->n_threads, false)) {
-            WHISPER_LOG_ERROR("%s: failed to compute VAD graph\n", __func__);
-            break;
-        }
+    vctx->probs.resize(n_windows);
 
-        // Get the probability for this chunk.
-        ggml_backend_tensor_get(prob, &vctx->probs[i], 0, sizeof(float));
+    if (n_windows == 0) {
+        return 0;
+    }
 
-        //WHISPER_LOG_DEBUG("chunk %d: p = %7.3f\n", i, probs[i]);
+    if (!whisper_vad_eval(*vctx, pending.data(), n_windows, vctx->probs.data())) {
+        vctx->probs.clear();
+        return -1;
     }
 
-    vctx->t_vad_us += ggml_time_us() - t_start_vad_us;
-    WHISPER_LOG_INFO("%s: vad time = %.2f ms processing %d samples\n", __func__, 1e-3f * vctx->t_vad_us, n_samples);
+    pending.erase(pending.begin(), pending.begin() + (size_t) n_windows*vctx->n_window);
 
-    ggml_backend_sched_reset(sched);
+    return n_windows;
+}
 
-    return true;
+void whisper_vad_stream_reset(struct whisper_vad_context * vctx) {
+    std::fill(vctx->h_state.begin(), vctx->h_state.end(), 0.0f);
+    std::fill(vctx->c_state.begin(), vctx->c_state.end(), 0.0f);
+
+    vctx->pending.clear();
+    vctx->probs.clear();
 }
 
 int whisper_vad_segments_n_segments(struct whisper_vad_segments * segments) {
@@ -5996,6 +7257,12 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.vad_model_path              =*/ nullptr,
 
         /* vad_params =*/ whisper_vad_default_params(),
+
+        /*.draft_ctx =*/ nullptr,
+        /*.n_draft   =*/ 8,
+
+        /*.audio_read_callback           =*/ nullptr,
+        /*.audio_read_callback_user_data =*/ nullptr,
     };
 
     switch (strategy) {
@@ -6495,29 +7762,10 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
     const auto & vocab = ctx.vocab;
 
     const auto & probs    = decoder.probs;
-    const auto & logits   = decoder.logits;
     const auto & logprobs = decoder.logprobs;
 
     const int n_logits = vocab.n_vocab;
 
-    auto & logits_id = decoder.logits_id;
-
-    logits_id.resize(n_logits);
-    for (int i = 0; i < n_logits; ++i) {
-        logits_id[i].first = logits[i];
-        logits_id[i].second = i;
-    }
-
-    {
-        using pair_type = std::remove_reference<decltype(logits_id)>::type::value_type;
-        std::partial_sort(
-                logits_id.begin(),
-                logits_id.begin() + k, logits_id.end(),
-                [](const pair_type & a, const pair_type & b) {
-            return a.first > b.first;
-        });
-    }
-
     std::vector<whisper_token_data> result;
     result.reserve(k);
 
@@ -6792,132 +8040,444 @@ static bool whisper_vad(
     return true;
 }
 
-int whisper_full_with_state(
-        struct whisper_context * ctx,
-          struct whisper_state * state,
-    struct whisper_full_params   params,
-                   const float * samples,
-                           int   n_samples) {
-    // clear old results
-    auto & result_all = state->result_all;
+// speculative decoding: prepare the draft state of the model state for a new input
+// returns nullptr if the draft model cannot be used with the model
+static whisper_state * whisper_draft_init(whisper_context & ctx, whisper_state & state, const whisper_full_params & params) {
+    whisper_context * dctx = params.draft_ctx;
 
-    result_all.clear();
+    if (dctx->vocab.n_vocab != ctx.vocab.n_vocab || dctx->model.hparams.n_mels != ctx.model.hparams.n_mels) {
+        WHISPER_LOG_WARN("%s: draft model is not compatible (n_vocab = %d vs %d, n_mels = %d vs %d) - speculative decoding disabled\n", __func__,
+                dctx->vocab.n_vocab, ctx.vocab.n_vocab, dctx->model.hparams.n_mels, ctx.model.hparams.n_mels);
+        return nullptr;
+    }
 
-    if (n_samples > 0) {
-        // compute log mel spectrogram
-        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
-            WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
-            return -2;
+    if (state.draft_state != nullptr && state.draft_ctx != dctx) {
+        whisper_free_state(state.draft_state);
+        state.draft_state = nullptr;
+    }
+
+    if (state.draft_state == nullptr) {
+        state.draft_state = whisper_init_state(dctx);
+        if (state.draft_state == nullptr) {
+            WHISPER_LOG_WARN("%s: failed to init the draft state - speculative decoding disabled\n", __func__);
+            return nullptr;
         }
+        state.draft_ctx = dctx;
     }
 
-    // auto-detect language if not specified
-    if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
-        std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
+    whisper_state & dstate = *state.draft_state;
 
-        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
-        if (lang_id < 0) {
-            WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
-            return -3;
-        }
-        state->lang_id = lang_id;
-        params.language = whisper_lang_str(lang_id);
+    // the draft model encodes the same spectrogram
+    dstate.mel             = state.mel;
+    dstate.encoded_offset  = -1;
+    dstate.exp_n_audio_ctx = std::min(params.audio_ctx, dctx->model.hparams.n_audio_ctx);
 
-        WHISPER_LOG_INFO("%s: auto-detected language: %s (p = %f)\n", __func__, params.language, probs[whisper_lang_id(params.language)]);
-        if (params.detect_language) {
-            return 0;
-        }
-    }
+    whisper_kv_cache_clear(dstate.kv_self);
+    state.draft_past.clear();
 
-    if (params.token_timestamps) {
-        state->t_beg    = 0;
-        state->t_last   = 0;
-        state->tid_last = 0;
-        if (n_samples > 0) {
-            state->energy = get_signal_energy(samples, n_samples, 32);
-        }
-    }
+    return state.draft_state;
+}
 
-    const int seek_start = params.offset_ms/10;
-    const int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/10;
+// speculative decoding: sample up to n_draft tokens that continue the sequence of the decoder with the draft model
+// the KV cache of the draft state is reused for the tokens that have not changed since the last call
+static bool whisper_draft_propose(
+        whisper_state & state,
+        const std::vector<whisper_token> & prompt,
+        const whisper_decoder & decoder,
+        whisper_full_params params,
+        int n_draft,
+        std::vector<whisper_token> & draft) {
+    const int64_t t_start_us = ggml_time_us();
 
-    // if length of spectrogram is less than 100ms (10 frames), then return
-    // basically don't process anything that is less than 100ms
-    // ref: https://github.com/ggml-org/whisper.cpp/issues/2065
-    const int delta_min = 10;
+    whisper_context & dctx   = *state.draft_ctx;
+    whisper_state   & dstate = *state.draft_state;
 
-    if (seek_end < seek_start + delta_min) {
-        WHISPER_LOG_WARN("%s: input is too short - %d ms < 100 ms. consider padding the input audio with silence\n", __func__, (seek_end - seek_start)*10);
-        return 0;
+    auto & past = state.draft_past;
+
+    draft.clear();
+
+    std::vector<whisper_token> tokens = prompt;
+    for (const auto & token : decoder.sequence.tokens) {
+        tokens.push_back(token.id);
     }
 
-    // a set of temperatures to use
-    // [ t0, t0 + delta, t0 + 2*delta, ..., < 1.0f + 1e-6f ]
-    std::vector<float> temperatures;
-    if (params.temperature_inc > 0.0f) {
-        for (float t = params.temperature; t < 1.0f + 1e-6f; t += params.temperature_inc) {
-            temperatures.push_back(t);
-        }
-    } else {
-        temperatures.push_back(params.temperature);
+    int n_past = 0;
+    while (n_past < (int) past.size() && n_past < (int) tokens.size() && past[n_past] == tokens[n_past]) {
+        n_past++;
     }
 
-    // initialize the decoders
-    int n_decoders = 1;
+    // the logits of the last token are always recomputed
+    n_past = std::min(n_past, (int) tokens.size() - 1);
 
-    switch (params.strategy) {
-        case WHISPER_SAMPLING_GREEDY:
-            {
-                n_decoders = params.greedy.best_of;
-            } break;
-        case WHISPER_SAMPLING_BEAM_SEARCH:
-            {
-                n_decoders = std::max(params.greedy.best_of, params.beam_search.beam_size);
-            } break;
-    };
+    whisper_kv_cache_seq_rm(dstate.kv_self, 0, n_past, -1);
+    past.resize(n_past);
 
-    n_decoders = std::max(1, n_decoders);
+    // the user callbacks expect the main model
+    params.logits_filter_callback = nullptr;
 
-    if (n_decoders > WHISPER_MAX_DECODERS) {
-        WHISPER_LOG_ERROR("%s: too many decoders requested (%d), max = %d\n", __func__, n_decoders, WHISPER_MAX_DECODERS);
-        return -4;
-    }
+    whisper_batch_prep_legacy(dstate.batch, tokens.data() + n_past, tokens.size() - n_past, n_past, 0);
 
-    // TAGS: WHISPER_DECODER_INIT
-    for (int j = 1; j < n_decoders; j++) {
-        auto & decoder = state->decoders[j];
+    bool ok = whisper_decode_internal(dctx, dstate, dstate.batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data);
+    if (ok) {
+        past.insert(past.end(), tokens.begin() + n_past, tokens.end());
 
-        decoder.sequence.tokens.reserve(state->decoders[0].sequence.tokens.capacity());
+        auto & ddec = dstate.decoders[0];
 
-        decoder.probs.resize   (ctx->vocab.n_vocab);
-        decoder.logits.resize  (ctx->vocab.n_vocab);
-        decoder.logprobs.resize(ctx->vocab.n_vocab);
-        decoder.logits_id.reserve(ctx->model.hparams.n_vocab);
+        ddec.sequence   = decoder.sequence;
+        ddec.grammar    = decoder.grammar;
+        ddec.seek_delta = decoder.seek_delta;
+        ddec.has_ts     = decoder.has_ts;
+        ddec.i_batch    = dstate.batch.n_tokens - 1;
 
-        decoder.rng = std::mt19937(j);
-    }
+        for (int i = 0; i < n_draft; ++i) {
+            whisper_process_logits(dctx, dstate, ddec, params, 0.0f);
 
-    // the accumulated text context so far
-    auto & prompt_past = state->prompt_past;
-    if (params.no_context) {
-        prompt_past.clear();
-    }
+            const whisper_token_data token = whisper_sample_token(dctx, ddec, true);
 
-    // prepare prompt
-    {
-        std::vector<whisper_token> prompt_tokens;
+            draft.push_back(token.id);
 
-        // initial prompt
-        if (!params.prompt_tokens && params.initial_prompt) {
-            prompt_tokens.resize(1024);
-            int n_needed = whisper_tokenize(ctx, params.initial_prompt, prompt_tokens.data(), prompt_tokens.size());
-            if (n_needed < 0) {
-                prompt_tokens.resize(-n_needed);
-                n_needed = whisper_tokenize(ctx, params.initial_prompt, prompt_tokens.data(), prompt_tokens.size());
+            if (token.id == whisper_token_eot(&dctx) || i == n_draft - 1) {
+                break;
             }
-            prompt_tokens.resize(n_needed);
-            params.prompt_tokens   = prompt_tokens.data();
-            params.prompt_n_tokens = prompt_tokens.size();
+
+            if (token.id > whisper_token_beg(&dctx)) {
+                ddec.seek_delta = 2*(token.id - whisper_token_beg(&dctx));
+                ddec.has_ts     = true;
+            }
+
+            ddec.sequence.tokens.push_back(token);
+            whisper_grammar_accept_token(dctx, ddec.grammar, token.id);
+
+            whisper_batch_prep_legacy(dstate.batch, &token.id, 1, past.size(), 0);
+
+            if (!whisper_decode_internal(dctx, dstate, dstate.batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                ok = false;
+                break;
+            }
+
+            past.push_back(token.id);
+
+            ddec.i_batch = 0;
+        }
+    }
+
+    state.t_draft_us += ggml_time_us() - t_start_us;
+
+    return ok;
+}
+
+// pull-based audio input of whisper_full()
+//
+// the audio is read from params.audio_read_callback while the windows are being transcribed. the raw spectrogram is
+// computed incrementally and the frames before the current window are dropped, so the memory does not grow with the
+// length of the audio. unlike log_mel_spectrogram(), the spectrogram is clamped relative to the maximum of the audio
+// read so far instead of the maximum of the whole audio
+struct whisper_audio_reader {
+    whisper_audio_read_callback callback;
+    void * user_data;
+
+    std::vector<int> filter_range;
+
+    // the audio from the window of frame n_past on - at the start, preceded by the reflective padding
+    std::vector<float> pcm;
+    std::vector<float> buf;
+
+    // raw log10 mel spectrogram of the frames [n_past, n_past + n_frames) - [n_frames][n_mel]
+    std::vector<float> mel;
+
+    int n_past   = 0;
+    int n_frames = 0;
+
+    int64_t n_samples = 0; // number of samples read so far
+    bool    eof       = false;
+
+    double mmax = -1e20;
+};
+
+// read the next chunk of audio and compute the mel frames whose window is complete
+static bool whisper_audio_reader_read(whisper_audio_reader & reader, const whisper_filters & filters, whisper_state & state) {
+    const int pad = WHISPER_N_FFT/2;
+
+    reader.buf.resize(WHISPER_SAMPLE_RATE);
+
+    const int n_read = reader.callback(reader.buf.data(), (int) reader.buf.size(), reader.user_data);
+    if (n_read < 0) {
+        WHISPER_LOG_ERROR("%s: failed to read audio (%d)\n", __func__, n_read);
+        return false;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    if (reader.pcm.empty()) {
+        reader.pcm.resize(pad, 0.0f);
+    }
+
+    reader.pcm.insert(reader.pcm.end(), reader.buf.begin(), reader.buf.begin() + n_read);
+    reader.n_samples += n_read;
+    reader.eof = n_read == 0;
+
+    // reflective padding at the start of the audio
+    if (reader.n_past == 0 && reader.n_samples - n_read <= pad) {
+        for (int i = 0; i < pad; ++i) {
+            reader.pcm[i] = pad - i < reader.n_samples ? reader.pcm[pad + pad - i] : 0.0f;
+        }
+    }
+
+    // at the end of the audio, the windows are zero-padded
+    int n_frames = 0;
+    if (reader.eof) {
+        n_frames = (int) ((reader.n_samples + pad)/WHISPER_HOP_LENGTH + 1) - reader.n_past;
+    } else if (reader.n_samples > pad) {
+        n_frames = (int) ((reader.n_samples - pad)/WHISPER_HOP_LENGTH + 1) - reader.n_past;
+    }
+
+    if (n_frames > reader.n_frames) {
+        const int n_mel = filters.n_mel;
+
+        reader.mel.resize(n_frames*n_mel);
+
+        whisper_compute_mel_frames(filters, reader.filter_range, reader.pcm.data(), (int) reader.pcm.size(),
+                reader.n_frames, n_frames, reader.mel.data() + reader.n_frames*n_mel);
+
+        for (int i = reader.n_frames*n_mel; i < n_frames*n_mel; ++i) {
+            reader.mmax = std::max(reader.mmax, (double) reader.mel[i]);
+        }
+
+        reader.n_frames = n_frames;
+    }
+
+    state.t_mel_us += ggml_time_us() - t_start_us;
+
+    return true;
+}
+
+// move the reader to the window starting at frame seek and set state.mel to its normalized spectrogram
+// seek_end is set to the end of the audio if it has been reached, otherwise to the end of the audio read so far which
+// is at least one second past the end of the window
+static bool whisper_audio_reader_seek(
+        whisper_audio_reader & reader,
+             whisper_context & ctx,
+               whisper_state & state,
+   const whisper_full_params & params,
+                         int   seek,
+                         int & seek_end) {
+    const auto & filters = ctx.model.filters;
+
+    const int n_mel    = filters.n_mel;
+    const int n_window = 2*ctx.model.hparams.n_audio_ctx;
+
+    int n_limit = seek + n_window + 100;
+    if (params.duration_ms > 0) {
+        n_limit = std::min(n_limit, params.offset_ms/10 + params.duration_ms/10);
+    }
+
+    while (true) {
+        // drop the frames before the window
+        const int n_drop = std::min(seek - reader.n_past, reader.n_frames);
+        if (n_drop > 0) {
+            reader.mel.erase(reader.mel.begin(), reader.mel.begin() + n_drop*n_mel);
+            reader.pcm.erase(reader.pcm.begin(), reader.pcm.begin() + std::min((size_t) n_drop*WHISPER_HOP_LENGTH, reader.pcm.size()));
+
+            reader.n_past   += n_drop;
+            reader.n_frames -= n_drop;
+        }
+
+        if (reader.eof || reader.n_past + reader.n_frames >= n_limit) {
+            break;
+        }
+
+        if (!whisper_audio_reader_read(reader, filters, state)) {
+            return false;
+        }
+    }
+
+    if (reader.eof) {
+        // same as mel.n_len_org in log_mel_spectrogram()
+        seek_end = (int) (1 + (reader.n_samples - WHISPER_N_FFT/2)/WHISPER_HOP_LENGTH);
+    } else {
+        seek_end = reader.n_past + reader.n_frames;
+    }
+
+    if (params.duration_ms > 0) {
+        seek_end = std::min(seek_end, params.offset_ms/10 + params.duration_ms/10);
+    }
+
+    const int n_avail = std::max(0, std::min(reader.n_past + reader.n_frames - seek, n_window));
+
+    auto & mel = state.mel;
+
+    mel.n_mel     = n_mel;
+    mel.n_len     = n_window;
+    mel.n_len_org = std::max(0, std::min(seek_end - seek, n_window));
+    mel.data.resize(n_mel*n_window);
+
+    const double mmin = reader.mmax - 8.0;
+
+    for (int j = 0; j < n_mel; ++j) {
+        for (int i = 0; i < n_window; ++i) {
+            const double v = i < n_avail ? reader.mel[i*n_mel + j] : log10(1e-10);
+            mel.data[j*n_window + i] = (std::max(v, mmin) + 4.0)/4.0;
+        }
+    }
+
+    // the audio of the window, for the token-level timestamps
+    if (params.token_timestamps) {
+        const int offset = std::min(WHISPER_N_FFT/2, (int) reader.pcm.size());
+        state.energy = get_signal_energy(reader.pcm.data() + offset, (int) reader.pcm.size() - offset, 32);
+    }
+
+    // state.mel starts at seek now
+    state.encoded_offset = -1;
+
+    return true;
+}
+
+int whisper_full_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+    struct whisper_full_params   params,
+                   const float * samples,
+                           int   n_samples) {
+    // clear old results
+    auto & result_all = state->result_all;
+
+    result_all.clear();
+
+    // set by whisper_audio_reader_seek() when the audio is pulled from params.audio_read_callback
+    int seek_end_read = 0;
+
+    std::unique_ptr<whisper_audio_reader> reader;
+
+    if (params.audio_read_callback) {
+        reader.reset(new whisper_audio_reader);
+        reader->callback     = params.audio_read_callback;
+        reader->user_data    = params.audio_read_callback_user_data;
+        reader->filter_range = whisper_mel_filter_range(ctx->model.filters, ctx->model.filters.n_mel);
+
+        if (!whisper_audio_reader_seek(*reader, *ctx, *state, params, params.offset_ms/10, seek_end_read)) {
+            WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+            return -2;
+        }
+    } else if (n_samples > 0) {
+        // compute log mel spectrogram
+        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
+            WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+            return -2;
+        }
+    }
+
+    // auto-detect language if not specified
+    if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
+        std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
+
+        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
+        if (lang_id < 0) {
+            WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
+            return -3;
+        }
+        state->lang_id = lang_id;
+        params.language = whisper_lang_str(lang_id);
+
+        WHISPER_LOG_INFO("%s: auto-detected language: %s (p = %f)\n", __func__, params.language, probs[whisper_lang_id(params.language)]);
+        if (params.detect_language) {
+            return 0;
+        }
+    }
+
+    if (params.token_timestamps) {
+        state->t_beg    = 0;
+        state->t_last   = 0;
+        state->tid_last = 0;
+        if (n_samples > 0 && !reader) {
+            state->energy = get_signal_energy(samples, n_samples, 32);
+        }
+    }
+
+    const int seek_start = params.offset_ms/10;
+
+    // when the audio is pulled, state->mel holds only the window at seek and seek_end grows as the audio is read
+    int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/10;
+    if (reader) {
+        seek_end = seek_end_read;
+    }
+
+    // if length of spectrogram is less than 100ms (10 frames), then return
+    // basically don't process anything that is less than 100ms
+    // ref: https://github.com/ggml-org/whisper.cpp/issues/2065
+    const int delta_min = 10;
+
+    if (seek_end < seek_start + delta_min) {
+        WHISPER_LOG_WARN("%s: input is too short - %d ms < 100 ms. consider padding the input audio with silence\n", __func__, (seek_end - seek_start)*10);
+        return 0;
+    }
+
+    // a set of temperatures to use
+    // [ t0, t0 + delta, t0 + 2*delta, ..., < 1.0f + 1e-6f ]
+    std::vector<float> temperatures;
+    if (params.temperature_inc > 0.0f) {
+        for (float t = params.temperature; t < 1.0f + 1e-6f; t += params.temperature_inc) {
+            temperatures.push_back(t);
+        }
+    } else {
+        temperatures.push_back(params.temperature);
+    }
+
+    // initialize the decoders
+    int n_decoders = 1;
+
+    switch (params.strategy) {
+        case WHISPER_SAMPLING_GREEDY:
+            {
+                n_decoders = params.greedy.best_of;
+            } break;
+        case WHISPER_SAMPLING_BEAM_SEARCH:
+            {
+                n_decoders = std::max(params.greedy.best_of, params.beam_search.beam_size);
+            } break;
+    };
+
+    n_decoders = std::max(1, n_decoders);
+
+    if (n_decoders > WHISPER_MAX_DECODERS) {
+        WHISPER_LOG_ERROR("%s: too many decoders requested (%d), max = %d\n", __func__, n_decoders, WHISPER_MAX_DECODERS);
+        return -4;
+    }
+
+    // TAGS: WHISPER_DECODER_INIT
+    for (int j = 1; j < n_decoders; j++) {
+        auto & decoder = state->decoders[j];
+
+        decoder.sequence.tokens.reserve(state->decoders[0].sequence.tokens.capacity());
+
+        decoder.probs.resize   (ctx->vocab.n_vocab);
+        decoder.logits.resize  (ctx->vocab.n_vocab);
+        decoder.logprobs.resize(ctx->vocab.n_vocab);
+        decoder.logits_id.reserve(ctx->model.hparams.n_vocab);
+
+        decoder.rng = std::mt19937(j);
+    }
+
+    // the accumulated text context so far
+    auto & prompt_past = state->prompt_past;
+    if (params.no_context) {
+        prompt_past.clear();
+    }
+
+    // prepare prompt
+    {
+        std::vector<whisper_token> prompt_tokens;
+
+        // initial prompt
+        if (!params.prompt_tokens && params.initial_prompt) {
+            prompt_tokens.resize(1024);
+            int n_needed = whisper_tokenize(ctx, params.initial_prompt, prompt_tokens.data(), prompt_tokens.size());
+            if (n_needed < 0) {
+                prompt_tokens.resize(-n_needed);
+                n_needed = whisper_tokenize(ctx, params.initial_prompt, prompt_tokens.data(), prompt_tokens.size());
+            }
+            prompt_tokens.resize(n_needed);
+            params.prompt_tokens   = prompt_tokens.data();
+            params.prompt_n_tokens = prompt_tokens.size();
         }
 
         // prepend the prompt tokens to the prompt_past
@@ -6969,8 +8529,18 @@ int whisper_full_with_state(
     std::vector<whisper_token> prompt;
     prompt.reserve(whisper_n_text_ctx(ctx));
 
+    // the sequence of decoder decoder_idx extended by token
+    // the sequences are materialized only for the selected candidates
     struct beam_candidate {
         int decoder_idx;
+
+        whisper_token_data token;
+
+        double sum_logprobs_all;
+    };
+
+    // the state of a decoder before the beam search step
+    struct beam_parent {
         int seek_delta;
 
         bool has_ts;
@@ -6982,9 +8552,36 @@ int whisper_full_with_state(
     std::vector<std::vector<beam_candidate>> bc_per_dec(n_decoders);
     std::vector<beam_candidate> beam_candidates;
 
+    std::vector<beam_parent>    beam_parents(n_decoders);
+    std::vector<beam_candidate> beam_selected(n_decoders);
+    std::vector<whisper_seq_id> beam_src;
+
+    // speculative decoding
+    whisper_state * dstate = nullptr;
+    if (params.draft_ctx != nullptr && params.n_draft > 0) {
+        dstate = whisper_draft_init(*ctx, *state, params);
+    }
+
+    std::vector<whisper_token> spec_draft; // the tokens proposed by the draft model
+    std::vector<whisper_token> spec_batch; // the tokens of the last verification batch
+    int spec_row = 0;                      // the row of the verification batch with the current logits
+
     // main loop
     while (true) {
-        if (params.progress_callback) {
+        if (reader && reader->n_past != seek) {
+            if (!whisper_audio_reader_seek(*reader, *ctx, *state, params, seek, seek_end)) {
+                WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+                return -2;
+            }
+
+            if (dstate != nullptr) {
+                dstate->mel            = state->mel;
+                dstate->encoded_offset = -1;
+            }
+        }
+
+        // the length of the audio is not known in advance when it is pulled
+        if (params.progress_callback && !reader) {
             const int progress_cur = (100*(seek - seek_start))/(seek_end - seek_start);
 
             params.progress_callback(
@@ -7004,11 +8601,18 @@ int whisper_full_with_state(
         }
 
         // encode audio features starting at offset seek
-        if (!whisper_encode_internal(*ctx, *state, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+        const int mel_offset = reader ? 0 : seek;
+
+        if (!whisper_encode_cached(*ctx, *state, mel_offset, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
             WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
             return -6;
         }
 
+        if (dstate != nullptr && !whisper_encode_cached(*params.draft_ctx, *dstate, mel_offset, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+            WHISPER_LOG_ERROR("%s: failed to encode with the draft model\n", __func__);
+            return -6;
+        }
+
         // if there is a very short audio segment left to process, we remove any past prompt since it tends
         // to confuse the decoder and often make it repeat or hallucinate stuff
         if (seek > seek_start && seek + 500 >= seek_end) {
@@ -7154,6 +8758,12 @@ int whisper_full_with_state(
                 }
             }
 
+            // the draft model proposes the tokens of the greedy decoder - the other strategies decode as usual
+            const bool spec = dstate != nullptr && params.strategy == WHISPER_SAMPLING_GREEDY && t_cur < 1e-6f && n_decoders_cur == 1;
+
+            spec_batch.clear();
+            spec_row = 0;
+
             for (int i = 0, n_max = whisper_n_text_ctx(ctx)/2 - 4; i < n_max; ++i) {
                 const int64_t t_start_sample_us = ggml_time_us();
 
@@ -7198,9 +8808,7 @@ int whisper_full_with_state(
                                         const auto tokens_new = whisper_sample_token_topk(*ctx, decoder, params.beam_search.beam_size);
 
                                         for (const auto & token : tokens_new) {
-                                            bc_per_dec[j].push_back({ j, decoder.seek_delta, decoder.has_ts, decoder.sequence, decoder.grammar, });
-                                            bc_per_dec[j].back().sequence.tokens.push_back(token);
-                                            bc_per_dec[j].back().sequence.sum_logprobs_all += token.plog;
+                                            bc_per_dec[j].push_back({ j, token, decoder.sequence.sum_logprobs_all + token.plog, });
                                         }
                                     } break;
                             };
@@ -7241,12 +8849,19 @@ int whisper_full_with_state(
                             beam_candidates.begin(),
                             beam_candidates.end(),
                             [](const beam_candidate & a, const beam_candidate & b) {
-                        if (a.sequence.sum_logprobs_all != b.sequence.sum_logprobs_all) {
-                            return a.sequence.sum_logprobs_all > b.sequence.sum_logprobs_all;
+                        if (a.sum_logprobs_all != b.sum_logprobs_all) {
+                            return a.sum_logprobs_all > b.sum_logprobs_all;
                         }
                         return a.decoder_idx < b.decoder_idx;
                     });
 
+                    const auto beam_candidates_equal = [&](const beam_candidate & a, const beam_candidate & b) {
+                        return a.token.id == b.token.id &&
+                            whisper_sequence_tokens_equal(state->decoders[a.decoder_idx].sequence, state->decoders[b.decoder_idx].sequence);
+                    };
+
+                    beam_src.assign(n_decoders_cur, -1);
+
                     uint32_t cur_c = 0;
 
                     for (int j = 0; j < n_decoders_cur; ++j) {
@@ -7262,37 +8877,58 @@ int whisper_full_with_state(
 
                         auto & cur = beam_candidates[cur_c++];
 
-                        while (beam_candidates.size() > cur_c && whisper_sequence_tokens_equal(beam_candidates[cur_c].sequence, cur.sequence) && i > 0) {
+                        while (beam_candidates.size() > cur_c && beam_candidates_equal(beam_candidates[cur_c], cur) && i > 0) {
                             ++cur_c;
                         }
 
-                        decoder.seek_delta = cur.seek_delta;
-                        decoder.has_ts     = cur.has_ts;
-                        decoder.sequence   = cur.sequence;
-                        decoder.grammar    = cur.grammar;
+                        beam_src[j]      = cur.decoder_idx;
+                        beam_selected[j] = cur;
+                    }
+
+                    // the decoders are overwritten below - save the state of the parents first
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        if (beam_src[j] < 0 || std::find(beam_src.begin(), beam_src.end(), j) == beam_src.end()) {
+                            continue;
+                        }
 
-                        whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
+                        const auto & decoder = state->decoders[j];
 
-                        WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
-                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
+                        beam_parents[j].seek_delta = decoder.seek_delta;
+                        beam_parents[j].has_ts     = decoder.has_ts;
+                        beam_parents[j].sequence   = decoder.sequence;
+                        beam_parents[j].grammar    = decoder.grammar;
                     }
 
                     for (int j = 0; j < n_decoders_cur; ++j) {
-                        auto & decoder = state->decoders[j];
-
-                        if (decoder.completed || decoder.failed) {
+                        if (beam_src[j] < 0) {
                             continue;
                         }
 
-                        whisper_kv_cache_seq_rm(state->kv_self, j,                           -1, -1);
-                        whisper_kv_cache_seq_cp(state->kv_self, WHISPER_MAX_DECODERS + j, j, -1, -1);
-                        whisper_kv_cache_seq_rm(state->kv_self, WHISPER_MAX_DECODERS + j,    -1, -1);
-                    }
-                }
+                        auto & decoder = state->decoders[j];
 
-                // update the decoder state
-                // - check if the sequence is completed
-                // - check if the sequence is failed
+                        const auto & cur    = beam_selected[j];
+                        const auto & parent = beam_parents[cur.decoder_idx];
+
+                        decoder.seek_delta = parent.seek_delta;
+                        decoder.has_ts     = parent.has_ts;
+                        decoder.sequence   = parent.sequence;
+                        decoder.grammar    = parent.grammar;
+
+                        decoder.sequence.tokens.push_back(cur.token);
+                        decoder.sequence.sum_logprobs_all = cur.sum_logprobs_all;
+
+                        WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
+                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
+                    }
+
+                    // the beams share the KV cells of their common prefix
+                    whisper_kv_cache_seq_remap(state->kv_self, beam_src);
+                    whisper_kv_cache_defrag(state->kv_self, ctx->model.hparams.n_text_state, !ctx->params.flash_attn);
+                }
+
+                // update the decoder state
+                // - check if the sequence is completed
+                // - check if the sequence is failed
                 // - update sliding window based on timestamp tokens
                 for (int j = 0; j < n_decoders_cur; ++j) {
                     auto & decoder = state->decoders[j];
@@ -7399,6 +9035,71 @@ int whisper_full_with_state(
 
                 state->t_sample_us += ggml_time_us() - t_start_sample_us;
 
+                // speculative decoding: obtain logits for the next token
+                // if the sampled token is the next token proposed by the draft model, its logits have already been
+                // computed by the last verification batch. otherwise, the rest of the draft is rejected and the model
+                // evaluates the sampled token together with a new draft in a single batch
+                // the sampling is the same as without a draft model, so the output is the same
+                if (spec) {
+                    auto & decoder = state->decoders[0];
+
+                    const whisper_token id     = decoder.sequence.tokens.back().id;
+                    const int           n_past = prompt.size() + i;
+
+                    if (spec_row + 1 < (int) spec_batch.size() && spec_batch[spec_row + 1] == id) {
+                        spec_row++;
+                        state->n_draft_accepted++;
+                    } else {
+                        // remove the rejected draft tokens from the KV cache
+                        whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+
+                        // the positions of the draft tokens must be inside the text context
+                        const int n_draft = std::min(params.n_draft, whisper_n_text_ctx(ctx) - 1 - n_past);
+
+                        spec_draft.clear();
+                        if (n_draft > 0 && id != whisper_token_eot(ctx)) {
+                            if (!whisper_draft_propose(*state, prompt, decoder, params, n_draft, spec_draft)) {
+                                WHISPER_LOG_ERROR("%s: failed to decode with the draft model\n", __func__);
+                                return -9;
+                            }
+                        }
+
+                        spec_batch.clear();
+                        spec_batch.push_back(id);
+                        spec_batch.insert(spec_batch.end(), spec_draft.begin(), spec_draft.end());
+
+                        auto & batch = state->batch;
+
+                        batch.n_tokens = spec_batch.size();
+
+                        for (int k = 0; k < batch.n_tokens; ++k) {
+                            batch.token   [k]    = spec_batch[k];
+                            batch.pos     [k]    = n_past + k;
+                            batch.n_seq_id[k]    = 1;
+                            batch.seq_id  [k][0] = 0;
+                            batch.logits  [k]    = 1;
+                        }
+
+                        if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                            WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                            return -9;
+                        }
+
+                        spec_row = 0;
+                        state->n_draft += spec_draft.size();
+                    }
+
+                    const int64_t t_start_sample_us = ggml_time_us();
+
+                    decoder.i_batch = spec_row;
+
+                    whisper_process_logits(*ctx, *state, decoder, params, t_cur);
+
+                    state->t_sample_us += ggml_time_us() - t_start_sample_us;
+
+                    continue;
+                }
+
                 // obtain logits for the next token
                 {
                     auto & batch = state->batch;
@@ -7717,6 +9418,11 @@ int whisper_full(
                            int   n_samples) {
 
     std::vector<float> vad_samples;
+    if (params.vad && params.audio_read_callback) {
+        WHISPER_LOG_ERROR("%s: VAD is not supported with audio_read_callback\n", __func__);
+        return -1;
+    }
+
     if (params.vad) {
         WHISPER_LOG_INFO("%s: VAD is enabled, processing speech segments only\n", __func__);
         if (!whisper_vad(ctx, ctx->state, params, samples, n_samples, vad_samples)) {
@@ -7733,6 +9439,414 @@ int whisper_full(
     return whisper_full_with_state(ctx, ctx->state, params, samples, n_samples);
 }
 
+int whisper_full_batch(
+        struct whisper_context * ctx,
+         struct whisper_state ** states,
+const struct whisper_full_params * params,
+                  const float ** samples,
+                     const int * n_samples,
+                           int   n_states,
+                           int * results) {
+    if (n_states <= 0) {
+        return 0;
+    }
+
+    if (n_states == 1) {
+        const int ret = whisper_full_with_state(ctx, states[0], params[0], samples[0], n_samples[0]);
+        if (results) {
+            results[0] = ret;
+        }
+        return ret;
+    }
+
+    // the VAD of a state also writes to the default state, so it is not run in parallel
+    std::vector<std::vector<float>> vad_samples(n_states);
+    std::vector<bool>               skip(n_states, false);
+
+    for (int i = 0; i < n_states; ++i) {
+        if (params[i].vad) {
+            if (!whisper_vad(ctx, states[i], params[i], samples[i], n_samples[i], vad_samples[i])) {
+                WHISPER_LOG_ERROR("%s: failed to compute VAD\n", __func__);
+                if (results) {
+                    std::fill(results, results + n_states, -1);
+                }
+                return -1;
+            }
+            if (vad_samples[i].empty()) {
+                states[i]->result_all.clear();
+                skip[i] = true;
+                if (results) {
+                    results[i] = 0;
+                }
+            }
+        }
+    }
+
+    std::vector<int> ret(n_states, 0);
+
+    const auto run_parallel = [&](const std::function<int(int)> & fn) {
+        std::vector<std::thread> workers;
+        for (int i = 1; i < n_states; ++i) {
+            if (!skip[i]) {
+                workers.emplace_back([&, i]() { ret[i] = fn(i); });
+            }
+        }
+        if (!skip[0]) {
+            ret[0] = fn(0);
+        }
+        for (auto & w : workers) {
+            w.join();
+        }
+        if (results) {
+            std::copy(ret.begin(), ret.end(), results);
+        }
+        for (int i = 0; i < n_states; ++i) {
+            if (ret[i] != 0) {
+                return ret[i];
+            }
+        }
+        return 0;
+    };
+
+    // compute the log mel spectrograms
+    const int err = run_parallel([&](int i) {
+        const float * samples_cur   = params[i].vad ? vad_samples[i].data() : samples[i];
+        const int     n_samples_cur = params[i].vad ? (int) vad_samples[i].size() : n_samples[i];
+
+        if (whisper_pcm_to_mel_with_state(ctx, states[i], samples_cur, n_samples_cur, params[i].n_threads) != 0) {
+            WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
+            return -2;
+        }
+
+        if (params[i].token_timestamps) {
+            states[i]->energy = get_signal_energy(samples_cur, n_samples_cur, 32);
+        }
+
+        return 0;
+    });
+
+    if (err != 0) {
+        return err;
+    }
+
+    // encode the first window of all states in batches - this is where most of the audio of short inputs is
+    // states with a different audio context are encoded in separate batches
+    {
+        std::vector<bool> encoded(skip);
+
+        for (int i = 0; i < n_states; ++i) {
+            states[i]->exp_n_audio_ctx = params[i].audio_ctx;
+        }
+
+        for (int i = 0; i < n_states; ++i) {
+            if (encoded[i]) {
+                continue;
+            }
+
+            std::vector<whisper_state *> batch;
+            std::vector<int>             offsets;
+
+            int n_threads = 0;
+
+            for (int j = i; j < n_states; ++j) {
+                if (encoded[j] || params[j].audio_ctx != params[i].audio_ctx) {
+                    continue;
+                }
+
+                encoded[j] = true;
+
+                const int seek_start = params[j].offset_ms/10;
+                if (seek_start >= states[j]->mel.n_len_org) {
+                    continue;
+                }
+
+                batch.push_back(states[j]);
+                offsets.push_back(seek_start);
+
+                n_threads += params[j].n_threads;
+            }
+
+            if (whisper_encode_batch(ctx, batch.data(), offsets.data(), (int) batch.size(), n_threads) != 0) {
+                WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+                if (results) {
+                    std::fill(results, results + n_states, -6);
+                }
+                return -6;
+            }
+        }
+    }
+
+    // decode concurrently - whisper_full_with_state() reuses the cross-attention memory computed above
+    return run_parallel([&](int i) {
+        auto params_cur = params[i];
+
+        params_cur.print_progress = false;
+        params_cur.print_realtime = false;
+
+        return whisper_full_with_state(ctx, states[i], std::move(params_cur), nullptr, 0);
+    });
+}
+
+// long-form transcription for whisper_full_parallel() with VAD
+//
+// the detected speech segments are packed into windows of up to 30 seconds, separated by short silences, so that the
+// audio is split on silences instead of through words. segments longer than 30 seconds are split into equal parts that
+// fit into a window - through words, unless vad_params.max_speech_duration_s is set lower. the windows are transcribed
+// with whisper_full_batch() in rounds of n_processors states and the results are merged in order, mapping the
+// timestamps back to the input audio
+static int whisper_full_parallel_vad(
+        struct whisper_context * ctx,
+    struct whisper_full_params   params,
+                   const float * samples,
+                           int   n_samples,
+                           int   n_processors) {
+    // a piece of the input audio [i0, i1) copied to offset w0 of a window
+    struct vad_piece {
+        int i0;
+        int i1;
+        int w0;
+    };
+
+    struct vad_window {
+        std::vector<float>     pcm;
+        std::vector<vad_piece> pieces;
+    };
+
+    const int offset_samples = std::min(n_samples, (int) ((int64_t) WHISPER_SAMPLE_RATE*params.offset_ms/1000));
+    if (params.duration_ms > 0) {
+        n_samples = std::min(n_samples, offset_samples + (int) ((int64_t) WHISPER_SAMPLE_RATE*params.duration_ms/1000));
+    }
+
+    samples   += offset_samples;
+    n_samples -= offset_samples;
+
+    whisper_state * state = ctx->state;
+
+    if (state->vad_context == nullptr) {
+        struct whisper_vad_context_params vad_ctx_params = whisper_vad_default_context_params();
+        struct whisper_vad_context * vctx = whisper_vad_init_from_file_with_params(params.vad_model_path, vad_ctx_params);
+        if (vctx == nullptr) {
+            WHISPER_LOG_ERROR("%s: failed to initialize VAD context\n", __func__);
+            return -1;
+        }
+        state->vad_context = vctx;
+    }
+
+    whisper_vad_segments * vad_segments = whisper_vad_segments_from_samples(state->vad_context, params.vad_params, samples, n_samples);
+    if (vad_segments == nullptr) {
+        WHISPER_LOG_ERROR("%s: failed to compute VAD\n", __func__);
+        return -1;
+    }
+
+    // pack the speech segments into windows
+    std::vector<vad_window> windows;
+
+    {
+        const int n_window_max = WHISPER_CHUNK_SIZE*WHISPER_SAMPLE_RATE;
+        const int n_overlap    = params.vad_params.samples_overlap*WHISPER_SAMPLE_RATE;
+        const int n_silence    = 0.1*WHISPER_SAMPLE_RATE;
+
+        for (const auto & segment : vad_segments->data) {
+            const int i0 = std::min(cs_to_samples(segment.start), n_samples);
+            const int i1 = std::min(cs_to_samples(segment.end) + n_overlap, n_samples);
+            if (i1 <= i0) {
+                continue;
+            }
+
+            // a segment that does not fit into a window is split into equal parts that do
+            const int n_parts = (i1 - i0 + n_window_max - 1)/n_window_max;
+
+            for (int k = 0; k < n_parts; ++k) {
+                const int j0 = i0 + (int) ((int64_t) (i1 - i0)*(k + 0)/n_parts);
+                const int j1 = i0 + (int) ((int64_t) (i1 - i0)*(k + 1)/n_parts);
+
+                if (windows.empty() || windows.back().pcm.size() + n_silence + (j1 - j0) > (size_t) n_window_max) {
+                    windows.emplace_back();
+                }
+
+                auto & window = windows.back();
+
+                if (!window.pcm.empty()) {
+                    window.pcm.resize(window.pcm.size() + n_silence, 0.0f);
+                }
+
+                window.pieces.push_back({ j0, j1, (int) window.pcm.size() });
+                window.pcm.insert(window.pcm.end(), samples + j0, samples + j1);
+            }
+        }
+    }
+
+    whisper_vad_free_segments(vad_segments);
+
+    WHISPER_LOG_INFO("%s: packed the speech segments into %zu windows\n", __func__, windows.size());
+
+    state->result_all.clear();
+    state->has_vad_segments = false;
+    state->vad_mapping_table.clear();
+
+    if (windows.empty()) {
+        return 0;
+    }
+
+    // map a timestamp of a window to the input audio - timestamps in the silences snap to the end of the previous piece
+    const int64_t offset_t = (int64_t) params.offset_ms/10;
+
+    const auto map_t = [&](const vad_window & window, int64_t t) -> int64_t {
+        const int ts = cs_to_samples(t);
+
+        const vad_piece * piece = &window.pieces[0];
+        for (const auto & p : window.pieces) {
+            if (p.w0 > ts) {
+                break;
+            }
+            piece = &p;
+        }
+
+        return samples_to_cs(piece->i0 + std::max(0, std::min(ts - piece->w0, piece->i1 - piece->i0))) + offset_t;
+    };
+
+    // state pool - the default state is used as the first state
+    n_processors = std::min(n_processors, (int) windows.size());
+
+    std::vector<whisper_state *> states(n_processors, state);
+    for (int i = 1; i < n_processors; ++i) {
+        states[i] = whisper_init_state(ctx);
+        if (states[i] == nullptr) {
+            WHISPER_LOG_ERROR("%s: failed to initialize state %d\n", __func__, i);
+            for (int j = 1; j < i; ++j) {
+                whisper_free_state(states[j]);
+            }
+            return -1;
+        }
+    }
+
+    auto params_cur = params;
+
+    params_cur.vad            = false;
+    params_cur.offset_ms      = 0;
+    params_cur.duration_ms    = 0;
+    params_cur.print_progress = false;
+    params_cur.print_realtime = false;
+
+    params_cur.new_segment_callback = nullptr;
+    params_cur.new_segment_callback_user_data = nullptr;
+
+    params_cur.progress_callback = nullptr;
+    params_cur.progress_callback_user_data = nullptr;
+
+    const std::vector<whisper_full_params> params_all(n_processors, params_cur);
+
+    std::vector<whisper_segment> result_all;
+
+    int ret = 0;
+
+    // text tokens of the last window of the previous round
+    std::vector<whisper_token> tokens_prev;
+
+    for (int iw = 0; iw < (int) windows.size(); iw += n_processors) {
+        const int n_cur = std::min(n_processors, (int) windows.size() - iw);
+
+        // the windows of a round are decoded in parallel, so only the first one has the text of the window before it
+        // as context - the others start without context, instead of the text of the window n_processors before them
+        for (int i = 0; i < n_cur; ++i) {
+            states[i]->prompt_past.clear();
+        }
+        if (!params.no_context) {
+            states[0]->prompt_past = tokens_prev;
+        }
+
+        std::vector<const float *> samples_cur(n_cur);
+        std::vector<int>           n_samples_cur(n_cur);
+
+        for (int i = 0; i < n_cur; ++i) {
+            samples_cur[i]   = windows[iw + i].pcm.data();
+            n_samples_cur[i] = windows[iw + i].pcm.size();
+        }
+
+        ret = whisper_full_batch(ctx, states.data(), params_all.data(), samples_cur.data(), n_samples_cur.data(), n_cur, nullptr);
+        if (ret != 0) {
+            WHISPER_LOG_ERROR("%s: failed to process windows %d - %d\n", __func__, iw, iw + n_cur - 1);
+            break;
+        }
+
+        for (int i = 0; i < n_cur; ++i) {
+            const auto & window = windows[iw + i];
+
+            if (i == n_cur - 1) {
+                tokens_prev.clear();
+            }
+
+            for (auto & result : states[i]->result_all) {
+                result.t0 = map_t(window, result.t0);
+                result.t1 = map_t(window, result.t1);
+
+                for (auto & token : result.tokens) {
+                    if (token.t0 >= 0) {
+                        token.t0 = map_t(window, token.t0);
+                    }
+                    if (token.t1 >= 0) {
+                        token.t1 = map_t(window, token.t1);
+                    }
+                    if (token.t_dtw >= 0) {
+                        token.t_dtw = map_t(window, token.t_dtw);
+                    }
+                }
+
+                // make sure that segments are not overlapping
+                if (!result_all.empty()) {
+                    result.t0 = std::max(result.t0, result_all.back().t1);
+                    result.t1 = std::max(result.t1, result.t0);
+                }
+
+                if (i == n_cur - 1) {
+                    for (const auto & token : result.tokens) {
+                        if (token.id < whisper_token_eot(ctx)) {
+                            tokens_prev.push_back(token.id);
+                        }
+                    }
+                }
+
+                result_all.push_back(std::move(result));
+            }
+
+            states[i]->result_all.clear();
+        }
+
+        if (params.progress_callback) {
+            params.progress_callback(ctx, state, (100*(iw + n_cur))/(int) windows.size(), params.progress_callback_user_data);
+        }
+    }
+
+    for (int i = 1; i < n_processors; ++i) {
+        state->t_mel_us    += states[i]->t_mel_us;
+        state->t_sample_us += states[i]->t_sample_us;
+        state->t_encode_us += states[i]->t_encode_us;
+        state->t_decode_us += states[i]->t_decode_us;
+        state->t_batchd_us += states[i]->t_batchd_us;
+        state->t_prompt_us += states[i]->t_prompt_us;
+
+        state->n_sample += states[i]->n_sample;
+        state->n_encode += states[i]->n_encode;
+        state->n_decode += states[i]->n_decode;
+        state->n_batchd += states[i]->n_batchd;
+        state->n_prompt += states[i]->n_prompt;
+
+        whisper_free_state(states[i]);
+    }
+
+    state->result_all.clear();
+
+    for (auto & result : result_all) {
+        state->result_all.push_back(std::move(result));
+
+        if (params.new_segment_callback) {
+            params.new_segment_callback(ctx, state, 1, params.new_segment_callback_user_data);
+        }
+    }
+
+    return ret;
+}
+
 int whisper_full_parallel(
         struct whisper_context * ctx,
         struct whisper_full_params params,
@@ -7740,23 +9854,19 @@ int whisper_full_parallel(
         int n_samples,
         int n_processors) {
 
+    if (n_processors > 1 && params.audio_read_callback) {
+        WHISPER_LOG_WARN("%s: audio_read_callback is not supported with multiple processors, using 1 processor\n", __func__);
+        n_processors = 1;
+    }
+
     if (n_processors == 1) {
         return whisper_full(ctx, params, samples, n_samples);
     }
 
-    std::vector<float> vad_samples;
     if (params.vad) {
-        WHISPER_LOG_INFO("%s: VAD is enabled, processing speech segments only\n", __func__);
-        if (!whisper_vad(ctx, ctx->state, params, samples, n_samples, vad_samples)) {
-            WHISPER_LOG_ERROR("%s: failed to compute VAD\n", __func__);
-            return -1;
-        }
-        if (vad_samples.empty()) {
-            return 0;
-        }
-        samples = vad_samples.data();
-        n_samples = vad_samples.size();
+        return whisper_full_parallel_vad(ctx, params, samples, n_samples, n_processors);
     }
+
     int ret = 0;
 
     // prepare separate states for each thread
@@ -8034,6 +10144,630 @@ float whisper_full_get_segment_no_speech_prob_from_state(struct whisper_state *
 
 // =================================================================================================
 
+//
+// Streaming
+//
+
+struct whisper_stream {
+    whisper_context * ctx   = nullptr;
+    whisper_state   * state = nullptr;
+
+    whisper_full_params   params;
+    whisper_stream_params sparams;
+
+    std::vector<int> filter_range;
+
+    // buffered audio, preceded by WHISPER_N_FFT/2 samples of the previous audio (zeros at the start of the stream)
+    std::vector<float> pcm;
+
+    // raw log10 mel spectrogram of the frames of the buffer whose FFT window is complete - [n_mel_stable][n_mel]
+    std::vector<float> mel;
+    int n_mel_stable = 0;
+
+    // work buffer for the mel frames at the end of the buffer
+    std::vector<float> mel_tail;
+
+    // position of the start of the buffer in the stream, in mel frames (10 ms)
+    int64_t t_offset = 0;
+
+    int lang_id = -1; // -1 - auto-detect on the first update
+
+    std::vector<whisper_token> prompt_init;
+    std::vector<whisper_token> prompt_past; // finalized tokens, used as context for the decoder
+
+    // committed tokens of the buffer that have not been finalized yet
+    std::vector<whisper_token_data> committed;
+
+    // the last n_agree hypotheses, without the committed tokens
+    std::vector<std::vector<whisper_token_data>> hypotheses;
+
+    // the tokens of sequence 0 in the self-attention KV cache
+    std::vector<whisper_token> kv_tokens;
+
+    std::vector<whisper_segment> segments;
+
+    std::string text_committed;
+    std::string text_tentative;
+};
+
+struct whisper_stream_params whisper_stream_default_params(void) {
+    whisper_stream_params result = {
+        /*.length_ms =*/ 15000,
+        /*.keep_ms   =*/ 200,
+        /*.n_agree   =*/ 2,
+        /*.reuse_kv  =*/ true,
+    };
+
+    return result;
+}
+
+// raw log10 mel spectrogram of the frames [i0, i1) of the buffer, zero-padding past the end of the audio - dst: [i1 - i0][n_mel]
+static void whisper_stream_compute_mel(const whisper_stream & stream, int i0, int i1, float * dst) {
+    whisper_compute_mel_frames(stream.ctx->model.filters, stream.filter_range, stream.pcm.data(), (int) stream.pcm.size(), i0, i1, dst);
+}
+
+// number of mel frames of the buffered audio
+static int whisper_stream_n_frames(const whisper_stream & stream) {
+    return ((int) stream.pcm.size() - WHISPER_N_FFT/2)/WHISPER_HOP_LENGTH;
+}
+
+static std::string whisper_stream_tokens_to_str(const whisper_stream & stream, const std::vector<whisper_token_data> & tokens) {
+    std::string result;
+
+    for (const auto & token : tokens) {
+        if (stream.params.print_special || token.id < whisper_token_eot(stream.ctx)) {
+            result += whisper_token_to_str(stream.ctx, token.id);
+        }
+    }
+
+    return result;
+}
+
+// move tokens to the finalized segments - timestamps are relative to the start of the buffer and clamped to t_end
+static void whisper_stream_finalize(whisper_stream & stream, const std::vector<whisper_token_data> & tokens, int64_t t_end) {
+    whisper_context * ctx = stream.ctx;
+
+    const whisper_token token_beg = whisper_token_beg(ctx);
+
+    int64_t t0 = 0;
+
+    std::string text;
+    std::vector<whisper_token_data> tokens_cur;
+
+    for (const auto & token : tokens) {
+        stream.prompt_past.push_back(token.id);
+
+        if (token.id >= token_beg) {
+            const int64_t t1 = std::min<int64_t>(2*(token.id - token_beg), t_end);
+
+            if (!text.empty()) {
+                tokens_cur.push_back(token);
+                stream.segments.push_back({ stream.t_offset + t0, stream.t_offset + t1, text, stream.state->no_speech_prob, tokens_cur, false });
+            }
+
+            text.clear();
+            tokens_cur.clear();
+
+            t0 = t1;
+            continue;
+        }
+
+        if (stream.params.print_special || token.id < whisper_token_eot(ctx)) {
+            text += whisper_token_to_str(ctx, token.id);
+        }
+
+        tokens_cur.push_back(token);
+    }
+
+    if (!text.empty()) {
+        stream.segments.push_back({ stream.t_offset + t0, stream.t_offset + std::max(t0, t_end), text, stream.state->no_speech_prob, tokens_cur, false });
+    }
+
+    // the decoder uses at most n_text_ctx/2 tokens of context
+    const int n_past_max = whisper_n_text_ctx(ctx)/2;
+    if ((int) stream.prompt_past.size() > n_past_max) {
+        stream.prompt_past.erase(stream.prompt_past.begin(), stream.prompt_past.end() - n_past_max);
+    }
+}
+
+// drop the first n_frames mel frames of the buffer and shift the timestamps of the pending tokens accordingly
+static void whisper_stream_trim(whisper_stream & stream, int n_frames) {
+    n_frames = std::min(n_frames, whisper_stream_n_frames(stream)) & ~1;
+    if (n_frames <= 0) {
+        return;
+    }
+
+    const int n_mel = stream.ctx->model.hparams.n_mels;
+
+    stream.pcm.erase(stream.pcm.begin(), stream.pcm.begin() + n_frames*WHISPER_HOP_LENGTH);
+
+    const int n_drop = std::min(n_frames, stream.n_mel_stable);
+    stream.mel.erase(stream.mel.begin(), stream.mel.begin() + n_drop*n_mel);
+    stream.n_mel_stable -= n_drop;
+
+    stream.t_offset += n_frames;
+
+    // a timestamp token is 2 mel frames
+    const whisper_token token_beg = whisper_token_beg(stream.ctx);
+
+    auto shift = [&](std::vector<whisper_token_data> & tokens) {
+        for (auto & token : tokens) {
+            if (token.id >= token_beg) {
+                token.id  = std::max(token_beg, token.id - n_frames/2);
+                token.tid = token.id;
+            }
+        }
+    };
+
+    shift(stream.committed);
+    for (auto & hyp : stream.hypotheses) {
+        shift(hyp);
+    }
+
+    // the cross-attention inputs of the cached tokens have moved
+    stream.kv_tokens.clear();
+}
+
+struct whisper_stream * whisper_stream_init_with_state(
+        struct whisper_context * ctx,
+          struct whisper_state * state,
+    struct whisper_full_params   params,
+  struct whisper_stream_params   sparams) {
+    if (state == nullptr) {
+        WHISPER_LOG_ERROR("%s: state is not initialized\n", __func__);
+        return nullptr;
+    }
+
+    if (params.audio_ctx > whisper_n_audio_ctx(ctx)) {
+        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, params.audio_ctx, whisper_n_audio_ctx(ctx));
+        return nullptr;
+    }
+
+    int lang_id = 0;
+    if (whisper_is_multilingual(ctx)) {
+        if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0) {
+            lang_id = -1;
+        } else {
+            lang_id = whisper_lang_id(params.language);
+            if (lang_id < 0) {
+                WHISPER_LOG_ERROR("%s: unknown language '%s'\n", __func__, params.language);
+                return nullptr;
+            }
+        }
+    }
+
+    whisper_stream * stream = new whisper_stream;
+
+    stream->ctx     = ctx;
+    stream->state   = state;
+    stream->params  = params;
+    stream->sparams = sparams;
+    stream->lang_id = lang_id;
+
+    stream->sparams.n_agree = std::max(1, sparams.n_agree);
+
+    // grammars are not supported
+    stream->params.grammar_rules   = nullptr;
+    stream->params.n_grammar_rules = 0;
+
+    stream->filter_range = whisper_mel_filter_range(ctx->model.filters, ctx->model.hparams.n_mels);
+
+    stream->pcm.assign(WHISPER_N_FFT/2, 0.0f);
+
+    if (params.prompt_tokens && params.prompt_n_tokens > 0) {
+        stream->prompt_past.assign(params.prompt_tokens, params.prompt_tokens + params.prompt_n_tokens);
+    } else if (params.initial_prompt) {
+        stream->prompt_past.resize(1024);
+        int n_needed = whisper_tokenize(ctx, params.initial_prompt, stream->prompt_past.data(), stream->prompt_past.size());
+        if (n_needed < 0) {
+            stream->prompt_past.resize(-n_needed);
+            n_needed = whisper_tokenize(ctx, params.initial_prompt, stream->prompt_past.data(), stream->prompt_past.size());
+        }
+        stream->prompt_past.resize(std::max(0, n_needed));
+    }
+
+    whisper_kv_cache_clear(state->kv_self);
+
+    return stream;
+}
+
+struct whisper_stream * whisper_stream_init(
+        struct whisper_context * ctx,
+    struct whisper_full_params   params,
+  struct whisper_stream_params   sparams) {
+    return whisper_stream_init_with_state(ctx, ctx->state, params, sparams);
+}
+
+void whisper_stream_free(struct whisper_stream * stream) {
+    delete stream;
+}
+
+int whisper_stream_push(struct whisper_stream * stream, const float * samples, int n_samples) {
+    if (n_samples <= 0) {
+        return 0;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    const int n_mel = stream->ctx->model.hparams.n_mels;
+
+    stream->pcm.insert(stream->pcm.end(), samples, samples + n_samples);
+
+    // only the frames of the new samples are computed
+    const int n_mel_stable = ((int) stream->pcm.size() - WHISPER_N_FFT)/WHISPER_HOP_LENGTH + 1;
+
+    if (n_mel_stable > stream->n_mel_stable) {
+        stream->mel.resize(n_mel_stable*n_mel);
+
+        whisper_stream_compute_mel(*stream, stream->n_mel_stable, n_mel_stable, stream->mel.data() + stream->n_mel_stable*n_mel);
+
+        stream->n_mel_stable = n_mel_stable;
+    }
+
+    stream->state->t_mel_us += ggml_time_us() - t_start_us;
+
+    return 0;
+}
+
+int whisper_stream_update(struct whisper_stream * stream) {
+    whisper_context & ctx   = *stream->ctx;
+    whisper_state   & state = *stream->state;
+
+    const auto & params  = stream->params;
+    const auto & sparams = stream->sparams;
+
+    const int n_mel        = ctx.model.hparams.n_mels;
+    const int n_text_ctx   = whisper_n_text_ctx(&ctx);
+    const int n_ctx_max    = params.audio_ctx > 0 ? params.audio_ctx : whisper_n_audio_ctx(&ctx);
+    const int n_frames_max = std::min(std::max(sparams.length_ms/10, 100), 2*n_ctx_max);
+
+    const whisper_token token_beg = whisper_token_beg(&ctx);
+    const whisper_token token_eot = whisper_token_eot(&ctx);
+
+    // if length of the buffer is less than 100ms (10 frames), then wait for more audio
+    const int delta_min = 10;
+
+    auto & committed  = stream->committed;
+    auto & hypotheses = stream->hypotheses;
+
+    // the buffer is full - finalize it as is
+    if (whisper_stream_n_frames(*stream) > n_frames_max || (int) committed.size() > n_text_ctx/2 - 32) {
+        const int n_frames = whisper_stream_n_frames(*stream);
+
+        std::vector<whisper_token_data> tokens = committed;
+        if (!hypotheses.empty()) {
+            tokens.insert(tokens.end(), hypotheses.back().begin(), hypotheses.back().end());
+        }
+
+        whisper_stream_finalize(*stream, tokens, n_frames);
+
+        committed.clear();
+        hypotheses.clear();
+
+        whisper_stream_trim(*stream, n_frames - sparams.keep_ms/10);
+    }
+
+    const int n_frames = whisper_stream_n_frames(*stream);
+
+    if (n_frames < delta_min) {
+        return 0;
+    }
+
+    // audio context sized to the buffered audio
+    const int n_ctx = params.audio_ctx > 0 ? params.audio_ctx : std::min(whisper_n_audio_ctx(&ctx), GGML_PAD(n_frames/2 + 1, 64));
+
+    // normalized mel spectrogram of the buffer - the frames at the end of the buffer are recomputed on every update
+    {
+        const int64_t t_start_us = ggml_time_us();
+
+        const int n_stable = std::min(stream->n_mel_stable, n_frames);
+
+        stream->mel_tail.resize((n_frames - n_stable)*n_mel);
+        if (n_frames > n_stable) {
+            whisper_stream_compute_mel(*stream, n_stable, n_frames, stream->mel_tail.data());
+        }
+
+        auto & mel = state.mel;
+
+        mel.n_mel     = n_mel;
+        mel.n_len     = 2*n_ctx;
+        mel.n_len_org = n_frames;
+        mel.data.assign(mel.n_mel*mel.n_len, log10(1e-10));
+
+        for (int i = 0; i < std::min(n_frames, mel.n_len); ++i) {
+            const float * src = i < n_stable ? stream->mel.data() + i*n_mel : stream->mel_tail.data() + (i - n_stable)*n_mel;
+            for (int j = 0; j < n_mel; ++j) {
+                mel.data[j*mel.n_len + i] = src[j];
+            }
+        }
+
+        // clamping and normalization, same as log_mel_spectrogram()
+        double mmax = -1e20;
+        for (float v : mel.data) {
+            mmax = std::max<double>(mmax, v);
+        }
+
+        mmax -= 8.0;
+
+        for (float & v : mel.data) {
+            v = (std::max<double>(v, mmax) + 4.0)/4.0;
+        }
+
+        state.exp_n_audio_ctx = n_ctx;
+        state.encoded_offset  = -1;
+
+        state.t_mel_us += ggml_time_us() - t_start_us;
+    }
+
+    if (stream->lang_id < 0) {
+        std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
+
+        const int lang_id = whisper_lang_auto_detect_with_state(&ctx, &state, 0, params.n_threads, probs.data());
+        if (lang_id < 0) {
+            WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
+            return -3;
+        }
+
+        WHISPER_LOG_INFO("%s: auto-detected language: %s (p = %f)\n", __func__, whisper_lang_str(lang_id), probs[lang_id]);
+
+        stream->lang_id = lang_id;
+        stream->kv_tokens.clear();
+    }
+
+    if (stream->prompt_init.empty()) {
+        stream->prompt_init = { whisper_token_sot(&ctx) };
+
+        if (whisper_is_multilingual(&ctx)) {
+            stream->prompt_init.push_back(whisper_token_lang(&ctx, stream->lang_id));
+            stream->prompt_init.push_back(params.translate ? whisper_token_translate(&ctx) : whisper_token_transcribe(&ctx));
+        }
+
+        if (params.no_timestamps) {
+            stream->prompt_init.push_back(whisper_token_not(&ctx));
+        }
+
+        state.lang_id = stream->lang_id;
+    }
+
+    if (!whisper_encode_cached(ctx, state, 0, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+        WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+        return -6;
+    }
+
+    // prompt: previous text, task tokens and the committed tokens
+    std::vector<whisper_token> prompt;
+    {
+        const int n_take = std::min({ params.n_max_text_ctx, n_text_ctx/2 - (int) committed.size(), (int) stream->prompt_past.size() });
+
+        if (!params.no_context && n_take > 0) {
+            prompt.push_back(whisper_token_prev(&ctx));
+            prompt.insert(prompt.end(), stream->prompt_past.end() - n_take, stream->prompt_past.end());
+        }
+
+        prompt.insert(prompt.end(), stream->prompt_init.begin(), stream->prompt_init.end());
+
+        for (const auto & token : committed) {
+            prompt.push_back(token.id);
+        }
+    }
+
+    // reuse the KV cache of the common prefix with the previous update
+    // the cached tokens attended to the previous encoder output, which differs only by the audio appended since then
+    int n_past = 0;
+    if (sparams.reuse_kv) {
+        const int n_max = std::min(stream->kv_tokens.size(), prompt.size() - 1);
+        while (n_past < n_max && stream->kv_tokens[n_past] == prompt[n_past]) {
+            n_past++;
+        }
+    }
+
+    whisper_kv_cache_seq_rm(state.kv_self, -1, n_past, -1);
+    stream->kv_tokens.resize(n_past);
+
+    whisper_batch_prep_legacy(state.batch, prompt.data() + n_past, prompt.size() - n_past, n_past, 0);
+
+    if (!whisper_decode_internal(ctx, state, state.batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+        WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+        return -8;
+    }
+
+    stream->kv_tokens = prompt;
+
+    if (committed.empty()) {
+        const int n_logits = ctx.vocab.n_vocab;
+        std::vector<float> logprobs(n_logits);
+        std::vector<float> probs(n_logits);
+
+        whisper_compute_logprobs(state.logits, n_logits, logprobs);
+        whisper_compute_probs(state.logits, n_logits, logprobs, probs);
+        state.no_speech_prob = probs[whisper_token_nosp(&ctx)];
+    }
+
+    // greedy decoding after the committed tokens
+    std::vector<whisper_token_data> hyp;
+    {
+        auto & decoder = state.decoders[0];
+
+        decoder.sequence.tokens = committed;
+        decoder.grammar         = {};
+        decoder.i_batch         = state.batch.n_tokens - 1;
+        decoder.seek_delta      = 100*WHISPER_CHUNK_SIZE;
+        decoder.has_ts          = false;
+        decoder.failed          = false;
+        decoder.completed       = false;
+
+        for (const auto & token : committed) {
+            if (token.id > token_beg) {
+                decoder.seek_delta = 2*(token.id - token_beg);
+                decoder.has_ts     = true;
+            }
+        }
+
+        double sum_logprobs = 0.0;
+
+        const int n_max = std::min(n_text_ctx/2, n_text_ctx - (int) prompt.size()) - 1;
+
+        for (int i = 0; i < n_max; ++i) {
+            const int64_t t_start_sample_us = ggml_time_us();
+
+            whisper_process_logits(ctx, state, decoder, params, 0.0f);
+
+            const whisper_token_data token = whisper_sample_token(ctx, decoder, true);
+
+            state.t_sample_us += ggml_time_us() - t_start_sample_us;
+            state.n_sample++;
+
+            if (token.id == token_eot) {
+                break;
+            }
+
+            decoder.sequence.tokens.push_back(token);
+            hyp.push_back(token);
+
+            sum_logprobs += token.plog;
+
+            if (token.id > token_beg) {
+                decoder.seek_delta = 2*(token.id - token_beg);
+                decoder.has_ts     = true;
+
+                // end of audio reached
+                if (decoder.seek_delta + delta_min >= n_frames) {
+                    break;
+                }
+            }
+
+            if (params.max_tokens > 0 && i + 1 >= params.max_tokens) {
+                break;
+            }
+
+            whisper_batch_prep_legacy(state.batch, &token.id, 1, prompt.size() + i, 0);
+
+            if (!whisper_decode_internal(ctx, state, state.batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                return -8;
+            }
+
+            decoder.i_batch = 0;
+        }
+
+        // the cache holds the hypothesis, which is not part of the prompt of the next update
+        whisper_kv_cache_seq_rm(state.kv_self, -1, prompt.size(), -1);
+
+        if (committed.empty() && !hyp.empty() &&
+            state.no_speech_prob > params.no_speech_thold && sum_logprobs/hyp.size() < params.logprob_thold) {
+            hyp.clear();
+        }
+    }
+
+    // local agreement - commit the longest common prefix of the last n_agree hypotheses
+    hypotheses.push_back(std::move(hyp));
+    if ((int) hypotheses.size() > sparams.n_agree) {
+        hypotheses.erase(hypotheses.begin());
+    }
+
+    if ((int) hypotheses.size() == sparams.n_agree) {
+        const auto & cur = hypotheses.back();
+
+        // timestamp tokens agree if they are within 20 ms - the latest value is used
+        // a timestamp predicted at the end of the buffer moves with the buffer and is not committed
+        auto agree = [&](whisper_token a, whisper_token b) {
+            return a == b || (a >= token_beg && b >= token_beg && std::abs(a - b) <= 1);
+        };
+
+        size_t n_commit = cur.size();
+        for (const auto & other : hypotheses) {
+            size_t n = 0;
+            while (n < n_commit && n < other.size() && agree(other[n].id, cur[n].id)) {
+                n++;
+            }
+            n_commit = n;
+        }
+
+        committed.insert(committed.end(), cur.begin(), cur.begin() + n_commit);
+
+        for (auto & other : hypotheses) {
+            other.erase(other.begin(), other.begin() + n_commit);
+        }
+    }
+
+    // finalize the committed segments that are closed by a timestamp token and drop their audio
+    {
+        int i_close = -1;
+        for (int i = 1; i < (int) committed.size(); ++i) {
+            if (committed[i].id >= token_beg && committed[i - 1].id < token_beg) {
+                i_close = i;
+            }
+        }
+
+        if (i_close > 0) {
+            const int t_close = std::min(2*(committed[i_close].id - token_beg), n_frames);
+
+            whisper_stream_finalize(*stream, std::vector<whisper_token_data>(committed.begin(), committed.begin() + i_close + 1), t_close);
+
+            committed.erase(committed.begin(), committed.begin() + i_close + 1);
+
+            whisper_stream_trim(*stream, t_close);
+        }
+    }
+
+    stream->text_committed = whisper_stream_tokens_to_str(*stream, committed);
+    stream->text_tentative = hypotheses.empty() ? "" : whisper_stream_tokens_to_str(*stream, hypotheses.back());
+
+    return 0;
+}
+
+int whisper_stream_flush(struct whisper_stream * stream) {
+    const int ret = whisper_stream_update(stream);
+    if (ret != 0) {
+        return ret;
+    }
+
+    const int n_frames = whisper_stream_n_frames(*stream);
+
+    std::vector<whisper_token_data> tokens = stream->committed;
+    if (!stream->hypotheses.empty()) {
+        tokens.insert(tokens.end(), stream->hypotheses.back().begin(), stream->hypotheses.back().end());
+    }
+
+    whisper_stream_finalize(*stream, tokens, n_frames);
+
+    stream->committed.clear();
+    stream->hypotheses.clear();
+
+    whisper_stream_trim(*stream, n_frames);
+
+    stream->text_committed.clear();
+    stream->text_tentative.clear();
+
+    return 0;
+}
+
+int whisper_stream_n_segments(struct whisper_stream * stream) {
+    return stream->segments.size();
+}
+
+const char * whisper_stream_get_segment_text(struct whisper_stream * stream, int i_segment) {
+    return stream->segments[i_segment].text.c_str();
+}
+
+int64_t whisper_stream_get_segment_t0(struct whisper_stream * stream, int i_segment) {
+    return stream->segments[i_segment].t0;
+}
+
+int64_t whisper_stream_get_segment_t1(struct whisper_stream * stream, int i_segment) {
+    return stream->segments[i_segment].t1;
+}
+
+const char * whisper_stream_get_text_committed(struct whisper_stream * stream) {
+    return stream->text_committed.c_str();
+}
+
+const char * whisper_stream_get_text_tentative(struct whisper_stream * stream) {
+    return stream->text_tentative.c_str();
+}
+
+// =================================================================================================
+
 //
 // Temporary interface needed for exposing ggml interface
 // Will be removed in the future when ggml becomes a separate library